@@ -10,7 +10,7 @@
 #  (at your option) any later version.
 #
 
-import os,re,time,pwd,fcntl
+import os,re,time,pwd,fcntl,ConfigParser
 # capisuite stuff
 import capisuite,cs_helpers
 
@@ -30,6 +30,7 @@ def idle(capi):
 
 	userlist=config.sections()
 	userlist.remove('GLOBAL')
+	indexed={} # send queues indexed by CapiSuite -> (user,outgoing_nr)
 
 	for user in userlist: # search in all user-specified sendq's
 		userdata=pwd.getpwnam(user)
@@ -54,103 +55,149 @@ def idle(capi):
 			os.mkdir(sendq,0700)
 			os.chown(sendq,userdata[2],userdata[3])
 
+		# the index of CapiSuite tells us which jobs are due, so we needn't read the queue
+		if (capisuite.queue_watch(sendq)):
+			indexed[sendq]=(user,outgoing_nr)
+			continue
+
 		files=os.listdir(sendq)
 		files=filter (lambda s: re.match("fax-.*\.txt",s),files)
 
 		for job in files:
-			job_fax=job[:-3]+"sff"
-			real_user_c=os.stat(sendq+job).st_uid
-			real_user_j=os.stat(sendq+job_fax).st_uid
-			if (real_user_j!=pwd.getpwnam(user)[2] or real_user_c!=pwd.getpwnam(user)[2]):
-				capisuite.error("job "+sendq+job_fax+" seems to be manipulated (wrong uid)! Ignoring...")
-				continue
+			startjob(capi,config,user,outgoing_nr,sendq,job)
 
-			lockfile=open(sendq+job[:-3]+"lock","w")
-			# read directory contents
-			fcntl.lockf(lockfile,fcntl.LOCK_EX) # lock so that it isn't deleted while sending
+	for job in capisuite.queue_due():
+		sendq=os.path.dirname(job)+"/"
+		if (not indexed.has_key(sendq)): # no user of ours
+			continue
+		user,outgoing_nr=indexed[sendq]
+		startjob(capi,config,user,outgoing_nr,sendq,os.path.basename(job))
 
-			if (not os.access(sendq+job,os.W_OK)): # perhaps it was cancelled?
-				fcntl.lockf(lockfile,fcntl.LOCK_UN)
-				lockfile.close()
-				os.unlink(sendq+job[:-3]+"lock")
-				continue
+# @brief hand a due job of the send queue of a user over to CapiSuite
+#
+# CapiSuite calls sendjob() in a thread of its own as soon as a B channel
+# is free, so several jobs are sent at the same time. Jobs which have to wait
+# are given to idle() again later.
+def startjob(capi,config,user,outgoing_nr,sendq,job):
+	try:
+		control=cs_helpers.readConfig(sendq+job)
+		# set DST value to -1 (unknown), as strptime sets it wrong for some reason
+		starttime=(time.strptime(control.get("GLOBAL","starttime")))[0:8]+(-1,)
+		dialstring=control.get("GLOBAL","dialstring")
+	except (IOError,ValueError,ConfigParser.Error): # cancelled or written at the moment, sendjob() will check it
+		return
+	if (time.mktime(starttime)>time.time()):
+		return
+	capisuite.send_start(capi,sendq+job,sendcontrollers(config),dialstring,(user,outgoing_nr,sendq,job))
 
-			control=cs_helpers.readConfig(sendq+job)
-			# set DST value to -1 (unknown), as strptime sets it wrong for some reason
-			starttime=(time.strptime(control.get("GLOBAL","starttime")))[0:8]+(-1,)
-			starttime=time.mktime(starttime)
-			if (starttime>time.time()):
-				fcntl.lockf(lockfile,fcntl.LOCK_UN)
-				lockfile.close()
-				os.unlink(sendq+job[:-3]+"lock")
-				continue
+# @brief return the controllers given by send_controller as tuple, 0 means all
+def sendcontrollers(config):
+	return tuple(map(int,cs_helpers.getOption(config,"","send_controller","1").split(",")))
 
-			tries=control.getint("GLOBAL","tries")
-			dialstring=control.get("GLOBAL","dialstring")
-			addressee=cs_helpers.getOption(control,"GLOBAL","addressee","")
-			subject=cs_helpers.getOption(control,"GLOBAL","subject","")
-			mailaddress=cs_helpers.getOption(config,user,"fax_email","")
-			if (mailaddress==""):
-				mailaddress=user
-			fromaddress=cs_helpers.getOption(config,user,"fax_email_from","")
-			if (fromaddress==""):
-				fromaddress=user
-
-			capisuite.log("job "+job_fax+" from "+user+" to "+dialstring+" initiated",1)
-			result,resultB3 = sendfax(capi,sendq+job_fax,outgoing_nr,dialstring,user,config)
-			tries+=1
-			capisuite.log("job "+job_fax+": result was %x,%x" % (result,resultB3),1)
-
-			if (result in (0,0x3400,0x3480,0x3490,0x349f) and resultB3==0):
-				movejob(job_fax,sendq,done,user)
-				capisuite.log("job "+job_fax+": finished successfully",1)
-				mailtext="Your fax job to "+addressee+" ("+dialstring+") was sent successfully.\n\n" \
-				  +"Subject: "+subject+"\nFilename: "+job_fax \
-				  +"\nNeeded tries: "+str(tries) \
-				  +("\nLast result: 0x%x/0x%x" % (result,resultB3)) \
-				  +"\n\nIt was moved to file://"+done+user+"-"+job_fax
-				cs_helpers.sendSimpleMail(fromaddress,mailaddress,
-				  "Fax to "+addressee+" ("+dialstring+") sent successfully.",
-				  mailtext)
-			else:
-				max_tries=int(cs_helpers.getOption(config,"","send_tries","10"))
-				delays=cs_helpers.getOption(config,"","send_delays","60,60,60,300,300,3600,3600,18000,36000").split(",")
-				delays=map(int,delays)
-				if ((tries-1)<len(delays)):
-					next_delay=delays[tries-1]
-				else:
-					next_delay=delays[-1]
-				starttime=time.time()+next_delay
-				capisuite.log("job "+job_fax+": delayed for "+str(next_delay)+" seconds",2)
-				cs_helpers.writeDescription(sendq+job_fax,"dialstring=\""+dialstring+"\"\n"
-				  +"starttime=\""+time.ctime(starttime)+"\"\ntries=\""+str(tries)+"\"\n"
-				  +"user=\""+user+"\"\naddressee=\""+addressee+"\"\nsubject=\""+subject+"\"\n")
-				if (tries>=max_tries):
-					movejob(job_fax,sendq,failed,user)
-					capisuite.log("job "+job_fax+": failed finally",1)
-					mailtext="I'm sorry, but your fax job to "+addressee+" ("+dialstring \
-					  +") failed finally.\n\nSubject: "+subject \
-					  +"\nFilename: "+job_fax+"\nTries: "+str(tries) \
-					  +"\nLast result: 0x%x/0x%x" % (result,resultB3) \
-					  +"\n\nIt was moved to file://"+failed+user+"-"+job_fax
-					cs_helpers.sendSimpleMail(fromaddress,mailaddress,
-					  "Fax to "+addressee+" ("+dialstring+") FAILED.",
-					  mailtext)
-
-			fcntl.lockf(lockfile,fcntl.LOCK_UN)
-			lockfile.close()
-			os.unlink(sendq+job[:-3]+"lock")
+# @brief send one job of the send queue of a user
+#
+# Called by CapiSuite in a thread of its own for each job given to
+# capisuite.send_start(). Moves the job to done or failed or sets the time
+# of the next try. Jobs which aren't due yet are left untouched.
+def sendjob(capi,user,outgoing_nr,sendq,job):
+	config=cs_helpers.readConfig()
+	spool=cs_helpers.getOption(config,"","spool_dir")
+	done=os.path.join(spool,"done")+"/"
+	failed=os.path.join(spool,"failed")+"/"
+
+	job_fax=job[:-3]+"sff"
+	real_user_c=os.stat(sendq+job).st_uid
+	real_user_j=os.stat(sendq+job_fax).st_uid
+	if (real_user_j!=pwd.getpwnam(user)[2] or real_user_c!=pwd.getpwnam(user)[2]):
+		capisuite.error("job "+sendq+job_fax+" seems to be manipulated (wrong uid)! Ignoring...")
+		return
+
+	lockfile=open(sendq+job[:-3]+"lock","w")
+	# read directory contents
+	fcntl.lockf(lockfile,fcntl.LOCK_EX) # lock so that it isn't deleted while sending
+
+	if (not os.access(sendq+job,os.W_OK)): # perhaps it was cancelled?
+		fcntl.lockf(lockfile,fcntl.LOCK_UN)
+		lockfile.close()
+		os.unlink(sendq+job[:-3]+"lock")
+		return
+
+	control=cs_helpers.readConfig(sendq+job)
+	# set DST value to -1 (unknown), as strptime sets it wrong for some reason
+	starttime=(time.strptime(control.get("GLOBAL","starttime")))[0:8]+(-1,)
+	starttime=time.mktime(starttime)
+	if (starttime>time.time()):
+		fcntl.lockf(lockfile,fcntl.LOCK_UN)
+		lockfile.close()
+		os.unlink(sendq+job[:-3]+"lock")
+		return
+
+	tries=control.getint("GLOBAL","tries")
+	dialstring=control.get("GLOBAL","dialstring")
+	addressee=cs_helpers.getOption(control,"GLOBAL","addressee","")
+	subject=cs_helpers.getOption(control,"GLOBAL","subject","")
+	mailaddress=cs_helpers.getOption(config,user,"fax_email","")
+	if (mailaddress==""):
+		mailaddress=user
+	fromaddress=cs_helpers.getOption(config,user,"fax_email_from","")
+	if (fromaddress==""):
+		fromaddress=user
+
+	capisuite.log("job "+job_fax+" from "+user+" to "+dialstring+" initiated",1)
+	result,resultB3 = sendfax(capi,sendq+job_fax,outgoing_nr,dialstring,user,config)
+	tries+=1
+	capisuite.log("job "+job_fax+": result was %x,%x" % (result,resultB3),1)
+
+	if (result in (0,0x3400,0x3480,0x3490,0x349f) and resultB3==0):
+		movejob(job_fax,sendq,done,user)
+		capisuite.log("job "+job_fax+": finished successfully",1)
+		mailtext="Your fax job to "+addressee+" ("+dialstring+") was sent successfully.\n\n" \
+		  +"Subject: "+subject+"\nFilename: "+job_fax \
+		  +"\nNeeded tries: "+str(tries) \
+		  +("\nLast result: 0x%x/0x%x" % (result,resultB3)) \
+		  +"\n\nIt was moved to file://"+done+user+"-"+job_fax
+		cs_helpers.sendSimpleMail(fromaddress,mailaddress,
+		  "Fax to "+addressee+" ("+dialstring+") sent successfully.",
+		  mailtext)
+	else:
+		max_tries=int(cs_helpers.getOption(config,"","send_tries","10"))
+		delays=cs_helpers.getOption(config,"","send_delays","60,60,60,300,300,3600,3600,18000,36000").split(",")
+		delays=map(int,delays)
+		if ((tries-1)<len(delays)):
+			next_delay=delays[tries-1]
+		else:
+			next_delay=delays[-1]
+		starttime=time.time()+next_delay
+		capisuite.log("job "+job_fax+": delayed for "+str(next_delay)+" seconds",2)
+		cs_helpers.writeDescription(sendq+job_fax,"dialstring=\""+dialstring+"\"\n"
+		  +"starttime=\""+time.ctime(starttime)+"\"\ntries=\""+str(tries)+"\"\n"
+		  +"user=\""+user+"\"\naddressee=\""+addressee+"\"\nsubject=\""+subject+"\"\n")
+		if (tries>=max_tries):
+			movejob(job_fax,sendq,failed,user)
+			capisuite.log("job "+job_fax+": failed finally",1)
+			mailtext="I'm sorry, but your fax job to "+addressee+" ("+dialstring \
+			  +") failed finally.\n\nSubject: "+subject \
+			  +"\nFilename: "+job_fax+"\nTries: "+str(tries) \
+			  +"\nLast result: 0x%x/0x%x" % (result,resultB3) \
+			  +"\n\nIt was moved to file://"+failed+user+"-"+job_fax
+			cs_helpers.sendSimpleMail(fromaddress,mailaddress,
+			  "Fax to "+addressee+" ("+dialstring+") FAILED.",
+			  mailtext)
+
+	fcntl.lockf(lockfile,fcntl.LOCK_UN)
+	lockfile.close()
+	os.unlink(sendq+job[:-3]+"lock")
 
 def sendfax(capi,job,outgoing_nr,dialstring,user,config):
 	try:
-		controller=int(cs_helpers.getOption(config,"","send_controller","1"))
+		controllers=sendcontrollers(config)
 		timeout=int(cs_helpers.getOption(config,user,"outgoing_timeout","60"))
 		stationID=cs_helpers.getOption(config,user,"fax_stationID")
 		if (stationID==None):
 			capisuite.error("Warning: fax_stationID for user "+user+" not set")
 			stationID=""
  		headline=cs_helpers.getOption(config,user,"fax_headline","")
-		(call,result)=capisuite.call_faxG3(capi,controller,outgoing_nr,dialstring,timeout,stationID,headline)
+		(call,result)=capisuite.call_faxG3(capi,controllers,outgoing_nr,dialstring,timeout,stationID,headline)
 		if (result!=0):
 			return(result,0)
 		capisuite.fax_send(call,job)
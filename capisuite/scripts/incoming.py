@@ -188,6 +188,13 @@ def voiceIncoming(call,call_from,call_to,curr_user,config):
 	if (action not in ("mailandsave","saveonly","none")):
 		capisuite.error("Warning: No valid voice_action definition found for user "+curr_user+" -> assuming SaveOnly")
 		action="saveonly"
+	wavname="" # wav file for the mail, written while recording
+	wavformat=cs_helpers.getOption(config,curr_user,"voice_email_format","wav").lower()
+	if (wavformat not in ("wav","adpcm")):
+		capisuite.error("Warning: invalid voice_email_format for user "+curr_user+" -> assuming wav")
+		wavformat="wav"
+	if (action=="mailandsave"):
+		wavname=filename[:-2]+"wav"
 	try:
 		capisuite.enable_DTMF(call)
 		userannouncement=udir+cs_helpers.getOption(config,curr_user,"announcement","announcement.la")
@@ -195,21 +202,25 @@ def voiceIncoming(call,call_from,call_to,curr_user,config):
 		if (os.access(userannouncement,os.R_OK)):
 			capisuite.audio_send(call,userannouncement,1)
 		else:
+			snippets=[]
 			if (call_to!="-"):
-				capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"anrufbeantworter-von.la"),1)
-				cs_helpers.sayNumber(call,call_to,curr_user,config)
-			capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"bitte-nachricht.la"),1)
+				snippets.append(cs_helpers.getAudio(config,curr_user,"anrufbeantworter-von.la"))
+				snippets+=cs_helpers.getNumberAudio(call_to,curr_user,config)
+			snippets.append(cs_helpers.getAudio(config,curr_user,"bitte-nachricht.la"))
+			capisuite.audio_send_list(call,snippets,1)
 
 		if (action!="none"):
 			capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"beep.la"),1)
 			length=cs_helpers.getOption(config,curr_user,"record_length","60")
 			silence_timeout=cs_helpers.getOption(config,curr_user,"record_silence_timeout","5")
-			capisuite.audio_receive(call,filename,int(length), int(silence_timeout),1)
+			capisuite.audio_receive(call,filename,int(length), int(silence_timeout),1,wavname,wavformat)
 
 		dtmf_list=capisuite.read_DTMF(call,0)
 		if (dtmf_list=="X"):
 			if (os.access(filename,os.R_OK)):
 				os.unlink(filename)
+			if (wavname and os.access(wavname,os.R_OK)):
+				os.unlink(wavname)
 			faxIncoming(call,call_from,call_to,curr_user,config,1)
 		elif (dtmf_list!="" and pin!=""):
 			dtmf_list+=capisuite.read_DTMF(call,3) # wait 5 seconds for input
@@ -222,6 +233,8 @@ def voiceIncoming(call,call_from,call_to,curr_user,config):
 			if (pin==dtmf_list):
 				if (os.access(filename,os.R_OK)):
 					os.unlink(filename)
+				if (wavname and os.access(wavname,os.R_OK)):
+					os.unlink(wavname)
 				capisuite.log("Starting remote inquiry...",1,call)
 				remoteInquiry(call,udir,curr_user,config)
 
@@ -249,9 +262,15 @@ def voiceIncoming(call,call_from,call_to,curr_user,config):
 		if (mailaddress==""):
 			mailaddress=curr_user
 		if (action=="mailandsave"):
-			cs_helpers.sendMIMEMail(fromaddress, mailaddress, "Voice call received from "+call_from+" to "+call_to, "la",
+			if (os.access(wavname,os.R_OK)):
+				mailtype,mailfile="wav",wavname
+			else: # fall back to conversion with sox
+				mailtype,mailfile="la",filename
+			cs_helpers.sendMIMEMail(fromaddress, mailaddress, "Voice call received from "+call_from+" to "+call_to, mailtype,
 			  "You got a voice call from "+call_from+" to "+call_to+"\nDate: "+time.ctime()+"\n\n"
-			  +"See attached file.\nThe original file was saved to file://"+filename+"\n\n", filename)
+			  +"See attached file.\nThe original file was saved to file://"+filename+"\n\n", mailfile)
+			if (mailtype=="wav"):
+				os.unlink(wavname)
 
 
 # @brief remote inquiry function (uses german wave snippets!)
@@ -303,11 +322,12 @@ def remoteInquiry(call,userdir,curr_user,config):
 			else:
 				i+=1
 
-		cs_helpers.sayNumber(call,str(len(messages)),curr_user,config)
+		snippets=cs_helpers.getNumberAudio(str(len(messages)),curr_user,config)
 		if (len(messages)==1):
-			capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"neue-nachricht.la"),1)
+			snippets.append(cs_helpers.getAudio(config,curr_user,"neue-nachricht.la"))
 		else:
-			capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"neue-nachrichten.la"),1)
+			snippets.append(cs_helpers.getAudio(config,curr_user,"neue-nachrichten.la"))
+		capisuite.audio_send_list(call,snippets,1)
 
 		# menu for record new announcement
 		cmd=""
@@ -322,39 +342,42 @@ def remoteInquiry(call,userdir,curr_user,config):
 
 		# start inquiry
 		for curr_msgs in (messages,oldmessages):
-			cs_helpers.sayNumber(call,str(len(curr_msgs)),curr_user,config)
+			snippets=cs_helpers.getNumberAudio(str(len(curr_msgs)),curr_user,config)
 			if (curr_msgs==messages):
 				if (len(curr_msgs)==1):
-					capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"neue-nachricht.la"),1)
+					snippets.append(cs_helpers.getAudio(config,curr_user,"neue-nachricht.la"))
 				else:
-					capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"neue-nachrichten.la"),1)
+					snippets.append(cs_helpers.getAudio(config,curr_user,"neue-nachrichten.la"))
 			else:
 				if (len(curr_msgs)==1):
-					capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"nachricht.la"),1)
+					snippets.append(cs_helpers.getAudio(config,curr_user,"nachricht.la"))
 				else:
-					capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"nachrichten.la"),1)
+					snippets.append(cs_helpers.getAudio(config,curr_user,"nachrichten.la"))
+			capisuite.audio_send_list(call,snippets,1)
 
 			i=0
 			while (i<len(curr_msgs)):
 				filename=userdir+"received/voice-"+str(curr_msgs[i])+".la"
 				descr=cs_helpers.readConfig(filename[:-2]+"txt")
-				capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"nachricht.la"),1)
-				cs_helpers.sayNumber(call,str(i+1),curr_user,config)
-				capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"von.la"),1)
-				cs_helpers.sayNumber(call,descr.get('GLOBAL','call_from'),curr_user,config)
-				capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"fuer.la"),1)
-				cs_helpers.sayNumber(call,descr.get('GLOBAL','call_to'),curr_user,config)
-				capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"am.la"),1)
 				calltime=time.strptime(descr.get('GLOBAL','time'))
-				cs_helpers.sayNumber(call,str(calltime[2]),curr_user,config)
-				capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"..la"),1)
-				cs_helpers.sayNumber(call,str(calltime[1]),curr_user,config)
-				capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"..la"),1)
-				capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"um.la"),1)
-				cs_helpers.sayNumber(call,str(calltime[3]),curr_user,config)
-				capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"uhr.la"),1)
-				cs_helpers.sayNumber(call,str(calltime[4]),curr_user,config)
-				capisuite.audio_send(call,filename,1)
+				# say the whole header and play the message as one stream
+				snippets=[cs_helpers.getAudio(config,curr_user,"nachricht.la")]
+				snippets+=cs_helpers.getNumberAudio(str(i+1),curr_user,config)
+				snippets.append(cs_helpers.getAudio(config,curr_user,"von.la"))
+				snippets+=cs_helpers.getNumberAudio(descr.get('GLOBAL','call_from'),curr_user,config)
+				snippets.append(cs_helpers.getAudio(config,curr_user,"fuer.la"))
+				snippets+=cs_helpers.getNumberAudio(descr.get('GLOBAL','call_to'),curr_user,config)
+				snippets.append(cs_helpers.getAudio(config,curr_user,"am.la"))
+				snippets+=cs_helpers.getNumberAudio(str(calltime[2]),curr_user,config)
+				snippets.append(cs_helpers.getAudio(config,curr_user,"..la"))
+				snippets+=cs_helpers.getNumberAudio(str(calltime[1]),curr_user,config)
+				snippets.append(cs_helpers.getAudio(config,curr_user,"..la"))
+				snippets.append(cs_helpers.getAudio(config,curr_user,"um.la"))
+				snippets+=cs_helpers.getNumberAudio(str(calltime[3]),curr_user,config)
+				snippets.append(cs_helpers.getAudio(config,curr_user,"uhr.la"))
+				snippets+=cs_helpers.getNumberAudio(str(calltime[4]),curr_user,config)
+				snippets.append(filename)
+				capisuite.audio_send_list(call,snippets,1)
 				cmd=""
 				while (cmd not in ("1","4","5","6")):
 					capisuite.audio_send(call,cs_helpers.getAudio(config,curr_user,"erklaerung.la"),1)
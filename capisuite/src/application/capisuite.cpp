@@ -25,11 +25,20 @@
 #include <signal.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include "../backend/capi.h"
 #include "../backend/connection.h"
+#include "../backend/promptcache.h"
 #include "incomingscript.h"
 #include "idlescript.h"
+#include "interpreterpool.h"
+#include "workerpool.h"
+#include "metricsserver.h"
+#include "submitserver.h"
+#include "faxqueue.h"
+#include "sendpool.h"
 #include "capisuite.h"
+#include "../backend/asynclog.h"
 
 /** @brief Global Pointer to current CapiSuite instance
 */
@@ -49,7 +58,7 @@ void hup_handler(int)
 }
  
 CapiSuite::CapiSuite(int argc,char **argv)
-:capi(NULL),waiting(),config(),idle(NULL),py_state(NULL),debug(NULL),error(NULL),finish_flag(false),custom_configfile(),daemonmode(false)
+:capi(NULL),waiting(),config(),idle(NULL),incoming_pool(NULL),workers(NULL),metrics(NULL),submit(NULL),fax_queue(NULL),sends(NULL),py_state(NULL),debug(NULL),error(NULL),debug_log(NULL),error_log(NULL),finish_flag(false),custom_configfile(),daemonmode(false)
 {
 	if (capisuiteInstance!=NULL) {
 		cerr << "FATAL error: More than one instances of CapiSuite created" << endl;
@@ -57,6 +66,9 @@ CapiSuite::CapiSuite(int argc,char **argv)
 	}
 	capisuiteInstance=this;
 
+	pthread_mutex_init(&waiting_mutex, NULL);
+	sem_init(&waiting_sem, 0, 0);
+
 	readCommandline(argc,argv);
 	readConfiguration();
 
@@ -68,6 +80,12 @@ CapiSuite::CapiSuite(int argc,char **argv)
 				exit(1);
 			}
 
+		// the threads writing the log files must be started after daemon() as threads don't survive fork()
+		if (debug_log)
+			debug_log->start();
+		if (error_log)
+			error_log->start();
+
 		debug_level=atoi(config["log_level"].c_str());
 
 		(*debug) << prefix() << "CapiSuite " << VERSION << " started." << endl;
@@ -88,8 +106,17 @@ CapiSuite::CapiSuite(int argc,char **argv)
 		}
 
 		// backend init
-		capi=new Capi(*debug,debug_level,*error,atoi(config["DDI_length"].c_str()),atoi(config["DDI_base_length"].c_str()),DDIStopList);
+		FileWriter::sync_policy_t receive_sync=FileWriter::SYNC_NONE;
+		if (config["receive_sync"]=="fdatasync")
+			receive_sync=FileWriter::SYNC_DATA;
+		else if (config["receive_sync"]=="direct")
+			receive_sync=FileWriter::SYNC_DIRECT;
+		capi=new Capi(*debug,debug_level,*error,atoi(config["DDI_length"].c_str()),atoi(config["DDI_base_length"].c_str()),DDIStopList,0,7,2048,receive_sync,
+		  atoi(config["capi_dispatch_threads"].c_str()));
 		capi->registerApplicationInterface(this);
+		// "auto" gives 0 here, which selects the automatic values
+		capi->setVoiceTransfer(atoi(config["voice_window"].c_str()),atoi(config["voice_block_size"].c_str()),atoi(config["voice_max_latency"].c_str()));
+		capi->setFaxTransfer(atoi(config["fax_window"].c_str()),atoi(config["fax_block_size"].c_str()));
 
                 string info;
 		if (debug_level>=2)
@@ -103,6 +130,33 @@ CapiSuite::CapiSuite(int argc,char **argv)
 				(*debug) << prefix();
 		}
 
+		// load the prompts into memory before the first call arrives
+		PromptCache::setLimit(atol(config["prompt_cache_size"].c_str())*1024);
+		string dirs=config["prompt_cache_dirs"];
+		string::size_type start=0;
+		while (start<dirs.size()) {
+			string::size_type end=dirs.find(',',start);
+			if (end==string::npos)
+				end=dirs.size();
+			string dir=dirs.substr(start,end-start);
+			start=end+1;
+			if (dir.empty())
+				continue;
+			try {
+				unsigned count=PromptCache::addDirectory(dir);
+				if (debug_level>=1)
+					(*debug) << prefix() << "prompt cache: " << count << " files loaded from " << dir << endl;
+			}
+			catch (CapiExternalError e) {
+				(*error) << prefix() << "Warning: can't cache prompts. The given error message was: " << e << endl;
+			}
+		}
+		if (debug_level>=2)
+			(*debug) << prefix() << "prompt cache: " << PromptCache::getSize() << " bytes used" << endl;
+
+		if (config["metrics_socket"]!="")
+			metrics=new MetricsServer(*debug,debug_level,*error,config["metrics_socket"]);
+
 		capi->setListenTelephony(0); // TODO: 0 = all, evtl. einstellbar?
 		capi->setListenFaxG3(0); // TODO: 0 = all, evtl. einstellbar?
 
@@ -114,6 +168,12 @@ CapiSuite::CapiSuite(int argc,char **argv)
 			exit(1);
 		}
 		PyEval_InitThreads();  // init and acquire lock
+
+		// prepare interpreters for the incoming script while we hold the lock anyway
+		int pool_size=atoi(config["incoming_script_pool_size"].c_str());
+		if (pool_size)
+			incoming_pool=new InterpreterPool(*debug,debug_level,*error,config["incoming_script"],pool_size);
+
 		py_state=PyEval_SaveThread();  // release lock, save thread context
 		if (!py_state) {
 			(*error) << prefix() << "FATAL error: can't release python lock" << endl;
@@ -122,8 +182,34 @@ CapiSuite::CapiSuite(int argc,char **argv)
 
 		// idle script object
 		int interval=atoi(config["idle_script_interval"].c_str());
-		if (interval && config["idle_script"]!="")
-			idle=new IdleScript(*debug,debug_level,*error,capi,config["idle_script"],interval,py_state,save_cStringIO);
+		if (interval && config["idle_script"]!="") {
+			// index of the fax jobs, without it the script reads the send queues itself
+			try {
+				fax_queue=new FaxQueue(*debug,debug_level,*error,interval);
+			}
+			catch (ApplicationError e) {
+				(*error) << prefix() << "Warning: can't create index of the fax jobs. The given error message was: " << e << endl;
+			}
+			idle=new IdleScript(*debug,debug_level,*error,capi,config["idle_script"],interval,py_state,save_cStringIO,fax_queue);
+			sends=new SendPool(*debug,debug_level,*error,capi,config["idle_script"],save_cStringIO,fax_queue,
+			  atoi(config["send_max_per_controller"].c_str()),atoi(config["send_max_per_destination"].c_str()));
+		}
+
+		// new fax jobs can start the idle script at once
+		if (idle && config["submit_socket"]!="") {
+			try {
+				submit=new SubmitServer(*debug,debug_level,*error,config["submit_socket"],idle,fax_queue);
+			}
+			catch (ApplicationError e) {
+				(*error) << prefix() << "Warning: new fax jobs will wait for the next run of the idle script. The given error message was: " << e << endl;
+			}
+		}
+
+		// worker threads for incoming calls
+		WorkerPool::overflow_policy_t overflow = (config["incoming_overflow"]=="reject") ? WorkerPool::REJECT : WorkerPool::QUEUE;
+		workers=new WorkerPool(*debug,debug_level,*error,atoi(config["incoming_workers"].c_str()),atoi(config["incoming_queue_size"].c_str()),
+		  atoi(config["incoming_queue_timeout"].c_str()),overflow,strtol(config["incoming_reject_cause"].c_str(),NULL,0),
+		  atoi(config["incoming_stack_size"].c_str())*1024,config["incoming_script"],save_cStringIO,incoming_pool);
 
 		// signal handling
 		signal(SIGTERM,exit_handler);
@@ -132,14 +218,26 @@ CapiSuite::CapiSuite(int argc,char **argv)
 	}
         catch (CapiError e) {
 		capisuiteInstance=NULL;
+		if (submit)
+			delete submit;
 		if (idle) {
 			idle->requestTerminate();
 		}
+		if (sends)
+			sends->requestTerminate(0);
 		if (py_state) {
 			PyEval_RestoreThread(py_state); // switch to right thread context, acquire lock
 			py_state=NULL;
+			if (incoming_pool) {
+				delete incoming_pool;
+				incoming_pool=NULL;
+			}
 			Py_Finalize();
 		}
+		if (fax_queue)
+			delete fax_queue;
+		if (metrics)
+			delete metrics;
                 if (capi)
 			delete capi;
                 (*error) << prefix() << "Can't start Capi abstraction. The given error message was: " << e << endl << endl;
@@ -147,14 +245,26 @@ CapiSuite::CapiSuite(int argc,char **argv)
         }
         catch (ApplicationError e) {
 		capisuiteInstance=NULL;
+		if (submit)
+			delete submit;
 		if (idle) {
 			idle->requestTerminate();
 		}
+		if (sends)
+			sends->requestTerminate(0);
 		if (py_state) {
 			PyEval_RestoreThread(py_state); // switch to right thread context, acquire lock
 			py_state=NULL;
+			if (incoming_pool) {
+				delete incoming_pool;
+				incoming_pool=NULL;
+			}
 			Py_Finalize();
 		}
+		if (fax_queue)
+			delete fax_queue;
+		if (metrics)
+			delete metrics;
                 if (capi)
 			delete capi;
                 (*error) << prefix() << "Can't start application. The given error message was: " << e << endl;
@@ -164,17 +274,50 @@ CapiSuite::CapiSuite(int argc,char **argv)
 
 CapiSuite::~CapiSuite()
 {
+	if (submit)
+		delete submit; // uses idle
 	if (idle)
 		idle->requestTerminate(); // will self-delete!
+	// threads still running after these waits use Capi and Python, so both are left alone then,
+	// they're cleaned up by the end of the process
+	bool threads_finished=true;
+	if (workers) // called without the Python lock, the workers need it to finish
+		threads_finished=workers->requestTerminate(60); // will self-delete!
 
 	// thread-safe shutdown of the Python interpreter (taken out of PyApache 4.26)
 	if (py_state) {
 		PyEval_RestoreThread(py_state); // switch to right thread context, acquire lock
 		py_state=NULL;
-		Py_Finalize();
+		if (sends) {
+			SendPool *pool=sends;
+			sends=NULL; // changed with the lock held, so the idle script can't get it any more
+			bool jobs_finished;
+			Py_BEGIN_ALLOW_THREADS // the jobs need the lock to finish
+			jobs_finished=pool->requestTerminate(60); // will self-delete!
+			Py_END_ALLOW_THREADS
+			threads_finished=threads_finished && jobs_finished;
+		}
+		if (threads_finished) {
+			if (incoming_pool) { // all workers have given back their interpreters
+				delete incoming_pool;
+				incoming_pool=NULL;
+			}
+			Py_Finalize();
+		}
 	}
 
-	delete capi;
+	if (threads_finished) {
+		if (fax_queue)
+			delete fax_queue; // used by the scripts
+		delete capi;
+	}
+	if (metrics)
+		delete metrics;
+
+	pthread_mutex_lock(&waiting_mutex); // assure the lock is free before destroying it
+	pthread_mutex_unlock(&waiting_mutex);
+	pthread_mutex_destroy(&waiting_mutex);
+	sem_destroy(&waiting_sem);
 
 	(*debug) << prefix() << "CapiSuite finished." << endl;
 	(*error) << prefix() << "CapiSuite finished." << endl;
@@ -189,12 +332,14 @@ CapiSuite::finish()
 	if (debug_level >= 2)
 		(*debug) << prefix() << "requested finish" << endl;
 	finish_flag=true;
+	sem_post(&waiting_sem); // wake up mainLoop()
 }
 
 void CapiSuite::reload()
 {
 	if (debug_level >= 2)
 		(*debug) << prefix() << "requested reload" << endl;
+	PythonScript::flushCache();
 	if (idle)
 		idle->activate();
 }
@@ -202,45 +347,40 @@ void CapiSuite::reload()
 void
 CapiSuite::callWaiting (Connection *conn)
 {
-	waiting.push(conn);
+	waiting_call_t call;
+	call.conn=conn;
+	gettimeofday(&call.arrival,NULL);
+
+	pthread_mutex_lock(&waiting_mutex);
+	waiting.push(call);
+	pthread_mutex_unlock(&waiting_mutex);
+	sem_post(&waiting_sem); // wake up mainLoop()
 }
 
 void
 CapiSuite::mainLoop()
 {
-	timespec delay_time;
-	delay_time.tv_sec=0; delay_time.tv_nsec=100000000;  // 100 msec
-	int count,errorcount=0;
 	while (!finish_flag) {
-		nanosleep(&delay_time,NULL);
-		count++;
-		while (waiting.size()) {
-			Connection* conn=waiting.front();
-			waiting.pop();
+		if (sem_wait(&waiting_sem)) // interrupted by a signal, check finish_flag
+			continue;
 
-			IncomingScript *instance;
-			try {
-				instance=new IncomingScript(*debug,debug_level,*error,conn,config["incoming_script"],save_cStringIO);
-			}
-			catch (ApplicationError e)
-			{
-				(*error) << prefix() << "ERROR: can't start IncomingScript thread, message was: " << e << endl;
-				delete instance;
-			}
-			// otherwise it will self-delete!
+		pthread_mutex_lock(&waiting_mutex);
+		if (waiting.empty()) { // woken up by finish()
+			pthread_mutex_unlock(&waiting_mutex);
+			continue;
 		}
+		waiting_call_t call=waiting.front();
+		waiting.pop();
+		pthread_mutex_unlock(&waiting_mutex);
+
+		workers->dispatch(call.conn,call.arrival);
 	}
 }
 
 string
 CapiSuite::prefix()
 {
-	time_t t=time(NULL);
-	char* ct=ctime(&t);
-	ct[24]='\0';
-	stringstream s;
-	s << ct << " CapiSuite " << hex << this << ": ";
-	return (s.str());
+	return AsyncLog::prefix("CapiSuite",this);
 }
 
 void
@@ -314,6 +454,26 @@ CapiSuite::readConfiguration()
 	}
 
 	checkOption("incoming_script",string(PKGLIBDIR)+"/incoming.py");
+	checkOption("incoming_script_pool_size","4");
+	checkOption("incoming_workers","16");
+	checkOption("incoming_queue_size","16");
+	checkOption("incoming_queue_timeout","10");
+	checkOption("incoming_overflow","queue");
+	checkOption("incoming_reject_cause","3");
+	checkOption("incoming_stack_size","0");
+	checkOption("receive_sync","none");
+	checkOption("capi_dispatch_threads","4");
+	checkOption("voice_window","auto");
+	checkOption("voice_block_size","auto");
+	checkOption("voice_max_latency","200");
+	checkOption("fax_window","auto");
+	checkOption("fax_block_size","auto");
+	checkOption("prompt_cache_dirs",string(PKGDATADIR)+"/");
+	checkOption("prompt_cache_size","8192");
+	checkOption("metrics_socket","");
+	checkOption("submit_socket",string(LOCALSTATEDIR)+"/run/capisuite.submit");
+	checkOption("send_max_per_controller","0");
+	checkOption("send_max_per_destination","1");
 	checkOption("idle_script",string(PKGLIBDIR)+"idle.py");
 	checkOption("idle_script_interval","60");
 	checkOption("log_file",string(LOCALSTATEDIR)+"/log/capisuite.log");
@@ -328,12 +488,79 @@ CapiSuite::readConfiguration()
 		if (t[i]<'0' || t[i]>'9')
 			throw ApplicationError("Invalid idle_script_interval given.","readConfiguration()");
 
+	t=config["incoming_script_pool_size"];
+	for (int i=0;i<t.size();i++)
+		if (t[i]<'0' || t[i]>'9')
+			throw ApplicationError("Invalid incoming_script_pool_size given.","readConfiguration()");
+
+	t=config["incoming_workers"];
+	if (!t.size() || t=="0")
+		throw ApplicationError("Invalid incoming_workers given.","readConfiguration()");
+	for (int i=0;i<t.size();i++)
+		if (t[i]<'0' || t[i]>'9')
+			throw ApplicationError("Invalid incoming_workers given.","readConfiguration()");
+
+	t=config["incoming_queue_size"];
+	for (int i=0;i<t.size();i++)
+		if (t[i]<'0' || t[i]>'9')
+			throw ApplicationError("Invalid incoming_queue_size given.","readConfiguration()");
+
+	t=config["incoming_queue_timeout"];
+	for (int i=0;i<t.size();i++)
+		if (t[i]<'0' || t[i]>'9')
+			throw ApplicationError("Invalid incoming_queue_timeout given.","readConfiguration()");
+
+	if (config["incoming_overflow"]!="queue" && config["incoming_overflow"]!="reject")
+		throw ApplicationError("Invalid incoming_overflow given.","readConfiguration()");
+
+	t=config["incoming_reject_cause"];
+	char *cause_end;
+	if (!t.size() || strtol(t.c_str(),&cause_end,0)<=0 || *cause_end)
+		throw ApplicationError("Invalid incoming_reject_cause given.","readConfiguration()");
+
+	t=config["incoming_stack_size"];
+	for (int i=0;i<t.size();i++)
+		if (t[i]<'0' || t[i]>'9')
+			throw ApplicationError("Invalid incoming_stack_size given.","readConfiguration()");
+
+	if (config["receive_sync"]!="none" && config["receive_sync"]!="fdatasync" && config["receive_sync"]!="direct")
+		throw ApplicationError("Invalid receive_sync given.","readConfiguration()");
+
+	t=config["capi_dispatch_threads"];
+	for (int i=0;i<t.size();i++)
+		if (t[i]<'0' || t[i]>'9')
+			throw ApplicationError("Invalid capi_dispatch_threads given.","readConfiguration()");
+
+	t=config["voice_max_latency"];
+	for (int i=0;i<t.size();i++)
+		if (t[i]<'0' || t[i]>'9')
+			throw ApplicationError("Invalid voice_max_latency given.","readConfiguration()");
+
+	const char *transfer_options[]={"voice_window","voice_block_size","fax_window","fax_block_size"};
+	for (int j=0;j<4;j++) {
+		t=config[transfer_options[j]];
+		if (t=="auto")
+			continue;
+		if (!t.size() || t=="0")
+			throw ApplicationError("Invalid "+string(transfer_options[j])+" given.","readConfiguration()");
+		for (int i=0;i<t.size();i++)
+			if (t[i]<'0' || t[i]>'9')
+				throw ApplicationError("Invalid "+string(transfer_options[j])+" given.","readConfiguration()");
+	}
+
+	t=config["prompt_cache_size"];
+	for (int i=0;i<t.size();i++)
+		if (t[i]<'0' || t[i]>'9')
+			throw ApplicationError("Invalid prompt_cache_size given.","readConfiguration()");
+
 	if (config["log_file"]!="" && config["log_file"]!="-") {
-		debug = new ofstream(config["log_file"].c_str(),ios::app);
-		if (! (*debug)) {
+		int fd=open(config["log_file"].c_str(),O_WRONLY|O_APPEND|O_CREAT,0666);
+		if (fd==-1) {
 			cerr << "Can't open log file. Writing to stdout." << endl;
-			delete debug;
 			debug = &cout;
+		} else {
+			debug_log = new AsyncLog(fd,true);
+			debug = new ostream(debug_log);
 		}
 	} else
 		debug=&cout;
@@ -343,11 +570,13 @@ CapiSuite::readConfiguration()
 		throw ApplicationError("Invalid log_level given.","main()");
 
 	if (config["log_error"]!="" && config["log_error"]!="-") {
-		error = new ofstream(config["log_error"].c_str(),ios::app);
-		if (! (*error)) {
+		int fd=open(config["log_error"].c_str(),O_WRONLY|O_APPEND|O_CREAT,0666);
+		if (fd==-1) {
 			cerr << "Can't open error log file. Writing to stderr." << endl;
-			delete error;
 			error = &cerr;
+		} else {
+			error_log = new AsyncLog(fd,true);
+			error = new ostream(error_log);
 		}
 	} else
 		error=&cerr;
@@ -21,11 +21,21 @@
 #include <map>
 #include <queue>
 #include <fstream>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/time.h>
 #include "../backend/applicationinterface.h"
 #include "applicationexception.h"
 #include "capisuitemodule.h"
 class Capi;
 class IdleScript;
+class InterpreterPool;
+class WorkerPool;
+class MetricsServer;
+class SubmitServer;
+class FaxQueue;
+class SendPool;
+class AsyncLog;
 class PycStringIO_CAPI;
 
 /** @brief Main application class, implements ApplicationInterface
@@ -34,9 +44,9 @@ class PycStringIO_CAPI;
     ApplicationInterface. It firstly generates the necessary objects from the CAPI
     abstraction layer (one object of class Capi) and enables call listening.
 
-    It contains the mainLoop() and creates handling objects of IncomingScript for 
-    all incoming calls and one object of IdleScript which will start the idle script
-    at regular intervals. The scripts are informed about disconnection / program termination
+    It contains the mainLoop() which hands over all incoming calls to a WorkerPool
+    running an IncomingScript for each of them and creates one object of IdleScript
+    which will start the idle script at regular intervals. The scripts are informed about disconnection / program termination
     but will delete themselves.
 
     main() should create one CapiSuite object and then call mainLoop().
@@ -50,6 +60,7 @@ class CapiSuite: public ApplicationInterface
 
 		    Creates a Capi object, enables listening, calls readConfiguration,
 		    and initializes the Python interpreter in multithreading mode.
+		    If incoming_script_pool_size is set, an InterpreterPool is created.
 		    It immediately releases the global Python lock after doing initialization.
 
 		    Also an IdleScript object is created and will regularly call the given script.
@@ -66,19 +77,27 @@ class CapiSuite: public ApplicationInterface
 		~CapiSuite();
 
 		/** @brief Callback: enqueue Connection in waiting
+
+		    Called by the CAPI thread. Records the arrival time and wakes up mainLoop() immediately.
 	   	*/
   		virtual void callWaiting (Connection *conn);
 
 		/** @brief Main Loop. Event Loop (handling incoming connections)
 
-		    For each incoming connection, an object of IncomingScript is created
-		    which handles this call in an own thread.
+		    Each incoming connection is handed over to the WorkerPool which creates
+		    an IncomingScript for it in one of its threads or rejects the call if
+		    all workers are busy.
+
+		    The loop blocks until callWaiting() or finish() posts waiting_sem, so
+		    there's no polling.
 
 		    This loop will run until the program is finished.
 		*/
 		void mainLoop();
 
 		/** @brief Request finish of mainLoop
+
+		    Only uses async-signal-safe calls as it's called from the signal handler.
 		*/
 		void finish();
 
@@ -110,7 +129,8 @@ class CapiSuite: public ApplicationInterface
 
 		/** @brief restart some aspects if the process gets a SIGHUP
 
-		    Currently, this only reactivates the idle script if it was deactivated by too much errors in a row.
+		    Reactivates the idle script if it was deactivated by too much errors in a row and
+		    forces all scripts to be compiled again before their next use.
 		*/
 		void reload();
 
@@ -131,6 +151,18 @@ class CapiSuite: public ApplicationInterface
 		*/
 		void errorMessage(string message);
 
+		/** @brief return the index of the fax jobs
+
+		    @return the FaxQueue, NULL if not available
+		*/
+		FaxQueue* getFaxQueue() {return fax_queue;}
+
+		/** @brief return the pool sending the fax jobs
+
+		    @return the SendPool, NULL if there's no idle script
+		*/
+		SendPool* getSendPool() {return sends;}
+
 	private:
   		/** @brief return a prefix containing this pointer and date for log messages
 
@@ -145,14 +177,31 @@ class CapiSuite: public ApplicationInterface
   		*/
 		void checkOption(string key, string value);
 
-		queue <Connection*> waiting; ///< queue for waiting connection instances
+		/** @brief entry of the waiting queue
+		*/
+		struct waiting_call_t {
+			Connection* conn; ///< the waiting connection
+			timeval arrival; ///< time when callWaiting() was called for it
+		};
+
+		queue <waiting_call_t> waiting; ///< queue for waiting connection instances
+		pthread_mutex_t waiting_mutex; ///< protects waiting against concurrent access by the CAPI thread
+		sem_t waiting_sem; ///< posted for each new entry in waiting and by finish()
 		IdleScript *idle; ///< reference to the IdleScript object created
+		InterpreterPool *incoming_pool; ///< prepared interpreters for the incoming script, NULL if disabled
+		WorkerPool *workers; ///< threads handling the incoming calls
+		MetricsServer *metrics; ///< exports the metrics on a Unix socket, NULL if disabled
+		SubmitServer *submit; ///< accepts new fax jobs on a Unix socket, NULL if disabled
+		FaxQueue *fax_queue; ///< index of the fax jobs in the send queues, NULL if not available
+		SendPool *sends; ///< sends the fax jobs handed over by the idle script, NULL if there's no idle script
 
 		PyThreadState *py_state; ///< saves the created thread state of the main python interpreter
 		PycStringIO_CAPI* save_cStringIO; ///< holds a pointer to the Python cStringIO C API
 		Capi* capi; ///< reference to Capi object to use, set in constructor
 		ostream  *debug, ///< debug stream
 			 *error; ///< stream for error messages
+		AsyncLog *debug_log, ///< buffer of debug if it writes to a file, NULL otherwise
+			 *error_log; ///< buffer of error if it writes to a file, NULL otherwise
 
 		unsigned short debug_level; ///< verbosity level for debug stream
 
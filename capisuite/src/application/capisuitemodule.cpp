@@ -19,7 +19,9 @@
 
 #include <Python.h>
 #include <string>
+#include <algorithm>
 #include <unistd.h> // for sleep()
+#include "../backend/capi.h"
 #include "../backend/connection.h"
 #include "../modules/audiosend.h"
 #include "../modules/audioreceive.h"
@@ -30,6 +32,9 @@
 #include "../modules/switch2faxG3.h"
 #include "../modules/readDTMF.h"
 #include "../modules/calloutgoing.h"
+#include "faxqueue.h"
+#include "faxconverter.h"
+#include "sendpool.h"
 #include "capisuitemodule.h"   
 #include "capisuite.h"
 
@@ -250,6 +255,78 @@ capisuite_audio_send(PyObject*, PyObject *args)
 	return (r);
 }
 
+/** @brief Send several audio files in a speech mode connection without gaps in between.
+    @ingroup python
+
+    This function works like capisuite_audio_send(), but sends all given files one after another
+    as if they were one file. Use it to speak several snippets like the words of a number, so
+    there are no gaps between them.
+
+    @param args Contains the python parameters. These are:
+    	- <b>call</b> Reference to the current call
+    	- <b>filenames (sequence of strings)</b> files to send
+    	- <b>exit_DTMF (integer, optional)</b> if set to 1, sending is aborted when a DTMF signal is received (0=off, default)
+    @return int containing duration of send in seconds
+*/
+static PyObject*
+capisuite_audio_send_list(PyObject*, PyObject *args)
+{
+	Connection* conn;
+	PyObject *py_filenames;
+	PyThreadState *_save;
+	int exit_DTMF=0;
+	long duration=0;
+
+	if (!PyArg_ParseTuple(args,"O&O|i:audio_send_list",convertConnRef,&conn,&py_filenames,&exit_DTMF))
+		return NULL;
+
+	PyObject *seq=PySequence_Fast(py_filenames,"Second parameter must be a sequence of file names."); // new ref
+	if (!seq)
+		return NULL;
+	vector<string> filenames;
+	for (int i=0;i<PySequence_Fast_GET_SIZE(seq);i++) {
+		PyObject *item=PySequence_Fast_GET_ITEM(seq,i); // borrowed ref
+		if (!PyString_Check(item)) {
+			Py_DECREF(seq);
+			PyErr_SetString(PyExc_TypeError,"Second parameter must be a sequence of file names.");
+			return NULL;
+		}
+		filenames.push_back(PyString_AsString(item));
+	}
+	Py_DECREF(seq);
+
+	try {
+		Py_UNBLOCK_THREADS
+		AudioSend active(conn,filenames,exit_DTMF);
+		active.mainLoop();
+		duration=active.duration();
+		Py_BLOCK_THREADS
+	}
+	catch (CapiWrongState e) {
+		Py_BLOCK_THREADS
+		PyErr_SetString(CallGoneError,"Call was finished from partner.");
+		return NULL;
+	}
+	catch (CapiMsgError e) {
+		Py_BLOCK_THREADS
+		PyErr_SetString(BackendError,(e.message()).c_str());
+		return NULL;
+	}
+	catch (CapiExternalError e) {
+		Py_BLOCK_THREADS
+		PyErr_SetString(BackendError,(e.message()).c_str());
+		return NULL;
+	}
+	catch (CapiError e) {
+		Py_BLOCK_THREADS
+		PyErr_SetString(BackendError,(e.message()).c_str());
+		return NULL;
+	}
+
+	PyObject *r=PyInt_FromLong(duration);
+	return (r);
+}
+
 /** @brief Receive an audio file in a speech mode connection.
     @ingroup python
 
@@ -264,7 +341,8 @@ capisuite_audio_send(PyObject*, PyObject *args)
 
     The connction must be in audio mode (use capisuite_connect_voice()), otherwise an exception will be caused.
 
-    The created file will be saved in bit-reversed A-Law format, 8 kHz mono. Use sox to convert it to a normal wav file.
+    The created file will be saved in bit-reversed A-Law format, 8 kHz mono. A wav file can be written at the same time,
+    so no conversion with sox is necessary afterwards.
 
     @param args Contains the python parameters. These are:
     	- <b>call</b> Reference to the current call
@@ -272,6 +350,8 @@ capisuite_audio_send(PyObject*, PyObject *args)
 	- <b>timeout (integer)</b> receive length in seconds (-1 = infinite)
 	- <b>silence_timeout (integer, optional)</b> abort after x seconds of silence (0=off, default)
 	- <b>exit_DTMF (integer, optional)</b> if set to 1, sending is aborted when a DTMF signal is received (0=off, default)
+	- <b>wav_filename (string, optional)</b> where to save the received audio as wav file additionally ("" = none, default)
+	- <b>wav_format (string, optional)</b> format of the wav file: "wav" for 16 bit PCM (default), "adpcm" for IMA ADPCM
     @return int containing duration of receive in seconds
 */
 static PyObject*
@@ -283,13 +363,23 @@ capisuite_audio_receive(PyObject *, PyObject *args)
 	PyThreadState *_save;
 	int exit_DTMF=0;
 	long duration=0;
+	const char *wav_filename="", *wav_format="wav";
+	AudioEncoder::format_t format;
+
+	if (!PyArg_ParseTuple(args,"O&si|iiss:audio_receive",convertConnRef,&conn,&filename, &timeout, &silence_timeout,&exit_DTMF,&wav_filename,&wav_format))
+		return NULL;
 
-	if (!PyArg_ParseTuple(args,"O&si|ii:audio_receive",convertConnRef,&conn,&filename, &timeout, &silence_timeout,&exit_DTMF))
+	try {
+		format=AudioEncoder::parseFormat(wav_format);
+	}
+	catch (CapiExternalError e) {
+		PyErr_SetString(PyExc_ValueError,(e.message()).c_str());
 		return NULL;
+	}
 
 	try {
 		Py_UNBLOCK_THREADS
-		AudioReceive active(conn,filename,timeout,silence_timeout,exit_DTMF);
+		AudioReceive active(conn,filename,timeout,silence_timeout,exit_DTMF,wav_filename,format);
 		active.mainLoop();
 		duration=active.duration();
 		Py_BLOCK_THREADS
@@ -620,10 +710,54 @@ capisuite_connect_faxG3(PyObject *, PyObject *args)
 		return NULL;
 }
 
+/** @brief helper function converting the controller parameter of the call functions
+
+    The parameter may be a controller number or a sequence of them. Controller 0 stands
+    for all installed controllers.
+
+    @param capi reference to object of Capi to use
+    @param arg the python parameter
+    @param controllers the controller numbers are appended here, without duplicates
+    @return true if successful, false if a python exception was set
+*/
+static bool
+getControllers(Capi *capi, PyObject *arg, vector<unsigned> &controllers)
+{
+	PyObject *seq=PyInt_Check(arg) ? Py_BuildValue("(O)",arg) : PySequence_Fast(arg,"controller must be an int or a sequence of ints"); // new ref
+	if (!seq)
+		return false;
+
+	for (int i=0;i<PySequence_Fast_GET_SIZE(seq);i++) {
+		PyObject *item=PySequence_Fast_GET_ITEM(seq,i); // borrowed ref
+		if (!PyInt_Check(item)) {
+			Py_DECREF(seq);
+			PyErr_SetString(PyExc_TypeError,"controller must be an int or a sequence of ints");
+			return false;
+		}
+		long controller=PyInt_AsLong(item);
+		if (controller<0 || controller>static_cast<long>(capi->getNumControllers())) {
+			Py_DECREF(seq);
+			PyErr_SetString(PyExc_ValueError,"unknown controller");
+			return false;
+		}
+		unsigned first=controller ? controller : 1, last=controller ? controller : capi->getNumControllers();
+		for (unsigned c=first;c<=last;c++)
+			if (find(controllers.begin(),controllers.end(),c)==controllers.end())
+				controllers.push_back(c);
+	}
+	Py_DECREF(seq);
+
+	if (controllers.empty()) {
+		PyErr_SetString(PyExc_ValueError,"no controller given");
+		return false;
+	}
+	return true;
+}
+
 /** @brief helper function for capisuite_call_voice() and capisuite_call_faxG3()
 
     @param capi reference to object of Capi to use
-    @param controller controller number to use
+    @param controllers controller numbers to use, see CallOutgoing
     @param call_from string containing the own number to use
     @param call_to string containing the number to call
     @param service service to call with as described in Connection::service_t
@@ -634,14 +768,14 @@ capisuite_connect_faxG3(PyObject *, PyObject *args)
     @return tuple (call,result) - call=reference to the created call object / result(int)=result of the call establishment
 */
 static PyObject*
-capisuite_call(Capi *capi, unsigned short controller, string call_from, string call_to, Connection::service_t service, int timeout, string faxStationID, string faxHeadline, bool clir)
+capisuite_call(Capi *capi, const vector<unsigned> &controllers, string call_from, string call_to, Connection::service_t service, int timeout, string faxStationID, string faxHeadline, bool clir)
 {
 	PyThreadState *_save;
 	Connection* conn=NULL;
 	int result;
 	try {
 		Py_UNBLOCK_THREADS
-		CallOutgoing active(capi,controller,call_from,call_to,service,timeout,faxStationID,faxHeadline,clir);
+		CallOutgoing active(capi,controllers,call_from,call_to,service,timeout,faxStationID,faxHeadline,clir);
 		active.mainLoop();
 		conn=active.getConnection();
 		result=active.getResult();
@@ -683,7 +817,7 @@ capisuite_call(Capi *capi, unsigned short controller, string call_from, string c
 
     @param args Contains the python parameters. These are:
 	- <b>capi</b> reference to object of Capi to use (given to the idle function as parameter)
-    	- <b>controller (int)</b> ISDN controller ID to use
+    	- <b>controller (int or sequence of ints)</b> ISDN controller ID(s) to use, 0 for all controllers. The call is made on the controller with the most free B channels. If it fails there because no channel is available, the next one is tried.
     	- <b>call_from (string)</b>own number to use
     	- <b>call_to (string)</b>the number to call
     	- <b>timeout (int)</b>timeout to wait for connection establishment in seconds
@@ -694,13 +828,18 @@ static PyObject*
 capisuite_call_voice(PyObject *, PyObject *args)
 {
 	Capi *capi;
-	int controller, timeout, clir=0;
+	PyObject *controller;
+	int timeout, clir=0;
 	char *call_from,*call_to;
 
-	if (!PyArg_ParseTuple(args,"O&issi|i:call_voice",convertCapiRef,&capi,&controller,&call_from,&call_to,&timeout,&clir))
+	if (!PyArg_ParseTuple(args,"O&Ossi|i:call_voice",convertCapiRef,&capi,&controller,&call_from,&call_to,&timeout,&clir))
 		return NULL;
 
-	return capisuite_call(capi,controller,call_from,call_to,Connection::VOICE,timeout,"","",clir);
+	vector<unsigned> controllers;
+	if (!getControllers(capi,controller,controllers))
+		return NULL;
+
+	return capisuite_call(capi,controllers,call_from,call_to,Connection::VOICE,timeout,"","",clir);
 }
 
 /** @brief Initiate an outgoing call with service faxG3 and wait for successful connection
@@ -724,7 +863,7 @@ capisuite_call_voice(PyObject *, PyObject *args)
 
     @param args Contains the python parameters. These are:
 	- <b>capi</b> reference to object of Capi to use (given to the idle function as parameter)
-    	- <b>controller (int)</b> ISDN controller ID to use
+    	- <b>controller (int or sequence of ints)</b> ISDN controller ID(s) to use, 0 for all controllers. The call is made on the controller with the most free B channels. If it fails there because no channel is available, the next one is tried.
     	- <b>call_from (string)</b>own number to use
     	- <b>call_to (string)</b>the number to call
     	- <b>timeout (int)</b>timeout to wait for connection establishment in seconds
@@ -737,13 +876,18 @@ static PyObject*
 capisuite_call_faxG3(PyObject *, PyObject *args)
 {
 	Capi *capi;
-	int controller, timeout, clir=0;
+	PyObject *controller;
+	int timeout, clir=0;
 	char *call_from,*call_to,*faxStationID,*faxHeadline;
 
-	if (!PyArg_ParseTuple(args,"O&ississ|i:call_faxG3",convertCapiRef,&capi,&controller,&call_from,&call_to,&timeout,&faxStationID,&faxHeadline,&clir))
+	if (!PyArg_ParseTuple(args,"O&Ossiss|i:call_faxG3",convertCapiRef,&capi,&controller,&call_from,&call_to,&timeout,&faxStationID,&faxHeadline,&clir))
+		return NULL;
+
+	vector<unsigned> controllers;
+	if (!getControllers(capi,controller,controllers))
 		return NULL;
 
-	return capisuite_call(capi,controller,call_from,call_to,Connection::FAXG3,timeout,faxStationID,faxHeadline,clir);
+	return capisuite_call(capi,controllers,call_from,call_to,Connection::FAXG3,timeout,faxStationID,faxHeadline,clir);
 }
 
 /** @brief Switch a connection from voice mode to fax mode.
@@ -915,12 +1059,174 @@ capisuite_read_DTMF(PyObject *, PyObject *args)
 	return (result);
 }
 
+/** @brief Add a send queue to the job index of CapiSuite.
+    @ingroup python
+
+    The directory is read once, afterwards CapiSuite notices new, changed and removed
+    jobs (fax-<id>.txt) by itself. Calling it again for the same directory does nothing,
+    so the idle script can call it in each run.
+
+    @param args Contains the python parameter:
+    	- <b>dir (string)</b> the send queue
+    @return 1 if the directory is indexed, 0 if the index isn't available and the script has to read the queue itself
+*/
+static PyObject*
+capisuite_queue_watch(PyObject *, PyObject *args)
+{
+	char *dir;
+
+	if (!PyArg_ParseTuple(args,"s:queue_watch",&dir))
+		return NULL;
+
+	FaxQueue *queue=capisuiteInstance ? capisuiteInstance->getFaxQueue() : NULL;
+	int ret=(queue && queue->watch(dir)) ? 1 : 0;
+
+	PyObject* result=Py_BuildValue("i",ret);
+	return (result);
+}
+
+/** @brief Return the jobs of the indexed send queues which are due.
+    @ingroup python
+
+    A job returned here isn't returned again for idle_script_interval seconds unless its
+    description file is changed, so the script should write the new starttime to it or
+    move it away.
+
+    @return python list of the description file names (strings), the oldest job first
+*/
+static PyObject*
+capisuite_queue_due(PyObject *, PyObject *args)
+{
+	if (!PyArg_ParseTuple(args,":queue_due"))
+		return NULL;
+
+	list<string> jobs;
+	FaxQueue *queue=capisuiteInstance ? capisuiteInstance->getFaxQueue() : NULL;
+	if (queue)
+		jobs=queue->due();
+
+	PyObject *result=PyList_New(0); // new ref
+	if (!result)
+		return NULL;
+	for (list<string>::iterator i=jobs.begin();i!=jobs.end();i++) {
+		PyObject *name=PyString_FromString(i->c_str()); // new ref
+		if (!name || PyList_Append(result,name)) {
+			Py_XDECREF(name);
+			Py_DECREF(result);
+			return NULL;
+		}
+		Py_DECREF(name);
+	}
+	return (result);
+}
+
+
+/** @brief Send a job of the send queue in a thread of its own.
+    @ingroup python
+
+    The function sendjob() of the idle script is called in a new thread with its own
+    interpreter, so several jobs can be sent at the same time. It gets the Capi reference
+    and the given arguments:
+
+    def sendjob(capi, arg1, arg2, ...):
+
+    The job is only started if one of the controllers has a free B channel and the limits set with
+    send_max_per_controller and send_max_per_destination in capisuite.conf allow it. sendjob()
+    should give the same controllers to call_faxG3(), which chooses the least busy one.
+    Otherwise it's given to the idle script again as soon as a running job has finished
+    (if its send queue is indexed, see queue_watch()).
+
+    @param args Contains the python parameters. These are:
+	- <b>capi</b> reference to object of Capi to use (given to the idle function as parameter)
+	- <b>key (string)</b> identifies the job, e.g. the name of the description file. A job with the same key isn't started twice.
+    	- <b>controller (int or sequence of ints)</b> ISDN controller ID(s) the job may use, 0 for all controllers
+    	- <b>destination (string)</b> the number the job will call
+	- <b>arguments (tuple of strings)</b> arguments given to sendjob()
+    @return 1 if the job was started, 0 if it's running already or has to wait
+*/
+static PyObject*
+capisuite_send_start(PyObject *, PyObject *args)
+{
+	Capi *capi;
+	char *key, *destination;
+	PyObject *controller, *job_args;
+
+	if (!PyArg_ParseTuple(args,"O&sOsO!:send_start",convertCapiRef,&capi,&key,&controller,&destination,&PyTuple_Type,&job_args))
+		return NULL;
+
+	vector<unsigned> controllers;
+	if (!getControllers(capi,controller,controllers))
+		return NULL;
+
+	vector<string> arguments;
+	for (int i=0;i<PyTuple_Size(job_args);i++) {
+		PyObject *arg=PyTuple_GetItem(job_args,i); // borrowed ref
+		if (!PyString_Check(arg)) {
+			PyErr_SetString(PyExc_TypeError,"arguments must be strings");
+			return NULL;
+		}
+		arguments.push_back(PyString_AsString(arg));
+	}
+
+	SendPool *pool=capisuiteInstance ? capisuiteInstance->getSendPool() : NULL;
+	int ret=(pool && pool->start(key,controllers,destination,arguments)) ? 1 : 0;
+
+	PyObject* result=Py_BuildValue("i",ret);
+	return (result);
+}
+
+/** @brief Convert a received fax file from SFF to TIFF or PDF
+    @ingroup python
+
+    Converts all pages of the SFF file without calling external tools. The G3 data
+    of the lines is copied, not decoded (see FaxConverter), so this is much cheaper
+    than converting with sfftobmp, tiff2ps and ps2pdf. The python global lock is
+    released while the file is converted.
+
+    @param args Contains the python parameters. These are:
+	- <b>sff_file (string)</b> the received fax file
+	- <b>out_file (string)</b> the file to create, overwritten if it exists
+	- <b>format (string)</b> "pdf" or "tiff" (multi-page TIFF class F, G3 1D)
+    @return number of converted pages. IOError is raised if the conversion fails, out_file doesn't exist then.
+*/
+static PyObject*
+capisuite_fax_convert(PyObject *, PyObject *args)
+{
+	char *sff_file, *out_file, *format;
+	PyThreadState *_save;
+
+	if (!PyArg_ParseTuple(args,"sss:fax_convert",&sff_file,&out_file,&format))
+		return NULL;
+
+	string type(format);
+	if (type!="pdf" && type!="tiff") {
+		PyErr_SetString(PyExc_ValueError,"format must be pdf or tiff");
+		return NULL;
+	}
+
+	unsigned pages;
+	try {
+		Py_UNBLOCK_THREADS
+		FaxConverter converter(sff_file);
+		pages=(type=="pdf") ? converter.writePDF(out_file) : converter.writeTIFF(out_file);
+		Py_BLOCK_THREADS
+	}
+	catch (ApplicationError e) {
+		Py_BLOCK_THREADS
+		PyErr_SetString(PyExc_IOError,e.message().c_str());
+		return NULL;
+	}
+
+	PyObject* result=Py_BuildValue("i",pages);
+	return (result);
+}
 
 /** PCallControlMethods - array of functions in module capisuite
 */
 static PyMethodDef PCallControlMethods[] = {
         {"audio_receive", 	capisuite_audio_receive, 	METH_VARARGS, "Receive audio. For further details see capisuite module reference."},
         {"audio_send", 		capisuite_audio_send, 		METH_VARARGS, "Send audio. For further details see capisuite module reference."},
+        {"audio_send_list", 	capisuite_audio_send_list, 	METH_VARARGS, "Send several audio files without gaps. For further details see capisuite module reference."},
  	{"fax_receive",		capisuite_fax_receive, 		METH_VARARGS, "Receive fax. For further details see capisuite module reference."},
  	{"fax_send",		capisuite_fax_send, 		METH_VARARGS, "Send fax. For further details see capisuite module reference."},
 	{"disconnect", 		capisuite_disconnect, 		METH_VARARGS, "Disconnect call. For further details see capisuite module reference."},
@@ -935,6 +1241,10 @@ static PyMethodDef PCallControlMethods[] = {
 	{"read_DTMF",		capisuite_read_DTMF,		METH_VARARGS, "Read and clear received DTMF. For further details see capisuite module reference."},
 	{"log",			capisuite_log,			METH_VARARGS, "Write log message. For further details see capisuite module reference."},
 	{"error",		capisuite_error,		METH_VARARGS, "Write error message. For further details see capisuite module reference."},
+	{"queue_watch",		capisuite_queue_watch,		METH_VARARGS, "Add a send queue to the job index. For further details see capisuite module reference."},
+	{"queue_due",		capisuite_queue_due,		METH_VARARGS, "Return the due jobs of the indexed send queues. For further details see capisuite module reference."},
+	{"fax_convert",		capisuite_fax_convert,		METH_VARARGS, "Convert a fax file from SFF to TIFF or PDF. For further details see capisuite module reference."},
+	{"send_start",		capisuite_send_start,		METH_VARARGS, "Send a job in a thread of its own. For further details see capisuite module reference."},
         {NULL,NULL,0,NULL}
 };
 
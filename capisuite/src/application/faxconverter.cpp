@@ -0,0 +1,390 @@
+/*  @file faxconverter.cpp
+    @brief Contains FaxConverter - Converts received fax files from SFF to multi-page TIFF or PDF
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sstream>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+#include "faxconverter.h"
+
+/** @brief MH code, used for the white runs of empty lines
+*/
+struct mh_code_t {
+	unsigned short code; ///< the code, the first bit is the highest one
+	unsigned short length; ///< length in bits
+};
+
+/** @brief white terminating codes for runs of 0 to 63 pixels (T.4, table 2)
+*/
+static const mh_code_t white_terminating[64] = {
+	{0x035,8},{0x007,6},{0x007,4},{0x008,4},{0x00B,4},{0x00C,4},{0x00E,4},{0x00F,4},
+	{0x013,5},{0x014,5},{0x007,5},{0x008,5},{0x008,6},{0x003,6},{0x034,6},{0x035,6},
+	{0x02A,6},{0x02B,6},{0x027,7},{0x00C,7},{0x008,7},{0x017,7},{0x003,7},{0x004,7},
+	{0x028,7},{0x02B,7},{0x013,7},{0x024,7},{0x018,7},{0x002,8},{0x003,8},{0x01A,8},
+	{0x01B,8},{0x012,8},{0x013,8},{0x014,8},{0x015,8},{0x016,8},{0x017,8},{0x028,8},
+	{0x029,8},{0x02A,8},{0x02B,8},{0x02C,8},{0x02D,8},{0x004,8},{0x005,8},{0x00A,8},
+	{0x00B,8},{0x052,8},{0x053,8},{0x054,8},{0x055,8},{0x024,8},{0x025,8},{0x058,8},
+	{0x059,8},{0x05A,8},{0x05B,8},{0x04A,8},{0x04B,8},{0x032,8},{0x033,8},{0x034,8}
+};
+
+/** @brief white make-up codes for runs of 64 to 2560 pixels in steps of 64 (T.4, tables 3 and 4)
+*/
+static const mh_code_t white_makeup[40] = {
+	{0x01B,5},{0x012,5},{0x017,6},{0x037,7},{0x036,8},{0x037,8},{0x064,8},{0x065,8},
+	{0x068,8},{0x067,8},{0x0CC,9},{0x0CD,9},{0x0D2,9},{0x0D3,9},{0x0D4,9},{0x0D5,9},
+	{0x0D6,9},{0x0D7,9},{0x0D8,9},{0x0D9,9},{0x0DA,9},{0x0DB,9},{0x098,9},{0x099,9},
+	{0x09A,9},{0x018,6},{0x09B,9},{0x008,11},{0x00C,11},{0x00D,11},{0x012,12},{0x013,12},
+	{0x014,12},{0x015,12},{0x016,12},{0x017,12},{0x01C,12},{0x01D,12},{0x01E,12},{0x01F,12}
+};
+
+/** @brief EOL code with 4 fill bits in front, so it ends at a byte boundary
+*/
+static const char eol[2] = {0x00,0x01};
+
+/** @brief append a 16 bit value in little endian byte order
+*/
+static void
+put16(string &buffer, unsigned value)
+{
+	buffer+=static_cast<char>(value & 0xFF);
+	buffer+=static_cast<char>((value>>8) & 0xFF);
+}
+
+/** @brief append a 32 bit value in little endian byte order
+*/
+static void
+put32(string &buffer, unsigned long value)
+{
+	put16(buffer,value & 0xFFFF);
+	put16(buffer,(value>>16) & 0xFFFF);
+}
+
+/** @brief append a TIFF directory entry with one value
+
+    @param buffer the entry is appended here
+    @param tag the TIFF tag
+    @param type 3 (SHORT), 4 (LONG) or 5 (RATIONAL, value is the offset)
+    @param value the value
+*/
+static void
+putTIFFEntry(string &buffer, unsigned tag, unsigned type, unsigned long value)
+{
+	put16(buffer,tag);
+	put16(buffer,type);
+	put32(buffer,1);
+	if (type==3) {
+		put16(buffer,value);
+		put16(buffer,0);
+	} else
+		put32(buffer,value);
+}
+
+FaxConverter::FaxConverter(const string &sff_file) throw (ApplicationError)
+:sff(sff_file.c_str(),ios::in|ios::binary),sff_file(sff_file),document_end(false),white_width(0)
+{
+	if (!sff)
+		throw ApplicationError("can't open "+sff_file,"FaxConverter::FaxConverter()");
+
+	// document header: magic, version, reserved, user info, page count, offset of the first page header, ...
+	unsigned char header[20];
+	if (!sff.read(reinterpret_cast<char*>(header),sizeof(header)) || string(reinterpret_cast<char*>(header),4)!="Sfff" || header[4]!=1)
+		throw ApplicationError(sff_file+" isn't a SFF file","FaxConverter::FaxConverter()");
+	first_page=header[10] | (header[11]<<8);
+
+	for (unsigned i=0;i<256;i++) {
+		reversed[i]=0;
+		for (unsigned bit=0;bit<8;bit++)
+			if (i & (1<<bit))
+				reversed[i]|=0x80>>bit;
+	}
+}
+
+unsigned
+FaxConverter::writeTIFF(const string &filename) throw (ApplicationError)
+{
+	ofstream out(filename.c_str(),ios::out|ios::trunc|ios::binary);
+	if (!out)
+		throw ApplicationError("can't create "+filename,"FaxConverter::writeTIFF()");
+
+	unsigned pages=0;
+	try {
+		rewind();
+		string header("II*\0",4);
+		put32(header,0); // offset of the first IFD, set below
+		out.write(header.data(),header.size());
+
+		unsigned long link=4; // where the offset of the next IFD has to be written
+		page_t page;
+		while (readPage(page)) {
+			pages++;
+			unsigned long strip=static_cast<streamoff>(out.tellp());
+			out.write(page.data.data(),page.data.size());
+			if (page.data.size()%2)
+				out.put(0); // IFDs must start at a word boundary
+
+			const unsigned entries=16;
+			unsigned long ifd=strip+page.data.size()+page.data.size()%2,
+				resolutions=ifd+2+entries*12+4;
+			string dir;
+			put16(dir,entries);
+			putTIFFEntry(dir,254,4,2); // NewSubfileType: page of a multi-page document
+			putTIFFEntry(dir,256,4,page.width); // ImageWidth
+			putTIFFEntry(dir,257,4,page.height); // ImageLength
+			putTIFFEntry(dir,258,3,1); // BitsPerSample
+			putTIFFEntry(dir,259,3,3); // Compression: CCITT T.4
+			putTIFFEntry(dir,262,3,0); // PhotometricInterpretation: WhiteIsZero
+			putTIFFEntry(dir,266,3,1); // FillOrder: highest bit first
+			putTIFFEntry(dir,273,4,strip); // StripOffsets
+			putTIFFEntry(dir,277,3,1); // SamplesPerPixel
+			putTIFFEntry(dir,278,4,page.height); // RowsPerStrip
+			putTIFFEntry(dir,279,4,page.data.size()); // StripByteCounts
+			putTIFFEntry(dir,282,5,resolutions); // XResolution
+			putTIFFEntry(dir,283,5,resolutions+8); // YResolution
+			putTIFFEntry(dir,292,4,4); // T4Options: 1D coding, fill bits before EOL
+			putTIFFEntry(dir,296,3,2); // ResolutionUnit: inch
+			put16(dir,297); put16(dir,3); put32(dir,2); // PageNumber: page, total unknown
+			put16(dir,pages-1); put16(dir,0);
+			put32(dir,0); // no next IFD yet
+			put32(dir,page.x_resolution); put32(dir,1);
+			put32(dir,page.y_resolution); put32(dir,1);
+			out.write(dir.data(),dir.size());
+
+			// link the new IFD to the previous one
+			string offset;
+			put32(offset,ifd);
+			out.seekp(link);
+			out.write(offset.data(),offset.size());
+			out.seekp(0,ios::end);
+			link=ifd+2+entries*12;
+
+			if (!out)
+				throw ApplicationError("can't write "+filename,"FaxConverter::writeTIFF()");
+		}
+		if (!pages)
+			throw ApplicationError(sff_file+" contains no pages","FaxConverter::writeTIFF()");
+
+		out.close();
+		if (out.fail())
+			throw ApplicationError("can't write "+filename,"FaxConverter::writeTIFF()");
+	}
+	catch (ApplicationError) {
+		out.close();
+		unlink(filename.c_str());
+		throw;
+	}
+	return pages;
+}
+
+unsigned
+FaxConverter::writePDF(const string &filename) throw (ApplicationError)
+{
+	ofstream out(filename.c_str(),ios::out|ios::trunc|ios::binary);
+	if (!out)
+		throw ApplicationError("can't create "+filename,"FaxConverter::writePDF()");
+
+	unsigned pages=0;
+	try {
+		rewind();
+		out << "%PDF-1.3\n%\xE2\xE3\xCF\xD3\n";
+
+		// object 1 is the catalog, 2 the page tree, both written at the end
+		vector<unsigned long> offsets(3,0);
+		stringstream kids;
+		page_t page;
+		while (readPage(page)) {
+			pages++;
+			unsigned image=offsets.size();
+			double width=page.width*72.0/page.x_resolution, height=page.height*72.0/page.y_resolution; // in points
+
+			offsets.push_back(static_cast<streamoff>(out.tellp()));
+			out << image << " 0 obj\n<< /Type /XObject /Subtype /Image /Width " << page.width << " /Height " << page.height
+			  << " /ColorSpace /DeviceGray /BitsPerComponent 1 /Filter /CCITTFaxDecode /DecodeParms << /K 0 /Columns " << page.width
+			  << " /Rows " << page.height << " /EndOfLine true /EncodedByteAlign true >> /Length " << page.data.size() << " >>\nstream\n";
+			out.write(page.data.data(),page.data.size());
+			out << "\nendstream\nendobj\n";
+
+			stringstream content;
+			content << "q " << width << " 0 0 " << height << " 0 0 cm /Im0 Do Q\n";
+			offsets.push_back(static_cast<streamoff>(out.tellp()));
+			out << image+1 << " 0 obj\n<< /Length " << content.str().size() << " >>\nstream\n" << content.str() << "endstream\nendobj\n";
+
+			offsets.push_back(static_cast<streamoff>(out.tellp()));
+			out << image+2 << " 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 " << width << " " << height
+			  << "] /Resources << /XObject << /Im0 " << image << " 0 R >> >> /Contents " << image+1 << " 0 R >>\nendobj\n";
+			kids << image+2 << " 0 R ";
+
+			if (!out)
+				throw ApplicationError("can't write "+filename,"FaxConverter::writePDF()");
+		}
+		if (!pages)
+			throw ApplicationError(sff_file+" contains no pages","FaxConverter::writePDF()");
+
+		offsets[2]=static_cast<streamoff>(out.tellp());
+		out << "2 0 obj\n<< /Type /Pages /Kids [" << kids.str() << "] /Count " << pages << " >>\nendobj\n";
+		offsets[1]=static_cast<streamoff>(out.tellp());
+		out << "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n";
+
+		unsigned long xref=static_cast<streamoff>(out.tellp());
+		out << "xref\n0 " << offsets.size() << "\n0000000000 65535 f \n";
+		for (unsigned i=1;i<offsets.size();i++) {
+			char entry[21];
+			snprintf(entry,sizeof(entry),"%010lu 00000 n \n",offsets[i]);
+			out << entry;
+		}
+		out << "trailer\n<< /Size " << offsets.size() << " /Root 1 0 R >>\nstartxref\n" << xref << "\n%%EOF\n";
+
+		out.close();
+		if (out.fail())
+			throw ApplicationError("can't write "+filename,"FaxConverter::writePDF()");
+	}
+	catch (ApplicationError) {
+		out.close();
+		unlink(filename.c_str());
+		throw;
+	}
+	return pages;
+}
+
+bool
+FaxConverter::readPage(page_t &page) throw (ApplicationError)
+{
+	bool in_page=false;
+	page.height=0;
+	page.data.clear();
+
+	while (!document_end) {
+		int record=sff.peek();
+		if (record==EOF) { // the file of a broken call may end anywhere
+			document_end=true;
+			break;
+		}
+		if (record==254 && in_page) // header of the next page
+			return true;
+		sff.get();
+
+		if (record==254) { // page header
+			int length=sff.get();
+			unsigned char header[255];
+			if (length<=0 || !sff.read(reinterpret_cast<char*>(header),length) || length<6 || header[0]==255) {
+				document_end=true; // length 0 or vertical resolution 255 mark the end of the document
+				break;
+			}
+			if (header[2]!=0)
+				throw ApplicationError(sff_file+" uses an unsupported coding","FaxConverter::readPage()");
+			page.width=header[4] | (header[5]<<8);
+			page.x_resolution=header[1] ? 408 : 204;
+			page.y_resolution=header[0]==0 ? 98 : (header[0]==1 ? 196 : 391);
+			in_page=true;
+			last_line.clear();
+			continue;
+		}
+
+		if (!in_page)
+			throw ApplicationError(sff_file+" has no page header","FaxConverter::readPage()");
+
+		if (record<=216) { // one line of pixel data, record 0 has a 16 bit length
+			unsigned length=record;
+			if (!record) {
+				unsigned char l[2];
+				if (!sff.read(reinterpret_cast<char*>(l),2)) {
+					document_end=true;
+					break;
+				}
+				length=l[0] | (l[1]<<8);
+			}
+			string line(length,'\0');
+			if (!sff.read(&line[0],length)) {
+				document_end=true;
+				break;
+			}
+			addLine(page,line);
+		} else if (record<=253) { // white lines
+			for (int i=216;i<record;i++)
+				addWhiteLine(page);
+		} else { // 255: invalid line or user information
+			int length=sff.get();
+			if (length==0) { // the line wasn't received correctly, repeat the last one
+				if (last_line.empty())
+					addWhiteLine(page);
+				else {
+					page.data.append(eol,2);
+					page.data+=last_line;
+					page.height++;
+				}
+			} else if (length>0)
+				sff.ignore(length);
+		}
+	}
+	return in_page && page.height;
+}
+
+void
+FaxConverter::rewind()
+{
+	sff.clear();
+	sff.seekg(first_page);
+	document_end=false;
+	last_line.clear();
+}
+
+void
+FaxConverter::addLine(page_t &page, const string &line)
+{
+	last_line.resize(line.size());
+	for (unsigned i=0;i<line.size();i++)
+		last_line[i]=reversed[static_cast<unsigned char>(line[i])];
+	page.data.append(eol,2);
+	page.data+=last_line;
+	page.height++;
+}
+
+void
+FaxConverter::addWhiteLine(page_t &page)
+{
+	if (white_width!=page.width || white_line.empty()) {
+		white_line.clear();
+		unsigned bits=0, count=0, run=page.width;
+		for (;run>=2560;run-=2560) // longer runs are made of several make-up codes
+			putBits(white_line,bits,count,white_makeup[39].code,white_makeup[39].length);
+		if (run>=64)
+			putBits(white_line,bits,count,white_makeup[run/64-1].code,white_makeup[run/64-1].length);
+		putBits(white_line,bits,count,white_terminating[run%64].code,white_terminating[run%64].length);
+		if (count) // fill the last byte
+			putBits(white_line,bits,count,0,8-count);
+		white_width=page.width;
+	}
+	page.data.append(eol,2);
+	page.data+=white_line;
+	page.height++;
+}
+
+void
+FaxConverter::putBits(string &buffer, unsigned &bits, unsigned &count, unsigned code, unsigned length)
+{
+	bits=(bits<<length) | code;
+	count+=length;
+	while (count>=8) {
+		count-=8;
+		buffer+=static_cast<char>((bits>>count) & 0xFF);
+	}
+	bits&=(1<<count)-1;
+}
+
+/* History
+
+$Log$
+
+*/
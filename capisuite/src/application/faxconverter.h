@@ -0,0 +1,135 @@
+/** @file faxconverter.h
+    @brief Contains FaxConverter - Converts received fax files from SFF to multi-page TIFF or PDF
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef FAXCONVERTER_H
+#define FAXCONVERTER_H
+
+#include <fstream>
+#include <string>
+#include "applicationexception.h"
+
+using namespace std;
+
+/** @brief Converts received fax files from SFF to multi-page TIFF or PDF
+
+    The CAPI saves received faxes in the Structured Fax File format (SFF, see
+    annex B of the CAPI 2.0 spec). It holds each line of a page coded with modified
+    Huffman (MH, T.4 1D) in a record of its own, padded to full bytes, but without
+    EOL codes and with the bits of each byte in reversed order.
+
+    This is very close to what TIFF (compression 3, T4Options 4 = fill bits) and
+    PDF (CCITTFaxDecode with EncodedByteAlign) expect, so the lines are only copied:
+    each one gets an EOL code in front and its bits are reversed. Only records standing
+    for several white lines are replaced by real white lines. The G3 data isn't decoded
+    or coded again, so the conversion is cheap.
+
+    The pages are read one after the other and written as soon as they're complete,
+    so only one page is kept in memory. As the file of a broken call may end in the
+    middle of a page, the end of the file is taken as end of the document.
+
+    @author agent
+*/
+class FaxConverter
+{
+	public:
+		/** @brief Constructor. Open the SFF file and check its header.
+
+		    @param sff_file name of the SFF file
+		    @throw ApplicationError Thrown if the file can't be read or isn't a SFF file
+		*/
+		FaxConverter(const string &sff_file) throw (ApplicationError);
+
+		/** @brief Write all pages to a multi-page TIFF file (TIFF class F, G3 1D)
+
+		    @param filename name of the TIFF file, overwritten if it exists
+		    @return number of pages
+		    @throw ApplicationError Thrown if the SFF file is broken, contains no page or the TIFF file can't be written.
+		    The TIFF file is removed then.
+		*/
+		unsigned writeTIFF(const string &filename) throw (ApplicationError);
+
+		/** @brief Write all pages to a PDF file
+
+		    @param filename name of the PDF file, overwritten if it exists
+		    @return number of pages
+		    @throw ApplicationError Thrown if the SFF file is broken, contains no page or the PDF file can't be written.
+		    The PDF file is removed then.
+		*/
+		unsigned writePDF(const string &filename) throw (ApplicationError);
+
+	private:
+		/** @brief a page read from the SFF file
+		*/
+		struct page_t {
+			unsigned width; ///< pixels per line
+			unsigned height; ///< number of lines
+			unsigned x_resolution; ///< horizontal resolution in dpi
+			unsigned y_resolution; ///< vertical resolution in lpi
+			string data; ///< G3 data, each line starts with an EOL code which ends at a byte boundary
+		};
+
+		/** @brief Read the next page of the SFF file
+
+		    @param page the page is stored here
+		    @return true if a page was read, false at the end of the document
+		    @throw ApplicationError Thrown if the file isn't valid
+		*/
+		bool readPage(page_t &page) throw (ApplicationError);
+
+		/** @brief Start reading at the first page again
+		*/
+		void rewind();
+
+		/** @brief Append a line to the page
+
+		    @param page the page
+		    @param line MH coded line as read from the SFF file (reversed bit order)
+		*/
+		void addLine(page_t &page, const string &line);
+
+		/** @brief Append a white line to the page
+
+		    @param page the page
+		*/
+		void addWhiteLine(page_t &page);
+
+		/** @brief Append a MH code to a bit buffer
+
+		    @param buffer the bytes are appended here
+		    @param bits bits not yet appended to the buffer (lowest bits)
+		    @param count number of bits in bits
+		    @param code the code to append
+		    @param length length of the code in bits
+		*/
+		static void putBits(string &buffer, unsigned &bits, unsigned &count, unsigned code, unsigned length);
+
+		ifstream sff; ///< the SFF file
+		string sff_file; ///< name of the SFF file for error messages
+		streampos first_page; ///< position of the first page header
+		bool document_end; ///< set when the end of the document was read
+		string last_line; ///< last line added by addLine(), repeated for invalid lines
+		string white_line; ///< MH coded white line, cached for white_width
+		unsigned white_width; ///< width white_line was coded for
+		unsigned char reversed[256]; ///< table to reverse the bits of a byte
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
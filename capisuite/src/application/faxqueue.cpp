@@ -0,0 +1,312 @@
+/*  @file faxqueue.cpp
+    @brief Contains FaxQueue - Index of the fax jobs in the send queues, ordered by the time of their next try
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <fstream>
+#include <limits>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include "../backend/asynclog.h"
+#include "faxqueue.h"
+
+void* faxqueue_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no FaxQueue reference given in faxqueue_exec_handler" << endl;
+		exit(1);
+	}
+	FaxQueue *instance=static_cast<FaxQueue*>(arg);
+	instance->run();
+	return NULL;
+}
+
+FaxQueue::FaxQueue(ostream &debug, unsigned short debug_level, ostream &error, int retry_hold) throw (ApplicationError)
+:debug(debug),error(error),debug_level(debug_level),retry_hold(retry_hold),fd(-1),next_due(numeric_limits<time_t>::max()),updates(0),reported_due(0),reported_updates(0)
+{
+	fd=inotify_init();
+	if (fd==-1)
+		throw ApplicationError(string("can't create inotify instance: ")+strerror(errno),"FaxQueue::FaxQueue()");
+
+	pthread_mutex_init(&index_mutex, NULL);
+
+	if (pthread_create(&thread_handle, NULL, faxqueue_exec_handler, this)) {
+		close(fd);
+		pthread_mutex_destroy(&index_mutex);
+		throw ApplicationError("error while creating thread","FaxQueue::FaxQueue()");
+	}
+
+	if (debug_level>=3)
+		debug << prefix() << "FaxQueue created." << endl;
+}
+
+FaxQueue::~FaxQueue()
+{
+	pthread_cancel(thread_handle);
+	pthread_join(thread_handle,NULL);
+	close(fd); // removes all watches
+	pthread_mutex_destroy(&index_mutex);
+}
+
+bool
+FaxQueue::watch(string dir)
+{
+	while (dir.size()>1 && dir[dir.size()-1]=='/')
+		dir.erase(dir.size()-1);
+
+	pthread_mutex_lock(&index_mutex);
+	for (map<int,string>::iterator i=dirs.begin();i!=dirs.end();i++)
+		if (i->second==dir) {
+			pthread_mutex_unlock(&index_mutex);
+			return true;
+		}
+
+	int wd=inotify_add_watch(fd,dir.c_str(),IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE|IN_ONLYDIR);
+	if (wd==-1) {
+		pthread_mutex_unlock(&index_mutex);
+		error << prefix() << "WARNING: can't watch " << dir << ": " << strerror(errno) << endl;
+		return false;
+	}
+	if (!dirs.count(wd)) { // the same directory may be known by another name
+		dirs[wd]=dir;
+		scan(dir);
+		updateNextDue();
+	}
+	pthread_mutex_unlock(&index_mutex);
+	return true;
+}
+
+bool
+FaxQueue::update(const string &filename)
+{
+	string::size_type pos=filename.rfind('/');
+	if (pos==string::npos || !isJob(filename.substr(pos+1)))
+		return false;
+	string dir=filename.substr(0,pos);
+
+	bool ret=false;
+	pthread_mutex_lock(&index_mutex);
+	for (map<int,string>::iterator i=dirs.begin();i!=dirs.end();i++)
+		if (i->second==dir) {
+			ret=read(filename);
+			if (ret)
+				updates++;
+			updateNextDue();
+			break;
+		}
+	pthread_mutex_unlock(&index_mutex);
+	return ret;
+}
+
+list<string>
+FaxQueue::due()
+{
+	list<string> result;
+	time_t now=time(NULL);
+
+	pthread_mutex_lock(&index_mutex);
+	while (!schedule.empty() && schedule.begin()->first<=now) {
+		string filename=schedule.begin()->second;
+		schedule.erase(schedule.begin());
+		// hold the job back until the script has changed it or the time is over
+		jobs[filename]=now+retry_hold;
+		schedule.insert(make_pair(now+retry_hold,filename));
+		result.push_back(filename);
+	}
+	updateNextDue();
+	size_t queued=jobs.size();
+	pthread_mutex_unlock(&index_mutex);
+
+	if (debug_level>=3)
+		debug << prefix() << dec << result.size() << " jobs due, " << queued << " jobs queued" << endl;
+	return result;
+}
+
+void
+FaxQueue::run()
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(inotify_event))));
+	while (1) {
+		ssize_t len=::read(fd,buffer,sizeof(buffer)); // cancellation point
+		if (len<=0) {
+			if (len==-1 && errno!=EINTR) {
+				error << prefix() << "WARNING: can't read inotify events: " << strerror(errno) << endl;
+				sleep(1); // don't spin if the error persists
+			}
+			continue;
+		}
+
+		int oldstate;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,&oldstate); // don't leave index_mutex locked if we're cancelled now
+		pthread_mutex_lock(&index_mutex);
+		for (char *p=buffer;p<buffer+len;p+=sizeof(inotify_event)+reinterpret_cast<inotify_event*>(p)->len) {
+			inotify_event *event=reinterpret_cast<inotify_event*>(p);
+
+			if (event->mask & IN_Q_OVERFLOW) { // we've lost events, so start again
+				error << prefix() << "WARNING: inotify queue overflow, reading all send queues again" << endl;
+				jobs.clear();
+				schedule.clear();
+				for (map<int,string>::iterator i=dirs.begin();i!=dirs.end();i++)
+					scan(i->second);
+				continue;
+			}
+
+			map<int,string>::iterator dir=dirs.find(event->wd);
+			if (dir==dirs.end())
+				continue;
+
+			if (event->mask & IN_IGNORED) { // directory was removed, watch() may add it again
+				if (debug_level>=1)
+					debug << prefix() << "send queue " << dir->second << " was removed" << endl;
+				string start=dir->second+"/";
+				map<string,time_t>::iterator i=jobs.lower_bound(start);
+				while (i!=jobs.end() && !i->first.compare(0,start.size(),start))
+					remove((i++)->first);
+				dirs.erase(dir);
+				continue;
+			}
+
+			if (!event->len || !isJob(event->name))
+				continue;
+			string filename=dir->second+"/"+event->name;
+			if (event->mask & (IN_CLOSE_WRITE|IN_MOVED_TO))
+				read(filename);
+			else if (event->mask & (IN_DELETE|IN_MOVED_FROM))
+				remove(filename);
+		}
+		updateNextDue();
+		pthread_mutex_unlock(&index_mutex);
+		pthread_setcancelstate(oldstate,NULL);
+	}
+}
+
+void
+FaxQueue::scan(const string &dir)
+{
+	DIR *d=opendir(dir.c_str());
+	if (!d) {
+		error << prefix() << "WARNING: can't read " << dir << ": " << strerror(errno) << endl;
+		return;
+	}
+	unsigned count=0;
+	dirent *entry;
+	while ((entry=readdir(d)))
+		if (isJob(entry->d_name) && read(dir+"/"+entry->d_name))
+			count++;
+	closedir(d);
+
+	if (debug_level>=2)
+		debug << prefix() << dec << count << " jobs found in " << dir << endl;
+}
+
+bool
+FaxQueue::read(const string &filename)
+{
+	ifstream file(filename.c_str());
+	if (!file) {
+		remove(filename);
+		return false;
+	}
+
+	// jobs without valid starttime are due at once, the script will complain about them
+	time_t starttime=0;
+	string line;
+	while (getline(file,line)) {
+		if (line.compare(0,9,"starttime"))
+			continue;
+		string::size_type start=line.find('=');
+		if (start==string::npos)
+			continue;
+		start=line.find_first_not_of(" \t\"",start+1);
+		string::size_type end=line.find_last_not_of(" \t\"\r");
+		if (start==string::npos || end<start)
+			continue;
+
+		// written by time.ctime() in the scripts
+		tm t;
+		memset(&t,0,sizeof(t));
+		if (strptime(line.substr(start,end-start+1).c_str(),"%a %b %d %H:%M:%S %Y",&t)) {
+			t.tm_isdst=-1; // unknown, let mktime() find out
+			starttime=mktime(&t);
+		}
+		break;
+	}
+
+	map<string,time_t>::iterator i=jobs.find(filename);
+	if (i!=jobs.end()) {
+		schedule.erase(make_pair(i->second,filename));
+		i->second=starttime;
+	} else
+		jobs[filename]=starttime;
+	schedule.insert(make_pair(starttime,filename));
+
+	if (debug_level>=3)
+		debug << prefix() << "job " << filename << " is due at " << dec << starttime << endl;
+	return true;
+}
+
+void
+FaxQueue::remove(const string &filename)
+{
+	map<string,time_t>::iterator i=jobs.find(filename);
+	if (i==jobs.end())
+		return;
+	schedule.erase(make_pair(i->second,filename));
+	jobs.erase(i);
+
+	if (debug_level>=3)
+		debug << prefix() << "job " << filename << " removed" << endl;
+}
+
+bool
+FaxQueue::isDue()
+{
+	// read only once, they're changed by other threads
+	unsigned current_updates=updates;
+	time_t due=next_due;
+	if (due>time(NULL) || (due==reported_due && current_updates==reported_updates))
+		return false;
+	reported_due=due;
+	reported_updates=current_updates;
+	return true;
+}
+
+void
+FaxQueue::updateNextDue()
+{
+	next_due=schedule.empty() ? numeric_limits<time_t>::max() : schedule.begin()->first;
+}
+
+bool
+FaxQueue::isJob(const string &name)
+{
+	return name.size()>=9 && !name.compare(0,4,"fax-") && !name.compare(name.size()-4,4,".txt")
+	  && name.find_first_not_of("0123456789",4)==name.size()-4;
+}
+
+string
+FaxQueue::prefix()
+{
+	return AsyncLog::prefix("FaxQueue",this);
+}
+
+/* History
+
+$Log$
+
+*/
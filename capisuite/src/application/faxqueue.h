@@ -0,0 +1,184 @@
+/** @file faxqueue.h
+    @brief Contains FaxQueue - Index of the fax jobs in the send queues, ordered by the time of their next try
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef FAXQUEUE_H
+#define FAXQUEUE_H
+
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <map>
+#include <set>
+#include <list>
+#include "../../config.h"
+#ifdef HAVE_OSTREAM
+  #include <ostream>
+#else
+  #include <ostream.h>
+#endif
+#include "applicationexception.h"
+
+using namespace std;
+
+/** @brief Thread exec handler for FaxQueue class
+
+    This is a handler which will call run() of the given FaxQueue for the use in pthread_create().
+*/
+void* faxqueue_exec_handler(void* arg);
+
+/** @brief Index of the fax jobs in the send queues, ordered by the time of their next try
+
+    Without the index, the idle script lists all send queues and reads all job
+    descriptions in each run only to find the few jobs which are due.
+
+    The idle script registers the send queues with watch() (capisuite.queue_watch()).
+    Each queue is read once, afterwards a thread keeps the index up to date
+    using inotify: a description file (fax-<id>.txt) which is written or moved into
+    the queue is read again, one which is deleted or moved away is removed.
+
+    The jobs are kept in a set ordered by their starttime. As soon as the first one
+    is due, isDue() returns true and the IdleScript starts the script, which gets the
+    due jobs from due() (capisuite.queue_due()) and sends them as before.
+    isDue() returns true only once for each starttime of the first job. So if the
+    script doesn't call due() (e.g. because it returns early or fails), it isn't
+    started over and over, the jobs are sent in its next regular run. A job given
+    to update() is reported again, even if the starttime didn't change, as
+    update() is used when a job can be sent now (e.g. a channel became free).
+
+    A job returned by due() isn't returned again for retry_hold seconds, so a job
+    which the script doesn't touch (e.g. because it's invalid) doesn't start the
+    script over and over. When the script writes the new starttime into the
+    description or moves the job away, the index is updated by inotify anyway.
+
+    @author agent
+*/
+class FaxQueue
+{
+	friend void* faxqueue_exec_handler(void*);
+
+	public:
+		/** @brief Constructor. Create the inotify instance and start the thread reading its events.
+
+		    @param debug stream for debugging info
+		    @param debug_level verbosity level for debug messages
+		    @param error stream for error messages
+		    @param retry_hold time in seconds before a job returned by due() is returned again
+		    @throw ApplicationError Thrown if inotify isn't available or the thread can't be started
+		*/
+		FaxQueue(ostream &debug, unsigned short debug_level, ostream &error, int retry_hold) throw (ApplicationError);
+
+		/** @brief Destructor. Stop the thread and remove all watches.
+		*/
+		~FaxQueue();
+
+		/** @brief Add a send queue to the index
+
+		    Nothing happens if the directory is already indexed.
+
+		    @param dir name of the directory, a trailing slash is ignored
+		    @return true if the directory is indexed, false if it can't be watched
+		*/
+		bool watch(string dir);
+
+		/** @brief Read a job description again
+
+		    Used if a job is known to be changed before inotify tells us, e.g. by SubmitServer.
+
+		    @param filename name of the description file
+		    @return true if the job is in the index now, false if its directory isn't indexed or the file doesn't exist
+		*/
+		bool update(const string &filename);
+
+		/** @brief Return the jobs whose starttime has passed, the oldest first
+
+		    @return names of the description files
+		*/
+		list<string> due();
+
+		/** @brief Check if a job is due without locking the index
+
+		    Called by IdleScript each 100 msecs, only from this thread.
+
+		    @return true if there's a job whose starttime has passed and true wasn't returned
+		    for this starttime since the last call of update()
+		*/
+		bool isDue();
+
+	private:
+		/** @brief Thread body. Read the inotify events and update the index.
+		*/
+		void run();
+
+		/** @brief Read all jobs of a directory, index_mutex must be held
+
+		    @param dir name of the directory without trailing slash
+		*/
+		void scan(const string &dir);
+
+		/** @brief Read one job description and put it into the index, index_mutex must be held
+
+		    @param filename name of the description file
+		    @return false if the file doesn't exist, it's removed from the index then
+		*/
+		bool read(const string &filename);
+
+		/** @brief Remove a job from the index, index_mutex must be held
+
+		    @param filename name of the description file
+		*/
+		void remove(const string &filename);
+
+		/** @brief Set next_due to the starttime of the first job, index_mutex must be held
+		*/
+		void updateNextDue();
+
+		/** @brief Check if a file name is the name of a job description (fax-<id>.txt)
+
+		    @param name file name without directory
+		*/
+		static bool isJob(const string &name);
+
+		/** @brief return a prefix containing this pointer and date for log messages
+
+		    @return constructed prefix as stringstream
+		*/
+		string prefix();
+
+		ostream &debug, ///< debug stream
+			&error; ///< stream for error messages
+		unsigned short debug_level; ///< debug level
+		int retry_hold; ///< time in seconds before a job returned by due() is returned again
+		int fd; ///< file descriptor of the inotify instance
+
+		map<int,string> dirs; ///< indexed directories by their watch descriptor
+		map<string,time_t> jobs; ///< starttime of each job by the name of its description file
+		set<pair<time_t,string> > schedule; ///< all jobs ordered by their starttime
+		volatile time_t next_due; ///< starttime of the first job in schedule, a time far in the future if there's none
+		volatile unsigned updates; ///< number of jobs read by update()
+		time_t reported_due; ///< next_due when isDue() returned true the last time
+		unsigned reported_updates; ///< updates when isDue() returned true the last time
+		pthread_mutex_t index_mutex; ///< protects dirs, jobs, schedule, next_due and updates
+
+		pthread_t thread_handle; ///< handle for the created pthread thread
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -16,7 +16,9 @@
 
 #include <Python.h>
 #include "idlescript.h"
+#include "faxqueue.h"
 #include "capisuitemodule.h"
+#include "../backend/metrics.h"
 
 void* idlescript_exec_handler(void* arg)
 {
@@ -40,8 +42,8 @@ void idlescript_cleanup_handler(void* arg)
 	instance->final();
 }
 
-IdleScript::IdleScript(ostream &debug, unsigned short debug_level, ostream &error, Capi *capi, string idlescript, int idlescript_interval, PyThreadState *py_state, PycStringIO_CAPI* cStringIO) throw (ApplicationError)
-:PythonScript(debug,debug_level,error,idlescript,"idle",cStringIO),idlescript_interval(idlescript_interval),py_state(py_state),capi(capi),active(true)
+IdleScript::IdleScript(ostream &debug, unsigned short debug_level, ostream &error, Capi *capi, string idlescript, int idlescript_interval, PyThreadState *py_state, PycStringIO_CAPI* cStringIO, FaxQueue *queue) throw (ApplicationError)
+:PythonScript(debug,debug_level,error,idlescript,"idle",cStringIO),idlescript_interval(idlescript_interval),py_state(py_state),capi(capi),active(true),triggered(false),queue(queue)
 {
         pthread_attr_t attr;
         pthread_attr_init(&attr);
@@ -70,13 +72,16 @@ IdleScript::run() throw()
 		pthread_testcancel(); // cancellation point
 		nanosleep(&delay_time,NULL);
 		count++;
-		if (active && (count>=idlescript_interval*10)) {
+		if (active && (count>=idlescript_interval*10 || triggered || (queue && queue->isDue()))) {
 			count=0;
+			triggered=false;
 			PyObject *capi_ref=NULL;
+			long long start=Metrics::now(), script_start=0;
 			try {
 				if (debug_level>=3)
 					debug << prefix() << "executing idlescript..." << endl;
 				PyEval_RestoreThread(py_state); // acquire lock, switch to right thread context
+				Metrics::observe(Metrics::WAIT_IDLE,Metrics::now()-start);
 
 				capisuitemodule_init();
 
@@ -88,7 +93,10 @@ IdleScript::run() throw()
 				if (!args)
 					throw ApplicationError("can't build arguments","IdleScript::run()");
 
+				script_start=Metrics::now();
 				PythonScript::run();
+				Metrics::observe(Metrics::SCRIPT_IDLE,Metrics::now()-script_start);
+				script_start=0; // don't count it again if cleaning up fails
 
 				Py_DECREF(args);
 				args=NULL;
@@ -104,6 +112,9 @@ IdleScript::run() throw()
 			}
 			catch (ApplicationError e) {
 				errorcount++;
+				Metrics::count(Metrics::SCRIPT_ERRORS);
+				if (script_start)
+					Metrics::observe(Metrics::SCRIPT_IDLE,Metrics::now()-script_start);
 				error << prefix() << "IdleScript " << this << " Error occured. " << endl;
 				error << prefix() << "message was: " << e << endl;
 				if (errorcount>9) {
@@ -134,6 +145,12 @@ IdleScript::activate()
 	active=true;
 }
 
+void
+IdleScript::trigger()
+{
+	triggered=true;
+}
+
 /* History
 
 $Log: idlescript.cpp,v $
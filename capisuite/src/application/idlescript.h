@@ -22,6 +22,7 @@
 #include "pythonscript.h"
 
 class Capi;
+class FaxQueue;
 class PycStringIO_CAPI;
 
 /** @brief Thread exec handler for IdleScript class
@@ -66,9 +67,10 @@ class IdleScript: public PythonScript
 		    @param idlescript_interval interval between two subsequent calls to the idle script in seconds
 		    @param py_state thread state of the main python interpreter which must be initialized an Py_SaveThread()'d before.
 		    @param cStringIO pointer to the Python cStringIO C API
+		    @param queue index of the fax jobs, the script is also run as soon as a job is due (see FaxQueue::isDue()), may be NULL
 		    @throw ApplicationError Thrown if thread can't be started
 		*/
-		IdleScript(ostream &debug, unsigned short debug_level, ostream &error, Capi *capi, string idlescript, int idlescript_interval, PyThreadState *py_state, PycStringIO_CAPI* cStringIO) throw (ApplicationError);
+		IdleScript(ostream &debug, unsigned short debug_level, ostream &error, Capi *capi, string idlescript, int idlescript_interval, PyThreadState *py_state, PycStringIO_CAPI* cStringIO, FaxQueue *queue=NULL) throw (ApplicationError);
 
 		/** @brief Destructor. Destruct object.
 		*/
@@ -82,6 +84,14 @@ class IdleScript: public PythonScript
 		*/
 		void activate(void);
 
+		/** @brief run the script as soon as possible instead of waiting for the end of the interval
+
+		    Used when a new job was submitted. If the script is running at the moment, it's
+		    started again after it has finished. Several calls before the script runs lead
+		    to one run only.
+		*/
+		void trigger(void);
+
 	private:
 		/** @brief Thread body. Calls the python function idle().
 
@@ -109,6 +119,8 @@ class IdleScript: public PythonScript
 		int idlescript_interval; ///< interval between subsequent executions of idle script
 		Capi *capi; ///< reference to Capi object
 		bool active; ///< used to disable IdleScript in case of too much errors
+		volatile bool triggered; ///< set by trigger() to run the script before the interval is over
+		FaxQueue *queue; ///< index of the fax jobs, NULL if not available
 		
 		pthread_t thread_handle; ///< handle for the created pthread thread
 };
@@ -16,43 +16,16 @@
 
 #include <Python.h>
 #include "incomingscript.h"
+#include "interpreterpool.h"
 #include "../modules/disconnectmodule.h"
 #include "capisuitemodule.h"
+#include "../backend/metrics.h"
 
 #define TEMPORARY_FAILURE 0x34A9    // see ETS 300 102-1, Table 4.13 (cause information element)
        
-void* incomingscript_exec_handler(void* arg)
+IncomingScript::IncomingScript(ostream &debug, unsigned short debug_level, ostream &error, Connection *conn, string incoming_script, PycStringIO_CAPI* cStringIO, InterpreterPool *pool)
+:PythonScript(debug,debug_level,error,incoming_script,"callIncoming",cStringIO),conn(conn),pool(pool)
 {
-	if (!arg) {
-                cerr << "FATAL ERROR: no IncomingScript reference given in incomingscript_exec_handler" << endl;
-		exit(1);
-	}
-	pthread_cleanup_push(incomingscript_cleanup_handler,arg);
-	IncomingScript *instance=static_cast<IncomingScript*>(arg);
-	instance->run();
-	pthread_cleanup_pop(1); // run the cleanup_handler and then deregister it
-}
-
-void incomingscript_cleanup_handler(void* arg)
-{
-	if (!arg) {
-                cerr << "FATAL ERROR: no IncomingScript reference given in incomingscript_exec_handler" << endl;
-		exit(1);
-	}
-	IncomingScript *instance=static_cast<IncomingScript*>(arg);
-	instance->final();
-}
-
-IncomingScript::IncomingScript(ostream &debug, unsigned short debug_level, ostream &error, Connection *conn, string incoming_script, PycStringIO_CAPI* cStringIO) throw (ApplicationError)
-:PythonScript(debug,debug_level,error,incoming_script,"callIncoming",cStringIO),conn(conn)
-{
-        pthread_attr_t attr;
-        pthread_attr_init(&attr);
-        pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
-        int ret=pthread_create(&thread_handle, &attr, incomingscript_exec_handler, this);   // start thread as detached
-	if (ret)
-		throw ApplicationError("error while creating thread","PythonScript::PythonScript()");
-
 	if (debug_level>=2)
 		debug << prefix() << "Connection " << conn << " created IncomingScript" << endl;
 }
@@ -79,22 +52,28 @@ IncomingScript::run() throw()
 {
 	PyObject *conn_ref=NULL;
 	PyThreadState *py_state=NULL;
+	bool pooled=false;
+	long long start=Metrics::now(), script_start=0;
 
 	try {
 		// thread safe Python init, taken out of PyApache 4.26
 		PyEval_AcquireLock();
 
-		if (!(py_state=Py_NewInterpreter() )) {
+		if (pool && (py_state=pool->get()) )
+			pooled=true;
+		else if (!(py_state=Py_NewInterpreter() )) {
 			PyEval_ReleaseLock();
 			capisuitemodule_destruct_connection(conn);
+			conn=NULL;
 			throw ApplicationError("error while creating new python interpreter","IncomingScript::run()");
-		}
-
-		capisuitemodule_init();
+		} else
+			capisuitemodule_init();
+		Metrics::observe(Metrics::WAIT_INCOMING,Metrics::now()-start);
 
 		conn_ref=PyCObject_FromVoidPtr(conn,capisuitemodule_destruct_connection); // new ref
 		if (!conn_ref) {
 			capisuitemodule_destruct_connection(conn);
+			conn=NULL;
 			throw ApplicationError("unable to create CObject from Connection reference","IncomingScript::run()");
 		}
 
@@ -102,7 +81,13 @@ IncomingScript::run() throw()
 		if (!args)
 			throw ApplicationError("error during argument building","IncomingScript::run()");
 
-		PythonScript::run();
+		script_start=Metrics::now();
+		if (pooled)
+			PythonScript::call(); // script was already read by the pool
+		else
+			PythonScript::run();
+		Metrics::observe(Metrics::SCRIPT_INCOMING,Metrics::now()-script_start);
+		script_start=0; // don't count it again if cleaning up fails
 
 		Py_DECREF(args);
 		args=NULL;
@@ -111,12 +96,18 @@ IncomingScript::run() throw()
 		conn_ref=NULL;
 		conn=NULL; // Connection object will be deleted by Python destruction handler...
 
-		Py_EndInterpreter(py_state);
+		if (pooled)
+			pool->put(py_state);
+		else
+			Py_EndInterpreter(py_state);
 		py_state=NULL;
 		PyEval_ReleaseLock(); // release lock
 	}
 	catch(ApplicationError e) {
 		error << prefix() << "Error occured. message was: " << e << endl;
+		Metrics::count(Metrics::SCRIPT_ERRORS);
+		if (script_start)
+			Metrics::observe(Metrics::SCRIPT_INCOMING,Metrics::now()-script_start);
 
 		if (args)
 			Py_DECREF(args);
@@ -125,7 +116,10 @@ IncomingScript::run() throw()
 			conn=NULL;
 		}
 		if (py_state) {
-			Py_EndInterpreter(py_state);
+			if (pooled)
+				pool->put(py_state);
+			else
+				Py_EndInterpreter(py_state);
 			py_state=NULL;
 			PyEval_ReleaseLock();
 		}
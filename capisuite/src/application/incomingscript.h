@@ -22,37 +22,24 @@
 
 class Connection;
 class PycStringIO_CAPI;
-
-/** @brief Thread exec handler for IncomingScript class
-
-    This is a handler which will call this->run() for the use in pthread_create().
-    It will also register incomingscript_cleanup_handler
-*/
-void* incomingscript_exec_handler(void* arg);
-
-/** @brief Thread clean handler for IncomingScript class
-
-    This is a handler which is called by pthreads at cleanup.
-    It will call this->final().
-*/
-void incomingscript_cleanup_handler(void* arg);
+class InterpreterPool;
 
 /** @brief Incoming call handling. One object for each incoming call is created.
 
     IncomingScript handels an incoming connection. For each connection, one object
-    of it is created by FlowControl. It mainly creates a new thread with an own
-    python subinterpreter, initializes the capisuitemodule, and calls run() of
-    PythonScript which will execute the defined function in the script.
+    of it is created by a thread of the WorkerPool which then calls run(). It mainly
+    creates an own python subinterpreter, initializes the capisuitemodule, and calls
+    run() of PythonScript which will execute the defined function in the script.
+
+    If an InterpreterPool is given, an interpreter which has already read the
+    script is taken from it instead, so only the function must be called.
 
     @author Gernot Hillier
 */
 class IncomingScript: public PythonScript
 {
-	friend void* incomingscript_exec_handler(void*);
-	friend void incomingscript_cleanup_handler(void*);
-
 	public:
-		/** @brief Constructor. Create Object and start detached thread
+		/** @brief Constructor. Create Object
 
 		    @param debug stream for debugging info
 		    @param debug_level verbosity level for debug messages
@@ -60,16 +47,15 @@ class IncomingScript: public PythonScript
 		    @param conn reference to according connection (disconnected if error occurs)
 		    @param incoming_script file name of the python script to use as incoming script
 		    @param cStringIO pointer to the Python cStringIO C API
-		    @throw ApplicationError Thrown if thread can't be started
+		    @param pool pool of interpreters which have read incoming_script, NULL=always create a new interpreter
 		*/
-		IncomingScript(ostream &debug, unsigned short debug_level, ostream &error, Connection *conn, string incoming_script, PycStringIO_CAPI* cStringIO) throw (ApplicationError);
+		IncomingScript(ostream &debug, unsigned short debug_level, ostream &error, Connection *conn, string incoming_script, PycStringIO_CAPI* cStringIO, InterpreterPool *pool=NULL);
 
 		/** @brief Destructor. Destruct object and assure the call is disconnected.
 		*/
 		virtual ~IncomingScript();
 
-	private:
-		/** @brief Thread body. Calls the python function callIncoming() which will handle the call.
+		/** @brief Calls the python function callIncoming() which will handle the call.
 
 		    Create python sub-interpreter, read script for incoming calls,
 
@@ -95,9 +81,11 @@ class IncomingScript: public PythonScript
     		*/
     		virtual void run(void) throw();
 
+	private:
+
 		Connection *conn; ///< reference to according connection object      
-		
-		pthread_t thread_handle; ///< handle for the created pthread thread
+
+		InterpreterPool *pool; ///< pool of prepared interpreters, may be NULL
 };
 
 #endif
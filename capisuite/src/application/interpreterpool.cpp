@@ -0,0 +1,184 @@
+/*  @file interpreterpool.cpp
+    @brief Contains InterpreterPool - Pool of Python sub-interpreters which have already read a script
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sstream>
+#include "interpreterpool.h"
+#include "../backend/asynclog.h"
+#include "pythonscript.h"
+#include "capisuitemodule.h"
+
+InterpreterPool::InterpreterPool(ostream &debug, unsigned short debug_level, ostream &error, string filename, unsigned size)
+:interpreters(),filename(filename),idle(),debug(debug),error(error),debug_level(debug_level)
+{
+	PyThreadState *saved_state=PyThreadState_Get();
+
+	for (unsigned i=0;i<size;i++) {
+		PyThreadState *state=Py_NewInterpreter();
+		if (!state) {
+			error << prefix() << "ERROR: can't create python interpreter for the pool" << endl;
+			break;
+		}
+
+		capisuitemodule_init();
+
+		interpreter_t entry;
+		entry.snapshot=NULL;
+		entry.generation=0;
+		PyObject *main_dict=PyModule_GetDict(PyImport_AddModule("__main__")); // borrowed ref
+		if (!(entry.pristine=PyDict_Copy(main_dict))) { // new ref
+			error << prefix() << "ERROR: unable to copy __main__ dictionary" << endl;
+			PyErr_Clear();
+			Py_EndInterpreter(state);
+			PyThreadState_Swap(saved_state);
+			break;
+		}
+
+		try {
+			loadScript(entry);
+		}
+		catch (ApplicationError e) {
+			error << prefix() << "ERROR: can't prepare python interpreter for the pool, message was: " << e << endl;
+			PyErr_Clear();
+			Py_DECREF(entry.pristine);
+			Py_EndInterpreter(state);
+			PyThreadState_Swap(saved_state);
+			break;
+		}
+
+		interpreters[state->interp]=entry;
+		idle.push_back(state->interp);
+
+		// the interpreter stays alive without any thread state, get() creates a new one for the calling thread
+		PyThreadState_Clear(state);
+		PyThreadState_Swap(saved_state);
+		PyThreadState_Delete(state);
+	}
+
+	if (debug_level>=1)
+		debug << prefix() << "created pool of " << dec << idle.size() << " python interpreters for " << filename << endl;
+}
+
+InterpreterPool::~InterpreterPool()
+{
+	PyThreadState *saved_state=PyThreadState_Get();
+
+	if (idle.size()!=interpreters.size())
+		error << prefix() << "Warning: " << dec << interpreters.size()-idle.size() << " python interpreters still in use while destroying the pool" << endl;
+
+	for (unsigned i=0;i<idle.size();i++) {
+		PyThreadState *state=PyThreadState_New(idle[i]);
+		PyThreadState_Swap(state);
+		interpreter_t &entry=interpreters[idle[i]];
+		Py_DECREF(entry.pristine);
+		Py_XDECREF(entry.snapshot);
+		Py_EndInterpreter(state);
+	}
+	PyThreadState_Swap(saved_state);
+}
+
+PyThreadState*
+InterpreterPool::get()
+{
+	if (idle.empty())
+		return NULL;
+
+	PyInterpreterState *interp=idle.back();
+	idle.pop_back();
+
+	PyThreadState *state=PyThreadState_New(interp);
+	PyThreadState_Swap(state);
+
+	interpreter_t &entry=interpreters[interp];
+	try {
+		unsigned long generation;
+		PythonScript::getCode(filename,generation);
+		if (generation!=entry.generation) {
+			if (debug_level>=2)
+				debug << prefix() << filename << " has changed, reading it again" << endl;
+			loadScript(entry);
+		}
+	}
+	catch (ApplicationError e) {
+		error << prefix() << "ERROR: can't read changed script into pooled interpreter, message was: " << e << endl;
+		PyErr_Clear();
+		entry.generation=0; // try again next time
+		PyThreadState_Clear(state);
+		PyThreadState_Swap(NULL);
+		PyThreadState_Delete(state);
+		idle.push_back(interp);
+		return NULL;
+	}
+	return state;
+}
+
+void
+InterpreterPool::put(PyThreadState *state)
+{
+	PyInterpreterState *interp=state->interp;
+	interpreter_t &entry=interpreters[interp];
+
+	// reset the global variables to the state after reading the script
+	PyObject *main_dict=PyModule_GetDict(PyImport_AddModule("__main__")); // borrowed ref
+	PyDict_Clear(main_dict);
+	if (PyDict_Update(main_dict,entry.snapshot)!=0) {
+		error << prefix() << "ERROR: can't reset __main__ of pooled python interpreter, removing it from the pool" << endl;
+		PyErr_Clear();
+		Py_DECREF(entry.pristine);
+		Py_XDECREF(entry.snapshot);
+		interpreters.erase(interp);
+		Py_EndInterpreter(state);
+		return;
+	}
+	PyErr_Clear();
+
+	PyThreadState_Clear(state);
+	PyThreadState_Swap(NULL);
+	PyThreadState_Delete(state);
+
+	idle.push_back(interp);
+}
+
+void
+InterpreterPool::loadScript(interpreter_t &entry) throw (ApplicationError)
+{
+	PyObject *main_dict=PyModule_GetDict(PyImport_AddModule("__main__")); // borrowed ref
+	PyDict_Clear(main_dict);
+	if (PyDict_Update(main_dict,entry.pristine)!=0)
+		throw ApplicationError("unable to reset __main__ dictionary","InterpreterPool::loadScript()");
+
+	unsigned long generation;
+	PyObject *code=PythonScript::getCode(filename,generation);
+	PythonScript::execCode(code,filename);
+
+	PyObject *snapshot=PyDict_Copy(main_dict); // new ref
+	if (!snapshot)
+		throw ApplicationError("unable to copy __main__ dictionary","InterpreterPool::loadScript()");
+	Py_XDECREF(entry.snapshot);
+	entry.snapshot=snapshot;
+	entry.generation=generation;
+}
+
+string
+InterpreterPool::prefix()
+{
+	return AsyncLog::prefix("InterpreterPool",this);
+}
+
+/* History
+
+$Log$
+
+*/
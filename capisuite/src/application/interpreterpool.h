@@ -0,0 +1,136 @@
+/** @file interpreterpool.h
+    @brief Contains InterpreterPool - Pool of Python sub-interpreters which have already read a script
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef INTERPRETERPOOL_H
+#define INTERPRETERPOOL_H
+
+#include <Python.h>
+#include <string>
+#include <map>
+#include <vector>
+#include "../../config.h"
+#include "applicationexception.h"
+#ifdef HAVE_OSTREAM
+  #include <ostream>
+#else
+  #include <ostream.h>
+#endif
+
+using namespace std;
+
+/** @brief Pool of Python sub-interpreters which have already read a script
+
+    Creating a sub-interpreter, initializing the capisuite module and reading the
+    script costs much time under the global Python lock. Therefore, a fixed number
+    of interpreters is prepared at startup and handed out to the calls.
+
+    get() and put() work like Py_NewInterpreter() and Py_EndInterpreter(), but the
+    interpreter isn't destroyed. Instead the entries of its __main__ dictionary are
+    reset to the objects they referred to after reading the script. This only undoes
+    the rebinding of global variables: objects changed in place (e.g. a global list
+    appended to or a global dict updated) are the same objects and keep their changes
+    for the next call, and so do imported modules and their attributes. Scripts
+    should therefore not keep per-call state in mutable globals.
+
+    If the script was changed in the meantime (see PythonScript::getCode()), get()
+    executes the new version in a clean __main__ before handing out the interpreter.
+
+    If the pool is empty, get() returns NULL and the caller should fall back to
+    create an own interpreter.
+
+    @author agent
+*/
+class InterpreterPool
+{
+	public:
+		/** @brief Constructor. Create the interpreters and read the script into them.
+
+		    The caller must hold the global Python lock. The current thread state is
+		    restored afterwards. Interpreters which can't be created or where the script
+		    fails are left out and reported to the error stream.
+
+		    @param debug stream for debugging info
+		    @param debug_level verbosity level for debug messages
+		    @param error stream for error messages
+		    @param filename file name of the python script to read
+		    @param size number of interpreters to create
+		*/
+		InterpreterPool(ostream &debug, unsigned short debug_level, ostream &error, string filename, unsigned size);
+
+		/** @brief Destructor. End all idle interpreters.
+
+		    The caller must hold the global Python lock. Interpreters which are still
+		    in use can't be ended and are left to Py_Finalize().
+		*/
+		~InterpreterPool();
+
+		/** @brief Take an idle interpreter out of the pool
+
+		    The caller must hold the global Python lock. A new thread state for the
+		    interpreter is created and made current.
+
+		    @return the new thread state or NULL if no interpreter is idle or the changed script can't be read
+		*/
+		PyThreadState* get();
+
+		/** @brief Give back an interpreter taken with get()
+
+		    The caller must hold the global Python lock and state must be the current
+		    thread state. The global names in __main__ are bound to the objects of the
+		    snapshot again (changes done in place to these objects are kept), the thread state is deleted
+		    and the current thread state is NULL afterwards.
+
+		    @param state thread state as returned by get()
+		*/
+		void put(PyThreadState *state);
+
+	private:
+		/** @brief return a prefix containing this pointer and date for log messages
+
+		    @return constructed prefix as stringstream
+		*/
+		string prefix();
+
+		/** @brief state of one interpreter in the pool
+		*/
+		struct interpreter_t {
+			PyObject *pristine; ///< copy of __main__ before reading the script
+			PyObject *snapshot; ///< copy of __main__ after reading the script
+			unsigned long generation; ///< generation of the script code read (see PythonScript::getCode()), 0=none
+		};
+
+		/** @brief Execute the script in a clean __main__ of the current interpreter and take a new snapshot
+
+		    @param entry the pool entry of the current interpreter
+		    @throw ApplicationError Thrown if the script can't be read or executed.
+		*/
+		void loadScript(interpreter_t &entry) throw (ApplicationError);
+
+		map<PyInterpreterState*,interpreter_t> interpreters; ///< all interpreters created by the pool
+		string filename; ///< name of the python script to read
+		vector<PyInterpreterState*> idle; ///< interpreters currently not in use, protected by the global Python lock
+		ostream &debug, ///< debug stream
+			&error; ///< error stream
+		unsigned short debug_level; ///< debug level
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
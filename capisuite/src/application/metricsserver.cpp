@@ -0,0 +1,128 @@
+/*  @file metricsserver.cpp
+    @brief Contains MetricsServer - Exports the Metrics on a local Unix socket
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sstream>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../backend/metrics.h"
+#include "metricsserver.h"
+#include "../backend/asynclog.h"
+
+void* metricsserver_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no MetricsServer reference given in metricsserver_exec_handler" << endl;
+		exit(1);
+	}
+	MetricsServer *instance=static_cast<MetricsServer*>(arg);
+	instance->run();
+	return NULL;
+}
+
+MetricsServer::MetricsServer(ostream &debug, unsigned short debug_level, ostream &error, string socket_path) throw (ApplicationError)
+:debug(debug),error(error),debug_level(debug_level),socket_path(socket_path),sock(-1)
+{
+	sockaddr_un addr;
+	if (socket_path.size()>=sizeof(addr.sun_path))
+		throw ApplicationError("name of metrics socket "+socket_path+" is too long","MetricsServer::MetricsServer()");
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	strcpy(addr.sun_path,socket_path.c_str());
+
+	sock=socket(AF_UNIX,SOCK_STREAM,0);
+	if (sock==-1)
+		throw ApplicationError(string("can't create metrics socket: ")+strerror(errno),"MetricsServer::MetricsServer()");
+
+	unlink(socket_path.c_str()); // left over from an earlier run
+	if (bind(sock,reinterpret_cast<sockaddr*>(&addr),sizeof(addr)) || listen(sock,5)) {
+		string msg=strerror(errno);
+		close(sock);
+		throw ApplicationError("can't listen on metrics socket "+socket_path+": "+msg,"MetricsServer::MetricsServer()");
+	}
+
+	if (pthread_create(&thread_handle, NULL, metricsserver_exec_handler, this)) {
+		close(sock);
+		unlink(socket_path.c_str());
+		throw ApplicationError("error while creating thread","MetricsServer::MetricsServer()");
+	}
+
+	if (debug_level>=1)
+		debug << prefix() << "exporting metrics on " << socket_path << endl;
+}
+
+MetricsServer::~MetricsServer()
+{
+	pthread_cancel(thread_handle);
+	pthread_join(thread_handle,NULL);
+	close(sock);
+	unlink(socket_path.c_str());
+}
+
+void
+MetricsServer::run()
+{
+	while (1) {
+		int client=accept(sock,NULL,NULL); // cancellation point
+		if (client==-1) {
+			if (errno!=EINTR && errno!=ECONNABORTED) {
+				error << prefix() << "WARNING: can't accept connection on metrics socket: " << strerror(errno) << endl;
+				sleep(1); // don't spin if the error persists
+			}
+			continue;
+		}
+
+		// a client which doesn't read mustn't block the server forever
+		timeval timeout;
+		timeout.tv_sec=1;
+		timeout.tv_usec=0;
+		setsockopt(client,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+
+		int oldstate;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,&oldstate); // don't leak client if we're cancelled now
+		string data=Metrics::format();
+		string::size_type pos=0;
+		while (pos<data.size()) {
+			ssize_t ret=send(client,data.data()+pos,data.size()-pos,MSG_NOSIGNAL); // client may be gone, so no SIGPIPE please
+			if (ret>0)
+				pos+=ret;
+			else if (ret==-1 && errno==EINTR)
+				continue;
+			else
+				break;
+		}
+		close(client);
+		pthread_setcancelstate(oldstate,NULL);
+
+		if (debug_level>=3)
+			debug << prefix() << "sent " << dec << pos << " bytes of metrics" << endl;
+	}
+}
+
+string
+MetricsServer::prefix()
+{
+	return AsyncLog::prefix("MetricsServer",this);
+}
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,97 @@
+/** @file metricsserver.h
+    @brief Contains MetricsServer - Exports the Metrics on a local Unix socket
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <pthread.h>
+#include <string>
+#include "../../config.h"
+#ifdef HAVE_OSTREAM
+  #include <ostream>
+#else
+  #include <ostream.h>
+#endif
+#include "applicationexception.h"
+
+using namespace std;
+
+/** @brief Thread exec handler for MetricsServer class
+
+    This is a handler which will call run() of the given MetricsServer for the use in pthread_create().
+*/
+void* metricsserver_exec_handler(void* arg);
+
+/** @brief Exports the Metrics on a local Unix socket
+
+    Listens on a Unix stream socket. Each client connecting to it gets the
+    current values of all metrics in the text format of Prometheus (see
+    Metrics::format()), then the connection is closed. So the values can be
+    read with e.g. "socat - UNIX-CONNECT:<socket>" and fed into any
+    monitoring system.
+
+    The values are only read when a client connects, so the server causes no
+    load while nobody asks.
+
+    @author agent
+*/
+class MetricsServer
+{
+	friend void* metricsserver_exec_handler(void*);
+
+	public:
+		/** @brief Constructor. Create the socket and start the thread serving it.
+
+		    An existing file with the name of the socket is removed.
+
+		    @param debug stream for debugging info
+		    @param debug_level verbosity level for debug messages
+		    @param error stream for error messages
+		    @param socket_path file name of the socket
+		    @throw ApplicationError Thrown if the socket can't be created or the thread can't be started
+		*/
+		MetricsServer(ostream &debug, unsigned short debug_level, ostream &error, string socket_path) throw (ApplicationError);
+
+		/** @brief Destructor. Stop the thread and remove the socket.
+		*/
+		~MetricsServer();
+
+	private:
+		/** @brief Thread body. Accept clients and send them the metrics.
+		*/
+		void run();
+
+		/** @brief return a prefix containing this pointer and date for log messages
+
+		    @return constructed prefix as stringstream
+		*/
+		string prefix();
+
+		ostream &debug, ///< debug stream
+			&error; ///< stream for error messages
+		unsigned short debug_level; ///< debug level
+		string socket_path; ///< file name of the socket
+		int sock; ///< file descriptor of the listening socket
+		pthread_t thread_handle; ///< handle for the created pthread thread
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -17,9 +17,17 @@
 #include "pythonscript.h"
 #include <cStringIO.h>
 #include <sstream> 
+#include <fstream>
+#include <sys/stat.h>
+#include <stdio.h>
+#include "../backend/asynclog.h"
+
+map<string,PythonScript::cached_script_t> PythonScript::script_cache;
+unsigned long PythonScript::last_generation=0;
+volatile bool PythonScript::cache_flush_requested=false;
 
 PythonScript::PythonScript(ostream &debug, unsigned short debug_level, ostream &error, string filename, string functionname, PycStringIO_CAPI* cStringIO)
-:debug(debug),debug_level(debug_level),error(error),filename(filename),functionname(functionname),args(NULL), cStringIO(cStringIO)
+:debug(debug),debug_level(debug_level),error(error),filename(filename),functionname(functionname),args(NULL), cStringIO(cStringIO),loaded_generation(0)
 {
 	if (debug_level>=3)
 		debug << prefix() << "PythonScript created." << endl;
@@ -34,75 +42,152 @@ PythonScript::~PythonScript()
 string
 PythonScript::prefix(bool verbose)
 {
-	stringstream s;
-	time_t t=time(NULL);
-	char* ct=ctime(&t);
-	ct[24]='\0';
-	if (verbose)
-		s << ct << " Pythonscript " << filename << "," << functionname << "," << hex << this << ": ";
-	else
-		s << ct << " Pythonscript " << hex << this << ": ";
-	return (s.str());
+	if (!verbose)
+		return AsyncLog::prefix("Pythonscript",this);
+	char address[32];
+	snprintf(address,sizeof(address),"%p",this);
+	return string(AsyncLog::timestamp())+" Pythonscript "+filename+","+functionname+","+address+": ";
 }
 
 void 
 PythonScript::run() throw (ApplicationError)
 {
-	PyObject *module=NULL, *module_dict=NULL, *function_ref=NULL, *result=NULL;
+	unsigned long generation;
+	PyObject *code=getCode(filename,generation);
+	if (generation!=loaded_generation) {
+		execCode(code,filename);
+		loaded_generation=generation;
+	}
+	call();
+}
 
-	FILE* scriptfile=NULL;
-	try {
-		if (!(scriptfile=fopen(filename.c_str(),"r") ) )
-			throw ApplicationError("unable to open "+filename,"PythonScript::run()");
+PyObject*
+PythonScript::getCode(string filename, unsigned long &generation) throw (ApplicationError)
+{
+	if (cache_flush_requested) {
+		cache_flush_requested=false;
+		for (map<string,cached_script_t>::iterator i=script_cache.begin();i!=script_cache.end();i++)
+			Py_DECREF(i->second.code);
+		script_cache.clear();
+	}
+
+	struct stat filestat;
+	if (stat(filename.c_str(),&filestat))
+		throw ApplicationError("unable to open "+filename,"PythonScript::getCode()");
+
+	map<string,cached_script_t>::iterator cached=script_cache.find(filename);
+	if (cached!=script_cache.end()) {
+		if (cached->second.device==filestat.st_dev && cached->second.inode==filestat.st_ino && cached->second.mtime==filestat.st_mtime) {
+			generation=cached->second.generation;
+			return cached->second.code;
+		}
+		Py_DECREF(cached->second.code);
+		script_cache.erase(cached);
+	}
+
+	ifstream scriptfile(filename.c_str());
+	if (!scriptfile)
+		throw ApplicationError("unable to open "+filename,"PythonScript::getCode()");
+	stringstream source;
+	source << scriptfile.rdbuf() << endl;
+
+	PyObject *code=Py_CompileString(source.str().c_str(),const_cast<char*>(filename.c_str()),Py_file_input); // new ref
+	if (!code) {
+		PyErr_Print();
+		throw ApplicationError("syntax error in python script "+filename,"PythonScript::getCode()");
+	}
+
+	cached_script_t entry;
+	entry.code=code;
+	entry.device=filestat.st_dev;
+	entry.inode=filestat.st_ino;
+	entry.mtime=filestat.st_mtime;
+	entry.generation=++last_generation;
+	script_cache[filename]=entry;
+
+	generation=entry.generation;
+	return code;
+}
+
+void
+PythonScript::execCode(PyObject *code, string filename) throw (ApplicationError)
+{
+	PyObject *module, *module_dict, *result;
+
+	// get __main__
+	if ( ! ( module=PyImport_AddModule("__main__"))) // module = borrowed ref
+		throw ApplicationError("unable to get __main__ namespace","PythonScript::execCode()");
+	if ( ! ( module_dict=PyModule_GetDict(module) ) )  // module_dict = borrowed ref
+		throw ApplicationError("unable to get __main__ dictionary","PythonScript::execCode()");
+
+	PyObject *py_filename=PyString_FromString(filename.c_str()); // new ref
+	if (!py_filename || PyDict_SetItemString(module_dict,"__file__",py_filename)!=0) {
+		Py_XDECREF(py_filename);
+		throw ApplicationError("unable to set __file__","PythonScript::execCode()");
+	}
+	Py_DECREF(py_filename);
 
+	// execute control script. It must define the function which is called later on
+	if (!(result=PyEval_EvalCode(reinterpret_cast<PyCodeObject*>(code),module_dict,module_dict))) { // new ref
+		PyErr_Print();
+		throw ApplicationError("error while executing python script "+filename,"PythonScript::execCode()");
+	}
+	Py_DECREF(result);
+}
+
+void
+PythonScript::flushCache()
+{
+	cache_flush_requested=true;
+}
+
+void
+PythonScript::call() throw (ApplicationError)
+{
+	PyObject *module=NULL, *module_dict=NULL, *result=NULL;
+
+	try {
 		// get __main__
 		if ( ! ( module=PyImport_AddModule("__main__"))) // module = borrowed ref
-			throw ApplicationError("unable to get __main__ namespace","PythonScript::run()");
+			throw ApplicationError("unable to get __main__ namespace","PythonScript::call()");
 		if ( ! ( module_dict=PyModule_GetDict(module) ) )  // module_dict = borrowed ref
-			throw ApplicationError("unable to get __main__ dictionary","PythonScript::run()");
-
-		// read control script. It must define a function callIncoming. For description see run()
-		if (PyRun_SimpleFile(scriptfile,const_cast<char*>(filename.c_str()))==-1)
-			throw ApplicationError("syntax error while executing python script","PythonScript::run()");
-
-		fclose(scriptfile);
-		scriptfile=NULL;
+			throw ApplicationError("unable to get __main__ dictionary","PythonScript::call()");
 
 		// now let's get the user defined function
 		PyObject* function_ref=PyDict_GetItemString(module_dict,const_cast<char*>(functionname.c_str())); // borrowed ref
 		if (! function_ref || !PyCallable_Check(function_ref) )
-			throw ApplicationError("control script does not define function "+functionname,"PythonScript::run()");
+			throw ApplicationError("control script does not define function "+functionname,"PythonScript::call()");
 
 		if (!args)
-			throw ApplicationError("no arguments given","PythonScript::run()");
+			throw ApplicationError("no arguments given","PythonScript::call()");
 		if (!PyTuple_Check(args))
-			throw ApplicationError("args must be a tuple","PythonScript::run()");
+			throw ApplicationError("args must be a tuple","PythonScript::call()");
 
 		result=PyObject_CallObject(function_ref,args);
 		if (!result) {
 			PyObject *catch_stderr;
 			// redirect sys.stderr and then print exception
 			if ( ! ( module=PyImport_AddModule("sys"))) // module = borrowed ref
-				throw ApplicationError("unable to get sys namespace","PythonScript::run()");
+				throw ApplicationError("unable to get sys namespace","PythonScript::call()");
 			if ( ! ( module_dict=PyModule_GetDict(module) ) )  // module_dict = borrowed ref
-				throw ApplicationError("unable to get sys dictionary","PythonScript::run()");
+				throw ApplicationError("unable to get sys dictionary","PythonScript::call()");
 
 			catch_stderr=cStringIO->NewOutput(128); // create StringIO object for collecting stderr messages
 			if ( PyDict_SetItemString(module_dict,"stderr",catch_stderr)!=0 ) {
 				Py_DECREF(catch_stderr);
-				throw ApplicationError("unable to redirect sys.stderr","PythonScript::run()");
+				throw ApplicationError("unable to redirect sys.stderr","PythonScript::call()");
 			}
 			Py_DECREF(catch_stderr);
 
 			PyErr_Print();
                         PyObject *py_traceback;
 			if ( !(py_traceback=cStringIO->cgetvalue(catch_stderr)) )
-				throw ApplicationError("unable to get traceback","PythonScript::run()");
+				throw ApplicationError("unable to get traceback","PythonScript::call()");
 			
 			int length;
 			char *traceback;
 			if (PyString_AsStringAndSize(py_traceback, &traceback, &length))
-				throw ApplicationError("unable to convert traceback to char*","PythonScript::run()");
+				throw ApplicationError("unable to convert traceback to char*","PythonScript::call()");
 
                         error << prefix() << "A python error occured. See traceback below." << endl;
 			error << prefix(false) << "Python traceback: ";
@@ -115,7 +200,7 @@ PythonScript::run() throw (ApplicationError)
 
 			// undo redirection
 			if ( PyDict_SetItemString(module_dict,"stderr",PyDict_GetItemString(module_dict,"__stderr__"))!=0 ) {
-				throw ApplicationError("unable to reset sys.stderr","PythonScript::run()");
+				throw ApplicationError("unable to reset sys.stderr","PythonScript::call()");
 			}
 		} else {
 			if (result!=Py_None)
@@ -126,8 +211,6 @@ PythonScript::run() throw (ApplicationError)
 		}
 	}
 	catch(ApplicationError e) {
-		if (scriptfile)
-			fclose(scriptfile);
 		if (result)
 			Py_DECREF(result);
 		throw;
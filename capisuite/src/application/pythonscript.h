@@ -18,6 +18,8 @@
 #define PYTHONSCRIPT_H
 
 #include <Python.h>
+#include <map>
+#include <sys/types.h>
 
 #include "../../config.h"
 #ifdef HAVE_OSTREAM
@@ -36,6 +38,12 @@ using namespace std;
     must define one function with given name. This function is called
     with arbitrary parameters.
 
+    The scripts are compiled only once and the code objects are kept in a
+    cache shared by all interpreters. A script is compiled again if its file
+    was changed (modification time or inode differ) or after flushCache().
+    run() only executes the script again if the code has changed since the
+    last run of this object.
+
     @author Gernot Hillier
 */
 class PythonScript
@@ -56,6 +64,35 @@ class PythonScript
 		*/
 		virtual ~PythonScript();
 
+		/** @brief Get the compiled code of a python script from the cache.
+
+		    The script is compiled if it isn't in the cache yet or if the file has changed.
+		    The caller must hold the global Python lock.
+
+		    @param filename file name of the python script to read
+		    @param generation will be set to a number identifying this compilation of the script
+		    @return code object (borrowed reference, valid until the global Python lock is released)
+		    @throw ApplicationError Thrown when the script can't be read or compiled.
+		*/
+		static PyObject* getCode(string filename, unsigned long &generation) throw (ApplicationError);
+
+		/** @brief Executes a code object returned by getCode() in __main__ of the current interpreter.
+
+		    The caller must hold the global Python lock.
+
+		    @param code code object
+		    @param filename file name of the script, used as __file__
+		    @throw ApplicationError Thrown when the script raised an exception.
+		*/
+		static void execCode(PyObject *code, string filename) throw (ApplicationError);
+
+		/** @brief Request recompilation of all cached scripts.
+
+		    Only sets a flag which is checked in the next getCode() call, so it's safe to call
+		    it from a signal handler or without holding the global Python lock.
+		*/
+		static void flushCache();
+
 	protected:
 		/** @brief Reads the given python script and calls the given function.
 
@@ -65,6 +102,15 @@ class PythonScript
 		*/
 		virtual void run() throw (ApplicationError);
 
+		/** @brief Calls the given function of a script already read into __main__ by execCode().
+
+		    The arguments for the function must be given in the constructor.
+		    Python errors raised by the function are logged to the error stream together with the traceback.
+
+		    @throw ApplicationError Thrown when the function can't be called for any reason.
+		*/
+		void call() throw (ApplicationError);
+
 		/** @brief Called by pscript_cleanup_handler(), will delete the current object.
 		*/
 		virtual void final();
@@ -83,6 +129,22 @@ class PythonScript
 			&error; ///< error stream
 		unsigned short debug_level; ///< debug level 
 		PycStringIO_CAPI* cStringIO; ///< holds a pointer to the Python cStringIO C API
+		unsigned long loaded_generation; ///< generation of the code last executed by run(), 0=none
+
+	private:
+		/** @brief entry of the script cache
+		*/
+		struct cached_script_t {
+			PyObject *code; ///< compiled code object
+			dev_t device; ///< device of the script file when it was compiled
+			ino_t inode; ///< inode of the script file when it was compiled
+			time_t mtime; ///< modification time of the script file when it was compiled
+			unsigned long generation; ///< unique number of this compilation
+		};
+
+		static map<string,cached_script_t> script_cache; ///< compiled scripts, protected by the global Python lock
+		static unsigned long last_generation; ///< last generation number given to a compilation
+		static volatile bool cache_flush_requested; ///< set by flushCache()
 };
 
 #endif
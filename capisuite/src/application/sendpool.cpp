@@ -0,0 +1,190 @@
+/*  @file sendpool.cpp
+    @brief Contains SendPool - Sends several jobs of the send queues at the same time
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <algorithm>
+#include "../backend/capi.h"
+#include "../backend/asynclog.h"
+#include "sendscript.h"
+#include "faxqueue.h"
+#include "sendpool.h"
+
+void* sendpool_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no job reference given in sendpool_exec_handler" << endl;
+		exit(1);
+	}
+	SendPool::job_t *job=static_cast<SendPool::job_t*>(arg);
+	job->pool->run(job);
+	return NULL;
+}
+
+SendPool::SendPool(ostream &debug, unsigned short debug_level, ostream &error, Capi *capi, string script, PycStringIO_CAPI* cStringIO, FaxQueue *queue, unsigned max_per_controller, unsigned max_per_destination)
+:terminate(false),orphaned(false),capi(capi),script(script),cStringIO(cStringIO),queue(queue),max_per_controller(max_per_controller)
+,max_per_destination(max_per_destination),debug(debug),error(error),debug_level(debug_level)
+{
+	pthread_mutex_init(&jobs_mutex, NULL);
+	pthread_cond_init(&jobs_cond, NULL);
+}
+
+SendPool::~SendPool()
+{
+	pthread_mutex_destroy(&jobs_mutex);
+	pthread_cond_destroy(&jobs_cond);
+	if (debug_level>=2)
+		debug << prefix() << "all jobs finished" << endl;
+}
+
+bool
+SendPool::start(const string &key, const vector<unsigned> &controllers, const string &destination, const vector<string> &job_args)
+{
+	pthread_mutex_lock(&jobs_mutex);
+	if (terminate || running.count(key)) {
+		pthread_mutex_unlock(&jobs_mutex);
+		return false;
+	}
+
+	// channels of the controllers which aren't used by incoming calls
+	long channels=0;
+	for (vector<unsigned>::const_iterator c=controllers.begin();c!=controllers.end();c++) {
+		long usable=capi->getBChannels(*c);
+		if (max_per_controller && static_cast<long>(max_per_controller)<usable)
+			usable=max_per_controller;
+		usable-=capi->getUsedBChannels(*c,true);
+		if (usable>0)
+			channels+=usable;
+	}
+	// running jobs which may use one of the controllers, too
+	long used=0;
+	for (map<string,vector<unsigned> >::iterator j=running.begin();j!=running.end();j++)
+		if (find_first_of(j->second.begin(),j->second.end(),controllers.begin(),controllers.end())!=j->second.end())
+			used++;
+	map<string,unsigned>::iterator d=per_destination.find(destination);
+	unsigned to_destination=(d!=per_destination.end() ? d->second : 0);
+	if (used>=channels || (max_per_destination && to_destination>=max_per_destination)) {
+		refused.insert(key);
+		pthread_mutex_unlock(&jobs_mutex);
+		if (debug_level>=3)
+			debug << prefix() << "job " << key << " has to wait, " << dec << used << " of " << channels << " channels used, "
+			  << to_destination << " jobs to " << destination << endl;
+		return false;
+	}
+
+	job_t *job=new job_t;
+	job->pool=this;
+	job->key=key;
+	job->destination=destination;
+	job->args=job_args;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+	pthread_t thread_handle;
+	if (pthread_create(&thread_handle, &attr, sendpool_exec_handler, job)) { // start thread as detached
+		pthread_attr_destroy(&attr);
+		refused.insert(key);
+		pthread_mutex_unlock(&jobs_mutex);
+		delete job;
+		error << prefix() << "ERROR: can't create thread for job " << key << endl;
+		return false;
+	}
+	pthread_attr_destroy(&attr);
+
+	running[key]=controllers;
+	per_destination[destination]++;
+	refused.erase(key);
+	unsigned count=running.size();
+	pthread_mutex_unlock(&jobs_mutex);
+
+	if (debug_level>=2)
+		debug << prefix() << "job " << key << " started, " << dec << count << " jobs running" << endl;
+	return true;
+}
+
+bool
+SendPool::requestTerminate(unsigned timeout)
+{
+	timeval now;
+	gettimeofday(&now,NULL);
+	timespec deadline;
+	deadline.tv_sec=now.tv_sec+timeout;
+	deadline.tv_nsec=now.tv_usec*1000;
+
+	pthread_mutex_lock(&jobs_mutex);
+	terminate=true;
+	queue=NULL; // may be deleted before the last job finishes
+	if (debug_level>=2 && !running.empty())
+		debug << prefix() << "waiting for " << dec << running.size() << " jobs to finish" << endl;
+	while (!running.empty())
+		if (pthread_cond_timedwait(&jobs_cond,&jobs_mutex,&deadline)==ETIMEDOUT)
+			break;
+	bool finished=running.empty();
+	if (!finished) {
+		orphaned=true;
+		error << prefix() << "WARNING: " << dec << running.size() << " jobs still running, not waiting any longer" << endl;
+	}
+	pthread_mutex_unlock(&jobs_mutex);
+	if (finished)
+		delete this;
+	return finished;
+}
+
+void
+SendPool::run(job_t *job)
+{
+	{
+		SendScript script(debug,debug_level,error,capi,this->script,job->args,cStringIO);
+		script.run();
+	}
+
+	pthread_mutex_lock(&jobs_mutex);
+	running.erase(job->key);
+	if (!--per_destination[job->destination])
+		per_destination.erase(job->destination);
+
+	// a channel is free now, so the waiting jobs are due again
+	if (queue)
+		for (set<string>::iterator i=refused.begin();i!=refused.end();i++)
+			queue->update(*i);
+	refused.clear();
+
+	// logged with the lock held, afterwards the object may be deleted by requestTerminate()
+	if (debug_level>=2)
+		debug << prefix() << "job " << job->key << " finished, " << dec << running.size() << " jobs running" << endl;
+	if (terminate)
+		pthread_cond_signal(&jobs_cond);
+	bool last=orphaned && running.empty();
+	pthread_mutex_unlock(&jobs_mutex);
+
+	delete job;
+	if (last)
+		delete this;
+}
+
+string
+SendPool::prefix()
+{
+	return AsyncLog::prefix("SendPool",this);
+}
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,159 @@
+/** @file sendpool.h
+    @brief Contains SendPool - Sends several jobs of the send queues at the same time
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef SENDPOOL_H
+#define SENDPOOL_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "../../config.h"
+#ifdef HAVE_OSTREAM
+  #include <ostream>
+#else
+  #include <ostream.h>
+#endif
+
+using namespace std;
+
+class Capi;
+class FaxQueue;
+class PycStringIO_CAPI;
+
+/** @brief Thread exec handler for SendPool class
+
+    This is a handler which will call run() of the SendPool the given job belongs to for the use in pthread_create().
+*/
+void* sendpool_exec_handler(void* arg);
+
+/** @brief Sends several jobs of the send queues at the same time
+
+    The idle script hands each due job over with capisuite.send_start() instead of
+    sending it itself. If a B channel is free, a thread is started for the job which
+    calls the function sendjob() of the idle script in an own interpreter (see SendScript),
+    so all channels can be used for sending.
+
+    A job is started if
+    	- it isn't running already (jobs are identified by a key, normally the name of the description file),
+	- one of its controllers has a free B channel. The channels used by incoming calls (see
+	  Capi::getUsedBChannels()) are subtracted from the B channels of each controller
+	  (at most max_per_controller, 0 = no limit). Then the running jobs which may use one of
+	  the controllers are subtracted from the sum. Jobs count from their start on, as their
+	  call isn't made at once and it isn't known which controller it will use
+	  (see CallOutgoing),
+	- less than max_per_destination jobs run for the same destination (0 = no limit).
+
+    Jobs which can't be started stay in the send queue. When a running job finishes,
+    they're read into the FaxQueue again, so the idle script gets them again at once.
+
+    The object deletes itself after requestTerminate() was called and all jobs have finished.
+
+    @author agent
+*/
+class SendPool
+{
+	friend void* sendpool_exec_handler(void*);
+
+	public:
+		/** @brief Constructor. Create the pool, threads are only created for the jobs.
+
+		    @param debug stream for debugging info
+		    @param debug_level verbosity level for debug messages
+		    @param error stream for error messages
+		    @param capi reference to Capi object
+		    @param script file name of the python script providing sendjob(), normally the idle script
+		    @param cStringIO pointer to the Python cStringIO C API
+		    @param queue index of the fax jobs, may be NULL
+		    @param max_per_controller max. number of channels of one controller used for the jobs, 0 = only limited by the B channels
+		    @param max_per_destination max. number of jobs running for one destination, 0 = no limit
+		*/
+		SendPool(ostream &debug, unsigned short debug_level, ostream &error, Capi *capi, string script, PycStringIO_CAPI* cStringIO, FaxQueue *queue, unsigned max_per_controller, unsigned max_per_destination);
+
+		/** @brief Start a job if the limits allow it
+
+		    @param key identifies the job, normally the name of its description file
+		    @param controllers controllers the job may use
+		    @param destination number the job will call
+		    @param job_args arguments given to sendjob()
+		    @return true if the job was started, false if it's running already or no channel is free
+		*/
+		bool start(const string &key, const vector<unsigned> &controllers, const string &destination, const vector<string> &job_args);
+
+		/** @brief Request termination and wait for the running jobs
+
+		    No jobs are started any more. Waits until the running jobs have finished, but at most
+		    timeout seconds. The jobs need the Python lock, so the caller must not hold it.
+		    The object will delete itself after the running jobs have finished, so don't use it any more.
+
+		    @param timeout max. time in seconds to wait for the running jobs
+		    @return true if all jobs have finished, false if some are still running
+		*/
+		bool requestTerminate(unsigned timeout);
+
+	private:
+		/** @brief Destructor. Only called if no job is running.
+		*/
+		~SendPool();
+
+		/** @brief a running job
+		*/
+		struct job_t {
+			SendPool *pool; ///< the pool running the job
+			string key; ///< identifies the job
+			string destination; ///< number the job calls
+			vector<string> args; ///< arguments for sendjob()
+		};
+
+		/** @brief Thread body of the jobs.
+
+		    @param job the job to send, deleted afterwards
+		*/
+		void run(job_t *job);
+
+		/** @brief return a prefix containing this pointer and date for log messages
+
+		    @return constructed prefix as stringstream
+		*/
+		string prefix();
+
+		map<string,vector<unsigned> > running; ///< controllers of the running jobs, indexed by their keys
+		set<string> refused; ///< keys of the jobs which couldn't be started since the last job finished
+		map<string,unsigned> per_destination; ///< number of running jobs per destination
+		pthread_mutex_t jobs_mutex; ///< protects all members above and queue, terminate and orphaned
+		pthread_cond_t jobs_cond; ///< signalled when a job finished after requestTerminate() was called
+		bool terminate, ///< set by requestTerminate()
+			orphaned; ///< set if requestTerminate() stopped waiting, the last job deletes the object then
+
+		Capi *capi; ///< reference to Capi object
+		string script; ///< file name of the script providing sendjob()
+		PycStringIO_CAPI* cStringIO; ///< pointer to the Python cStringIO C API
+		FaxQueue *queue; ///< index of the fax jobs, NULL if not available
+		unsigned max_per_controller, ///< max. number of channels of one controller used for the jobs, 0 = no limit
+			max_per_destination; ///< max. number of jobs running for one destination, 0 = no limit
+		ostream &debug, ///< debug stream
+			&error; ///< error stream
+		unsigned short debug_level; ///< debug level
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
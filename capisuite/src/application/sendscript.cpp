@@ -0,0 +1,97 @@
+/*  @file sendscript.cpp
+    @brief Contains SendScript - Sends one job of the send queue. One object for each job is created.
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <Python.h>
+#include "sendscript.h"
+#include "capisuitemodule.h"
+#include "../backend/metrics.h"
+
+SendScript::SendScript(ostream &debug, unsigned short debug_level, ostream &error, Capi *capi, string script, const vector<string> &job_args, PycStringIO_CAPI* cStringIO)
+:PythonScript(debug,debug_level,error,script,"sendjob",cStringIO),capi(capi),job_args(job_args)
+{
+	if (debug_level>=3)
+		debug << prefix() << "SendScript created." << endl;
+}
+
+SendScript::~SendScript()
+{
+	if (debug_level>=3)
+		debug << prefix() << "SendScript deleted" << endl;
+}
+
+void
+SendScript::run() throw()
+{
+	PyObject *capi_ref=NULL;
+	PyThreadState *py_state=NULL;
+
+	try {
+		// thread safe Python init, taken out of PyApache 4.26
+		PyEval_AcquireLock();
+
+		if (!(py_state=Py_NewInterpreter() )) {
+			PyEval_ReleaseLock();
+			throw ApplicationError("error while creating new python interpreter","SendScript::run()");
+		}
+		capisuitemodule_init();
+
+		capi_ref=PyCObject_FromVoidPtr(capi,NULL); // new ref
+		if (!capi_ref)
+			throw ApplicationError("unable to create CObject from Capi reference","SendScript::run()");
+
+		if (!(args=PyTuple_New(job_args.size()+1))) // args = new ref
+			throw ApplicationError("can't build arguments","SendScript::run()");
+		PyTuple_SET_ITEM(args,0,capi_ref); // steals the reference
+		capi_ref=NULL;
+		for (unsigned i=0;i<job_args.size();i++) {
+			PyObject *arg=PyString_FromString(job_args[i].c_str()); // new ref
+			if (!arg)
+				throw ApplicationError("can't build arguments","SendScript::run()");
+			PyTuple_SET_ITEM(args,i+1,arg); // steals the reference
+		}
+
+		PythonScript::run();
+
+		Py_DECREF(args);
+		args=NULL;
+
+		Py_EndInterpreter(py_state);
+		py_state=NULL;
+		PyEval_ReleaseLock(); // release lock
+	}
+	catch(ApplicationError e) {
+		error << prefix() << "Error occured. message was: " << e << endl;
+		Metrics::count(Metrics::SCRIPT_ERRORS);
+
+		if (args) {
+			Py_DECREF(args);
+			args=NULL;
+		}
+		if (capi_ref)
+			Py_DECREF(capi_ref);
+		if (py_state) {
+			Py_EndInterpreter(py_state);
+			py_state=NULL;
+			PyEval_ReleaseLock();
+		}
+	}
+}
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,84 @@
+/** @file sendscript.h
+    @brief Contains SendScript - Sends one job of the send queue. One object for each job is created.
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef SENDSCRIPT_H
+#define SENDSCRIPT_H
+
+#include <vector>
+#include "applicationexception.h"
+#include "pythonscript.h"
+
+class Capi;
+class PycStringIO_CAPI;
+
+/** @brief Sends one job of the send queue. One object for each job is created.
+
+    The idle script doesn't send the jobs itself, but hands them over to the
+    SendPool with capisuite.send_start(). For each job, the SendPool creates a
+    thread which creates an object of this class and calls run(). Like
+    IncomingScript, it creates an own python subinterpreter, so several jobs can
+    be sent at the same time.
+
+    @author agent
+*/
+class SendScript: public PythonScript
+{
+	public:
+		/** @brief Constructor. Create Object
+
+		    @param debug stream for debugging info
+		    @param debug_level verbosity level for debug messages
+		    @param error stream for error messages
+		    @param capi reference to Capi object
+		    @param script file name of the python script providing sendjob(), normally the idle script
+		    @param job_args arguments for sendjob() as given to capisuite.send_start()
+		    @param cStringIO pointer to the Python cStringIO C API
+		*/
+		SendScript(ostream &debug, unsigned short debug_level, ostream &error, Capi *capi, string script, const vector<string> &job_args, PycStringIO_CAPI* cStringIO);
+
+		/** @brief Destructor. Destruct object.
+		*/
+		virtual ~SendScript();
+
+		/** @brief Calls the python function sendjob() which will send the job.
+
+		    The script must provide a function named sendjob with the following signature:
+
+		    def sendjob(capi, arg1, arg2, ...):
+		    	# function body
+
+		    The parameters given to the python function are:
+			- capi: reference to the capi providing the interface to the ISDN hardware (needed for the call_*() functions)
+			- arg1, arg2, ... (strings): the arguments given to capisuite.send_start()
+
+		    The script is responsible for clearing each call it initiates, even in the exception handlers!
+
+		    The python global lock will be acquired while the function runs.
+    		*/
+    		virtual void run(void) throw();
+
+	private:
+		Capi *capi; ///< reference to Capi object
+		vector<string> job_args; ///< arguments for sendjob()
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,188 @@
+/*  @file submitserver.cpp
+    @brief Contains SubmitServer - Accepts new fax jobs on a local Unix socket and starts sending them at once
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../backend/asynclog.h"
+#include "idlescript.h"
+#include "faxqueue.h"
+#include "submitserver.h"
+
+void* submitserver_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no SubmitServer reference given in submitserver_exec_handler" << endl;
+		exit(1);
+	}
+	SubmitServer *instance=static_cast<SubmitServer*>(arg);
+	instance->run();
+	return NULL;
+}
+
+SubmitServer::SubmitServer(ostream &debug, unsigned short debug_level, ostream &error, string socket_path, IdleScript *idle, FaxQueue *queue) throw (ApplicationError)
+:debug(debug),error(error),debug_level(debug_level),socket_path(socket_path),idle(idle),queue(queue),sock(-1)
+{
+	sockaddr_un addr;
+	if (socket_path.size()>=sizeof(addr.sun_path))
+		throw ApplicationError("name of submit socket "+socket_path+" is too long","SubmitServer::SubmitServer()");
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	strcpy(addr.sun_path,socket_path.c_str());
+
+	sock=socket(AF_UNIX,SOCK_STREAM,0);
+	if (sock==-1)
+		throw ApplicationError(string("can't create submit socket: ")+strerror(errno),"SubmitServer::SubmitServer()");
+
+	unlink(socket_path.c_str()); // left over from an earlier run
+	if (bind(sock,reinterpret_cast<sockaddr*>(&addr),sizeof(addr)) || chmod(socket_path.c_str(),0666) || listen(sock,16)) {
+		string msg=strerror(errno);
+		close(sock);
+		unlink(socket_path.c_str());
+		throw ApplicationError("can't listen on submit socket "+socket_path+": "+msg,"SubmitServer::SubmitServer()");
+	}
+
+	if (pthread_create(&thread_handle, NULL, submitserver_exec_handler, this)) {
+		close(sock);
+		unlink(socket_path.c_str());
+		throw ApplicationError("error while creating thread","SubmitServer::SubmitServer()");
+	}
+
+	if (debug_level>=1)
+		debug << prefix() << "accepting fax jobs on " << socket_path << endl;
+}
+
+SubmitServer::~SubmitServer()
+{
+	pthread_cancel(thread_handle);
+	pthread_join(thread_handle,NULL);
+	close(sock);
+	unlink(socket_path.c_str());
+}
+
+void
+SubmitServer::run()
+{
+	while (1) {
+		int client=accept(sock,NULL,NULL); // cancellation point
+		if (client==-1) {
+			if (errno!=EINTR && errno!=ECONNABORTED) {
+				error << prefix() << "WARNING: can't accept connection on submit socket: " << strerror(errno) << endl;
+				sleep(1); // don't spin if the error persists
+			}
+			continue;
+		}
+
+		int oldstate;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,&oldstate); // don't leak client if we're cancelled now
+
+		// a client which doesn't talk to us mustn't block the server forever
+		timeval timeout;
+		timeout.tv_sec=2;
+		timeout.tv_usec=0;
+		setsockopt(client,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+		setsockopt(client,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+
+		string request;
+		char buffer[256];
+		while (request.size()<1024 && request.find('\n')==string::npos) {
+			ssize_t ret=recv(client,buffer,sizeof(buffer),0);
+			if (ret>0)
+				request.append(buffer,ret);
+			else if (ret==-1 && errno==EINTR)
+				continue;
+			else
+				break;
+		}
+
+		ucred cred;
+		socklen_t length=sizeof(cred);
+		string answer;
+		if (request.find('\n')==string::npos)
+			answer="ERROR incomplete request";
+		else if (getsockopt(client,SOL_SOCKET,SO_PEERCRED,&cred,&length))
+			answer="ERROR can't determine user";
+		else if (checkJob(request.substr(0,request.find('\n')),cred.uid,answer)) {
+			string filename=request.substr(7,request.find('\n')-7);
+			// the index starts the script when the job is due
+			if (!queue || !queue->update(filename)) {
+				// not in an indexed send queue (yet), only the script knows if it's in one of its send queues
+				idle->trigger();
+				answer="QUEUED "+answer.substr(3);
+			}
+			if (debug_level>=2)
+				debug << prefix() << "job " << filename << " submitted by uid " << dec << cred.uid << endl;
+		} else
+			error << prefix() << "refused job submitted by uid " << dec << cred.uid << ": " << answer << endl;
+
+		answer+='\n';
+		send(client,answer.data(),answer.size(),MSG_NOSIGNAL); // client may be gone, so no SIGPIPE please
+		close(client);
+		pthread_setcancelstate(oldstate,NULL);
+	}
+}
+
+bool
+SubmitServer::checkJob(const string &request, uid_t uid, string &answer)
+{
+	if (request.compare(0,7,"SUBMIT ") || request.size()<9 || request[7]!='/') {
+		answer="ERROR invalid request, expected SUBMIT <absolute file name>";
+		return false;
+	}
+	string filename=request.substr(7);
+
+	// the name must be fax-<id>.txt
+	string::size_type pos=filename.rfind('/')+1;
+	string id=filename.substr(pos);
+	if (id.size()<9 || id.compare(0,4,"fax-") || id.compare(id.size()-4,4,".txt") || id.find_first_not_of("0123456789",4)!=id.size()-4) {
+		answer="ERROR invalid job name";
+		return false;
+	}
+	id=id.substr(4,id.size()-8);
+
+	// the description and the fax file must be regular files of the client, no links to files of others
+	string files[2]={filename,filename.substr(0,filename.size()-3)+"sff"};
+	for (int i=0;i<2;i++) {
+		struct stat st;
+		if (lstat(files[i].c_str(),&st) || !S_ISREG(st.st_mode)) {
+			answer="ERROR can't find "+files[i];
+			return false;
+		}
+		if (uid && st.st_uid!=uid) {
+			answer="ERROR "+files[i]+" doesn't belong to you";
+			return false;
+		}
+	}
+
+	answer="OK "+id;
+	return true;
+}
+
+string
+SubmitServer::prefix()
+{
+	return AsyncLog::prefix("SubmitServer",this);
+}
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,127 @@
+/** @file submitserver.h
+    @brief Contains SubmitServer - Accepts new fax jobs on a local Unix socket and starts sending them at once
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef SUBMITSERVER_H
+#define SUBMITSERVER_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <string>
+#include "../../config.h"
+#ifdef HAVE_OSTREAM
+  #include <ostream>
+#else
+  #include <ostream.h>
+#endif
+#include "applicationexception.h"
+
+using namespace std;
+
+class IdleScript;
+class FaxQueue;
+
+/** @brief Thread exec handler for SubmitServer class
+
+    This is a handler which will call run() of the given SubmitServer for the use in pthread_create().
+*/
+void* submitserver_exec_handler(void* arg);
+
+/** @brief Accepts new fax jobs on a local Unix socket and starts sending them at once
+
+    capisuitefax stores new jobs in the send queue of the user. Without further
+    notice they are found by the idle script with its next run, which may take
+    up to idle_script_interval seconds. After storing a job, capisuitefax hands it
+    over to this server, which puts it into the FaxQueue, so the idle script is started
+    as soon as the job is due. Without FaxQueue, the idle script is started at once
+    (see IdleScript::trigger()).
+
+    The client sends one line and gets one line back:
+
+    	SUBMIT <absolute name of the job description file>
+	OK <job id>
+
+    if the job was put into the FaxQueue. If there's no FaxQueue or the job isn't in one of
+    its send queues, the idle script is started, which only sends the job if it's in one of
+    its send queues, and the answer is "QUEUED <job id>". If the job isn't accepted, the
+    answer is "ERROR <message>". The description file must be named fax-<job id>.txt and must belong to the user connected to the socket (which is
+    determined by the kernel, see SO_PEERCRED), only root may submit jobs of other
+    users. Invalid jobs are only refused here, the idle script checks the queue as
+    before.
+
+    The socket can be used by all local users.
+
+    @author agent
+*/
+class SubmitServer
+{
+	friend void* submitserver_exec_handler(void*);
+
+	public:
+		/** @brief Constructor. Create the socket and start the thread serving it.
+
+		    An existing file with the name of the socket is removed.
+
+		    @param debug stream for debugging info
+		    @param debug_level verbosity level for debug messages
+		    @param error stream for error messages
+		    @param socket_path file name of the socket
+		    @param idle the idle script sending the jobs
+		    @param queue index of the fax jobs, may be NULL
+		    @throw ApplicationError Thrown if the socket can't be created or the thread can't be started
+		*/
+		SubmitServer(ostream &debug, unsigned short debug_level, ostream &error, string socket_path, IdleScript *idle, FaxQueue *queue) throw (ApplicationError);
+
+		/** @brief Destructor. Stop the thread and remove the socket.
+		*/
+		~SubmitServer();
+
+	private:
+		/** @brief Thread body. Accept clients and handle their requests.
+		*/
+		void run();
+
+		/** @brief Check a submitted job
+
+		    @param request the line sent by the client, without newline
+		    @param uid user id of the client
+		    @param answer the line to send back, without newline
+		    @return true if the job was accepted
+		*/
+		bool checkJob(const string &request, uid_t uid, string &answer);
+
+		/** @brief return a prefix containing this pointer and date for log messages
+
+		    @return constructed prefix as stringstream
+		*/
+		string prefix();
+
+		ostream &debug, ///< debug stream
+			&error; ///< stream for error messages
+		unsigned short debug_level; ///< debug level
+		string socket_path; ///< file name of the socket
+		IdleScript *idle; ///< the idle script sending the jobs
+		FaxQueue *queue; ///< index of the fax jobs, NULL if not available
+		int sock; ///< file descriptor of the listening socket
+		pthread_t thread_handle; ///< handle for the created pthread thread
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,315 @@
+/*  @file workerpool.cpp
+    @brief Contains WorkerPool - Fixed number of threads handling incoming calls with a bounded queue
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sstream>
+#include <errno.h>
+#include "../backend/connection.h"
+#include "../modules/disconnectmodule.h"
+#include "incomingscript.h"
+#include "workerpool.h"
+#include "../backend/asynclog.h"
+#include "../backend/metrics.h"
+
+void* workerpool_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no WorkerPool reference given in workerpool_exec_handler" << endl;
+		exit(1);
+	}
+	WorkerPool *instance=static_cast<WorkerPool*>(arg);
+	instance->run();
+	return NULL;
+}
+
+void* workerpool_reaper_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no WorkerPool reference given in workerpool_reaper_exec_handler" << endl;
+		exit(1);
+	}
+	WorkerPool *instance=static_cast<WorkerPool*>(arg);
+	instance->reap();
+	return NULL;
+}
+
+WorkerPool::WorkerPool(ostream &debug, unsigned short debug_level, ostream &error, unsigned workers, unsigned queue_size, unsigned queue_timeout, overflow_policy_t overflow, int reject_cause, size_t stack_size, string incoming_script, PycStringIO_CAPI* cStringIO, InterpreterPool *pool) throw (ApplicationError)
+:jobs(),rejects(),idle_workers(0),running_threads(0),queue_size(queue_size),queue_timeout(queue_timeout),overflow(overflow),reject_cause(reject_cause)
+,terminate(false),orphaned(false),incoming_script(incoming_script),cStringIO(cStringIO),pool(pool),debug(debug),error(error),debug_level(debug_level)
+{
+	pthread_mutex_init(&jobs_mutex, NULL);
+	pthread_cond_init(&jobs_cond, NULL);
+	pthread_cond_init(&reaper_cond, NULL);
+	pthread_cond_init(&finished_cond, NULL);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (stack_size && pthread_attr_setstacksize(&attr,stack_size))
+		error << prefix() << "Warning: invalid stack size " << dec << stack_size << " for worker threads, using default" << endl;
+
+	pthread_mutex_lock(&jobs_mutex);
+	running_threads=1; // the constructor, so no thread deletes the object before it's complete
+
+	pthread_t reaper_handle;
+	if (pthread_create(&reaper_handle, &attr, workerpool_reaper_exec_handler, this)) {   // joinable until the workers are started
+		pthread_mutex_unlock(&jobs_mutex);
+		pthread_attr_destroy(&attr);
+		pthread_mutex_destroy(&jobs_mutex);
+		pthread_cond_destroy(&jobs_cond);
+		pthread_cond_destroy(&reaper_cond);
+		pthread_cond_destroy(&finished_cond);
+		throw ApplicationError("error while creating reaper thread","WorkerPool::WorkerPool()");
+	}
+	running_threads++;
+
+	pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+	unsigned created=0;
+	for (unsigned i=0;i<workers;i++) {
+		pthread_t thread_handle;
+		if (pthread_create(&thread_handle, &attr, workerpool_exec_handler, this)) {   // start thread as detached
+			error << prefix() << "ERROR: can't create worker thread, only " << dec << created << " workers available" << endl;
+			break;
+		}
+		created++;
+		running_threads++;
+	}
+	if (!created) {
+		terminate=true;
+		pthread_cond_signal(&reaper_cond);
+	}
+	pthread_mutex_unlock(&jobs_mutex);
+	pthread_attr_destroy(&attr);
+
+	if (!created) {
+		pthread_join(reaper_handle,NULL);
+		pthread_mutex_destroy(&jobs_mutex);
+		pthread_cond_destroy(&jobs_cond);
+		pthread_cond_destroy(&reaper_cond);
+		pthread_cond_destroy(&finished_cond);
+		throw ApplicationError("error while creating worker threads","WorkerPool::WorkerPool()");
+	}
+	pthread_detach(reaper_handle);
+
+	pthread_mutex_lock(&jobs_mutex);
+	running_threads--; // can't be the last one, the reaper runs until requestTerminate()
+	pthread_mutex_unlock(&jobs_mutex);
+
+	if (debug_level>=1)
+		debug << prefix() << "started " << dec << created << " workers for incoming calls" << endl;
+}
+
+WorkerPool::~WorkerPool()
+{
+	pthread_mutex_destroy(&jobs_mutex);
+	pthread_cond_destroy(&jobs_cond);
+	pthread_cond_destroy(&reaper_cond);
+	pthread_cond_destroy(&finished_cond);
+
+	if (debug_level>=2)
+		debug << prefix() << "all workers finished" << endl;
+}
+
+void
+WorkerPool::dispatch(Connection *conn, timeval arrival)
+{
+	job_t job;
+	job.conn=conn;
+	job.arrival=arrival;
+	gettimeofday(&job.queued,NULL);
+
+	pthread_mutex_lock(&jobs_mutex);
+	expireJobs(job.queued);
+	// jobs which will be taken by an idle worker don't count as waiting
+	unsigned waiting=(jobs.size()>=idle_workers) ? jobs.size()-idle_workers : 0;
+	bool accept=!terminate && ( jobs.size()<idle_workers || (overflow==QUEUE && waiting<queue_size) );
+	if (accept) {
+		jobs.push(job);
+		Metrics::changeQueuedCalls(1);
+		pthread_cond_signal(&jobs_cond);
+		if (jobs.size()==1)
+			pthread_cond_signal(&reaper_cond); // so it waits for the queue timeout of this call
+	} else {
+		rejects.push(conn);
+		pthread_cond_signal(&reaper_cond);
+	}
+	unsigned depth=jobs.size();
+	pthread_mutex_unlock(&jobs_mutex);
+
+	if (!accept)
+		error << prefix() << "all workers busy, rejecting connection " << conn << endl;
+	else if (debug_level>=2 && depth>1)
+		debug << prefix() << "connection " << conn << " queued, " << dec << depth << " calls waiting for a worker" << endl;
+}
+
+bool
+WorkerPool::requestTerminate(unsigned timeout)
+{
+	timeval now;
+	gettimeofday(&now,NULL);
+	timespec deadline;
+	deadline.tv_sec=now.tv_sec+timeout;
+	deadline.tv_nsec=now.tv_usec*1000;
+
+	pthread_mutex_lock(&jobs_mutex);
+	terminate=true;
+	pthread_cond_broadcast(&jobs_cond);
+	pthread_cond_signal(&reaper_cond);
+	while (running_threads)
+		if (pthread_cond_timedwait(&finished_cond,&jobs_mutex,&deadline)==ETIMEDOUT)
+			break;
+	bool finished=!running_threads;
+	if (!finished) {
+		orphaned=true;
+		error << prefix() << "WARNING: " << dec << running_threads << " threads still running, not waiting any longer" << endl;
+	}
+	pthread_mutex_unlock(&jobs_mutex);
+	if (finished)
+		delete this;
+	return finished;
+}
+
+void
+WorkerPool::run()
+{
+	while (1) {
+		pthread_mutex_lock(&jobs_mutex);
+		idle_workers++;
+		while (jobs.empty() && !terminate)
+			pthread_cond_wait(&jobs_cond,&jobs_mutex);
+		idle_workers--;
+		if (terminate) { // the reaper rejects the calls left in the queue
+			threadFinished();
+			return;
+		}
+		timeval now;
+		gettimeofday(&now,NULL);
+		expireJobs(now);
+		if (jobs.empty()) {
+			pthread_mutex_unlock(&jobs_mutex);
+			continue;
+		}
+		job_t job=jobs.front();
+		jobs.pop();
+		Metrics::changeQueuedCalls(-1);
+		unsigned depth=jobs.size();
+		pthread_mutex_unlock(&jobs_mutex);
+
+		long wait_time=(now.tv_sec-job.queued.tv_sec)*1000000+(now.tv_usec-job.queued.tv_usec);
+		long latency=(now.tv_sec-job.arrival.tv_sec)*1000000+(now.tv_usec-job.arrival.tv_usec);
+		Metrics::observe(Metrics::QUEUE_INCOMING,wait_time);
+
+		if (debug_level>=2)
+			debug << prefix() << "starting incoming script for connection " << job.conn << " " << dec << latency
+			  << " usecs after call arrival, waited " << wait_time << " usecs in queue, " << depth << " calls still waiting" << endl;
+
+		IncomingScript script(debug,debug_level,error,job.conn,incoming_script,cStringIO,pool);
+		script.run();
+	}
+}
+
+void
+WorkerPool::reap()
+{
+	pthread_mutex_lock(&jobs_mutex);
+	while (1) {
+		if (terminate) { // no worker will take the calls left in the queue
+			while (!jobs.empty()) {
+				rejects.push(jobs.front().conn);
+				jobs.pop();
+				Metrics::changeQueuedCalls(-1);
+			}
+		} else {
+			timeval now;
+			gettimeofday(&now,NULL);
+			expireJobs(now);
+		}
+
+		if (!rejects.empty()) {
+			Connection *conn=rejects.front();
+			rejects.pop();
+			pthread_mutex_unlock(&jobs_mutex);
+			reject(conn);
+			pthread_mutex_lock(&jobs_mutex);
+		} else if (terminate) {
+			break;
+		} else if (overflow==QUEUE && queue_timeout && !jobs.empty()) {
+			timespec timeout; // when the first call in the queue reaches the queue timeout
+			timeout.tv_sec=jobs.front().queued.tv_sec+queue_timeout;
+			timeout.tv_nsec=jobs.front().queued.tv_usec*1000;
+			pthread_cond_timedwait(&reaper_cond,&jobs_mutex,&timeout);
+		} else
+			pthread_cond_wait(&reaper_cond,&jobs_mutex);
+	}
+	threadFinished();
+}
+
+void
+WorkerPool::threadFinished()
+{
+	bool last=(--running_threads==0);
+	if (last)
+		pthread_cond_signal(&finished_cond);
+	bool remove=last && orphaned;
+	pthread_mutex_unlock(&jobs_mutex);
+	if (remove)
+		delete this;
+}
+
+void
+WorkerPool::expireJobs(timeval now)
+{
+	if (overflow!=QUEUE || !queue_timeout)
+		return;
+	bool expired=false;
+	while (!jobs.empty()) {
+		const job_t &job=jobs.front();
+		long wait_time=(now.tv_sec-job.queued.tv_sec)*1000000+(now.tv_usec-job.queued.tv_usec);
+		if (wait_time<queue_timeout*1000000L)
+			break;
+		error << prefix() << "connection " << job.conn << " waited too long for a worker, rejecting it" << endl;
+		Metrics::observe(Metrics::QUEUE_INCOMING,wait_time);
+		rejects.push(job.conn);
+		jobs.pop();
+		Metrics::changeQueuedCalls(-1);
+		expired=true;
+	}
+	if (expired)
+		pthread_cond_signal(&reaper_cond);
+}
+
+void
+WorkerPool::reject(Connection *conn)
+{
+	try {
+		DisconnectModule active(conn,reject_cause);
+		active.mainLoop();
+	}
+	catch (CapiError e) {
+		error << prefix() << "ERROR: rejecting connection " << conn << " failed, message was: " << e << endl;
+	}
+	delete conn;
+}
+
+string
+WorkerPool::prefix()
+{
+	return AsyncLog::prefix("WorkerPool",this);
+}
+
+/* History
+
+$Log$
+
+*/
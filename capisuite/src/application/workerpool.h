@@ -0,0 +1,204 @@
+/** @file workerpool.h
+    @brief Contains WorkerPool - Fixed number of threads handling incoming calls with a bounded queue
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <string>
+#include <queue>
+#include "../../config.h"
+#ifdef HAVE_OSTREAM
+  #include <ostream>
+#else
+  #include <ostream.h>
+#endif
+#include "applicationexception.h"
+
+using namespace std;
+
+class Connection;
+class PycStringIO_CAPI;
+class InterpreterPool;
+
+/** @brief Thread exec handler for WorkerPool class
+
+    This is a handler which will call run() of the given WorkerPool for the use in pthread_create().
+*/
+void* workerpool_exec_handler(void* arg);
+
+/** @brief Thread exec handler for the reaper of the WorkerPool class
+
+    This is a handler which will call reap() of the given WorkerPool for the use in pthread_create().
+*/
+void* workerpool_reaper_exec_handler(void* arg);
+
+/** @brief Fixed number of threads handling incoming calls with a bounded queue
+
+    Each worker thread takes waiting calls out of the queue and runs an IncomingScript
+    for them. So the number of threads doesn't grow with the number of incoming calls.
+
+    If all workers are busy, the overflow policy decides what happens:
+    	- QUEUE: the call waits in the queue until a worker is free. If the queue is full or the
+	  call waited longer than the queue timeout, it's rejected.
+	- REJECT: the call is rejected immediately.
+
+    Rejected calls get the configured reject cause (see Connection::rejectWaiting()).
+    Rejecting a call waits for the DISCONNECT_IND, so this is done by an extra thread, the
+    reaper. It also rejects the calls which reach the queue timeout while all workers are busy.
+
+    The queue depth and the time each call waited in the queue are recorded in Metrics.
+
+    requestTerminate() waits for all threads and deletes the object then. If they don't finish
+    in time, the last finishing thread deletes it.
+
+    @author agent
+*/
+class WorkerPool
+{
+	friend void* workerpool_exec_handler(void*);
+	friend void* workerpool_reaper_exec_handler(void*);
+
+	public:
+		/** @brief what to do with a call if all workers are busy
+		*/
+		enum overflow_policy_t {
+			QUEUE, ///< queue the call
+			REJECT ///< reject the call immediately
+		};
+
+		/** @brief Constructor. Create the worker threads and the reaper.
+
+		    @param debug stream for debugging info
+		    @param debug_level verbosity level for debug messages
+		    @param error stream for error messages
+		    @param workers number of worker threads to create
+		    @param queue_size maximum number of calls waiting for a free worker (only for QUEUE)
+		    @param queue_timeout maximum time in seconds a call waits for a free worker, 0=infinite (only for QUEUE)
+		    @param overflow what to do if all workers are busy
+		    @param reject_cause reason to give when rejecting a call (see Connection::rejectWaiting())
+		    @param stack_size stack size for the worker threads in bytes, 0=system default
+		    @param incoming_script file name of the python script to use as incoming script
+		    @param cStringIO pointer to the Python cStringIO C API
+		    @param pool pool of interpreters which have read incoming_script, may be NULL
+		    @throw ApplicationError Thrown if no thread can be started
+		*/
+		WorkerPool(ostream &debug, unsigned short debug_level, ostream &error, unsigned workers, unsigned queue_size, unsigned queue_timeout, overflow_policy_t overflow, int reject_cause, size_t stack_size, string incoming_script, PycStringIO_CAPI* cStringIO, InterpreterPool *pool) throw (ApplicationError);
+
+		/** @brief Hand over a waiting call to the workers
+
+		    If the call can't be queued, it's handed to the reaper for rejection, so this never
+		    blocks. Calls in the queue which reached the queue timeout are rejected first, so they
+		    don't take up room in the queue. Don't call this after requestTerminate().
+
+		    @param conn the waiting connection
+		    @param arrival time when the call arrived
+		*/
+		void dispatch(Connection *conn, timeval arrival);
+
+		/** @brief Request termination of all workers and wait for them
+
+		    Idle workers finish immediately, busy workers after their call was handled.
+		    The calls still waiting in the queue are rejected by the reaper. Waits until all
+		    threads have finished, but at most timeout seconds. The object will delete itself
+		    afterwards, so don't use it any more.
+
+		    @param timeout max. time in seconds to wait for the threads
+		    @return true if all threads have finished, false if some still use Capi and the Python interpreters
+		*/
+		bool requestTerminate(unsigned timeout);
+
+	private:
+		/** @brief Destructor. Only called by requestTerminate() or the last finishing thread.
+		*/
+		~WorkerPool();
+
+		/** @brief Thread body of the workers.
+		*/
+		void run();
+
+		/** @brief Thread body of the reaper.
+
+		    Rejects the calls handed over by dispatch() and the calls which reached the queue
+		    timeout. Sleeps until the first call in the queue will reach it.
+		*/
+		void reap();
+
+		/** @brief Count a finished thread
+
+		    Must be called with jobs_mutex held, which is released. Deletes the object if it's
+		    the last thread and requestTerminate() has stopped waiting.
+		*/
+		void threadFinished();
+
+		/** @brief Hand over the calls in the queue which reached the queue timeout to the reaper
+
+		    Must be called with jobs_mutex held.
+
+		    @param now the current time
+		*/
+		void expireJobs(timeval now);
+
+		/** @brief Reject a waiting call and delete the Connection object
+
+		    @param conn the waiting connection
+		*/
+		void reject(Connection *conn);
+
+		/** @brief return a prefix containing this pointer and date for log messages
+
+		    @return constructed prefix as stringstream
+		*/
+		string prefix();
+
+		/** @brief entry of the call queue
+		*/
+		struct job_t {
+			Connection* conn; ///< the waiting connection
+			timeval arrival, ///< time when the call arrived
+				queued; ///< time when the call was put into the queue
+		};
+
+		queue<job_t> jobs; ///< calls waiting for a worker
+		queue<Connection*> rejects; ///< calls waiting for the reaper to reject them
+		pthread_mutex_t jobs_mutex; ///< protects jobs, rejects, idle_workers, running_threads, terminate and orphaned
+		pthread_cond_t jobs_cond, ///< signalled when a job was queued or termination is requested
+			reaper_cond, ///< signalled when a call must be rejected, the queue was empty before or termination is requested
+			finished_cond; ///< signalled when the last thread finished
+		unsigned idle_workers, ///< number of workers waiting for a job
+			running_threads, ///< number of running threads (workers and reaper)
+			queue_size, ///< maximum number of calls waiting for a free worker
+			queue_timeout; ///< maximum time in seconds a call may wait in the queue, 0=infinite
+		overflow_policy_t overflow; ///< what to do if all workers are busy
+		int reject_cause; ///< reason given when rejecting a call
+		bool terminate, ///< set by requestTerminate()
+			orphaned; ///< set if requestTerminate() stopped waiting, the last thread deletes the object then
+		string incoming_script; ///< file name of the incoming script
+		PycStringIO_CAPI* cStringIO; ///< pointer to the Python cStringIO C API
+		InterpreterPool *pool; ///< pool of prepared interpreters, may be NULL
+		ostream &debug, ///< debug stream
+			&error; ///< error stream
+		unsigned short debug_level; ///< debug level
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,251 @@
+/*  @file asynclog.cpp
+    @brief Contains AsyncLog - Stream buffer writing log files in the background
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "asynclog.h"
+
+AsyncLog *AsyncLog::instances=NULL;
+pthread_mutex_t AsyncLog::instances_mutex=PTHREAD_MUTEX_INITIALIZER;
+
+pthread_once_t AsyncLog::exit_handler_once=PTHREAD_ONCE_INIT;
+
+void* asynclog_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no AsyncLog reference given in asynclog_exec_handler" << endl;
+		exit(1);
+	}
+	AsyncLog *instance=static_cast<AsyncLog*>(arg);
+	instance->run();
+	return NULL;
+}
+
+AsyncLog::AsyncLog(int fd, bool close_fd, unsigned interval)
+:streambuf(),fd(fd),close_fd(close_fd),interval(interval),queued(NULL),finish(false),started(false)
+{
+	pthread_key_create(&buffer_key,deleteBuffer);
+	pthread_mutex_init(&write_mutex, NULL);
+	setp(NULL,NULL); // no put area, so each output reaches overflow() or xsputn() and we can choose the buffer per thread
+
+	pthread_once(&exit_handler_once,registerExitHandler);
+	pthread_mutex_lock(&instances_mutex);
+	next_instance=instances;
+	instances=this;
+	pthread_mutex_unlock(&instances_mutex);
+}
+
+AsyncLog::~AsyncLog()
+{
+	pthread_mutex_lock(&instances_mutex);
+	AsyncLog **i=&instances;
+	while (*i!=this)
+		i=&(*i)->next_instance;
+	*i=next_instance;
+	pthread_mutex_unlock(&instances_mutex);
+
+	if (started) {
+		finish=true;
+		pthread_join(thread_handle,NULL);
+	}
+	sync(); // text of the calling thread
+	flush();
+
+	pthread_mutex_destroy(&write_mutex);
+	pthread_key_delete(buffer_key); // buffers of other threads are lost, they didn't flush them
+	if (close_fd)
+		close(fd);
+}
+
+void
+AsyncLog::start() throw (CapiExternalError)
+{
+	if (started)
+		return;
+	if (pthread_create(&thread_handle, NULL, asynclog_exec_handler, this))
+		throw CapiExternalError("error while creating thread","AsyncLog::start()");
+	started=true;
+}
+
+void
+AsyncLog::flush()
+{
+	pthread_mutex_lock(&write_mutex);
+	line_t *lines=__sync_lock_test_and_set(&queued,static_cast<line_t*>(NULL));
+
+	// the queue holds the newest line first, so reverse it
+	line_t *ordered=NULL;
+	while (lines) {
+		line_t *l=lines;
+		lines=l->next;
+		l->next=ordered;
+		ordered=l;
+	}
+
+	string data;
+	while (ordered) {
+		line_t *l=ordered;
+		ordered=l->next;
+		data+=l->text;
+		delete l;
+	}
+
+	string::size_type pos=0;
+	while (pos<data.size()) {
+		ssize_t ret=write(fd,data.data()+pos,data.size()-pos);
+		if (ret>0)
+			pos+=ret;
+		else if (ret==-1 && errno==EINTR)
+			continue;
+		else
+			break; // nobody left to tell about it
+	}
+	pthread_mutex_unlock(&write_mutex);
+}
+
+const char*
+AsyncLog::timestamp()
+{
+	static __thread time_t cached_time=-1;
+	static __thread char cached[26];
+
+	time_t t=time(NULL);
+	if (t!=cached_time) {
+		ctime_r(&t,cached);
+		cached[24]='\0';
+		cached_time=t;
+	}
+	return cached;
+}
+
+string
+AsyncLog::prefix(const char *name, const void *object, const string &fields)
+{
+	char address[32];
+	snprintf(address,sizeof(address),"%p",object);
+
+	string s(timestamp());
+	s+=' ';
+	s+=name;
+	s+=' ';
+	s+=address;
+	s+=fields;
+	s+=": ";
+	return s;
+}
+
+int
+AsyncLog::overflow(int c)
+{
+	if (c==EOF)
+		return traits_type::not_eof(c);
+	string &buffer=threadBuffer();
+	buffer+=static_cast<char>(c);
+	if (buffer.size()>max_buffer)
+		queue(buffer);
+	return c;
+}
+
+streamsize
+AsyncLog::xsputn(const char *s, streamsize n)
+{
+	string &buffer=threadBuffer();
+	buffer.append(s,n);
+	if (buffer.size()>max_buffer)
+		queue(buffer);
+	return n;
+}
+
+int
+AsyncLog::sync()
+{
+	string &buffer=threadBuffer();
+	if (!buffer.empty())
+		queue(buffer);
+	return 0;
+}
+
+void
+AsyncLog::run()
+{
+	timespec delay_time;
+	delay_time.tv_sec=interval/1000;
+	delay_time.tv_nsec=(interval%1000)*1000000;
+	while (!finish) {
+		nanosleep(&delay_time,NULL);
+		if (queued)
+			flush();
+	}
+}
+
+string&
+AsyncLog::threadBuffer()
+{
+	string *buffer=static_cast<string*>(pthread_getspecific(buffer_key));
+	if (!buffer) {
+		buffer=new string;
+		pthread_setspecific(buffer_key,buffer);
+	}
+	return *buffer;
+}
+
+void
+AsyncLog::queue(string &text)
+{
+	line_t *l=new line_t;
+	l->text.swap(text); // hand over the memory instead of copying the text
+	line_t *head=queued;
+	while (1) {
+		l->next=head;
+		line_t *old=__sync_val_compare_and_swap(&queued,head,l);
+		if (old==head)
+			break;
+		head=old;
+	}
+}
+
+void
+AsyncLog::deleteBuffer(void *buffer)
+{
+	delete static_cast<string*>(buffer);
+}
+
+void
+AsyncLog::flushAll()
+{
+	pthread_mutex_lock(&instances_mutex);
+	for (AsyncLog *i=instances;i;i=i->next_instance) {
+		i->sync(); // text of the exiting thread
+		i->flush();
+	}
+	pthread_mutex_unlock(&instances_mutex);
+}
+
+void
+AsyncLog::registerExitHandler()
+{
+	atexit(AsyncLog::flushAll);
+}
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,195 @@
+/** @file asynclog.h
+    @brief Contains AsyncLog - Stream buffer writing log files in the background
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include <streambuf>
+#include <string>
+#include <pthread.h>
+#include "capiexception.h"
+
+using namespace std;
+
+/** @brief Thread exec handler for AsyncLog class
+
+    This is a handler which will call run() of the given AsyncLog for the use in pthread_create().
+*/
+void* asynclog_exec_handler(void* arg);
+
+/** @brief Stream buffer writing log files in the background
+
+    All threads of CapiSuite write their log messages to the same debug and
+    error streams, including the thread dispatching the CAPI messages. Writing
+    each line to the file directly makes the data paths wait for the disk
+    at higher log levels.
+
+    An ostream using this buffer collects the text written by each thread in
+    a buffer of its own. When the thread flushes the stream (e.g. with endl),
+    the collected line is put into a queue, then the thread goes on at once. A
+    background thread started with start() writes the queued lines to the file
+    in regular intervals.
+
+    Adding a line to the queue uses an atomic compare and swap, so the writing
+    threads never wait for a lock or for each other. Lines of one thread keep
+    their order, lines of different threads are written in the order they
+    were flushed.
+
+    Lines still queued when the program exits are written by an exit handler.
+
+    The formatting flags of the ostream (e.g. hex) are shared by all threads
+    as before, so log lines should set them before writing numbers.
+
+    Besides that, timestamp() and prefix() build the common beginning of log
+    lines without calling ctime() for each line.
+
+    @author agent
+*/
+class AsyncLog: public streambuf
+{
+	friend void* asynclog_exec_handler(void*);
+
+	public:
+		/** @brief Constructor. Create a buffer for the given file.
+
+		    The lines are only queued until start() is called.
+
+		    @param fd file descriptor to write to, should be opened with O_APPEND
+		    @param close_fd true if fd should be closed by the destructor
+		    @param interval time between two writes in milliseconds
+		*/
+		AsyncLog(int fd, bool close_fd, unsigned interval=100);
+
+		/** @brief Destructor. Stop the background thread and write all queued lines.
+		*/
+		virtual ~AsyncLog();
+
+		/** @brief Start the background thread writing the queued lines
+
+		    As threads don't survive fork(), this must be called after daemon().
+
+		    @throw CapiExternalError Thrown if the thread can't be started
+		*/
+		void start() throw (CapiExternalError);
+
+		/** @brief Write all queued lines to the file now
+		*/
+		void flush();
+
+		/** @brief Return the current time formatted like ctime() does, without the newline
+
+		    The text is cached per thread and only formatted again when the second has changed.
+
+		    @return the time, valid until the next call in the same thread
+		*/
+		static const char* timestamp();
+
+		/** @brief Build the beginning of a log line
+
+		    @param name name of the class writing the line
+		    @param object address of the object writing the line
+		    @param fields further fields, e.g. " plci=0x101", inserted before the colon
+		    @return "<timestamp> <name> <object><fields>: "
+		*/
+		static string prefix(const char *name, const void *object, const string &fields="");
+
+	protected:
+		/** @brief Append one character to the buffer of the calling thread
+
+		    @param c the character
+		    @return c or a value different from EOF if c was EOF
+		*/
+		virtual int overflow(int c);
+
+		/** @brief Append characters to the buffer of the calling thread
+
+		    @param s the characters
+		    @param n number of characters
+		    @return n
+		*/
+		virtual streamsize xsputn(const char *s, streamsize n);
+
+		/** @brief Queue the buffer of the calling thread
+
+		    @return 0
+		*/
+		virtual int sync();
+
+	private:
+		/** @brief queued text of one flush of one thread
+		*/
+		struct line_t {
+			line_t *next; ///< next entry in the queue
+			string text; ///< the text
+		};
+
+		/** @brief Thread body. Writes the queued lines in regular intervals.
+		*/
+		void run();
+
+		/** @brief Return the buffer of the calling thread, create it if needed
+
+		    @return the buffer
+		*/
+		string& threadBuffer();
+
+		/** @brief Put the text into the queue, text is empty afterwards
+
+		    @param text the text
+		*/
+		void queue(string &text);
+
+		/** @brief Delete the buffer of a thread, used as destructor for buffer_key
+
+		    @param buffer the buffer
+		*/
+		static void deleteBuffer(void *buffer);
+
+		/** @brief Write the queued lines of all AsyncLog objects, called at exit
+		*/
+		static void flushAll();
+
+		/** @brief Register flushAll() with atexit(), called once
+		*/
+		static void registerExitHandler();
+
+		enum {
+			max_buffer=65536 ///< text of a thread is queued if it gets longer, even without flush
+		};
+
+		int fd; ///< file descriptor to write to
+		bool close_fd; ///< close fd in the destructor
+		unsigned interval; ///< time between two writes in milliseconds
+		pthread_key_t buffer_key; ///< key of the buffer of each thread
+		line_t *queued; ///< queued lines, the newest first, changed with atomic operations only
+		pthread_mutex_t write_mutex; ///< serializes writing the queue to the file, never taken by threads logging
+		volatile bool finish; ///< tells the background thread to stop
+		bool started; ///< true if the background thread was started
+		pthread_t thread_handle; ///< handle of the background thread
+
+		AsyncLog *next_instance; ///< next entry in the list of all objects
+		static AsyncLog *instances; ///< list of all objects, for flushAll()
+		static pthread_mutex_t instances_mutex; ///< protects instances and next_instance
+		static pthread_once_t exit_handler_once; ///< makes sure registerExitHandler() is only called once
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,231 @@
+/*  @file audioencoder.cpp
+    @brief Contains AudioEncoder - Converts received A-Law audio to WAV files while recording
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <ctype.h> // for tolower()
+#include "audioencoder.h"
+
+#define conf_sample_rate 8000 // ISDN audio sample rate
+
+/* 16 bit linear value of the bit-reversed A-Law samples as received from ISDN
+   (i.e. bits swapped, odd bits inverted, decoded according to ITU-T G.711) */
+static const short alaw_linear[256] = {
+   -5504,   5504,   -344,    344, -22016,  22016,  -1376,   1376,  -2752,   2752,
+     -88,     88, -11008,  11008,   -688,    688,  -7552,   7552,   -472,    472,
+  -30208,  30208,  -1888,   1888,  -3776,   3776,   -216,    216, -15104,  15104,
+    -944,    944,  -4480,   4480,   -280,    280, -17920,  17920,  -1120,   1120,
+   -2240,   2240,    -24,     24,  -8960,   8960,   -560,    560,  -6528,   6528,
+    -408,    408, -26112,  26112,  -1632,   1632,  -3264,   3264,   -152,    152,
+  -13056,  13056,   -816,    816,  -6016,   6016,   -376,    376, -24064,  24064,
+   -1504,   1504,  -3008,   3008,   -120,    120, -12032,  12032,   -752,    752,
+   -8064,   8064,   -504,    504, -32256,  32256,  -2016,   2016,  -4032,   4032,
+    -248,    248, -16128,  16128,  -1008,   1008,  -4992,   4992,   -312,    312,
+  -19968,  19968,  -1248,   1248,  -2496,   2496,    -56,     56,  -9984,   9984,
+    -624,    624,  -7040,   7040,   -440,    440, -28160,  28160,  -1760,   1760,
+   -3520,   3520,   -184,    184, -14080,  14080,   -880,    880,  -5248,   5248,
+    -328,    328, -20992,  20992,  -1312,   1312,  -2624,   2624,    -72,     72,
+  -10496,  10496,   -656,    656,  -7296,   7296,   -456,    456, -29184,  29184,
+   -1824,   1824,  -3648,   3648,   -200,    200, -14592,  14592,   -912,    912,
+   -4224,   4224,   -264,    264, -16896,  16896,  -1056,   1056,  -2112,   2112,
+      -8,      8,  -8448,   8448,   -528,    528,  -6272,   6272,   -392,    392,
+  -25088,  25088,  -1568,   1568,  -3136,   3136,   -136,    136, -12544,  12544,
+    -784,    784,  -5760,   5760,   -360,    360, -23040,  23040,  -1440,   1440,
+   -2880,   2880,   -104,    104, -11520,  11520,   -720,    720,  -7808,   7808,
+    -488,    488, -31232,  31232,  -1952,   1952,  -3904,   3904,   -232,    232,
+  -15616,  15616,   -976,    976,  -4736,   4736,   -296,    296, -18944,  18944,
+   -1184,   1184,  -2368,   2368,    -40,     40,  -9472,   9472,   -592,    592,
+   -6784,   6784,   -424,    424, -27136,  27136,  -1696,   1696,  -3392,   3392,
+    -168,    168, -13568,  13568,   -848,    848
+};
+
+/* IMA ADPCM step sizes and step index changes, see IMA Digital Audio Focus and Technical Working Group,
+   "Recommended Practices for Enhancing Digital Audio Compatibility in Multimedia Systems" */
+static const short adpcm_step[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int adpcm_index_change[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+/** @brief Append a little endian value to a string
+
+    @param out string to append to
+    @param value the value
+    @param bytes number of bytes to append
+*/
+static void append_le(string &out, unsigned long value, unsigned bytes)
+{
+	for (unsigned i=0;i<bytes;i++) {
+		out+=static_cast<char>(value & 0xFF);
+		value>>=8;
+	}
+}
+
+AudioEncoder::AudioEncoder(format_t format)
+:format(format),block_fill(0),step_index(0)
+{}
+
+AudioEncoder::format_t
+AudioEncoder::parseFormat(string name) throw (CapiExternalError)
+{
+	for (unsigned i=0;i<name.size();i++)
+		name[i]=tolower(name[i]);
+	if (name=="wav")
+		return WAV_PCM;
+	if (name=="adpcm")
+		return WAV_ADPCM;
+	throw CapiExternalError("unknown audio format "+name,"AudioEncoder::parseFormat()");
+}
+
+void
+AudioEncoder::encode(const unsigned char *data, unsigned length, string &out)
+{
+	if (format==WAV_PCM) {
+		for (unsigned i=0;i<length;i++)
+			append_le(out,static_cast<unsigned short>(alaw_linear[data[i]]),2);
+		return;
+	}
+
+	for (unsigned i=0;i<length;i++) {
+		block[block_fill++]=alaw_linear[data[i]];
+		if (block_fill==adpcm_block_samples)
+			encodeBlock(out);
+	}
+}
+
+void
+AudioEncoder::finish(string &out)
+{
+	if (format==WAV_ADPCM && block_fill) {
+		while (block_fill<adpcm_block_samples)
+			block[block_fill++]=0;
+		encodeBlock(out);
+	}
+}
+
+void
+AudioEncoder::encodeBlock(string &out)
+{
+	// block header: first sample uncompressed, step index, reserved byte
+	int predictor=block[0];
+	append_le(out,static_cast<unsigned short>(block[0]),2);
+	out+=static_cast<char>(step_index);
+	out+='\0';
+
+	unsigned char byte=0;
+	for (unsigned i=1;i<adpcm_block_samples;i++) {
+		int step=adpcm_step[step_index];
+		int diff=block[i]-predictor;
+		unsigned char code=0;
+		if (diff<0) {
+			code=8;
+			diff=-diff;
+		}
+
+		// quantize diff to 3 bits and calculate the value the decoder will reconstruct
+		int vpdiff=step>>3;
+		if (diff>=step) {
+			code|=4;
+			diff-=step;
+			vpdiff+=step;
+		}
+		step>>=1;
+		if (diff>=step) {
+			code|=2;
+			diff-=step;
+			vpdiff+=step;
+		}
+		step>>=1;
+		if (diff>=step) {
+			code|=1;
+			vpdiff+=step;
+		}
+
+		predictor+=(code & 8) ? -vpdiff : vpdiff;
+		if (predictor>32767)
+			predictor=32767;
+		else if (predictor<-32768)
+			predictor=-32768;
+
+		step_index+=adpcm_index_change[code & 7];
+		if (step_index<0)
+			step_index=0;
+		else if (step_index>88)
+			step_index=88;
+
+		if (i & 1) // samples are stored with the low nibble first
+			byte=code;
+		else
+			out+=static_cast<char>(byte | (code<<4));
+	}
+	block_fill=0;
+}
+
+unsigned
+AudioEncoder::headerSize()
+{
+	return format==WAV_PCM ? 44 : 60;
+}
+
+unsigned long
+AudioEncoder::dataSize(unsigned long samples)
+{
+	if (format==WAV_PCM)
+		return samples*2;
+	return (samples+adpcm_block_samples-1)/adpcm_block_samples*adpcm_block_size;
+}
+
+string
+AudioEncoder::header(unsigned long samples)
+{
+	unsigned long data_size=dataSize(samples);
+	string h("RIFF");
+	append_le(h,headerSize()-8+data_size,4);
+	h+="WAVEfmt ";
+	if (format==WAV_PCM) {
+		append_le(h,16,4); // size of fmt chunk
+		append_le(h,1,2); // PCM
+		append_le(h,1,2); // mono
+		append_le(h,conf_sample_rate,4);
+		append_le(h,conf_sample_rate*2,4); // bytes per second
+		append_le(h,2,2); // block align
+		append_le(h,16,2); // bits per sample
+	} else {
+		append_le(h,20,4); // size of fmt chunk
+		append_le(h,0x11,2); // IMA ADPCM
+		append_le(h,1,2); // mono
+		append_le(h,conf_sample_rate,4);
+		append_le(h,conf_sample_rate*adpcm_block_size/adpcm_block_samples,4); // bytes per second
+		append_le(h,adpcm_block_size,2); // block align
+		append_le(h,4,2); // bits per sample
+		append_le(h,2,2); // size of extension
+		append_le(h,adpcm_block_samples,2); // samples per block
+		h+="fact"; // needed for compressed formats to tell the real number of samples
+		append_le(h,4,4);
+		append_le(h,samples,4);
+	}
+	h+="data";
+	append_le(h,data_size,4);
+	return h;
+}
+
+/* History
+
+$Log$
+
+*/
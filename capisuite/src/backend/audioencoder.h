@@ -0,0 +1,127 @@
+/** @file audioencoder.h
+    @brief Contains AudioEncoder - Converts received A-Law audio to WAV files while recording
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef AUDIOENCODER_H
+#define AUDIOENCODER_H
+
+#include <string>
+#include "capiexception.h"
+
+using namespace std;
+
+/** @brief Converts received A-Law audio to WAV files while recording
+
+    ISDN delivers audio as bit-reversed A-Law with 8000 samples per second. To
+    mail a recorded call, it must be converted to a format common mail clients
+    can play. Instead of converting the complete file after the call with an
+    external program, FileWriter feeds the received data through an AudioEncoder
+    while the call is in progress, so the file is ready at hangup.
+
+    Supported formats are:
+	- WAV_PCM: WAV with 16 bit linear PCM (128 kbit/s), plays everywhere
+	- WAV_ADPCM: WAV with IMA ADPCM (4 bit per sample, 32 kbit/s), a quarter of
+	  the size of WAV_PCM and half of the size of the A-Law data
+
+    The sizes in the WAV header depend on the amount of data, so the header is
+    written with header() when the recording has finished.
+
+    @author agent
+*/
+class AudioEncoder
+{
+	public:
+		/** @brief supported output formats
+		*/
+		enum format_t {
+			WAV_PCM, ///< WAV, 16 bit linear PCM
+			WAV_ADPCM ///< WAV, IMA ADPCM with 4 bit per sample
+		};
+
+		/** @brief Constructor. Create an encoder for the given format.
+
+		    @param format output format
+		*/
+		AudioEncoder(format_t format);
+
+		/** @brief Find the format belonging to a name
+
+		    @param name "wav" for WAV_PCM or "adpcm" for WAV_ADPCM, case is ignored
+		    @return the format
+		    @throw CapiExternalError Thrown if the name is unknown
+		*/
+		static format_t parseFormat(string name) throw (CapiExternalError);
+
+		/** @brief Encode A-Law data
+
+		    @param data bit-reversed A-Law samples as received from ISDN
+		    @param length number of samples
+		    @param out the encoded data is appended here
+		*/
+		void encode(const unsigned char *data, unsigned length, string &out);
+
+		/** @brief Encode the rest of the samples at the end of the recording
+
+		    WAV_ADPCM encodes whole blocks only, so the last block is filled up with silence.
+
+		    @param out the encoded data is appended here
+		*/
+		void finish(string &out);
+
+		/** @brief Create the file header
+
+		    @param samples number of samples contained in the file
+		    @return the header, always headerSize() bytes
+		*/
+		string header(unsigned long samples);
+
+		/** @brief Return the size of the header
+
+		    @return size of the header in bytes
+		*/
+		unsigned headerSize();
+
+		/** @brief Return the size of the encoded data
+
+		    @param samples number of samples
+		    @return number of bytes needed for the given number of samples, without header
+		*/
+		unsigned long dataSize(unsigned long samples);
+
+	private:
+		/** @brief Encode one IMA ADPCM block of adpcm_block_samples samples
+
+		    @param out the encoded block is appended here
+		*/
+		void encodeBlock(string &out);
+
+		enum {
+			adpcm_block_size=256, ///< bytes per IMA ADPCM block
+			adpcm_block_samples=505 ///< samples per IMA ADPCM block: one in the header and two per remaining byte
+		};
+
+		format_t format; ///< output format
+		short block[adpcm_block_samples]; ///< samples collected for the next IMA ADPCM block
+		unsigned block_fill; ///< number of samples in block
+		int step_index; ///< IMA ADPCM step index, carried over from block to block
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -14,18 +14,37 @@
  *                                                                         *
  ***************************************************************************/
 
+// the message macros of capiutils.h send with capi_put_cmsg(), this redirects them to the CapiTransport
+#define capi_put_cmsg capi_transport_put_cmsg
+
 #include <iostream>
 #include <sstream>
+#include <string.h> // for memcpy()
 #include "connection.h"
 #include "applicationinterface.h"
+#include "callinterface.h"
 #include "capi.h"
+#include "asynclog.h"
+#include "dispatchthread.h"
+#include "metrics.h"
 #include "../../config.h"
 
 // initialize static members
+CapiTransport* Capi::transport=NULL;
 short Capi::numControllers=0;
 string Capi::capiManufacturer, Capi::capiVersion;
 vector <Capi::CardProfileT> Capi::profiles;
 
+static Capi20Transport capi20_transport; ///< used if no other transport is given to Capi
+
+unsigned capi_transport_put_cmsg(_cmsg *cmsg)
+{
+	unsigned char message[2048]; // the message macros only build messages with a few short structs
+	capi_cmsg2message(cmsg,message);
+	Metrics::count(Metrics::MESSAGES_SENT);
+	return Capi::transport->putMessage(cmsg->ApplId,message);
+}
+
 void* capi_exec_handler(void* arg)
 {
         if (!arg) {
@@ -37,10 +56,22 @@ void* capi_exec_handler(void* arg)
 	instance->run();
 }
 
-Capi::Capi (ostream& debug, unsigned short debug_level, ostream &error, unsigned short DDILength, unsigned short DDIBaseLength, vector<string> DDIStopNumbers, unsigned maxLogicalConnection, unsigned maxBDataBlocks,unsigned maxBDataLen) throw (CapiError, CapiMsgError)
+Capi::Capi (ostream& debug, unsigned short debug_level, ostream &error, unsigned short DDILength, unsigned short DDIBaseLength, vector<string> DDIStopNumbers, unsigned maxLogicalConnection, unsigned maxBDataBlocks,unsigned maxBDataLen, FileWriter::sync_policy_t receive_sync, unsigned dispatchThreads, CapiTransport *transport) throw (CapiError, CapiMsgError)
 :debug(debug),debug_level(debug_level),error(error),messageNumber(0),usedInfoMask(0x10),usedCIPMask(0),
-DDILength(DDILength),DDIBaseLength(DDIBaseLength),DDIStopNumbers(DDIStopNumbers)
+DDILength(DDILength),DDIBaseLength(DDIBaseLength),DDIStopNumbers(DDIStopNumbers),receive_sync(receive_sync),
+maxBDataBlocks(maxBDataBlocks),maxBDataLen(maxBDataLen)
 {
+	for (int i=0;i<256;i++)
+		connection_table[i]=NULL;
+	for (int i=0;i<128;i++)
+		used_b_channels[i][0]=used_b_channels[i][1]=0;
+	for (int i=0;i<pending_connects_size;i++)
+		pending_connects[i].conn=NULL;
+	pthread_mutex_init(&pending_mutex, NULL);
+	pthread_mutex_init(&message_number_mutex, NULL);
+	initDispatchTable();
+	Capi::transport=transport ? transport : &capi20_transport;
+
 	if (debug_level >= 2)
 		debug << prefix() << "Capi object created" << endl;
 	Capi::readProfile(); // can throw CapiMsgError. Just propagate...
@@ -56,16 +87,34 @@ DDILength(DDILength),DDIBaseLength(DDIBaseLength),DDIStopNumbers(DDIStopNumbers)
 	if (debug_level >= 2)
 		debug << prefix() << "Registering for handling max. " << maxLogicalConnection << " logical connections" << endl;
 
-	unsigned info = capi20_register(maxLogicalConnection, maxBDataBlocks, maxBDataLen, &applId);
+	// CAPI 2.0 allows windows of up to 7 blocks with 128 to 2048 bytes each
+	if (Capi::maxBDataBlocks<1)
+		Capi::maxBDataBlocks=1;
+	else if (Capi::maxBDataBlocks>7)
+		Capi::maxBDataBlocks=7;
+	if (Capi::maxBDataLen<128)
+		Capi::maxBDataLen=128;
+	else if (Capi::maxBDataLen>2048)
+		Capi::maxBDataLen=2048;
+
+	unsigned info = Capi::transport->registerApplication(maxLogicalConnection, Capi::maxBDataBlocks, Capi::maxBDataLen, &applId);
 	if (applId == 0 || info!=0)
         	throw (CapiMsgError(info,"Error while registering application: "+describeParamInfo(info),"Capi::Capi()"));
 
+	setVoiceTransfer(0,0);
+	setFaxTransfer(0,0);
+
 	if (DDILength)
 		usedInfoMask|=0x80; // enable Called Party Number Info Element for PtP configuration
 
 	for (int i=1;i<=Capi::numControllers;i++)
 		listen_req(i, usedInfoMask, usedCIPMask); // can throw CapiMsgError
 
+	for (unsigned i=0;i<dispatchThreads;i++)
+		dispatch_threads.push_back(new DispatchThread(this)); // can throw CapiMsgError
+	if (debug_level >= 2 && dispatchThreads)
+		debug << prefix() << "started " << dec << dispatchThreads << " threads for processing messages" << endl;
+
 	int erg=pthread_create(&thread_handle, NULL, capi_exec_handler, this); // create a normal thread
 	if (erg!=0)
 		throw (CapiMsgError(erg,"Error while starting message thread","Capi::Capi()"));
@@ -80,7 +129,27 @@ Capi::~Capi ()
 	if (ret)
 		throw (CapiMsgError(ret,"Error while joining Capi thread","Capi::~Capi()"));
 
-	unsigned info = capi20_release(applId); // this will abort capi20_waitformessage
+	for (int i=0;i<dispatch_threads.size();i++)
+		delete dispatch_threads[i]; // processes the messages still waiting
+
+	for (int i=0;i<256;i++)
+		if (connection_table[i])
+			delete[] connection_table[i];
+	pthread_mutex_destroy(&pending_mutex);
+	pthread_mutex_destroy(&message_number_mutex);
+
+	if (debug_level >= 2)
+		for (int i=0;i<256;i++)
+			for (int j=0;j<2;j++)
+				if (dispatch_table[i][j].count) {
+					debug << prefix() << "received " << dec << dispatch_table[i][j].count << " ";
+					if (dispatch_table[i][j].name)
+						debug << dispatch_table[i][j].name << " messages" << endl;
+					else
+						debug << "unhandled messages with command 0x" << hex << i << (j ? " (IND)" : " (CONF)") << endl;
+				}
+
+	unsigned info = Capi::transport->release(applId); // this will abort waitForMessage()
 	if (info != 0)
 		throw (CapiMsgError(info,"Error while unregistering application: "+describeParamInfo(info),"Capi::~Capi()"));
 
@@ -100,7 +169,88 @@ Capi::registerApplicationInterface(ApplicationInterface* application_in)
 void
 Capi::unregisterConnection(_cdword plci)
 {
-	connections.erase(plci);
+	Connection **row=connection_table[plci & 0xFF];
+	if (row && row[(plci>>8) & 0xFF]) {
+		countBChannel(plci,row[(plci>>8) & 0xFF]->our_call,-1);
+		row[(plci>>8) & 0xFF]=NULL;
+	}
+}
+
+_cword
+Capi::nextMessageNumber()
+{
+	pthread_mutex_lock(&message_number_mutex);
+	_cword number=messageNumber++;
+	pthread_mutex_unlock(&message_number_mutex);
+	return number;
+}
+
+void
+Capi::registerConnection(_cdword plci, Connection *conn)
+{
+	Connection **row=connection_table[plci & 0xFF];
+	if (!row) {
+		// Several dispatch threads may register the first connection of a controller at the same time.
+		// The row is initialized before it's published, the builtin is a full barrier.
+		Connection **new_row=new Connection*[256];
+		for (int i=0;i<256;i++)
+			new_row[i]=NULL;
+		row=__sync_val_compare_and_swap(&connection_table[plci & 0xFF],static_cast<Connection**>(NULL),new_row);
+		if (row) // another thread was faster
+			delete[] new_row;
+		else
+			row=new_row;
+	}
+	if (row[(plci>>8) & 0xFF]) // left over from a connection which was never unregistered
+		countBChannel(plci,row[(plci>>8) & 0xFF]->our_call,-1);
+	row[(plci>>8) & 0xFF]=conn;
+	countBChannel(plci,conn->our_call,1);
+}
+
+Connection*
+Capi::getConnection(_cdword plci, const char *message) throw (CapiError)
+{
+	Connection *conn=findConnection(plci);
+	if (!conn)
+		throw(CapiError(string("PLCI unknown in ")+message,"Capi::readMessage()"));
+	return conn;
+}
+
+void
+Capi::registerPendingConnect(_cword messageNumber, Connection *conn) throw (CapiMsgError)
+{
+	pthread_mutex_lock(&pending_mutex);
+	for (unsigned i=0;i<pending_connects_size;i++) {
+		pending_connect_t &slot=pending_connects[(messageNumber+i)%pending_connects_size];
+		if (!slot.conn) {
+			slot.messageNumber=messageNumber;
+			slot.conn=conn;
+			countBChannel(conn->controller,true,1);
+			pthread_mutex_unlock(&pending_mutex);
+			return;
+		}
+	}
+	pthread_mutex_unlock(&pending_mutex);
+	throw(CapiMsgError(0x1008,"Error while CONNECT_REQ: too many outgoing calls waiting for confirmation","Capi::connect_req()")); // 0x1008 = OS resource error
+}
+
+Connection*
+Capi::takePendingConnect(_cword messageNumber)
+{
+	Connection *conn=NULL;
+	pthread_mutex_lock(&pending_mutex);
+	// as slots can be freed in any order, we can't stop probing at the first free slot
+	for (unsigned i=0;i<pending_connects_size;i++) {
+		pending_connect_t &slot=pending_connects[(messageNumber+i)%pending_connects_size];
+		if (slot.conn && slot.messageNumber==messageNumber) {
+			conn=slot.conn;
+			slot.conn=NULL;
+			countBChannel(conn->controller,true,-1);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pending_mutex);
+	return conn;
 }
 
 void
@@ -114,7 +264,7 @@ Capi::listen_req(_cdword Controller, _cdword InfoMask, _cdword CIPMask) throw (C
     		debug << prefix() << ">LISTEN_REQ ApplID 0x" << hex << applId << " msgNum 0x" << messageNumber << " Controller 0x" << Controller << " InfoMask 0x"
 		 << InfoMask << " CIPMask 0x" << CIPMask << " 0x0 NULL NULL" << endl;
 	}
-	unsigned info=LISTEN_REQ(&CMSG, applId, messageNumber++, Controller, InfoMask,CIPMask,0,NULL,NULL);
+	unsigned info=LISTEN_REQ(&CMSG, applId, nextMessageNumber(), Controller, InfoMask,CIPMask,0,NULL,NULL);
 	if (debug_level >= 2) {
 		debug << prefix() << "info: " << info << endl;
 	}
@@ -131,7 +281,7 @@ Capi::alert_req(_cdword plci) throw (CapiMsgError)
 	if (debug_level >= 2) {
 	    	debug << prefix() << ">ALERT_REQ: ApplId 0x" << hex << applId << ", MsgNr 0x" << messageNumber << ", PLCI 0x" << plci << endl;
 	}
-	unsigned info=ALERT_REQ(&CMSG, applId, messageNumber++, plci, 
+	unsigned info=ALERT_REQ(&CMSG, applId, nextMessageNumber(), plci, 
 	    NULL, NULL, NULL, NULL
 	#ifdef HAVE_NEW_CAPI4LINUX
 	    , NULL
@@ -151,23 +301,24 @@ Capi::connect_req(Connection *conn, _cdword controller, _cword CIPValue, _cstruc
 {
 	_cmsg CMSG;  // Nachrichten-Struktur
 
-	messageNumber++;
+	_cword msgNum=nextMessageNumber();
 
-	connections[0xFACE0000 | messageNumber]=conn; // pseudo PLCI to see which CONNECT_CONF corresponds to which CONNECT_REQ
-						      // this can't be a valid NCCI as a valid ncci & 0xFF000000 = 0
+	registerPendingConnect(msgNum,conn); // to see which CONNECT_CONF corresponds to which CONNECT_REQ
 
 	if (debug_level >= 2) {
-		debug << prefix() << ">CONNECT_REQ: ApplId 0x" << hex << applId << ", MsgNr 0x" << messageNumber << ", Controller 0x" << controller
+		debug << prefix() << ">CONNECT_REQ: ApplId 0x" << hex << applId << ", MsgNr 0x" << msgNum << ", Controller 0x" << controller
 		<< " CIPValue 0x" << CIPValue << ", B1proto 0x" << B1protocol << ", B2proto 0x" << B2protocol <<", B3proto 0x" << B3protocol << endl;
 	}
-	unsigned info=CONNECT_REQ(&CMSG, applId, messageNumber, controller, CIPValue, calledPartyNumber, callingPartyNumber, NULL, NULL,
+	unsigned info=CONNECT_REQ(&CMSG, applId, msgNum, controller, CIPValue, calledPartyNumber, callingPartyNumber, NULL, NULL,
 		B1protocol, B2protocol, B3protocol, B1configuration, B2configuration, B3configuration, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
 	if (debug_level >= 2) {
 		debug << prefix() << "info: " << info << endl;
 	}
 
-	if (info != 0)
+	if (info != 0) {
+		takePendingConnect(msgNum); // there will be no CONNECT_CONF
 		throw(CapiMsgError(info,"Error while CONNECT_REQ: "+Capi::describeParamInfo(info),"Capi::connect_req()"));
+	}
 }
 
 void
@@ -178,7 +329,7 @@ Capi::connect_b3_req(_cdword plci) throw (CapiMsgError)
 	if (debug_level >= 2) {
 		debug << prefix() << ">CONNECT_B3_REQ: ApplId 0x" << hex << applId << ", MsgNr 0x" << messageNumber << ", PLCI 0x" << plci << endl;
 	}
-	unsigned info=CONNECT_B3_REQ(&CMSG, applId, messageNumber++, plci, NULL);
+	unsigned info=CONNECT_B3_REQ(&CMSG, applId, nextMessageNumber(), plci, NULL);
 	if (debug_level >= 2) {
 	    	debug << prefix() << "info: " << info << endl;
 	}
@@ -194,7 +345,7 @@ Capi::select_b_protocol_req (_cdword plci, _cword B1protocol, _cword B2protocol,
 
 	if (debug_level >= 2)	    	debug << prefix() << ">SELECT_B_PROTOCOL_REQ: ApplId 0x" << hex << applId << ", MsgNr 0x" << messageNumber << ", PLCI 0x" << plci
 	 		     << ", B1protocol " << B1protocol << ", B2protocol " << B2protocol << ", B3protocol " << B3protocol << endl;
-	unsigned info=SELECT_B_PROTOCOL_REQ(&CMSG, applId, messageNumber++, plci, B1protocol, B2protocol, B3protocol, B1configuration, B2configuration, B3configuration);
+	unsigned info=SELECT_B_PROTOCOL_REQ(&CMSG, applId, nextMessageNumber(), plci, B1protocol, B2protocol, B3protocol, B1configuration, B2configuration, B3configuration);
 	if (debug_level >= 2)
 			debug << prefix() << "info: " << info << endl;
 
@@ -209,7 +360,7 @@ Capi::data_b3_req (_cdword ncci, void* Data, _cword DataLength,_cword DataHandle
 	if (debug_level >= 3)
 		debug << prefix() << ">DATA_B3_REQ ApplId 0x" << hex << applId << ", msgNum 0x" << messageNumber << ", NCCI 0x" << ncci << dec
 	 		 << ", DataLen " << DataLength << ", DataHandle " << DataHandle << hex << ", Flags 0x" << Flags << endl;
-	unsigned info=DATA_B3_REQ(&CMSG, applId, messageNumber++, ncci, Data, DataLength, DataHandle, Flags);
+	unsigned info=DATA_B3_REQ(&CMSG, applId, nextMessageNumber(), ncci, Data, DataLength, DataHandle, Flags);
 	if (debug_level >= 3)
 			debug << prefix() << "info: " << info << endl;
 
@@ -223,7 +374,7 @@ Capi::disconnect_b3_req (_cdword ncci, _cstruct ncpi) throw (CapiMsgError)
 	_cmsg    CMSG;  // Nachrichten-Struktur
 	if (debug_level >= 2)
 		debug << prefix() << ">DISCONNECT_B3_REQ ApplId 0x" << hex << applId << " MsgNum 0x" << messageNumber << " NCCI 0x" << ncci << endl;
-	unsigned info=DISCONNECT_B3_REQ(&CMSG, applId, messageNumber++, ncci, ncpi);
+	unsigned info=DISCONNECT_B3_REQ(&CMSG, applId, nextMessageNumber(), ncci, ncpi);
 	if (debug_level >= 2)
 		debug << prefix() << "info: " << info << endl;
 
@@ -238,7 +389,7 @@ Capi::disconnect_req (_cdword plci, _cstruct Keypadfacility, _cstruct Useruserda
 	if (debug_level >= 2) {
 		debug << prefix() << ">DISCONNECT_REQ ApplId 0x" << hex << applId << " MsgNum 0x" << messageNumber << " PLCI 0x" << plci << endl;
 	}
-	unsigned info=DISCONNECT_REQ(&CMSG, applId, messageNumber++, plci, NULL, Keypadfacility, Useruserdata, Facilitydataarray);
+	unsigned info=DISCONNECT_REQ(&CMSG, applId, nextMessageNumber(), plci, NULL, Keypadfacility, Useruserdata, Facilitydataarray);
 	if (debug_level >= 2) {
 		debug << prefix() << "info: " << info << endl;
 	}
@@ -254,7 +405,7 @@ Capi::facility_req (_cdword address, _cword FacilitySelector, _cstruct FacilityR
 	if (debug_level >= 2) {
 		debug << prefix() << ">FACILITY_REQ ApplId 0x" << hex << applId << ", MsgNr 0x" << messageNumber << ", Address 0x" << address << ", FacilitySelector 0x" << FacilitySelector << endl;
 	}
-	unsigned info=FACILITY_REQ(&CMSG, applId, messageNumber++, address, FacilitySelector, FacilityRequestParameter);
+	unsigned info=FACILITY_REQ(&CMSG, applId, nextMessageNumber(), address, FacilitySelector, FacilityRequestParameter);
 	if (debug_level >= 2) {
 		debug << prefix() << "info: " << info << endl;
 	}
@@ -300,6 +451,41 @@ Capi::setListenTelephony (_cdword controller) throw (CapiMsgError,CapiError)
 	}
 }
 
+void
+Capi::setVoiceTransfer (unsigned window, unsigned block_size, unsigned max_latency)
+{
+	voice_transfer=limitTransfer(window,block_size,4,320);
+	voice_transfer.max_queued=max_latency*8; // A-Law has 8 bytes per msec
+	if (debug_level >= 2) {
+		debug << prefix() << "sending voice in blocks of " << dec << voice_transfer.block_size << " bytes, window " << voice_transfer.window;
+		if (max_latency)
+			debug << ", max. " << max_latency << " msecs queued";
+		debug << endl;
+	}
+}
+
+void
+Capi::setFaxTransfer (unsigned window, unsigned block_size)
+{
+	fax_transfer=limitTransfer(window,block_size,maxBDataBlocks,maxBDataLen);
+	if (debug_level >= 2)
+		debug << prefix() << "sending fax in blocks of " << dec << fax_transfer.block_size << " bytes, window " << fax_transfer.window << endl;
+}
+
+Capi::transfer_parameters_t
+Capi::limitTransfer (unsigned window, unsigned block_size, unsigned auto_window, unsigned auto_block_size)
+{
+	transfer_parameters_t t;
+	t.window= window ? window : auto_window;
+	t.block_size= block_size ? block_size : auto_block_size;
+	t.max_queued=0;
+	if (t.window>maxBDataBlocks)
+		t.window=maxBDataBlocks;
+	if (t.block_size>maxBDataLen)
+		t.block_size=maxBDataLen;
+	return t;
+}
+
 void
 Capi::connect_resp (_cword messageNumber, _cdword plci, _cword reject, _cword B1protocol, _cword B2protocol, _cword B3protocol, _cstruct B1configuration, _cstruct B2configuration, _cstruct B3configuration) throw (CapiMsgError)
 {
@@ -442,288 +628,404 @@ Capi::disconnect_resp (_cword messageNumber, _cdword plci) throw (CapiMsgError)
 
 
 
+void
+Capi::initDispatchTable()
+{
+	for (int i=0;i<256;i++)
+		for (int j=0;j<2;j++) {
+			dispatch_table[i][j].name=NULL;
+			dispatch_table[i][j].handler=NULL;
+			dispatch_table[i][j].count=0;
+		}
+
+	static const struct {
+		_cbyte command;
+		bool indication;
+		const char *name;
+		message_handler_t handler;
+	} handlers[] = {
+		{ CAPI_ALERT, false, "ALERT_CONF", &Capi::alert_conf },
+		{ CAPI_CONNECT, false, "CONNECT_CONF", &Capi::connect_conf },
+		{ CAPI_CONNECT_B3, false, "CONNECT_B3_CONF", &Capi::connect_b3_conf },
+		{ CAPI_SELECT_B_PROTOCOL, false, "SELECT_B_PROTOCOL_CONF", &Capi::select_b_protocol_conf },
+		{ CAPI_LISTEN, false, "LISTEN_CONF", &Capi::listen_conf },
+		{ CAPI_DATA_B3, false, "DATA_B3_CONF", &Capi::data_b3_conf },
+		{ CAPI_FACILITY, false, "FACILITY_CONF", &Capi::facility_conf },
+		{ CAPI_DISCONNECT_B3, false, "DISCONNECT_B3_CONF", &Capi::disconnect_b3_conf },
+		{ CAPI_DISCONNECT, false, "DISCONNECT_CONF", &Capi::disconnect_conf },
+		{ CAPI_CONNECT, true, "CONNECT_IND", &Capi::connect_ind },
+		{ CAPI_CONNECT_ACTIVE, true, "CONNECT_ACTIVE_IND", &Capi::connect_active_ind },
+		{ CAPI_CONNECT_B3, true, "CONNECT_B3_IND", &Capi::connect_b3_ind },
+		{ CAPI_CONNECT_B3_ACTIVE, true, "CONNECT_B3_ACTIVE_IND", &Capi::connect_b3_active_ind },
+		{ CAPI_DISCONNECT, true, "DISCONNECT_IND", &Capi::disconnect_ind },
+		{ CAPI_DISCONNECT_B3, true, "DISCONNECT_B3_IND", &Capi::disconnect_b3_ind },
+		{ CAPI_DATA_B3, true, "DATA_B3_IND", &Capi::data_b3_ind },
+		{ CAPI_FACILITY, true, "FACILITY_IND", &Capi::facility_ind },
+		{ CAPI_INFO, true, "INFO_IND", &Capi::info_ind }
+	};
+
+	for (unsigned i=0;i<sizeof(handlers)/sizeof(handlers[0]);i++) {
+		dispatch_entry_t &entry=dispatch_table[handlers[i].command][handlers[i].indication];
+		entry.name=handlers[i].name;
+		entry.handler=handlers[i].handler;
+	}
+}
+
+unsigned long
+Capi::getMessageCount(_cbyte command, _cbyte subcommand)
+{
+	if (subcommand!=CAPI_CONF && subcommand!=CAPI_IND)
+		return 0;
+	return dispatch_table[command][subcommand==CAPI_IND].count;
+}
+
+unsigned
+Capi::getBChannels(unsigned controller)
+{
+	if (controller<1 || controller>(unsigned)Capi::numControllers)
+		return 0;
+	return profiles[controller-1].bChannels;
+}
+
+unsigned
+Capi::getUsedBChannels(unsigned controller, bool incoming_only)
+{
+	long used=used_b_channels[controller & 0x7F][0];
+	if (!incoming_only)
+		used+=used_b_channels[controller & 0x7F][1];
+	return used>0 ? used : 0;
+}
+
+unsigned
+Capi::selectController(const vector<unsigned> &controllers)
+{
+	unsigned best=0;
+	long best_free=0;
+	for (vector<unsigned>::const_iterator i=controllers.begin();i!=controllers.end();i++) {
+		long free=static_cast<long>(getBChannels(*i))-getUsedBChannels(*i);
+		if (*i>=1 && *i<=(unsigned)Capi::numControllers && (!best || free>best_free)) {
+			best=*i;
+			best_free=free;
+		}
+	}
+	return best;
+}
+
 void
 Capi::readMessage (void) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
 {
-	_cmsg nachricht;
- 	unsigned info=CAPI_GET_CMSG(&nachricht, applId);  // don't use capi20_get_message here as CAPI_GET_CMSG does disassembling of message parameters for us
+	unsigned char *message;
+ 	unsigned info=Capi::transport->getMessage(applId, &message);
 	switch (info) {
-		case CapiNoError:           //----- a message has been read -----
-      			switch (nachricht.Subcommand) {
-         			case CAPI_CONF:    // confirmation
-					switch (nachricht.Command) {
-						case CAPI_ALERT: {
-							_cdword plci=ALERT_CONF_PLCI(&nachricht);
-							if (debug_level >= 2)
-								debug << prefix() << "<ALERT_CONF, PLCI: 0x" << hex << ALERT_CONF_PLCI(&nachricht) << ", Info 0x" << ALERT_CONF_INFO(&nachricht) << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in ALERT_CONF","Capi::readMessage()"));
-							else
-								connections[plci]->alert_conf(nachricht);
-						} break;
-
-						case CAPI_CONNECT: {
-							_cdword pseudoPLCI=0xFACE0000 | nachricht.Messagenumber; // pseudo PLCI as set by connect_req
-							_cdword plci=CONNECT_CONF_PLCI(&nachricht);
-							if (debug_level >= 2)
-								debug << prefix() << "<CONNECT_CONF, PLCI: 0x" << hex << CONNECT_CONF_PLCI(&nachricht) << ", Info 0x" << CONNECT_CONF_INFO(&nachricht) << endl;
-							if (connections.count(pseudoPLCI)==0)
-								throw(CapiError("MessageNumber unknown in CONNECT_CONF","Capi::readMessage()"));
-							else {
-								connections[plci]=connections[pseudoPLCI];
-								connections.erase(pseudoPLCI);
-								connections[plci]->connect_conf(nachricht);
-							}
-						} break;
-
-						case CAPI_CONNECT_B3: {
-							_cdword plci=CONNECT_B3_CONF_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
-							if (debug_level >= 2)
-								debug << prefix() << "<CONNECT_B3_CONF, NCCI: 0x" << hex << CONNECT_B3_CONF_NCCI(&nachricht) << ", Info 0x" << CONNECT_B3_CONF_INFO(&nachricht) << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in CONNECT_B3_CONF","Capi::readMessage()"));
-							else
-								connections[plci]->connect_b3_conf(nachricht);
-						} break;
-
-						case CAPI_SELECT_B_PROTOCOL: {
-							_cdword plci=SELECT_B_PROTOCOL_CONF_PLCI(&nachricht);
-							if (debug_level >= 2)
-								debug << prefix() << "<SELECT_B_PROTOCOL_CONF, PLCI: 0x" << hex << SELECT_B_PROTOCOL_CONF_PLCI(&nachricht) << ", Info 0x" << SELECT_B_PROTOCOL_CONF_INFO(&nachricht) << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in SELECT_B_PROTOCOL_CONF","Capi::readMessage()"));
-							else
-								connections[plci]->select_b_protocol_conf(nachricht);
-						} break;
-
-						case CAPI_LISTEN:
-							if (debug_level >= 2)
-								debug << prefix() << "<LISTEN_CONF Controller 0x" << hex << LISTEN_CONF_CONTROLLER(&nachricht) << " Info 0x" << LISTEN_CONF_INFO(&nachricht) << endl;
-
-							if (LISTEN_CONF_INFO(&nachricht)!=0)
-								throw CapiMsgError(LISTEN_CONF_INFO(&nachricht),"LISTEN_REQ was unsuccesful "+Capi::describeParamInfo(LISTEN_CONF_INFO(&nachricht)),"Capi::readMessage()");
-
-						break;
-
-						case CAPI_DATA_B3: {
-							_cdword plci=DATA_B3_CONF_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
-							if (debug_level >= 3)
-								debug << prefix() << "<DATA_B3_CONF, NCCI 0x" << hex << DATA_B3_CONF_NCCI(&nachricht) << dec << ", DataHandle " << DATA_B3_CONF_DATAHANDLE(&nachricht)
-								      << ", Info 0x" << DATA_B3_CONF_INFO(&nachricht) << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in DATA_B3_CONF","Capi::readMessage()"));
-							else
-								connections[plci]->data_b3_conf(nachricht);
-						} break;
-
-
-						case CAPI_FACILITY:
-							switch (FACILITY_CONF_FACILITYSELECTOR(&nachricht)) {
-								case 1: { // DTMF
-									_cdword plci=FACILITY_CONF_PLCI(&nachricht) & 0xFFFF; // this *should* be PLCI but who knows, so let's mask it to be sure
-									if (debug_level >= 2)
-										debug << prefix() << "<FACILITY_CONF PLCI 0x" << hex << FACILITY_CONF_PLCI(&nachricht) << " Info 0x" << FACILITY_CONF_INFO(&nachricht)
-								                     << " FacilitySelector 0x" << FACILITY_CONF_FACILITYSELECTOR(&nachricht) << endl;
-
-		     							if (connections.count(plci)==0)
-										throw(CapiError("PLCI unknown in FACILITY_CONF","Capi::readMessage()"));
-									else
-										connections[plci]->facility_conf_DTMF(nachricht);
-								} break;
-
-								default:
-									error << prefix() << "WARNING: PLCI " << hex << FACILITY_CONF_PLCI(&nachricht) << ": unsupported facility selector " << FACILITY_CONF_FACILITYSELECTOR(&nachricht) << " in FACILITY_CONF" << endl;
-								break;
-							}
-						break;
-
-						case CAPI_DISCONNECT_B3: {
-							_cdword plci=DISCONNECT_B3_CONF_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
-							if (debug_level >= 2)
-								debug << prefix() << "<DISCONNECT_B3_CONF NCCI 0x" << hex << DISCONNECT_B3_CONF_NCCI(&nachricht) << " Info 0x" << DISCONNECT_B3_CONF_INFO(&nachricht)
-							              << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in DISCONNECT_B3_CONF","Capi::readMessage()"));
-							else
-								connections[plci]->disconnect_b3_conf(nachricht);
-						} break;
-
-						case CAPI_DISCONNECT: { // TODO: perhaps we should handle NCPI telling us fax infos here??
-							_cdword plci=DISCONNECT_CONF_PLCI(&nachricht);
-							if (debug_level >= 2)
-								debug << prefix() << "<DISCONNECT_CONF PLCI 0x" << hex << DISCONNECT_CONF_PLCI(&nachricht) << " Info 0x" << DISCONNECT_CONF_INFO(&nachricht)
-						                     << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in DISCONNECT_CONF","Capi::readMessage()"));
-							else
-								connections[plci]->disconnect_conf(nachricht);
-						} break;
-					}
-            			break;
-
-				case CAPI_IND:     // indication
-            				switch (nachricht.Command) {
-						case CAPI_CONNECT: { // call for us
-							_cdword plci=CONNECT_IND_PLCI(&nachricht);
-							if (debug_level >= 2)
-								debug << prefix() << "<CONNECT_IND PLCI 0x" << hex << plci << " CIP 0x" << CONNECT_IND_CIPVALUE(&nachricht) << endl;
-
-							if (connections.count(plci)>0)
-								throw(CapiError("PLCI used twice from CAPI in CONNECT_IND","Capi::readMessage()"));
-							else {
-								Connection *c=new Connection(nachricht,this,DDILength,DDIBaseLength,DDIStopNumbers);
-								connections[plci]=c;
-								if (!DDILength) // if we have PtP then wait until DDI is complete
-									application->callWaiting(c);
-							}
-						} break;
-
-						case CAPI_CONNECT_ACTIVE: {
-							_cdword plci=CONNECT_IND_PLCI(&nachricht);
-							if (debug_level >= 2)
-								debug << prefix() << "<CONNECT_ACTIVE_IND PLCI 0x" << hex << plci << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in CONNECT_ACTIVE_IND","Capi::readMessage()"));
-							else
-								connections[plci]->connect_active_ind(nachricht);
-						} break;
-
-						case CAPI_CONNECT_B3: {
-							_cdword plci=CONNECT_B3_IND_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
-							if (debug_level >= 2)
-								debug << prefix() << "<CONNECT_B3_IND NCCI 0x" << hex << CONNECT_B3_IND_NCCI(&nachricht) << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in CONNECT_B3_IND","Capi::readMessage()"));
-							else
-								connections[plci]->connect_b3_ind(nachricht);
-						} break;
-
-						case CAPI_CONNECT_B3_ACTIVE: {
-							_cdword plci=CONNECT_B3_ACTIVE_IND_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
-							if (debug_level >= 2)
-								debug << prefix() << "<CONNECT_B3_ACTIVE_IND NCCI 0x" << hex << CONNECT_B3_ACTIVE_IND_NCCI(&nachricht) << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in CONNECT_B3_ACTIVE_IND","Capi::readMessage()"));
-							else
-								connections[plci]->connect_b3_active_ind(nachricht);
-						} break;
-
-						case CAPI_DISCONNECT: {  // call gone, we'll confirm to CAPI
-							_cdword plci=DISCONNECT_IND_PLCI(&nachricht);
-							if (debug_level >= 2)
-								debug << prefix() << "<DISCONNECT_IND PLCI 0x" << hex << plci << " Reason 0x" << DISCONNECT_IND_REASON(&nachricht) << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in DISCONNECT_IND","Capi::readMessage()"));
-							else {
-								connections[plci]->disconnect_ind(nachricht);
-							}
-						} break;
-
-						case CAPI_DISCONNECT_B3: {
-							_cdword plci=DISCONNECT_B3_IND_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
-							if (debug_level >= 2)
-								debug << prefix() << "<DISCONNECT_B3_IND NCCI 0x" << hex << DISCONNECT_B3_IND_NCCI(&nachricht) << " Reason 0x" << DISCONNECT_B3_IND_REASON_B3(&nachricht) << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in DISCONNECT_B3_IND","Capi::readMessage()"));
-							else
-								connections[plci]->disconnect_b3_ind(nachricht);
-						} break;
-
-						case CAPI_DATA_B3: {
-							_cdword plci=DATA_B3_IND_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
-							if (debug_level >= 3)
-								debug << prefix() << "<DATA_B3_IND: NCCI 0x" << hex << DATA_B3_IND_NCCI(&nachricht) << dec << ", DataLength " << DATA_B3_IND_DATALENGTH(&nachricht)
-							      		<< hex << ", DataHandle 0x" << DATA_B3_IND_DATAHANDLE(&nachricht) << ", Flags 0x" << DATA_B3_IND_FLAGS(&nachricht) << endl;
-							if (connections.count(plci)==0)
-								throw(CapiError("PLCI unknown in DATA_B3_IND","Capi::readMessage()"));
-							else
-								connections[plci]->data_b3_ind(nachricht);
-						} break;
-
-						case CAPI_FACILITY:
-							switch (FACILITY_IND_FACILITYSELECTOR(&nachricht)) {
-								case 1: { // DTMF
-									_cdword plci=FACILITY_IND_PLCI(&nachricht) & 0xFFFF; // we *should* get PLCI but just to be sure we mask the NCCI-part out...
-									if (debug_level >= 2)
-										debug << prefix() << "<FACILITY_IND: PLCI 0x" << hex << FACILITY_IND_PLCI(&nachricht) << ", FacilitySelector 0x" << FACILITY_IND_FACILITYSELECTOR(&nachricht) << endl;
-
-		     							if (connections.count(plci)==0)
-										throw(CapiError("PLCI unknown in FACILITY_IND","Capi::readMessage()"));
-									else
-										connections[plci]->facility_ind_DTMF(nachricht);
-								} break;
-
-								default:
-									error << prefix() << "WARNING: PLCI " << hex << (FACILITY_IND_PLCI(&nachricht) & 0xFFFF) << ": Unsupported facility selector " << FACILITY_IND_FACILITYSELECTOR(&nachricht) << " in FACILITY_IND" << endl;
-								break;
-							}
-						break;
-
-						case CAPI_INFO:
-							switch (INFO_IND_INFONUMBER(&nachricht)) {
-								case 0x8001: { // ALERTING
-									_cdword plci=INFO_IND_PLCI(&nachricht);
-									if (debug_level >= 2)
-										debug << prefix() << "<INFO_IND: PLCI 0x" << hex << plci << ", InfoNumber ALERTING " << endl;
-		     							if (connections.count(plci)==0)
-										throw(CapiError("PLCI unknown in INFO_IND","Capi::readMessage()"));
-									else
-										connections[plci]->info_ind_alerting(nachricht);
-								} break;
-
-								case 0x70: { // Called Party Number
-									_cdword plci=INFO_IND_PLCI(&nachricht);
-									if (debug_level >= 2)
-										debug << prefix() << "<INFO_IND: PLCI 0x" << hex << plci << ", InfoNumber CalledPartyNr " << endl;
-									
-									bool nrComplete;
-									if (connections.count(plci)==0)
-										throw(CapiError("PLCI unknown in INFO_IND","Capi::readMessage()"));
-									else {
-										nrComplete=connections[plci]->info_ind_called_party_nr(nachricht);
-										if (nrComplete && DDILength)
-											application->callWaiting(connections[plci]);
-									}
-								} break;
-
-								default:
-									if (debug_level >= 2)
-										debug << prefix() << "<INFO_IND: Controller/PLCI 0x" << hex << INFO_IND_PLCI(&nachricht) << ", InfoNumber " << INFO_IND_INFONUMBER(&nachricht) << " (ignoring)" << endl;
-									info_resp(nachricht.Messagenumber,INFO_IND_PLCI(&nachricht));
-								break;
-							}
-						break;
-
-
-						default:
-							stringstream err;
-							err << "Indication 0x" << hex << static_cast<int>(nachricht.Command) << " not handled" << ends;
-                  					throw (CapiError(err.str(),"Capi::readMessage()"));
-						break;
-      					}
-   				break;
-
-            			default:       //----- neither indication nor confirmation ???? -----
-                			throw(CapiError("Unknown subcommand in function Handle_CAPI_Msg","Capi::readMessage()"));
-				break;
-            		}
-		break;
+		case CapiNoError: {          //----- a message has been read -----
+			_cbyte subcommand=CAPIMSG_SUBCOMMAND(message);
+			if (subcommand!=CAPI_CONF && subcommand!=CAPI_IND) //----- neither indication nor confirmation ???? -----
+				throw(CapiError("Unknown subcommand in function Handle_CAPI_Msg","Capi::readMessage()"));
+
+			dispatch_table[CAPIMSG_COMMAND(message)][subcommand==CAPI_IND].count++;
+			Metrics::count(Metrics::MESSAGES_RECEIVED);
+
+			if (dispatch_threads.empty()) {
+				_cmsg nachricht;
+				capi_message2cmsg(&nachricht, message); // disassemble message parameters
+				dispatchMessage(nachricht);
+			} else {
+				// the message buffer is reused by the next getMessage(), so we need a copy
+				unsigned length=CAPIMSG_LEN(message);
+				unsigned char *copy=new unsigned char[length];
+				memcpy(copy,message,length);
+
+				// all messages of one PLCI must go to the same thread to keep their order
+				_cdword plci=CAPIMSG_CONTROL(message) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
+				dispatch_threads[(plci ^ (plci>>8)) % dispatch_threads.size()]->put(copy);
+			}
+		} break;
+
         	case CapiReceiveQueueEmpty:
             		throw (CapiError("readMessage called but no message available?","Capi::readMessage()"));
 		break;
 
         	default:
-            		throw (CapiMsgError(info,"Error while CAPI_GET_CMSG: "+Capi::describeParamInfo(info),"Capi::readMessage()"));
+            		throw (CapiMsgError(info,"Error while getting message: "+Capi::describeParamInfo(info),"Capi::readMessage()"));
 		break;
    	}
 }
 
+void
+Capi::processMessage (unsigned char *message)
+{
+	_cmsg nachricht;
+	capi_message2cmsg(&nachricht, message); // disassemble message parameters
+	try {
+		dispatchMessage(nachricht);
+	}
+	catch (CapiMsgError e) {
+	 	error << prefix() << "ERROR: Error in processMessage(), message: " << e << endl;
+	}
+	catch (CapiError e) {
+	 	error << prefix() << "ERROR: Error in processMessage(), message: " << e << endl;
+	}
+}
+
+void
+Capi::dispatchMessage (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	bool indication=(nachricht.Subcommand==CAPI_IND);
+	dispatch_entry_t &entry=dispatch_table[nachricht.Command][indication];
+
+	// fast path for the data stream which makes up most of the messages
+	if (nachricht.Command==CAPI_DATA_B3) {
+		if (indication)
+			data_b3_ind(nachricht);
+		else
+			data_b3_conf(nachricht);
+	} else if (entry.handler) {
+		(this->*entry.handler)(nachricht);
+	} else if (indication) {
+		stringstream err;
+		err << "Indication 0x" << hex << static_cast<int>(nachricht.Command) << " not handled" << ends;
+		throw (CapiError(err.str(),"Capi::readMessage()"));
+	} // unknown confirmations are ignored
+}
+
+void
+Capi::alert_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=ALERT_CONF_PLCI(&nachricht);
+	if (debug_level >= 2)
+		debug << prefix() << "<ALERT_CONF, PLCI: 0x" << hex << ALERT_CONF_PLCI(&nachricht) << ", Info 0x" << ALERT_CONF_INFO(&nachricht) << endl;
+	getConnection(plci,"ALERT_CONF")->alert_conf(nachricht);
+}
+
+void
+Capi::connect_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=CONNECT_CONF_PLCI(&nachricht);
+	if (debug_level >= 2)
+		debug << prefix() << "<CONNECT_CONF, PLCI: 0x" << hex << CONNECT_CONF_PLCI(&nachricht) << ", Info 0x" << CONNECT_CONF_INFO(&nachricht) << endl;
+	Connection *conn=takePendingConnect(nachricht.Messagenumber); // as registered by connect_req
+	if (!conn)
+		throw(CapiError("MessageNumber unknown in CONNECT_CONF","Capi::readMessage()"));
+	if (!CONNECT_CONF_INFO(&nachricht)) // a failed call got no PLCI
+		registerConnection(plci,conn);
+	try {
+		conn->connect_conf(nachricht);
+	}
+	catch (CapiMsgError) {
+		// There will be no DISCONNECT_IND, so the call is over now. This is done after
+		// Connection::connect_conf() has returned, as the waiting module may delete conn at once.
+		conn->plci_state=Connection::P0;
+		if (conn->call_if)
+			conn->call_if->callDisconnectedPhysical();
+		throw;
+	}
+}
+
+void
+Capi::connect_b3_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=CONNECT_B3_CONF_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
+	if (debug_level >= 2)
+		debug << prefix() << "<CONNECT_B3_CONF, NCCI: 0x" << hex << CONNECT_B3_CONF_NCCI(&nachricht) << ", Info 0x" << CONNECT_B3_CONF_INFO(&nachricht) << endl;
+	getConnection(plci,"CONNECT_B3_CONF")->connect_b3_conf(nachricht);
+}
+
+void
+Capi::select_b_protocol_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=SELECT_B_PROTOCOL_CONF_PLCI(&nachricht);
+	if (debug_level >= 2)
+		debug << prefix() << "<SELECT_B_PROTOCOL_CONF, PLCI: 0x" << hex << SELECT_B_PROTOCOL_CONF_PLCI(&nachricht) << ", Info 0x" << SELECT_B_PROTOCOL_CONF_INFO(&nachricht) << endl;
+	getConnection(plci,"SELECT_B_PROTOCOL_CONF")->select_b_protocol_conf(nachricht);
+}
+
+void
+Capi::listen_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	if (debug_level >= 2)
+		debug << prefix() << "<LISTEN_CONF Controller 0x" << hex << LISTEN_CONF_CONTROLLER(&nachricht) << " Info 0x" << LISTEN_CONF_INFO(&nachricht) << endl;
+
+	if (LISTEN_CONF_INFO(&nachricht)!=0)
+		throw CapiMsgError(LISTEN_CONF_INFO(&nachricht),"LISTEN_REQ was unsuccesful "+Capi::describeParamInfo(LISTEN_CONF_INFO(&nachricht)),"Capi::readMessage()");
+}
+
+void
+Capi::data_b3_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=DATA_B3_CONF_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
+	if (debug_level >= 3)
+		debug << prefix() << "<DATA_B3_CONF, NCCI 0x" << hex << DATA_B3_CONF_NCCI(&nachricht) << dec << ", DataHandle " << DATA_B3_CONF_DATAHANDLE(&nachricht)
+		      << ", Info 0x" << DATA_B3_CONF_INFO(&nachricht) << endl;
+	getConnection(plci,"DATA_B3_CONF")->data_b3_conf(nachricht);
+}
+
+void
+Capi::facility_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	switch (FACILITY_CONF_FACILITYSELECTOR(&nachricht)) {
+		case 1: { // DTMF
+			_cdword plci=FACILITY_CONF_PLCI(&nachricht) & 0xFFFF; // this *should* be PLCI but who knows, so let's mask it to be sure
+			if (debug_level >= 2)
+				debug << prefix() << "<FACILITY_CONF PLCI 0x" << hex << FACILITY_CONF_PLCI(&nachricht) << " Info 0x" << FACILITY_CONF_INFO(&nachricht)
+		                     << " FacilitySelector 0x" << FACILITY_CONF_FACILITYSELECTOR(&nachricht) << endl;
+
+			getConnection(plci,"FACILITY_CONF")->facility_conf_DTMF(nachricht);
+		} break;
+
+		default:
+			error << prefix() << "WARNING: PLCI " << hex << FACILITY_CONF_PLCI(&nachricht) << ": unsupported facility selector " << FACILITY_CONF_FACILITYSELECTOR(&nachricht) << " in FACILITY_CONF" << endl;
+		break;
+	}
+}
+
+void
+Capi::disconnect_b3_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=DISCONNECT_B3_CONF_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
+	if (debug_level >= 2)
+		debug << prefix() << "<DISCONNECT_B3_CONF NCCI 0x" << hex << DISCONNECT_B3_CONF_NCCI(&nachricht) << " Info 0x" << DISCONNECT_B3_CONF_INFO(&nachricht)
+		      << endl;
+	getConnection(plci,"DISCONNECT_B3_CONF")->disconnect_b3_conf(nachricht);
+}
+
+void
+Capi::disconnect_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	// TODO: perhaps we should handle NCPI telling us fax infos here??
+	_cdword plci=DISCONNECT_CONF_PLCI(&nachricht);
+	if (debug_level >= 2)
+		debug << prefix() << "<DISCONNECT_CONF PLCI 0x" << hex << DISCONNECT_CONF_PLCI(&nachricht) << " Info 0x" << DISCONNECT_CONF_INFO(&nachricht)
+		      << endl;
+	getConnection(plci,"DISCONNECT_CONF")->disconnect_conf(nachricht);
+}
+
+void
+Capi::connect_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	// call for us
+	_cdword plci=CONNECT_IND_PLCI(&nachricht);
+	if (debug_level >= 2)
+		debug << prefix() << "<CONNECT_IND PLCI 0x" << hex << plci << " CIP 0x" << CONNECT_IND_CIPVALUE(&nachricht) << endl;
+
+	if (findConnection(plci))
+		throw(CapiError("PLCI used twice from CAPI in CONNECT_IND","Capi::readMessage()"));
+
+	Connection *c=new Connection(nachricht,this,DDILength,DDIBaseLength,DDIStopNumbers);
+	registerConnection(plci,c);
+	if (!DDILength) // if we have PtP then wait until DDI is complete
+		application->callWaiting(c);
+}
+
+void
+Capi::connect_active_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=CONNECT_IND_PLCI(&nachricht);
+	if (debug_level >= 2)
+		debug << prefix() << "<CONNECT_ACTIVE_IND PLCI 0x" << hex << plci << endl;
+	getConnection(plci,"CONNECT_ACTIVE_IND")->connect_active_ind(nachricht);
+}
+
+void
+Capi::connect_b3_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=CONNECT_B3_IND_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
+	if (debug_level >= 2)
+		debug << prefix() << "<CONNECT_B3_IND NCCI 0x" << hex << CONNECT_B3_IND_NCCI(&nachricht) << endl;
+	getConnection(plci,"CONNECT_B3_IND")->connect_b3_ind(nachricht);
+}
+
+void
+Capi::connect_b3_active_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=CONNECT_B3_ACTIVE_IND_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
+	if (debug_level >= 2)
+		debug << prefix() << "<CONNECT_B3_ACTIVE_IND NCCI 0x" << hex << CONNECT_B3_ACTIVE_IND_NCCI(&nachricht) << endl;
+	getConnection(plci,"CONNECT_B3_ACTIVE_IND")->connect_b3_active_ind(nachricht);
+}
+
+void
+Capi::disconnect_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	// call gone, we'll confirm to CAPI
+	_cdword plci=DISCONNECT_IND_PLCI(&nachricht);
+	if (debug_level >= 2)
+		debug << prefix() << "<DISCONNECT_IND PLCI 0x" << hex << plci << " Reason 0x" << DISCONNECT_IND_REASON(&nachricht) << endl;
+	getConnection(plci,"DISCONNECT_IND")->disconnect_ind(nachricht);
+}
+
+void
+Capi::disconnect_b3_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=DISCONNECT_B3_IND_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
+	if (debug_level >= 2)
+		debug << prefix() << "<DISCONNECT_B3_IND NCCI 0x" << hex << DISCONNECT_B3_IND_NCCI(&nachricht) << " Reason 0x" << DISCONNECT_B3_IND_REASON_B3(&nachricht) << endl;
+	getConnection(plci,"DISCONNECT_B3_IND")->disconnect_b3_ind(nachricht);
+}
+
+void
+Capi::data_b3_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	_cdword plci=DATA_B3_IND_NCCI(&nachricht) & 0xFFFF; // PLCI is coded in the least 2 octets of NCCI
+	if (debug_level >= 3)
+		debug << prefix() << "<DATA_B3_IND: NCCI 0x" << hex << DATA_B3_IND_NCCI(&nachricht) << dec << ", DataLength " << DATA_B3_IND_DATALENGTH(&nachricht)
+		      << hex << ", DataHandle 0x" << DATA_B3_IND_DATAHANDLE(&nachricht) << ", Flags 0x" << DATA_B3_IND_FLAGS(&nachricht) << endl;
+	getConnection(plci,"DATA_B3_IND")->data_b3_ind(nachricht);
+}
+
+void
+Capi::facility_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	switch (FACILITY_IND_FACILITYSELECTOR(&nachricht)) {
+		case 1: { // DTMF
+			_cdword plci=FACILITY_IND_PLCI(&nachricht) & 0xFFFF; // we *should* get PLCI but just to be sure we mask the NCCI-part out...
+			if (debug_level >= 2)
+				debug << prefix() << "<FACILITY_IND: PLCI 0x" << hex << FACILITY_IND_PLCI(&nachricht) << ", FacilitySelector 0x" << FACILITY_IND_FACILITYSELECTOR(&nachricht) << endl;
+
+			getConnection(plci,"FACILITY_IND")->facility_ind_DTMF(nachricht);
+		} break;
+
+		default:
+			error << prefix() << "WARNING: PLCI " << hex << (FACILITY_IND_PLCI(&nachricht) & 0xFFFF) << ": Unsupported facility selector " << FACILITY_IND_FACILITYSELECTOR(&nachricht) << " in FACILITY_IND" << endl;
+		break;
+	}
+}
+
+void
+Capi::info_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError)
+{
+	switch (INFO_IND_INFONUMBER(&nachricht)) {
+		case 0x8001: { // ALERTING
+			_cdword plci=INFO_IND_PLCI(&nachricht);
+			if (debug_level >= 2)
+				debug << prefix() << "<INFO_IND: PLCI 0x" << hex << plci << ", InfoNumber ALERTING " << endl;
+			getConnection(plci,"INFO_IND")->info_ind_alerting(nachricht);
+		} break;
+
+		case 0x70: { // Called Party Number
+			_cdword plci=INFO_IND_PLCI(&nachricht);
+			if (debug_level >= 2)
+				debug << prefix() << "<INFO_IND: PLCI 0x" << hex << plci << ", InfoNumber CalledPartyNr " << endl;
+
+			Connection *conn=getConnection(plci,"INFO_IND");
+			bool nrComplete=conn->info_ind_called_party_nr(nachricht);
+			if (nrComplete && DDILength)
+				application->callWaiting(conn);
+		} break;
+
+		default:
+			if (debug_level >= 2)
+				debug << prefix() << "<INFO_IND: Controller/PLCI 0x" << hex << INFO_IND_PLCI(&nachricht) << ", InfoNumber " << INFO_IND_INFONUMBER(&nachricht) << " (ignoring)" << endl;
+			info_resp(nachricht.Messagenumber,INFO_IND_PLCI(&nachricht));
+		break;
+	}
+}
+
 void
 Capi::run()
 {       
 	while (1) {
 		pthread_testcancel();
-		unsigned info=capi20_waitformessage (applId, NULL);   // will block until message is available or capi20_release called
+		unsigned info=Capi::transport->waitForMessage(applId);   // will block until message is available or release() called
 		try {
 			if (info==CapiNoError) {
 				if (debug_level >= 3)
@@ -865,12 +1167,7 @@ Capi::describeParamInfo (unsigned int info)
 string
 Capi::prefix()
 {
-	stringstream s;
-	time_t t=time(NULL);
-	char* ct=ctime(&t);
-	ct[24]='\0';
-	s << ct << " Capi " << hex << this << ": ";
-	return (s.str());
+	return AsyncLog::prefix("Capi",this);
 }
     
 void
@@ -880,24 +1177,24 @@ Capi::readProfile() throw (CapiMsgError)
  	_cdword buf2[4]; 
 
 	// is CAPI correctly installed?
-	unsigned info=CAPI20_ISINSTALLED();
+	unsigned info=transport->isInstalled();
     	if (info!=0)
       		throw (CapiMsgError(info,"Error in CAPI20_ISINSTALLED: "+describeParamInfo(info),"Capi::getCapiInfo()"));
 
     	// retrieve number of installed controllers and create array for storing the descriptions
-    	info=CAPI20_GET_PROFILE (0, buf);
+    	info=transport->getProfile(0, buf);
     	if (info!=0)
       		throw (CapiMsgError(info,"Error in CAPI20_GET_PROFILE: "+describeParamInfo(info),"Capi::getCapiInfo()"));
 
 	Capi::numControllers=buf[0]+(buf[1] << 8);
 
 	// retrieve general information (kernel driver manufacturer, version of kernel driver)
-	if (capi20_get_manufacturer(0,buf))
+	if (transport->getManufacturer(0,buf))
 		capiManufacturer=reinterpret_cast<char *> (buf);
 	else
 		capiManufacturer="unknown";
 
-	if (capi20_get_version(0, reinterpret_cast<unsigned char *>(buf2))) {
+	if (transport->getVersion(0, reinterpret_cast<unsigned char *>(buf2))) {
 		stringstream tmp;
 		tmp << buf2[0] << "." << buf2[1] << "/" << buf2[2] << "." << buf2[3] << ends;
 		capiVersion=tmp.str();
@@ -909,12 +1206,12 @@ Capi::readProfile() throw (CapiMsgError)
 
 		profiles.push_back(CardProfileT());
 		
-		if (capi20_get_manufacturer(i,buf))
+		if (transport->getManufacturer(i,buf))
 			profiles[i-1].manufacturer=reinterpret_cast<char *> (buf);
 		else
 			profiles[i-1].manufacturer="unknown";
 			
-		info = CAPI20_GET_PROFILE(i, buf);
+		info = transport->getProfile(i, buf);
 		if (info!=0)
 			throw (CapiMsgError(info,"Error in CAPI20_GET_PROFILE/2: "+Capi::describeParamInfo(info),"Capi::getCapiInfo()"));
 
@@ -945,7 +1242,7 @@ Capi::readProfile() throw (CapiMsgError)
 		else
 			profiles[i-1].faxExt=false;
 
-		if (capi20_get_version(i,reinterpret_cast<unsigned char*>(buf2))) {
+		if (transport->getVersion(i,reinterpret_cast<unsigned char*>(buf2))) {
 			stringstream tmp;
 			tmp << buf2[0] << "." << buf2[1] << "/" << buf2[2] << "." << buf2[3];
 			profiles[i-1].version=tmp.str();
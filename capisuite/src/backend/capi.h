@@ -19,12 +19,15 @@
 
 #include <capi20.h>
 #include <string>
-#include <map>  
+#include <pthread.h>
 #include <vector>
 #include "capiexception.h"
+#include "filewriter.h"
+#include "capitransport.h"
 
 class Connection;
 class ApplicationInterface;
+class DispatchThread;
 
 /** @brief Thread exec handler for Capi class
 
@@ -32,6 +35,15 @@ class ApplicationInterface;
 */
 void* capi_exec_handler(void* args);
 
+/** @brief Send a message built with the message macros of capiutils.h using the transport of Capi
+
+    capi.cpp redirects capi_put_cmsg(), which is called by these macros, to this function.
+
+    @param cmsg the message to send
+    @return CAPI info value
+*/
+unsigned capi_transport_put_cmsg(_cmsg *cmsg);
+
 /** @brief Main Class for communication with CAPI
 
     This class is the main encapsulation to use the CAPI ISDN interface.
@@ -46,11 +58,18 @@ void* capi_exec_handler(void* args);
     is described in every detail here.  For more details please have a look in 
     the CAPI 2.0 specification, available from http://www.capi.org.
 
-    There's also a big message handling routine (readMessage()) which calls 
-    special handlers for incoming messages of the CAPI.
+    All communication with CAPI is done by a CapiTransport. This is libcapi20 by
+    default, but another implementation like the CapiSimulator can be given to
+    the constructor.
+
+    There's also a message handling routine (readMessage()) which calls the
+    handler for each incoming message of the CAPI found in a dispatch table
+    and counts the received messages (see getMessageCount()).
 
     A Capi object creates a new thread (with body run()) which waits for 
     incoming messages in an endless loop and hands them to readMessage().
+    If dispatch threads are used, readMessage() only hands the messages over
+    to them, so the connections are handled in parallel (see DispatchThread).
 
     This class only does the general things - for handling single connections
     see Connection. Connection objects will be automatically created by this 
@@ -67,7 +86,10 @@ void* capi_exec_handler(void* args);
 */
 class Capi {
 	friend class Connection; 
+	friend class DispatchThread;
+	friend class BackendBenchmark;
 	friend void* capi_exec_handler(void*);
+	friend unsigned capi_transport_put_cmsg(_cmsg*);
 
 	public:
 		/** @brief Constructor. Registers our App at CAPI and start the communication thread.
@@ -79,8 +101,11 @@ class Capi {
 		    @param DDIBaseLength the base number length w/o extension (and w/o 0) if DDI is used
 		    @param DDIStopNumbers list of DDIs shorter than DDILength we will accept
 		    @param maxLogicalConnection max. number of logical connections we will handle. 0 means autodetect.
-        	    @param maxBDataBlocks max. number of unconfirmed B3-datablocks, 7  is the maximum supported by CAPI
-	 	    @param maxBDataLen max. B3-Datablocksize, 2048 is the maximum supported by CAPI
+        	    @param maxBDataBlocks max. number of unconfirmed B3-datablocks, 7  is the maximum supported by CAPI (larger values are reduced)
+	 	    @param maxBDataLen max. B3-Datablocksize, 2048 is the maximum supported by CAPI (values out of 128..2048 are adjusted)
+		    @param receive_sync how received files are synced to the disk, see FileWriter
+		    @param dispatchThreads number of threads processing the received messages (see DispatchThread), 0 means the message thread processes them itself
+		    @param transport used to exchange messages with CAPI, NULL means libcapi20 (see CapiTransport). It isn't deleted by Capi.
 		    @throw CapiError Thrown if no ISDN controller is reported by CAPI
 		    @throw CapiMsgError Thrown if registration at CAPI wasn't successful.
 		*/
@@ -88,13 +113,14 @@ class Capi {
 		  unsigned short DDILength=0, unsigned short DDIBaseLength=0, 
 		  vector<string> DDIStopNumbers=vector<string>(), 
 		  unsigned maxLogicalConnection=0, unsigned maxBDataBlocks=7,
-		  unsigned maxBDataLen=2048) throw (CapiError, CapiMsgError);
+		  unsigned maxBDataLen=2048, FileWriter::sync_policy_t receive_sync=FileWriter::SYNC_NONE,
+		  unsigned dispatchThreads=0, CapiTransport *transport=NULL) throw (CapiError, CapiMsgError);
 
 		/** @brief Destructor. Unregister App at CAPI
 
 		    @throw CapiMsgError Thrown if deregistration at CAPI failed.
 		*/
-		~Capi();
+		virtual ~Capi();
 
 		/** @brief Register the instance implementing the ApplicationInterface
 
@@ -132,6 +158,38 @@ class Capi {
 		*/
   		void setListenTelephony (_cdword Controller=0) throw (CapiMsgError,CapiError);
 
+		/** @brief Set the window and block size used for sending data in voice connections
+
+		    Small blocks let the transmission react fast when it's stopped (e.g. by a DTMF
+		    signal), as less data is queued at the controller. Each block costs one DATA_B3_REQ
+		    and one DATA_B3_CONF, though.
+
+		    The values are limited to the maxBDataBlocks and maxBDataLen registered at CAPI.
+		    0 selects the automatic value, which is a window of 4 blocks with 320 bytes (40 ms),
+		    so not more than 160 ms of audio are queued.
+
+		    Additionally, the amount of queued audio can be limited in msecs, which is the time
+		    the caller still hears the old data after the transmission was aborted. It should
+		    cover at least two blocks, otherwise the audio may stutter.
+
+		    Changes affect transmissions started afterwards.
+
+		    @param window max. number of unconfirmed blocks, 0 for automatic
+		    @param block_size size of the blocks in bytes, 0 for automatic
+		    @param max_latency max. amount of queued audio in msecs, 0 for no limit
+		*/
+		void setVoiceTransfer (unsigned window, unsigned block_size, unsigned max_latency=0);
+
+		/** @brief Set the window and block size used for sending data in fax connections
+
+		    Works like setVoiceTransfer(), but the automatic values are the maximum window and
+		    block size registered at CAPI to get the highest throughput.
+
+		    @param window max. number of unconfirmed blocks, 0 for automatic
+		    @param block_size size of the blocks in bytes, 0 for automatic
+		*/
+		void setFaxTransfer (unsigned window, unsigned block_size);
+
 		/** @brief Static Returns some info about the installed Controllers
 
 		     The returned string has the following format (UPPERCASE words replaced):
@@ -153,14 +211,122 @@ class Capi {
 		*/
 	  	string getInfo(bool verbose=false);
 
+		/** @brief Return how many messages of the given type were received
+
+		    @param command command of the message (CAPI_ALERT, CAPI_CONNECT, ...)
+		    @param subcommand subcommand of the message, only CAPI_CONF and CAPI_IND are counted
+		    @return number of received messages
+		*/
+		unsigned long getMessageCount(_cbyte command, _cbyte subcommand);
+
+		/** @brief Return the number of installed controllers
+
+		    @return number of controllers, they're numbered from 1 to this number
+		*/
+		unsigned getNumControllers() {return numControllers;}
+
+		/** @brief Return the number of B channels of a controller
+
+		    @param controller number of the controller, starting with 1
+		    @return number of B channels as given in the profile, 0 if there's no such controller
+		*/
+		unsigned getBChannels(unsigned controller);
+
+		/** @brief Return the number of B channels of a controller which are in use
+
+		    Counts the connections in the connection table and the outgoing calls waiting for
+		    CONNECT_CONF. The counters are changed when connections are registered and
+		    unregistered, so no lock is needed.
+
+		    @param controller number of the controller, starting with 1
+		    @param incoming_only only count the calls we didn't initiate
+		    @return number of used B channels
+		*/
+		unsigned getUsedBChannels(unsigned controller, bool incoming_only=false);
+
+		/** @brief Choose the controller for an outgoing call
+
+		    Returns the controller with the most free B channels (see getUsedBChannels()).
+		    If several controllers have the same number of free channels, the first one
+		    of the list wins.
+
+		    @param controllers controllers to choose from
+		    @return number of the chosen controller, 0 if the list contains no valid controller
+		*/
+		unsigned selectController(const vector<unsigned> &controllers);
+
 	private:
 
-		/** @brief erase Connection object in connections map
+		/** @brief erase Connection object in connection table
 
-		    This method is used by Connection::~Connection()
+		    This method is used by Connection::disconnect_ind()
 		*/
 		void unregisterConnection (_cdword plci);  
 
+		/** @brief change the number of used B channels of a controller
+
+		    @param controller number of the controller
+		    @param outgoing true for calls we initiated
+		    @param delta 1 if a connection was registered, -1 if it was unregistered
+		*/
+		void countBChannel (unsigned controller, bool outgoing, long delta)
+		{
+			__sync_fetch_and_add(&used_b_channels[controller & 0x7F][outgoing ? 1 : 0],delta);
+		}
+
+		/** @brief return the message number for the next request and increase it
+
+		    @return message number to use
+		*/
+		_cword nextMessageNumber();
+
+		/** @brief enter Connection object in connection table
+
+		    The row for the controller is allocated on first use.
+
+		    @param plci PLCI of the connection
+		    @param conn the Connection object
+		*/
+		void registerConnection (_cdword plci, Connection *conn);
+
+		/** @brief find the Connection object for a PLCI
+
+		    Only the least 2 octets (controller and PLCI number) are used, so a NCCI can be given, too.
+		    This is a direct table lookup as it's done for every received message.
+
+		    @param plci PLCI or NCCI of the connection
+		    @return the Connection object, NULL if the PLCI is unknown
+		*/
+		Connection* findConnection (_cdword plci)
+		{
+			Connection **row=connection_table[plci & 0xFF];
+			return row ? row[(plci>>8) & 0xFF] : NULL;
+		}
+
+		/** @brief find the Connection object a received message belongs to
+
+		    @param plci PLCI or NCCI given in the message
+		    @param message name of the message for the error description
+		    @return the Connection object
+		    @throw CapiError Thrown if the PLCI is unknown
+		*/
+		Connection* getConnection (_cdword plci, const char *message) throw (CapiError);
+
+		/** @brief remember a Connection object waiting for CONNECT_CONF
+
+		    @param messageNumber message number of the CONNECT_REQ
+		    @param conn the Connection object
+		    @throw CapiMsgError Thrown if too many CONNECT_REQs are waiting for their confirmation
+		*/
+		void registerPendingConnect (_cword messageNumber, Connection *conn) throw (CapiMsgError);
+
+		/** @brief find and forget a Connection object waiting for CONNECT_CONF
+
+		    @param messageNumber message number of the CONNECT_REQ
+		    @return the Connection object, NULL if no CONNECT_REQ with this message number is known
+		*/
+		Connection* takePendingConnect (_cword messageNumber);
+
 		/** @brief Get informations about CAPI driver and installed controllers
 
 		     Fills the members profiles, capiVersion, capiManufacturer, numControllers
@@ -194,8 +360,8 @@ class Capi {
 		/** @brief Send CONNECT_REQ to CAPI
 
 		    To be able to see which CONNECT_CONF corresponds to this CONNECT_REQ, the Connection object
-		    will be saved in the connections map under a pseudo PLCI (0xFACE & messageNumber). This will
-		    be corrected at the moment the CONNECT_CONF is received.
+		    will be saved in the pending_connects table under the message number. It's moved to the
+		    connection table at the moment the CONNECT_CONF is received.
 
       	    	    @param conn reference to the Connection object which calls connect_req()
 		    @param Controller Nr. of controller to use for connection establishment
@@ -362,8 +528,10 @@ class Capi {
 
 		/** @brief read Message from CAPI and process it accordingly
 		
-		    This method handles all incoming messages. It is called by run() and will call
-		    special handler methods of Connection mainly. Prints messages for debug purposes.
+		    This method reads all incoming messages and counts them. It is called by run().
+		    Without dispatch threads, it processes the message with dispatchMessage().
+		    Otherwise, a copy of the message is given to the DispatchThread responsible for its
+		    PLCI.
 
 	      	    @throw CapiMsgError directly raised when CAPI_GET_MESSAGE or LISTEN_REQ fails, may also be raised by all called *_ind, *_conf handlers
 	      	    @throw CapiError directly raised when general error occurs (unknown call references, unknown message, ... received)
@@ -372,6 +540,59 @@ class Capi {
 		*/
 	  	void readMessage (void) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError);
 
+		/** @brief call the handler for the message
+
+		    The handler is looked up in dispatch_table. DATA_B3_IND and DATA_B3_CONF are called
+		    directly as they make up most of the messages.
+
+		    @param nachricht the disassembled message
+	      	    @throw CapiMsgError may be raised by all called *_ind, *_conf handlers
+	      	    @throw CapiError Thrown if an unknown indication is received, may also be raised by the handlers
+	      	    @throw CapiWrongState may be raised by all called *_ind(), *_conf() handlers
+	      	    @throw CapiExternalError may be raised by some called *_ind(), *_conf() handlers
+		*/
+		void dispatchMessage (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError);
+
+		/** @brief process a message in a DispatchThread
+
+		    Disassembles the message and calls dispatchMessage(). Errors are reported to the error stream.
+
+		    @param message copy of the raw CAPI message
+		*/
+		void processMessage (unsigned char *message);
+
+		/** @brief fill dispatch_table with the handlers below
+		*/
+		void initDispatchTable();
+
+		/********************************************************************************/
+    		/*   handlers for incoming msgs - called by readMessage() via dispatch_table    */
+		/********************************************************************************/
+
+		/* These handlers print the message for debug purposes, find the Connection object
+		   and call its handler method. Only the data handlers log on debug level 3, all others
+		   on level 2. They throw the same exceptions as readMessage().
+		*/
+
+		void alert_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle ALERT_CONF
+		void connect_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle CONNECT_CONF, move Connection from pending_connects to connection_table
+		void connect_b3_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle CONNECT_B3_CONF
+		void select_b_protocol_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle SELECT_B_PROTOCOL_CONF
+		void listen_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle LISTEN_CONF
+		void data_b3_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle DATA_B3_CONF
+		void facility_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle FACILITY_CONF (only DTMF)
+		void disconnect_b3_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle DISCONNECT_B3_CONF
+		void disconnect_conf (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle DISCONNECT_CONF
+		void connect_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle CONNECT_IND, create new Connection object
+		void connect_active_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle CONNECT_ACTIVE_IND
+		void connect_b3_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle CONNECT_B3_IND
+		void connect_b3_active_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle CONNECT_B3_ACTIVE_IND
+		void disconnect_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle DISCONNECT_IND
+		void disconnect_b3_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle DISCONNECT_B3_IND
+		void data_b3_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle DATA_B3_IND
+		void facility_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle FACILITY_IND (only DTMF)
+		void info_ind (_cmsg& nachricht) throw (CapiMsgError, CapiError, CapiWrongState, CapiExternalError); ///< handle INFO_IND (ALERTING and Called Party Number)
+
 		/********************************************************************************/
     		/*	    		methods for internal use				*/
 		/********************************************************************************/
@@ -427,6 +648,8 @@ class Capi {
 			bool suppServ; ///< does this controller support Supplementary Services?
 		};
 
+		static CapiTransport *transport; ///< used to exchange messages with CAPI, static as readProfile() needs it
+
 		static short numControllers;  ///< number of installed controllers, set by readProfile() method
                 static string capiManufacturer, ///< manufacturer of the general CAPI driver
 		       capiVersion; ///< version of the general CAPI driver
@@ -434,14 +657,68 @@ class Capi {
 		unsigned short DDILength; ///< length of extension number (DDI) when ISDN PtP mode is used (0=PtMP)
 		unsigned short DDIBaseLength; ///< base number length for the ISDN interface if PtP mode is used
 		vector<string> DDIStopNumbers; ///< list of DDIs shorten than DDILength we'll accept
+		FileWriter::sync_policy_t receive_sync; ///< how received files are synced to the disk
+
+		/** @brief window and block size used for sending data, see setVoiceTransfer()
+		*/
+		struct transfer_parameters_t {
+			unsigned window; ///< max. number of unconfirmed blocks
+			unsigned block_size; ///< size of the blocks in bytes
+			unsigned max_queued; ///< max. number of unconfirmed bytes, 0 for no limit
+		};
+
+		unsigned maxBDataBlocks, ///< max. number of unconfirmed B3 data blocks registered at CAPI
+			maxBDataLen; ///< max. size of B3 data blocks registered at CAPI
+		transfer_parameters_t voice_transfer, ///< parameters for sending in voice connections
+			fax_transfer; ///< parameters for sending in fax connections
+
+		/** @brief Limit window and block size to the values registered at CAPI
+
+		    @param window requested window, 0 for automatic
+		    @param block_size requested block size, 0 for automatic
+		    @param auto_window window used if 0 is given
+		    @param auto_block_size block size used if 0 is given
+		    @return the parameters to use
+		*/
+		transfer_parameters_t limitTransfer (unsigned window, unsigned block_size, unsigned auto_window, unsigned auto_block_size);
 		
 		static vector <CardProfileT> profiles; ///< vector containing profiles for all found cards (ATTENTION: starts with index 0,
 						///< while CAPI numbers controllers starting by 1 (sigh)
 
-		map <_cdword,Connection*> connections; ///< containing pointers to the currently active Connection
-							///< objects, referenced by PLCI (or 0xFACE & messageNum when Connection is in plci_state Connection::P01
+		Connection **connection_table[256]; ///< pointers to the currently active Connection objects, indexed by controller
+						    ///< (least octet of PLCI), then by PLCI number (second octet). Rows are allocated on first use
+						    ///< and published with __sync_val_compare_and_swap(), so they're read without lock.
+		long used_b_channels[128][2]; ///< connections per controller (lowest 7 bits of the PLCI), [0] incoming, [1] outgoing, changed by countBChannel() only
+
+		/** @brief slot in the table of Connection objects waiting for CONNECT_CONF (plci_state Connection::P01)
+		*/
+		struct pending_connect_t {
+			_cword messageNumber; ///< message number of the CONNECT_REQ
+			Connection *conn; ///< the Connection object, NULL if the slot is free
+		};
+
+		static const unsigned pending_connects_size=64; ///< max. number of CONNECT_REQs waiting for their confirmation
+		pending_connect_t pending_connects[pending_connects_size]; ///< hashed by message number with linear probing
+		pthread_mutex_t pending_mutex; ///< protects pending_connects as connect_req() is called by the application threads
+
+		/** @brief type of the message handlers in dispatch_table
+		*/
+		typedef void (Capi::*message_handler_t)(_cmsg&);
+
+		/** @brief entry of the dispatch table
+		*/
+		struct dispatch_entry_t {
+			const char *name; ///< name of the message, NULL if not handled
+			message_handler_t handler; ///< handler for the message, NULL if not handled
+			unsigned long count; ///< number of received messages, only changed by the message thread
+		};
+
+		vector<DispatchThread*> dispatch_threads; ///< threads processing the received messages, empty if the message thread does it
+
+		dispatch_entry_t dispatch_table[256][2]; ///< handlers for received messages, indexed by command and subcommand (0=CONF, 1=IND)
 
-		_cword messageNumber;  ///< sequencial message number, must be increased for every sent message
+		_cword messageNumber;  ///< sequencial message number, must be increased for every sent message, use nextMessageNumber()
+		pthread_mutex_t message_number_mutex; ///< protects messageNumber as requests are sent from several threads
 		_cdword usedInfoMask;  ///< InfoMask currently used (in last listen_req)
 		_cdword usedCIPMask;   ///< CIPMask currently used (in last listen_req)
 
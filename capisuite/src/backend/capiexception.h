@@ -19,6 +19,7 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include "metrics.h"
 
 using namespace std;
 
@@ -110,7 +111,9 @@ class CapiMsgError : public CapiError
 		*/
  		CapiMsgError(unsigned info, string errormsg ,string function_name):
 			CapiError(errormsg,function_name),info(info)
-		{}
+		{
+			Metrics::capiError(info);
+		}
 		
 		/** @brief Return nice formatted error message
 
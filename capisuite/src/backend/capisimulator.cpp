@@ -0,0 +1,626 @@
+/*  @file capisimulator.cpp
+    @brief Contains CapiSimulator - Simulated CAPI for load and latency measurements
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sstream>
+#include <stdlib.h> // for exit()
+#include <string.h> // for memset(), memcpy(), strcpy()
+#include <sys/time.h> // for gettimeofday()
+#include "capisimulator.h"
+#include "asynclog.h"
+
+#define conf_usecs_per_byte 125 // B channel transmits 8000 bytes per second
+#define conf_normal_clearing 0x3490 // reason in DISCONNECT_IND if the remote party hangs up
+
+void* capisimulator_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no CapiSimulator reference given in capisimulator_exec_handler" << endl;
+		exit(1);
+	}
+	CapiSimulator *instance=static_cast<CapiSimulator*>(arg);
+	instance->run();
+	return NULL;
+}
+
+static void capisimulator_unlock_handler(void* mutex)
+{
+	pthread_mutex_unlock(static_cast<pthread_mutex_t*>(mutex));
+}
+
+CapiSimulator::CapiSimulator(parameters_t parameters, ostream &debug, unsigned short debug_level, ostream &error) throw (CapiExternalError)
+:parameters(parameters),statistics(),random_state(parameters.seed),window(7),listening(false),released(false),terminate(false),call_blocked(false)
+,active_incoming(0),next_serial(1),next_call(0),messageNumber(0),block(),calls(),events(),inbox(),delivered()
+,debug(debug),error(error),debug_level(debug_level)
+{
+	if (this->parameters.channels>255)
+		this->parameters.channels=255;
+	if (!this->parameters.block_size)
+		this->parameters.block_size=1;
+
+	for (unsigned i=0;i<this->parameters.block_size;i++)
+		block+=static_cast<char>(random());
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&inbox_cond, NULL);
+	pthread_cond_init(&event_cond, NULL);
+
+	if (pthread_create(&thread_handle, NULL, capisimulator_exec_handler, this)) {
+		pthread_mutex_destroy(&mutex);
+		pthread_cond_destroy(&inbox_cond);
+		pthread_cond_destroy(&event_cond);
+		throw CapiExternalError("unable to start simulation thread","CapiSimulator::CapiSimulator()");
+	}
+}
+
+CapiSimulator::~CapiSimulator()
+{
+	pthread_mutex_lock(&mutex);
+	terminate=true;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&mutex);
+
+	pthread_join(thread_handle,NULL);
+
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&inbox_cond);
+	pthread_cond_destroy(&event_cond);
+}
+
+CapiSimulator::statistics_t
+CapiSimulator::getStatistics()
+{
+	pthread_mutex_lock(&mutex);
+	statistics_t copy=statistics;
+	pthread_mutex_unlock(&mutex);
+	return copy;
+}
+
+bool
+CapiSimulator::finished()
+{
+	pthread_mutex_lock(&mutex);
+	bool ret=listening && statistics.calls_offered>=parameters.calls && calls.empty();
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+unsigned
+CapiSimulator::isInstalled()
+{
+	return 0;
+}
+
+unsigned
+CapiSimulator::getProfile(unsigned controller, unsigned char *buf)
+{
+	memset(buf,0,64);
+	if (!controller) {
+		buf[0]=parameters.controllers & 0xFF;
+		buf[1]=parameters.controllers >> 8;
+	} else if (controller<=parameters.controllers) {
+		buf[2]=parameters.channels & 0xFF;
+		buf[3]=parameters.channels >> 8;
+		buf[4]=0x08; // DTMF
+		buf[8]=0x12; // B1: 64 kbit/s bit-transparent, T.30 fax G3
+		buf[12]=0x12; // B2: transparent, T.30 fax G3
+		buf[16]=0x31; // B3: transparent, T.30 fax G3, T.30 fax G3 extended
+	} else
+		return 0x2002; // illegal controller
+	return 0;
+}
+
+unsigned char*
+CapiSimulator::getManufacturer(unsigned controller, unsigned char *buf)
+{
+	strcpy(reinterpret_cast<char*>(buf),"CapiSuite simulator");
+	return buf;
+}
+
+unsigned char*
+CapiSimulator::getVersion(unsigned controller, unsigned char *buf)
+{
+	_cdword version[4]={2,0,0,1};
+	memcpy(buf,version,sizeof(version));
+	return buf;
+}
+
+unsigned
+CapiSimulator::registerApplication(unsigned maxLogicalConnection, unsigned maxBDataBlocks, unsigned maxBDataLen, unsigned *applId)
+{
+	pthread_mutex_lock(&mutex);
+	window=maxBDataBlocks;
+	released=false;
+	pthread_mutex_unlock(&mutex);
+	*applId=1;
+	return 0;
+}
+
+unsigned
+CapiSimulator::release(unsigned applId)
+{
+	pthread_mutex_lock(&mutex);
+	released=true;
+	pthread_cond_broadcast(&inbox_cond);
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+unsigned
+CapiSimulator::putMessage(unsigned applId, unsigned char *message)
+{
+	_cmsg request;
+	capi_message2cmsg(&request,message);
+
+	pthread_mutex_lock(&mutex);
+	unsigned info=0x1101; // illegal application number
+	if (!released) {
+		statistics.messages_received++;
+		handleMessage(request,currentTime());
+		info=0;
+	}
+	pthread_mutex_unlock(&mutex);
+	return info;
+}
+
+unsigned
+CapiSimulator::getMessage(unsigned applId, unsigned char **message)
+{
+	pthread_mutex_lock(&mutex);
+	unsigned info=0;
+	if (released)
+		info=0x1101; // illegal application number
+	else if (inbox.empty())
+		info=CapiReceiveQueueEmpty;
+	else {
+		delivered.swap(inbox.front());
+		inbox.pop_front();
+		*message=reinterpret_cast<unsigned char*>(&delivered[0]);
+	}
+	pthread_mutex_unlock(&mutex);
+	return info;
+}
+
+unsigned
+CapiSimulator::waitForMessage(unsigned applId)
+{
+	unsigned info;
+	pthread_mutex_lock(&mutex);
+	pthread_cleanup_push(capisimulator_unlock_handler,&mutex); // pthread_cond_wait() is a cancellation point
+	while (inbox.empty() && !released)
+		pthread_cond_wait(&inbox_cond,&mutex);
+	info=released ? 0x1101 : 0; // illegal application number
+	pthread_cleanup_pop(1);
+	return info;
+}
+
+void
+CapiSimulator::run()
+{
+	pthread_mutex_lock(&mutex);
+	while (!terminate) {
+		long long now=currentTime();
+		while (!events.empty() && events.begin()->first<=now) {
+			event_t event=events.begin()->second;
+			events.erase(events.begin());
+			handleEvent(event,now);
+		}
+		if (events.empty())
+			pthread_cond_wait(&event_cond,&mutex);
+		else {
+			long long due=events.begin()->first;
+			timespec deadline;
+			deadline.tv_sec=due/1000000;
+			deadline.tv_nsec=(due%1000000)*1000;
+			pthread_cond_timedwait(&event_cond,&mutex,&deadline);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+CapiSimulator::handleEvent(event_t &event, long long now)
+{
+	if (event.type==NEW_CALL) {
+		offerCall(now);
+		return;
+	}
+
+	map<_cdword,call_t>::iterator i=calls.find(event.plci);
+	if (i==calls.end() || i->second.serial!=event.serial)
+		return; // call already finished
+	call_t &call=i->second;
+	_cmsg message;
+
+	switch (event.type) {
+		case DATA_IND:
+			if (call.state!=call_t::B3_ACTIVE)
+				break;
+			if (call.unconfirmed.size()>=window) {
+				statistics.blocks_lost++; // a real controller would have to discard the data, too
+			} else {
+				header(message,CAPI_DATA_B3,CAPI_IND,messageNumber++,event.plci | 0x10000);
+				message.Data=&block[0];
+				message.DataLength=block.size();
+				message.DataHandle=call.dataHandle;
+				send(message);
+				call.unconfirmed[call.dataHandle++]=now;
+			}
+			call.next_block+=block.size()*conf_usecs_per_byte;
+			schedule(call.next_block+(parameters.jitter ? random()%parameters.jitter : 0),DATA_IND,event.plci);
+		break;
+
+		case DATA_CONF:
+			if (call.state!=call_t::B3_ACTIVE)
+				break; // no DATA_B3_CONF after DISCONNECT_B3_IND
+			header(message,CAPI_DATA_B3,CAPI_CONF,event.messageNumber,event.plci | 0x10000);
+			message.DataHandle=event.dataHandle;
+			send(message);
+			call.last_conf=now;
+		break;
+
+		case CONNECT_ACTIVE:
+			if (call.state!=call_t::OFFERED)
+				break;
+			call.state=call_t::CONNECTED;
+			send(header(message,CAPI_CONNECT_ACTIVE,CAPI_IND,messageNumber++,event.plci));
+		break;
+
+		case HANGUP:
+			disconnectCall(event.plci,call,conf_normal_clearing);
+		break;
+
+		case NEW_CALL: // handled above
+		break;
+	}
+}
+
+void
+CapiSimulator::handleMessage(_cmsg &request, long long now)
+{
+	_cdword plci=request.adr.adrNCCI & 0xFFFF; // address is controller, PLCI or NCCI depending on the message
+	map<_cdword,call_t>::iterator i=calls.find(plci);
+	call_t *call=(i==calls.end()) ? NULL : &i->second;
+	_cmsg message;
+
+	if (request.Subcommand==CAPI_REQ) {
+		switch (request.Command) {
+			case CAPI_LISTEN:
+				confirm(request);
+				if (LISTEN_REQ_CIPMASK(&request) && !listening) {
+					listening=true;
+					next_call=now;
+					if (parameters.calls)
+						schedule(now,NEW_CALL);
+					if (debug_level>=1)
+						debug << prefix() << "application listens, offering " << dec << parameters.calls << " calls" << endl;
+				}
+			break;
+
+			case CAPI_CONNECT: {
+				_cdword new_plci=allocatePlci(request.adr.adrController & 0x7F);
+				if (!new_plci) {
+					confirm(request,0x2003); // out of PLCI
+					break;
+				}
+				call_t &new_call=calls[new_plci];
+				new_call.state=call_t::OFFERED;
+				new_call.serial=next_serial++;
+				new_call.incoming=false;
+				new_call.disconnect=false;
+				new_call.offered=now;
+				new_call.line_free=new_call.last_conf=0;
+				new_call.dataHandle=0;
+				header(message,CAPI_CONNECT,CAPI_CONF,request.Messagenumber,new_plci);
+				send(message);
+				schedule(now+parameters.dial_delay,CONNECT_ACTIVE,new_plci);
+			} break;
+
+			case CAPI_CONNECT_B3:
+				if (!call || call->state!=call_t::CONNECTED) {
+					confirm(request,0x2001); // message not supported in current state
+					break;
+				}
+				call->state=call_t::B3_CONNECTING;
+				send(header(message,CAPI_CONNECT_B3,CAPI_CONF,request.Messagenumber,plci | 0x10000));
+				send(header(message,CAPI_CONNECT_B3_ACTIVE,CAPI_IND,messageNumber++,plci | 0x10000));
+			break;
+
+			case CAPI_DATA_B3: {
+				if (!call || call->state!=call_t::B3_ACTIVE) {
+					confirm(request,0x2001); // message not supported in current state
+					break;
+				}
+				long long start=call->line_free;
+				if (start<now) {
+					if (start) // the application didn't send the next block in time
+						statistics.send_gaps.push_back(now-start);
+					start=now;
+				}
+				if (call->last_conf) {
+					statistics.send_latency.push_back(now-call->last_conf);
+					call->last_conf=0;
+				}
+				call->line_free=start+DATA_B3_REQ_DATALENGTH(&request)*conf_usecs_per_byte;
+				statistics.bytes_received+=DATA_B3_REQ_DATALENGTH(&request);
+				schedule(call->line_free,DATA_CONF,plci,request.Messagenumber,DATA_B3_REQ_DATAHANDLE(&request));
+			} break;
+
+			case CAPI_FACILITY: {
+				header(message,CAPI_FACILITY,CAPI_CONF,request.Messagenumber,request.adr.adrNCCI);
+				unsigned char parameter[]={2,0,0}; // DTMF information: sent/detection initiated
+				message.FacilitySelector=FACILITY_REQ_FACILITYSELECTOR(&request);
+				message.FacilityConfirmationParameter=parameter;
+				send(message);
+			} break;
+
+			case CAPI_DISCONNECT_B3:
+				confirm(request);
+				if (call && (call->state==call_t::B3_CONNECTING || call->state==call_t::B3_ACTIVE)) {
+					call->state=call_t::B3_DISCONNECTING;
+					send(header(message,CAPI_DISCONNECT_B3,CAPI_IND,messageNumber++,plci | 0x10000));
+				}
+			break;
+
+			case CAPI_DISCONNECT:
+				confirm(request);
+				if (call)
+					disconnectCall(plci,*call,0);
+			break;
+
+			default: // ALERT_REQ, SELECT_B_PROTOCOL_REQ, ...
+				confirm(request);
+			break;
+		}
+	} else if (request.Subcommand==CAPI_RESP && call) {
+		switch (request.Command) {
+			case CAPI_CONNECT:
+				if (call->state!=call_t::OFFERED)
+					break;
+				if (CONNECT_RESP_REJECT(&request)) {
+					statistics.calls_rejected++;
+					call->state=call_t::DISCONNECTING;
+					header(message,CAPI_DISCONNECT,CAPI_IND,messageNumber++,plci);
+					message.Reason=0;
+					send(message);
+					break;
+				}
+				statistics.accept_latency.push_back(now-call->offered);
+				call->state=call_t::CONNECTED;
+				send(header(message,CAPI_CONNECT_ACTIVE,CAPI_IND,messageNumber++,plci));
+			break;
+
+			case CAPI_CONNECT_ACTIVE:
+				if (call->incoming && call->state==call_t::CONNECTED) { // for outgoing calls the application requests the B3 connection
+					call->state=call_t::B3_CONNECTING;
+					send(header(message,CAPI_CONNECT_B3,CAPI_IND,messageNumber++,plci | 0x10000));
+				}
+			break;
+
+			case CAPI_CONNECT_B3:
+				if (call->state==call_t::B3_CONNECTING)
+					send(header(message,CAPI_CONNECT_B3_ACTIVE,CAPI_IND,messageNumber++,plci | 0x10000));
+			break;
+
+			case CAPI_CONNECT_B3_ACTIVE:
+				if (call->state!=call_t::B3_CONNECTING)
+					break;
+				call->state=call_t::B3_ACTIVE;
+				statistics.calls_connected++;
+				if (call->incoming)
+					statistics.setup_latency.push_back(now-call->offered);
+				call->next_block=now+block.size()*conf_usecs_per_byte;
+				schedule(call->next_block,DATA_IND,plci);
+				if (parameters.call_duration)
+					schedule(now+parameters.call_duration,HANGUP,plci);
+			break;
+
+			case CAPI_DATA_B3: {
+				map<_cword,long long>::iterator sent=call->unconfirmed.find(DATA_B3_RESP_DATAHANDLE(&request));
+				if (sent!=call->unconfirmed.end()) {
+					statistics.data_latency.push_back(now-sent->second);
+					call->unconfirmed.erase(sent);
+				}
+			} break;
+
+			case CAPI_DISCONNECT_B3:
+				if (call->state!=call_t::B3_DISCONNECTING)
+					break;
+				call->state=call_t::CONNECTED;
+				call->unconfirmed.clear();
+				if (call->disconnect) {
+					call->state=call_t::DISCONNECTING;
+					header(message,CAPI_DISCONNECT,CAPI_IND,messageNumber++,plci);
+					message.Reason=call->reason;
+					send(message);
+				}
+			break;
+
+			case CAPI_DISCONNECT:
+				if (call->incoming)
+					active_incoming--;
+				calls.erase(i);
+				statistics.calls_finished++;
+				if (call_blocked) {
+					call_blocked=false;
+					schedule(now,NEW_CALL);
+				}
+			break;
+
+			default: // INFO_RESP, FACILITY_RESP, ...
+			break;
+		}
+	}
+}
+
+void
+CapiSimulator::offerCall(long long now)
+{
+	if (statistics.calls_offered>=parameters.calls)
+		return;
+
+	_cdword plci=0;
+	if (active_incoming<parameters.concurrent)
+		plci=allocatePlci(0);
+	if (!plci) {
+		call_blocked=true; // the next call is offered when a call has finished
+		return;
+	}
+
+	call_t &call=calls[plci];
+	call.state=call_t::OFFERED;
+	call.serial=next_serial++;
+	call.incoming=true;
+	call.disconnect=false;
+	call.offered=now;
+	call.line_free=call.last_conf=0;
+	call.dataHandle=0;
+	active_incoming++;
+	statistics.calls_offered++;
+
+	// numbers according to ETS 300 102-1: called party is unknown type/ISDN plan, calling party national/ISDN plan
+	stringstream calling_nr;
+	calling_nr << 5550000+call.serial%10000;
+	unsigned char called[]={4,0x81,'1','0','0'};
+	unsigned char calling[16]={static_cast<unsigned char>(calling_nr.str().size()+2),0x21,0x80};
+	memcpy(&calling[3],calling_nr.str().data(),calling_nr.str().size());
+
+	_cmsg message;
+	header(message,CAPI_CONNECT,CAPI_IND,messageNumber++,plci);
+	message.CIPValue=parameters.cip;
+	message.CalledPartyNumber=called;
+	message.CallingPartyNumber=calling;
+	send(message);
+
+	if (statistics.calls_offered<parameters.calls) {
+		next_call+=parameters.call_interval;
+		if (next_call<now)
+			next_call=now; // we were blocked before
+		schedule(next_call,NEW_CALL);
+	}
+}
+
+void
+CapiSimulator::disconnectCall(_cdword plci, call_t &call, _cword reason)
+{
+	_cmsg message;
+	call.reason=reason;
+	switch (call.state) {
+		case call_t::B3_CONNECTING:
+		case call_t::B3_ACTIVE:
+			call.state=call_t::B3_DISCONNECTING;
+			call.disconnect=true;
+			send(header(message,CAPI_DISCONNECT_B3,CAPI_IND,messageNumber++,plci | 0x10000));
+		break;
+
+		case call_t::B3_DISCONNECTING:
+			call.disconnect=true; // DISCONNECT_IND follows DISCONNECT_B3_RESP
+		break;
+
+		case call_t::DISCONNECTING:
+		break;
+
+		default:
+			call.state=call_t::DISCONNECTING;
+			header(message,CAPI_DISCONNECT,CAPI_IND,messageNumber++,plci);
+			message.Reason=reason;
+			send(message);
+		break;
+	}
+}
+
+_cdword
+CapiSimulator::allocatePlci(_cdword controller)
+{
+	for (unsigned c=1;c<=parameters.controllers;c++) {
+		if (controller && c!=controller)
+			continue;
+		for (unsigned channel=1;channel<=parameters.channels;channel++) {
+			_cdword plci=c | (channel<<8);
+			if (calls.find(plci)==calls.end())
+				return plci;
+		}
+	}
+	return 0;
+}
+
+void
+CapiSimulator::schedule(long long time, event_type_t type, _cdword plci, _cword messageNumber, _cword dataHandle)
+{
+	event_t event;
+	event.type=type;
+	event.plci=plci;
+	event.serial=plci ? calls[plci].serial : 0;
+	event.messageNumber=messageNumber;
+	event.dataHandle=dataHandle;
+	bool earliest=events.empty() || time<events.begin()->first;
+	events.insert(pair<const long long,event_t>(time,event));
+	if (earliest)
+		pthread_cond_signal(&event_cond);
+}
+
+_cmsg&
+CapiSimulator::header(_cmsg &message, _cbyte command, _cbyte subcommand, _cword messageNumber, _cdword address)
+{
+	memset(&message,0,sizeof(_cmsg));
+	capi_cmsg_header(&message,1,command,subcommand,messageNumber,address);
+	return message;
+}
+
+void
+CapiSimulator::send(_cmsg &message)
+{
+	unsigned char buffer[2048]; // the simulator only sends messages with a few short structs
+	capi_cmsg2message(&message,buffer);
+	inbox.push_back(string(reinterpret_cast<char*>(buffer),CAPIMSG_LEN(buffer)));
+	statistics.messages_sent++;
+	pthread_cond_signal(&inbox_cond);
+}
+
+void
+CapiSimulator::confirm(_cmsg &request, _cword info)
+{
+	_cmsg message;
+	header(message,request.Command,CAPI_CONF,request.Messagenumber,request.adr.adrNCCI);
+	message.Info=info;
+	send(message);
+}
+
+unsigned
+CapiSimulator::random()
+{
+	random_state=random_state*1103515245+12345;
+	return random_state>>8;
+}
+
+long long
+CapiSimulator::currentTime()
+{
+	timeval now;
+	gettimeofday(&now,NULL);
+	return static_cast<long long>(now.tv_sec)*1000000+now.tv_usec;
+}
+
+string
+CapiSimulator::prefix()
+{
+	return AsyncLog::prefix("CapiSimulator",this);
+}
+
+/* History
+
+$Log$
+
+*/
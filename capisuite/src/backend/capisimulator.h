@@ -0,0 +1,320 @@
+/** @file capisimulator.h
+    @brief Contains CapiSimulator - Simulated CAPI for load and latency measurements
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef CAPISIMULATOR_H
+#define CAPISIMULATOR_H
+
+#include <pthread.h>
+#include <string>
+#include <deque>
+#include <map>
+#include <vector>
+#include "../../config.h"
+#ifdef HAVE_OSTREAM
+  #include <ostream>
+#else
+  #include <ostream.h>
+#endif
+#include "capiexception.h"
+#include "capitransport.h"
+
+using namespace std;
+
+/** @brief Thread exec handler for CapiSimulator class
+
+    This is a handler which will call run() of the given CapiSimulator for the use in pthread_create().
+*/
+void* capisimulator_exec_handler(void* arg);
+
+/** @brief Simulated CAPI for load and latency measurements
+
+    This CapiTransport plays the role of the ISDN controllers and the remote
+    parties, so the real Capi, Connection and module code can be run with many
+    calls without any ISDN hardware.
+
+    Once the application listens for calls, incoming calls are offered with
+    CONNECT_IND in a fixed interval until the configured number of calls was
+    reached, keeping at most the configured number of calls active at the same
+    time. Accepted calls are connected like a real controller does and the
+    remote party sends a DATA_B3_IND block at line rate (8000 bytes per second)
+    until it hangs up after the configured call duration. Data blocks sent by
+    the application are confirmed at line rate, too. Outgoing calls started with
+    CONNECT_REQ are connected after a dial delay.
+
+    All timing is derived from the start of the simulation, the optional random
+    delay of the data blocks uses a fixed seed, so each run offers exactly the same
+    load.
+
+    While running, the simulator measures how fast the application reacts
+    (see statistics_t):
+	- accept latency: from CONNECT_IND to CONNECT_RESP
+	- setup latency: from CONNECT_IND to CONNECT_B3_ACTIVE_RESP
+	- data latency: from DATA_B3_IND to DATA_B3_RESP
+	- send latency: from DATA_B3_CONF to the next DATA_B3_REQ of the call
+	- send gaps: time the line was idle between two data blocks sent by the
+	  application, i.e. audible dropouts
+
+    The simulator uses an own thread to send the timed messages. The reactions to
+    the messages sent by the application are generated in putMessage().
+
+    @author agent
+*/
+class CapiSimulator: public CapiTransport
+{
+	friend void* capisimulator_exec_handler(void*);
+
+	public:
+		/** @brief parameters of the simulation, see CapiSimulator()
+		*/
+		struct parameters_t {
+			unsigned controllers; ///< number of simulated controllers
+			unsigned channels; ///< number of B channels per controller, max. 255
+			unsigned calls; ///< number of incoming calls to offer
+			unsigned concurrent; ///< max. number of incoming calls active at the same time
+			unsigned call_interval; ///< usecs between two incoming calls
+			unsigned call_duration; ///< usecs from CONNECT_B3_ACTIVE_IND until the remote party hangs up, 0=never
+			unsigned dial_delay; ///< usecs from CONNECT_REQ until CONNECT_ACTIVE_IND for outgoing calls
+			unsigned block_size; ///< size of the DATA_B3_IND blocks in bytes
+			unsigned jitter; ///< max. random delay of a DATA_B3_IND in usecs
+			unsigned seed; ///< seed for the random delays and data
+			_cword cip; ///< CIP value of the incoming calls (1=speech, 4=3.1kHz audio, 16=telephony, 17=fax G3)
+		};
+
+		/** @brief measurements of the simulation, all times in usecs
+		*/
+		struct statistics_t {
+			unsigned long calls_offered, ///< number of CONNECT_INDs sent
+				calls_rejected, ///< number of calls rejected by the application
+				calls_connected, ///< number of calls which reached CONNECT_B3_ACTIVE
+				calls_finished, ///< number of calls which are completely disconnected
+				messages_sent, ///< number of messages sent to the application
+				messages_received, ///< number of messages received from the application
+				blocks_lost, ///< DATA_B3_INDs not sent as the application didn't confirm the previous ones in time
+				bytes_received; ///< bytes sent by the application with DATA_B3_REQ
+			vector<long> accept_latency, ///< from CONNECT_IND to CONNECT_RESP for each call
+				setup_latency, ///< from CONNECT_IND to CONNECT_B3_ACTIVE_RESP for each call
+				data_latency, ///< from DATA_B3_IND to DATA_B3_RESP for each block
+				send_latency, ///< from DATA_B3_CONF to the next DATA_B3_REQ of the same call
+				send_gaps; ///< idle time of the line between two blocks sent by the application, only if >0
+		};
+
+		/** @brief Constructor. Start the simulation thread.
+
+		    @param parameters parameters of the simulation
+		    @param debug stream for debugging info
+		    @param debug_level verbosity level for debug messages
+		    @param error stream for error messages
+		    @throw CapiExternalError Thrown if the thread can't be started
+		*/
+		CapiSimulator(parameters_t parameters, ostream &debug, unsigned short debug_level, ostream &error) throw (CapiExternalError);
+
+		/** @brief Destructor. Stop the simulation thread.
+
+		    Delete the Capi object using this simulator first.
+		*/
+		~CapiSimulator();
+
+		/** @brief Get a copy of the current measurements
+
+		    @return the measurements
+		*/
+		statistics_t getStatistics();
+
+		/** @brief Check if the simulation is finished
+
+		    @return true if all incoming calls were offered and all calls are disconnected
+		*/
+		bool finished();
+
+		unsigned isInstalled();
+		unsigned getProfile(unsigned controller, unsigned char *buf);
+		unsigned char* getManufacturer(unsigned controller, unsigned char *buf);
+		unsigned char* getVersion(unsigned controller, unsigned char *buf);
+		unsigned registerApplication(unsigned maxLogicalConnection, unsigned maxBDataBlocks, unsigned maxBDataLen, unsigned *applId);
+		unsigned release(unsigned applId);
+		unsigned putMessage(unsigned applId, unsigned char *message);
+		unsigned getMessage(unsigned applId, unsigned char **message);
+		unsigned waitForMessage(unsigned applId);
+
+	private:
+		/** @brief types of the timed events
+		*/
+		enum event_type_t {
+			NEW_CALL, ///< offer the next incoming call
+			DATA_IND, ///< send the next DATA_B3_IND of a call
+			DATA_CONF, ///< confirm a DATA_B3_REQ, the line has sent the block
+			CONNECT_ACTIVE, ///< the remote party answered an outgoing call
+			HANGUP ///< the remote party hangs up
+		};
+
+		/** @brief timed event
+		*/
+		struct event_t {
+			event_type_t type; ///< what to do
+			_cdword plci; ///< the call the event belongs to
+			unsigned long serial; ///< serial number of the call, so events of finished calls are ignored
+			_cword messageNumber; ///< message number of the DATA_B3_REQ for DATA_CONF
+			_cword dataHandle; ///< data handle of the DATA_B3_REQ for DATA_CONF
+		};
+
+		/** @brief state of a simulated call
+		*/
+		struct call_t {
+			enum {
+				OFFERED, ///< CONNECT_IND sent or CONNECT_REQ confirmed
+				CONNECTED, ///< CONNECT_ACTIVE_IND sent
+				B3_CONNECTING, ///< CONNECT_B3_IND sent or CONNECT_B3_REQ confirmed
+				B3_ACTIVE, ///< CONNECT_B3_ACTIVE_IND sent
+				B3_DISCONNECTING, ///< DISCONNECT_B3_IND sent
+				DISCONNECTING ///< DISCONNECT_IND sent
+			} state; ///< state of the call
+			unsigned long serial; ///< unique serial number of the call
+			bool incoming; ///< true for calls offered by the simulator
+			bool disconnect; ///< true if DISCONNECT_IND must follow DISCONNECT_B3_IND
+			_cword reason; ///< reason for DISCONNECT_IND
+			long long offered; ///< time of CONNECT_IND or CONNECT_REQ
+			long long next_block; ///< nominal time of the next DATA_B3_IND
+			long long line_free; ///< time when the line has sent all blocks of the application
+			long long last_conf; ///< time of the last DATA_B3_CONF not yet followed by a DATA_B3_REQ, 0=none
+			_cword dataHandle; ///< data handle for the next DATA_B3_IND
+			map<_cword,long long> unconfirmed; ///< send times of the DATA_B3_INDs without DATA_B3_RESP, by data handle
+		};
+
+		/** @brief Thread body, sends the timed messages until the object is destroyed
+		*/
+		void run();
+
+		/** @brief Handle a timed event, mutex must be held
+
+		    @param event the event
+		    @param now current time
+		*/
+		void handleEvent(event_t &event, long long now);
+
+		/** @brief Handle a message of the application, mutex must be held
+
+		    @param message the disassembled message
+		    @param now current time
+		*/
+		void handleMessage(_cmsg &message, long long now);
+
+		/** @brief Offer a new incoming call, mutex must be held
+
+		    @param now current time
+		*/
+		void offerCall(long long now);
+
+		/** @brief Disconnect a call, starting with the B3 connection if necessary, mutex must be held
+
+		    @param plci PLCI of the call
+		    @param call the call
+		    @param reason reason for DISCONNECT_IND
+		*/
+		void disconnectCall(_cdword plci, call_t &call, _cword reason);
+
+		/** @brief Find a free B channel on a controller, mutex must be held
+
+		    @param controller number of the controller, 0=any
+		    @return PLCI for the channel, 0 if all channels are busy
+		*/
+		_cdword allocatePlci(_cdword controller);
+
+		/** @brief Schedule a timed event, mutex must be held
+
+		    @param time when the event is due
+		    @param type type of the event
+		    @param plci the call the event belongs to, 0 if none
+		    @param messageNumber message number for DATA_CONF
+		    @param dataHandle data handle for DATA_CONF
+		*/
+		void schedule(long long time, event_type_t type, _cdword plci=0, _cword messageNumber=0, _cword dataHandle=0);
+
+		/** @brief Prepare a message to the application
+
+		    @param message the message to fill
+		    @param command CAPI command
+		    @param subcommand CAPI subcommand
+		    @param messageNumber message number, for indications use nextMessageNumber()
+		    @param address controller, PLCI or NCCI
+		    @return reference to message
+		*/
+		_cmsg& header(_cmsg &message, _cbyte command, _cbyte subcommand, _cword messageNumber, _cdword address);
+
+		/** @brief Queue a message for the application, mutex must be held
+
+		    @param message the message
+		*/
+		void send(_cmsg &message);
+
+		/** @brief Send a confirmation with Info value, mutex must be held
+
+		    @param request the request to confirm
+		    @param info Info value
+		*/
+		void confirm(_cmsg &request, _cword info=0);
+
+		/** @brief Pseudo random number generator with fixed seed
+
+		    @return the next random number
+		*/
+		unsigned random();
+
+		/** @brief return the current time in usecs
+		*/
+		static long long currentTime();
+
+		/** @brief return a prefix containing this pointer and date for log messages
+
+		    @return constructed prefix as stringstream
+		*/
+		string prefix();
+
+		parameters_t parameters; ///< parameters of the simulation
+		statistics_t statistics; ///< measurements
+		unsigned random_state; ///< state of random()
+		unsigned window; ///< max. number of unconfirmed DATA_B3_INDs, as registered by the application
+		bool listening, ///< true after the application has listened for incoming calls
+			released, ///< true after release()
+			terminate, ///< set by the destructor to stop the thread
+			call_blocked; ///< true if the next incoming call waits until another call has finished
+		unsigned active_incoming; ///< number of incoming calls currently active
+		unsigned long next_serial; ///< serial number of the next call
+		long long next_call; ///< nominal time of the next incoming call
+		_cword messageNumber; ///< message number for the next indication
+		string block; ///< data sent with each DATA_B3_IND, never changed
+
+		map<_cdword,call_t> calls; ///< all calls not yet disconnected, by PLCI
+		multimap<long long,event_t> events; ///< timed events by due time
+		deque<string> inbox; ///< messages waiting for the application
+		string delivered; ///< message last returned by getMessage(), kept until the next call
+
+		pthread_t thread_handle; ///< the simulation thread
+		pthread_mutex_t mutex; ///< protects all members
+		pthread_cond_t inbox_cond, ///< signalled when a message is queued or the application is released
+			event_cond; ///< signalled when an earlier event is scheduled or the thread shall terminate
+
+		ostream &debug, ///< debug stream
+			&error; ///< error stream
+		unsigned short debug_level; ///< debug level
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,78 @@
+/*  @file capitransport.cpp
+    @brief Contains CapiTransport - Interface for exchanging messages with CAPI and Capi20Transport - its implementation using libcapi20
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stddef.h> // for NULL
+#include "capitransport.h"
+
+unsigned
+Capi20Transport::isInstalled()
+{
+	return CAPI20_ISINSTALLED();
+}
+
+unsigned
+Capi20Transport::getProfile(unsigned controller, unsigned char *buf)
+{
+	return CAPI20_GET_PROFILE(controller,buf);
+}
+
+unsigned char*
+Capi20Transport::getManufacturer(unsigned controller, unsigned char *buf)
+{
+	return capi20_get_manufacturer(controller,buf);
+}
+
+unsigned char*
+Capi20Transport::getVersion(unsigned controller, unsigned char *buf)
+{
+	return capi20_get_version(controller,buf);
+}
+
+unsigned
+Capi20Transport::registerApplication(unsigned maxLogicalConnection, unsigned maxBDataBlocks, unsigned maxBDataLen, unsigned *applId)
+{
+	return capi20_register(maxLogicalConnection,maxBDataBlocks,maxBDataLen,applId);
+}
+
+unsigned
+Capi20Transport::release(unsigned applId)
+{
+	return capi20_release(applId); // this will abort capi20_waitformessage
+}
+
+unsigned
+Capi20Transport::putMessage(unsigned applId, unsigned char *message)
+{
+	return capi20_put_message(applId,message);
+}
+
+unsigned
+Capi20Transport::getMessage(unsigned applId, unsigned char **message)
+{
+	return capi20_get_message(applId,message);
+}
+
+unsigned
+Capi20Transport::waitForMessage(unsigned applId)
+{
+	return capi20_waitformessage(applId,NULL);
+}
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,145 @@
+/** @file capitransport.h
+    @brief Contains CapiTransport - Interface for exchanging messages with CAPI and Capi20Transport - its implementation using libcapi20
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef CAPITRANSPORT_H
+#define CAPITRANSPORT_H
+
+#include <capi20.h>
+
+/** @brief Interface for exchanging messages with CAPI
+
+    Capi doesn't call libcapi20 directly but uses an implementation of this
+    interface. Normally this is Capi20Transport, but another implementation
+    can be given to the Capi constructor to run the real Capi, Connection and
+    module code against something else than an ISDN card, e.g. the CapiSimulator
+    used for benchmarking.
+
+    The methods have the same parameters, return values and semantics as the
+    according capi20_* functions of libcapi20. Messages are passed in their
+    raw CAPI format. A message returned by getMessage() must stay valid until
+    the next call of getMessage().
+
+    @author agent
+*/
+class CapiTransport
+{
+	public:
+		/** @brief Destructor
+		*/
+		virtual ~CapiTransport() {}
+
+		/** @brief Check if CAPI is installed, see CAPI20_ISINSTALLED()
+
+		    @return CAPI info value, 0 if CAPI is available
+		*/
+		virtual unsigned isInstalled()=0;
+
+		/** @brief Read the profile of a controller, see CAPI20_GET_PROFILE()
+
+		    @param controller number of the controller, 0 returns the number of controllers in the first two bytes
+		    @param buf buffer of 64 bytes for the profile
+		    @return CAPI info value
+		*/
+		virtual unsigned getProfile(unsigned controller, unsigned char *buf)=0;
+
+		/** @brief Read the manufacturer of a controller or the driver, see capi20_get_manufacturer()
+
+		    @param controller number of the controller, 0 for the driver
+		    @param buf buffer of 64 bytes for the zero-terminated manufacturer string
+		    @return buf or NULL if not available
+		*/
+		virtual unsigned char* getManufacturer(unsigned controller, unsigned char *buf)=0;
+
+		/** @brief Read the version of a controller or the driver, see capi20_get_version()
+
+		    @param controller number of the controller, 0 for the driver
+		    @param buf buffer for four dwords containing the CAPI and manufacturer version
+		    @return buf or NULL if not available
+		*/
+		virtual unsigned char* getVersion(unsigned controller, unsigned char *buf)=0;
+
+		/** @brief Register an application, see capi20_register()
+
+		    @param maxLogicalConnection max. number of logical connections
+		    @param maxBDataBlocks max. number of unconfirmed B3 data blocks
+		    @param maxBDataLen max. size of B3 data blocks
+		    @param applId the assigned application id is stored here
+		    @return CAPI info value
+		*/
+		virtual unsigned registerApplication(unsigned maxLogicalConnection, unsigned maxBDataBlocks, unsigned maxBDataLen, unsigned *applId)=0;
+
+		/** @brief Release an application, see capi20_release()
+
+		    This must wake up a thread blocking in waitForMessage().
+
+		    @param applId application id
+		    @return CAPI info value
+		*/
+		virtual unsigned release(unsigned applId)=0;
+
+		/** @brief Send a message, see capi20_put_message()
+
+		    @param applId application id
+		    @param message the message in raw CAPI format
+		    @return CAPI info value
+		*/
+		virtual unsigned putMessage(unsigned applId, unsigned char *message)=0;
+
+		/** @brief Receive a message without waiting, see capi20_get_message()
+
+		    @param applId application id
+		    @param message a pointer to the message is stored here, it's valid until the next call
+		    @return CAPI info value, CapiReceiveQueueEmpty if no message is available
+		*/
+		virtual unsigned getMessage(unsigned applId, unsigned char **message)=0;
+
+		/** @brief Wait until a message is available, see capi20_waitformessage()
+
+		    This is a cancellation point for the calling thread.
+
+		    @param applId application id
+		    @return CAPI info value, 0 if a message is available
+		*/
+		virtual unsigned waitForMessage(unsigned applId)=0;
+};
+
+/** @brief Implementation of CapiTransport using libcapi20
+
+    All methods directly call the according functions of libcapi20.
+
+    @author agent
+*/
+class Capi20Transport: public CapiTransport
+{
+	public:
+		unsigned isInstalled();
+		unsigned getProfile(unsigned controller, unsigned char *buf);
+		unsigned char* getManufacturer(unsigned controller, unsigned char *buf);
+		unsigned char* getVersion(unsigned controller, unsigned char *buf);
+		unsigned registerApplication(unsigned maxLogicalConnection, unsigned maxBDataBlocks, unsigned maxBDataLen, unsigned *applId);
+		unsigned release(unsigned applId);
+		unsigned putMessage(unsigned applId, unsigned char *message);
+		unsigned getMessage(unsigned applId, unsigned char **message);
+		unsigned waitForMessage(unsigned applId);
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -15,30 +15,40 @@
  ***************************************************************************/
 
 #include "../../config.h"
-#include <fstream>
 #include <stdexcept> // for out_of_range
 #include <pthread.h>
 #include <errno.h> // for errno
+#include <fcntl.h> // for open(), posix_fadvise()
+#include <unistd.h> // for read(), close()
+#include <string.h> // for strerror()
+#include <stdio.h> // for snprintf()
 #include <iconv.h> // for iconv(), iconv_open(), iconv_close()
 #include "capi.h"
 #include "callinterface.h"
 #include "connection.h"
-
-#define conf_send_buffers 4
+#include "metrics.h"
+#include "asynclog.h"
 
 using namespace std;
 
 Connection::Connection (_cmsg& message, Capi *capi, unsigned short DDILength, unsigned short DDIBaseLength, std::vector<std::string> DDIStopNumbers):
 	call_if(NULL),capi(capi),plci_state(P2),ncci_state(N0), buffer_start(0), buffers_used(0),
-	file_for_reception(NULL), file_to_send(NULL), received_dtmf(""), keepPhysicalConnection(false),
+	file_for_reception(NULL), encoded_reception(NULL), file_to_send(-1), send_data(NULL), send_data_length(0), send_data_pos(0), send_list_pos(0), send_window(0), send_block_size(0), send_max_queued(0), send_queued(0), received_dtmf(""), keepPhysicalConnection(false),
 	disconnect_cause(0),debug(capi->debug), debug_level(capi->debug_level), error(capi->error),
 	our_call(false), disconnect_cause_b3(0), fax_info(NULL), DDILength(DDILength), 
 	DDIBaseLength(DDIBaseLength), DDIStopNumbers(DDIStopNumbers) 
 {
 	pthread_mutex_init(&send_mutex, NULL);
 	pthread_mutex_init(&receive_mutex, NULL);
+	pthread_cond_init(&send_cond, NULL);
+	abort_time.tv_sec=abort_time.tv_usec=0;
+	abort_queued=0;
 
 	plci=CONNECT_IND_PLCI(&message); // Physical Link Connection Identifier
+	controller=plci & 0x7F; // the lowest 7 bits of the PLCI hold the controller number
+	setup_start=Metrics::now();
+	Metrics::count(Metrics::CALLS_INCOMING);
+	Metrics::callStarted(controller);
 	call_from = getNumber(CONNECT_IND_CALLINGPARTYNUMBER(&message),true);
 	if (DDILength)
 		call_to=""; // we enable the CalledParty InfoElement when using DDI and will get the number later again
@@ -67,13 +77,18 @@ Connection::Connection (_cmsg& message, Capi *capi, unsigned short DDILength, un
 
 Connection::Connection (Capi* capi, _cdword controller, string call_from, bool clir, string call_to, service_t service, string faxStationID, string faxHeadline)  throw (CapiExternalError, CapiMsgError)
 	:call_if(NULL),capi(capi),plci_state(P01),ncci_state(N0),plci(0),service(service),  
-	buffer_start(0), buffers_used(0), file_for_reception(NULL), file_to_send(NULL), 
+	buffer_start(0), buffers_used(0), file_for_reception(NULL), encoded_reception(NULL), file_to_send(-1), send_data(NULL), send_data_length(0), send_data_pos(0), send_list_pos(0), send_window(0), send_block_size(0), send_max_queued(0), send_queued(0),
 	call_from(call_from), call_to(call_to), connect_ind_msg_nr(0), disconnect_cause(0), 
 	debug(capi->debug), debug_level(capi->debug_level), error(capi->error), keepPhysicalConnection(false),
 	our_call(true), disconnect_cause_b3(0), fax_info(NULL), DDILength(0), DDIBaseLength(0) 
 {
 	pthread_mutex_init(&send_mutex, NULL);
 	pthread_mutex_init(&receive_mutex, NULL);
+	pthread_cond_init(&send_cond, NULL);
+	abort_time.tv_sec=abort_time.tv_usec=0;
+	abort_queued=0;
+	this->controller=controller;
+	setup_start=Metrics::now();
 
 	if (debug_level >= 1) {
 		debug << prefix() << "Connection object created for outgoing call from " << call_from << " to " << call_to
@@ -145,6 +160,10 @@ Connection::Connection (Capi* capi, _cdword controller, string call_from, bool c
 		delete[] calledPartyNumber;
 	if (callingPartyNumber)
 		delete[] callingPartyNumber;
+
+	// counted only now, as the destructor isn't called if connect_req() failed
+	Metrics::count(Metrics::CALLS_OUTGOING);
+	Metrics::callStarted(controller);
 }
 
 Connection::~Connection()
@@ -163,9 +182,12 @@ Connection::~Connection()
 	pthread_mutex_lock(&send_mutex);  // assure the lock is free before destroying it
 	pthread_mutex_unlock(&send_mutex);
 	pthread_mutex_destroy(&send_mutex);
+	pthread_cond_destroy(&send_cond);
 
 	pthread_mutex_lock(&receive_mutex); // assure the lock is free before destroying it
 	pthread_mutex_unlock(&receive_mutex);
+
+	Metrics::callFinished(controller);
 	pthread_mutex_destroy(&receive_mutex);
 
 	if (fax_info)
@@ -301,12 +323,13 @@ Connection::getCallingPartyNumber()
 string
 Connection::prefix()
 {
-	stringstream s;
-	time_t t=time(NULL);
-	char* ct=ctime(&t);
-	ct[24]='\0';
-	s << ct << " Connection " << hex << this << ": ";
-	return (s.str());
+	// the object address identifies the call, PLCI and NCCI are added once they are known
+	char fields[48]="";
+	if (plci && ncci_state!=N0)
+		snprintf(fields,sizeof(fields)," plci=0x%x ncci=0x%x",plci,ncci);
+	else if (plci)
+		snprintf(fields,sizeof(fields)," plci=0x%x",plci);
+	return AsyncLog::prefix("Connection",this,fields);
 }
 
 void
@@ -418,6 +441,11 @@ Connection::connect_b3_active_ind(_cmsg& message) throw (CapiError,CapiWrongStat
 		}
 		ncci_state=NACT;
 
+		if (setup_start) { // only the first logical connection counts for the setup time
+			Metrics::observe(our_call ? Metrics::SETUP_OUTGOING : Metrics::SETUP_INCOMING,Metrics::now()-setup_start);
+			setup_start=0;
+		}
+
 		if (service==FAXG3 && CONNECT_B3_ACTIVE_IND_NCPI(&message)[0]>=9) {
 			_cstruct ncpi=CONNECT_B3_ACTIVE_IND_NCPI(&message);
 			if (!fax_info)
@@ -469,7 +497,10 @@ Connection::disconnect_b3_ind(_cmsg& message) throw (CapiError,CapiWrongState)
 		}
 
 		pthread_mutex_lock(&send_mutex);
+		Metrics::changeSendBuffers(-static_cast<long>(buffers_used));
 		buffers_used=0; // we'll get no DATA_B3_CONF's after DISCONNECT_B3_IND, see Capi 2.0 spec, 5.18, note for DATA_B3_CONF
+		send_queued=0;
+		pthread_cond_broadcast(&send_cond);
 		pthread_mutex_unlock(&send_mutex);
 
 		stop_file_transmission();
@@ -534,12 +565,15 @@ Connection::data_b3_ind(_cmsg& message) throw (CapiError,CapiWrongState,CapiMsgE
 		throw CapiError("DATA_B3_IND received with wrong NCCI","Connection::data_b3_ind()");
 
 	pthread_mutex_lock(&receive_mutex);
-	if (file_for_reception)	{
-		for (int i=0;i<DATA_B3_IND_DATALENGTH(&message);i++)
-			(*file_for_reception) << DATA_B3_IND_DATA(&message)[i];
-	}
+	if (file_for_reception) // only copied to memory, so we can answer without waiting for the disk
+		file_for_reception->write(DATA_B3_IND_DATA(&message),DATA_B3_IND_DATALENGTH(&message));
+	if (encoded_reception)
+		encoded_reception->write(DATA_B3_IND_DATA(&message),DATA_B3_IND_DATALENGTH(&message));
 	pthread_mutex_unlock(&receive_mutex);
 
+	Metrics::count(Metrics::BLOCKS_RECEIVED);
+	Metrics::count(Metrics::BYTES_RECEIVED,DATA_B3_IND_DATALENGTH(&message));
+
 	if (call_if)
 		call_if->dataIn(DATA_B3_IND_DATA(&message),DATA_B3_IND_DATALENGTH(&message));
 
@@ -644,9 +678,11 @@ Connection::connect_conf(_cmsg& message) throw (CapiWrongState, CapiMsgError)
 	if (plci_state!=P01)
 		throw CapiWrongState("CONNECT_CONF received in wrong state","Connection::connect_conf()");
 
-	if (CONNECT_CONF_INFO(&message))
+	if (CONNECT_CONF_INFO(&message)) {
+		// Capi::connect_conf() ends the call, as the waiting module may delete us then
+		disconnect_cause=CONNECT_CONF_INFO(&message);
 		throw CapiMsgError(CONNECT_CONF_INFO(&message),"CONNECT_CONF received with Error (Info)","Connection::connect_conf()");
-		// TODO: do we have to delete Connection here if Info!=0 or is a DISCONNECT_IND initiated then (think not ...)
+	}
 
 	plci=CONNECT_CONF_PLCI(&message);
 	if (debug_level >= 2) {
@@ -727,10 +763,14 @@ Connection::data_b3_conf(_cmsg& message) throw (CapiError,CapiWrongState,CapiMsg
 		if ( (!buffers_used) || (DATA_B3_CONF_DATAHANDLE(&message)!=buffer_start) )
 			throw CapiError("DATA_B3_CONF received with invalid data handle","Connection::data_b3_conf()");
 		// free one buffer
+		send_queued-=send_length[buffer_start];
 		buffers_used--;
+		Metrics::changeSendBuffers(-1);
 		buffer_start=(buffer_start+1)%7;
-		while (file_to_send && (buffers_used < conf_send_buffers) )
+		while ((file_to_send!=-1 || send_data) && send_window_free())
 			send_block();
+		if (!buffers_used)
+			pthread_cond_broadcast(&send_cond);
 	}
 	catch (...) {
 		pthread_mutex_unlock(&send_mutex);
@@ -806,7 +846,7 @@ Connection::send_block() throw (CapiError,CapiWrongState,CapiExternalError,CapiM
 	if (ncci_state!=NACT)
 		throw CapiWrongState("unable to send file because connection is not established","Connection::send_block()");
 
-	if (!file_to_send)
+	if (file_to_send==-1 && !send_data)
 		throw CapiError("unable to play file because no input file is open","Connection::send_block()");
 
 	if (buffers_used>=7)
@@ -816,33 +856,47 @@ Connection::send_block() throw (CapiError,CapiWrongState,CapiExternalError,CapiM
 
 	unsigned short buff_num=(buffer_start+buffers_used)%7; // buffer to store the next item
 
-	int i=0;
-	while (i<2048 && !file_completed) {
-		if (!file_to_send->get(send_buffer[buff_num][i]))
-			file_completed=true;
-		else
-	   		i++;
+	char *block;
+	int i=0, block_size=send_block_size;
+	if (send_data) { // send directly out of memory
+		block=const_cast<char*>(send_data)+send_data_pos;
+		i=send_data_length-send_data_pos;
+		if (i>block_size)
+			i=block_size;
+		send_data_pos+=i;
+		file_completed=(send_data_pos>=send_data_length);
+	} else {
+		block=send_buffer[buff_num];
+		while (i<block_size && !file_completed) { // read() may return less than requested, so repeat until block is full or EOF
+			ssize_t ret=read(file_to_send,block+i,block_size-i);
+			if (ret>0)
+				i+=ret;
+			else if (ret<0 && errno==EINTR)
+				continue;
+			else {
+				if (ret<0)
+					error << prefix() << "WARNING: error while reading file to send: " << strerror(errno) << endl;
+				file_completed=true;
+			}
+		}
 	}
 
 	try {
 		if (i>0) {
-	  	 	capi->data_b3_req(ncci,send_buffer[buff_num],i,buff_num,0); // can throw CapiMsgError. Propagate.
+	  	 	capi->data_b3_req(ncci,block,i,buff_num,0); // can throw CapiMsgError. Propagate.
 			buffers_used++;
+			send_length[buff_num]=i;
+			send_queued+=i;
+			Metrics::changeSendBuffers(1);
+			Metrics::count(Metrics::BLOCKS_SENT);
+			Metrics::count(Metrics::BYTES_SENT,i);
 		}
 	}
 	catch (CapiMsgError e) {
 		error << prefix() << "WARNING: Can't send data_b3_req. Message was: " << e << endl;
-		if (file_completed) {
-			file_to_send->close();
-			delete file_to_send;
-			file_to_send=NULL;
-		}
 	}
 
-  	if (file_completed) {
-    		file_to_send->close();
-		delete file_to_send;
-	 	file_to_send=NULL;
+  	if (file_completed && !next_send_source()) {
 	 	if (call_if)
 	 		call_if->transmissionComplete();
 		else
@@ -850,36 +904,129 @@ Connection::send_block() throw (CapiError,CapiWrongState,CapiExternalError,CapiM
   	}
 }
 
+void
+Connection::close_send_source()
+{
+	send_list.clear();
+	next_send_source();
+}
+
+bool
+Connection::next_send_source()
+{
+	if (file_to_send!=-1) {
+		close(file_to_send);
+		file_to_send=-1;
+	}
+	send_data=NULL;
+	send_data_length=send_data_pos=0;
+
+	while (send_list_pos<send_list.size()) {
+		send_item_t &item=send_list[send_list_pos++];
+		if (item.data) {
+			if (!item.length)
+				continue;
+			send_data=item.data;
+			send_data_length=item.length;
+			return true;
+		}
+		int fd=open(item.filename.c_str(),O_RDONLY);
+		if (fd==-1) {
+			error << prefix() << "WARNING: unable to open file to send (" << item.filename << "): " << strerror(errno) << endl;
+			continue;
+		}
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+		file_to_send=fd;
+		return true;
+	}
+	send_list.clear();
+	send_list_pos=0;
+	return false;
+}
+
 void
 Connection::start_file_transmission(string filename) throw (CapiError,CapiWrongState,CapiExternalError,CapiMsgError)
 {
 	if (debug_level >= 2) {
 		debug << prefix() << "start_file_transmission " << filename << endl;
 	}
+	vector<send_item_t> items(1);
+	items[0].filename=filename;
+	items[0].data=NULL;
+	items[0].length=0;
+	start_list_transmission(items);
+}
+
+void
+Connection::start_buffer_transmission(const char *data, unsigned length) throw (CapiError,CapiWrongState,CapiExternalError,CapiMsgError)
+{
+	if (debug_level >= 2) {
+		debug << prefix() << "start_buffer_transmission " << dec << length << " bytes" << endl;
+	}
+	vector<send_item_t> items(1);
+	items[0].data=data;
+	items[0].length=length;
+	start_list_transmission(items);
+}
+
+void
+Connection::start_list_transmission(const vector<send_item_t> &items) throw (CapiError,CapiWrongState,CapiExternalError,CapiMsgError)
+{
+	if (debug_level >= 3) {
+		debug << prefix() << "start_list_transmission " << dec << items.size() << " items" << endl;
+	}
 	if (ncci_state!=NACT)
-		throw CapiWrongState("unable to send file because connection is not established","Connection::start_file_transmission()");
+		throw CapiWrongState("unable to send file because connection is not established","Connection::start_list_transmission()");
 
-	if (file_to_send)
-		throw CapiExternalError("unable to send file because transmission is already in progress","Connection::start_file_transmission()");
+	if (file_to_send!=-1 || send_data)
+		throw CapiExternalError("unable to send file because transmission is already in progress","Connection::start_list_transmission()");
 
-	file_to_send=new ifstream(filename.c_str());
+	// check all files now, so missing files are reported to the caller
+	for (unsigned i=0;i<items.size();i++)
+		if (!items[i].data && access(items[i].filename.c_str(),R_OK))
+			throw CapiExternalError("unable to open file to send ("+items[i].filename+")","Connection::start_list_transmission()");
 
-	if (! (*file_to_send)) { // we can't open the file
-		delete file_to_send;
-		file_to_send=NULL;
-		throw CapiExternalError("unable to open file to send ("+filename+")","Connection::start_file_transmission()");
-	} else {
-		pthread_mutex_lock(&send_mutex);
-		try {
-			while (file_to_send && buffers_used<conf_send_buffers)
-				send_block();
-		}
-		catch (...) {
-			pthread_mutex_unlock(&send_mutex);
-			throw;
+	pthread_mutex_lock(&send_mutex);
+	// use the window and block size for the current service, it may have changed since the last transmission
+	Capi::transfer_parameters_t &transfer= (service==FAXG3) ? capi->fax_transfer : capi->voice_transfer;
+	send_window=transfer.window;
+	send_block_size=transfer.block_size;
+	send_max_queued=transfer.max_queued;
+	send_list=items;
+	send_list_pos=0;
+	try {
+		if (!next_send_source()) { // nothing to send, but the caller still expects transmissionComplete()
+			if (call_if)
+				call_if->transmissionComplete();
 		}
+		while ((file_to_send!=-1 || send_data) && send_window_free())
+			send_block();
+	}
+	catch (...) {
 		pthread_mutex_unlock(&send_mutex);
+		throw;
+	}
+	pthread_mutex_unlock(&send_mutex);
+}
+
+bool
+Connection::send_window_free()
+{
+	return buffers_used<send_window && (!send_max_queued || send_queued<send_max_queued);
+}
+
+void
+Connection::abort_file_transmission()
+{
+	pthread_mutex_lock(&send_mutex);
+	if (file_to_send!=-1 || send_data) {
+		close_send_source();
+		gettimeofday(&abort_time,NULL);
+		abort_queued=send_queued;
 	}
+	pthread_mutex_unlock(&send_mutex);
 }
 
 void
@@ -889,27 +1036,34 @@ Connection::stop_file_transmission()
 		debug << prefix() << "stop_file_transmission initiated" << endl;
 	}
 	pthread_mutex_lock(&send_mutex);
-	if (file_to_send) {
-		file_to_send->close();
-		delete file_to_send;
-		file_to_send=NULL;
+	close_send_source();
+	while (buffers_used) // wait until all packages are transmitted
+		pthread_cond_wait(&send_cond,&send_mutex);
+	if (abort_time.tv_sec) {
+		if (debug_level >= 2) {
+			timeval now;
+			gettimeofday(&now,NULL);
+			long latency=(now.tv_sec-abort_time.tv_sec)*1000+(now.tv_usec-abort_time.tv_usec)/1000;
+			debug << prefix() << "transmission aborted, " << dec << abort_queued << " bytes were queued, confirmed after "
+			  << latency << " msecs" << endl;
+		}
+		abort_time.tv_sec=abort_time.tv_usec=0;
+		abort_queued=0;
 	}
 	pthread_mutex_unlock(&send_mutex);
-
-	timespec delay_time;
-	delay_time.tv_sec=0; delay_time.tv_nsec=100000000;  // 100 msec
-	while (buffers_used) // wait until all packages are transmitted
-		nanosleep(&delay_time,NULL);
 	if (debug_level >= 2) {
 		debug << prefix() << "stop_file_transmission finished" << endl;
 	}
 }
 
 void
-Connection::start_file_reception(string filename) throw (CapiWrongState, CapiExternalError)
+Connection::start_file_reception(string filename, string encoded_filename, AudioEncoder::format_t format) throw (CapiWrongState, CapiExternalError)
 {
 	if (debug_level >= 2) {
-		debug << prefix() << "start_file_reception " << filename << endl;
+		debug << prefix() << "start_file_reception " << filename;
+		if (!encoded_filename.empty())
+			debug << ", encoding to " << encoded_filename;
+		debug << endl;
 	}
 	if (ncci_state!=NACT)
 		throw CapiWrongState("unable to receive file because connection is not established","Connection::start_file_reception()");
@@ -917,26 +1071,43 @@ Connection::start_file_reception(string filename) throw (CapiWrongState, CapiExt
 	if (file_for_reception)
 		throw CapiExternalError("file reception is already active","Connection::start_file_reception()");
 
-  	file_for_reception=new ofstream(filename.c_str());
-  	if (! (*file_for_reception)) { // we can't open the file
-  		delete file_for_reception;
-		file_for_reception=NULL;
-		throw CapiExternalError("unable to open file for reception ("+filename+")","Connection::start_file_reception()");
-  	}
+	FileWriter *writer=new FileWriter(filename,capi->receive_sync,debug,debug_level,error);
+	FileWriter *encoder=NULL;
+	if (!encoded_filename.empty()) {
+		try {
+			encoder=new FileWriter(encoded_filename,capi->receive_sync,debug,debug_level,error,new AudioEncoder(format));
+		}
+		catch (CapiExternalError) {
+			delete writer;
+			throw;
+		}
+	}
+
+	pthread_mutex_lock(&receive_mutex);
+	file_for_reception=writer;
+	encoded_reception=encoder;
+	pthread_mutex_unlock(&receive_mutex);
 }
 
 void
-Connection::stop_file_reception()
+Connection::stop_file_reception(unsigned long discard)
 {
 	pthread_mutex_lock(&receive_mutex);
+	FileWriter *writer=file_for_reception;
+	FileWriter *encoder=encoded_reception;
+	file_for_reception=NULL;
+	encoded_reception=NULL;
+	pthread_mutex_unlock(&receive_mutex);
 
-	if (file_for_reception) {
-  		file_for_reception->close();
-		delete file_for_reception;
-		file_for_reception=NULL;
+	// flush the rest outside of the lock so data_b3_ind() doesn't have to wait for it
+	if (writer) {
+		writer->discardTail(discard);
+		delete writer;
+	}
+	if (encoder) {
+		encoder->discardTail(discard);
+		delete encoder;
 	}
-
-	pthread_mutex_unlock(&receive_mutex);
 	if (debug_level >= 2) {
 		debug << prefix() << "stop_file_reception finished" << endl;
 	}
@@ -20,8 +20,9 @@
 #include <capi20.h>
 #include <vector>
 #include <string>
-#include <fstream>
+#include <sys/time.h>
 #include "capiexception.h"
+#include "filewriter.h"
 
 class CallInterface;
 class Capi;
@@ -49,6 +50,7 @@ using namespace std;
 class Connection
 {
 	friend class Capi;
+	friend class BackendBenchmark;
 
 	public:
 		/** @brief Type for describing the service of incoming and outgoing calls.
@@ -140,12 +142,65 @@ class Connection
 		*/
 		void start_file_transmission(string filename) throw (CapiError,CapiWrongState,CapiExternalError,CapiMsgError);
 
+		/** @brief called to start sending of data already held in memory
+
+		    Works like start_file_transmission(), but the data is sent directly out of the given buffer
+		    without any file access or copying. So it's well suited for often used announcements.
+
+		    The buffer must stay valid until stop_file_transmission() has returned.
+
+ 		    @param data pointer to the data to send
+ 		    @param length length of data in bytes
+		    @throw CapiWrongState Thrown if Connection isn't up completely (physical & logical)
+		    @throw CapiExternalError Thrown if file transmission is already in progress
+		    @throw CapiMsgError Thrown by send_block(). See there.
+		    @throw CapiError Thrown by send_block(). See there.
+		*/
+		void start_buffer_transmission(const char *data, unsigned length) throw (CapiError,CapiWrongState,CapiExternalError,CapiMsgError);
+
+		/** @brief one item of a playlist, see start_list_transmission()
+		*/
+		struct send_item_t {
+			string filename; ///< name of the file to send, only used if data is NULL
+			const char *data; ///< data held in memory, NULL to send the file
+			unsigned length; ///< length of data in bytes
+		};
+
+		/** @brief called to start sending of several files and buffers one after another
+
+		    Works like start_file_transmission(), but sends all items of the list without a gap
+		    in between. When one item is finished, the next one is used to fill up the send
+		    buffers at once, so they don't run empty at the item boundaries.
+		    CallInterface::transmissionComplete() is called once after the last item.
+
+		    Buffers must stay valid until stop_file_transmission() has returned. If a file
+		    can't be opened when it's its turn, it's skipped with an error message.
+
+ 		    @param items the items to send
+		    @throw CapiWrongState Thrown if Connection isn't up completely (physical & logical)
+		    @throw CapiExternalError Thrown if file transmission is already in progress or one of the files can't be read
+		    @throw CapiMsgError Thrown by send_block(). See there.
+		    @throw CapiError Thrown by send_block(). See there.
+		*/
+		void start_list_transmission(const vector<send_item_t> &items) throw (CapiError,CapiWrongState,CapiExternalError,CapiMsgError);
+
 		/** @brief called to stop sending of the current file, will block until file is really finished
 
 		    If you stop the file transmission manually, CallInterface::transferCompleted won't be called.
 		*/
 		void stop_file_transmission();
 
+		/** @brief called to abort sending at once, e.g. when DTMF was received
+
+		    Closes the file or forgets the buffer currently sent, so no more blocks are given to CAPI,
+		    but doesn't wait for the blocks already queued. It may be called from the CallInterface
+		    methods like CallInterface::gotDTMF() to react as soon as possible.
+
+		    stop_file_transmission() must be called afterwards as usual. It will wait for the queued
+		    blocks and report the time this took in the debug log.
+		*/
+		void abort_file_transmission();
+
 		/** @brief called to activate receive mode
 
 		    This method doen't do anything active, it will only set the receive mode for this connection
@@ -153,17 +208,27 @@ class Connection
 		    is written to this file w/o changes. So it's in the native format given by CAPI (i.e. inserved A-Law
 		    for speech, SFF for FaxG3).
 
+		    The data is written by a FileWriter in a separate thread using the sync policy given to Capi.
+		    The file is complete after stop_file_reception() returned.
+
+		    For speech, a second file converted by an AudioEncoder can be written at the same time,
+		    e.g. to mail it without converting it afterwards.
+
  		    @param filename name of the file to which to save the incoming data
+		    @param encoded_filename name of the file to which to save the encoded data, empty for none
+		    @param format format of the encoded file
 		    @throw CapiWrongState Thrown if Connection isn't up completely (physical & logical)
-		    @throw CapiExternalError Thrown if file reception is already in progress or the file couldn't be opened
+		    @throw CapiExternalError Thrown if file reception is already in progress or a file couldn't be opened
 		*/
-		void start_file_reception(string filename) throw (CapiWrongState, CapiExternalError);
+		void start_file_reception(string filename, string encoded_filename="", AudioEncoder::format_t format=AudioEncoder::WAV_PCM) throw (CapiWrongState, CapiExternalError);
 
 		/** @brief called to stop receive mode
 
-		    This closes the reception file and tells us to ignore further incoming B3 data.
+		    This closes the reception files and tells us to ignore further incoming B3 data.
+
+		    @param discard number of bytes received last which are dropped from the files, e.g. silence
 		*/
-		void stop_file_reception();
+		void stop_file_reception(unsigned long discard=0);
 
 		/** @brief Tells disconnectCall() method how to disconnect.
 		*/
@@ -278,6 +343,7 @@ class Connection
 
 		/** @brief Return disconnection cause given by the CAPI
 
+		    0x20xx=outgoing call rejected by CAPI (CONNECT_CONF), see CAPI spec
 		    0x33xx=see CAPI spec
 		    0x34xx=ISDN cause, for coding of xx see ETS 300102-1.
 
@@ -408,6 +474,7 @@ class Connection
 		/** @brief called when we get DATA_B3_IND from CAPI
 
 		    This method will also save the received data, send a response to Capi and call CallInterface::dataIn().
+		    The data is only handed over to the FileWriter, so the response isn't delayed by disk I/O.
 
 		    @param message the received DATA_B3_IND message
 		    @throw CapiError Thrown when an invalid message is received
@@ -478,7 +545,7 @@ class Connection
 
 		    @param message the received CONNECT_CONF message
 		    @throw CapiWrongState Thrown when the message is received unexpected (i.e. in a wrong plci_state)
-		    @throw CapiMsgError Thrown if the info InfoElement indicates an error
+		    @throw CapiMsgError Thrown if the info InfoElement indicates an error. getCause() returns the info, Capi::connect_conf() ends the call then.
 		*/
 		void connect_conf(_cmsg& message) throw (CapiWrongState, CapiMsgError);
 
@@ -565,11 +632,14 @@ class Connection
   		*/
   		string getNumber (_cstruct capi_input, bool isCallingNr);
 
-		/** @brief called to send next block (2048 bytes) of file
+		/** @brief called to send next block (send_block_size bytes) of file
 
 		    The transmission will be controlled automatically by Connection, so you don't
 		    need to call this method directly. send_block() will automatically send as much
-		    packets as the configured window size (conf_send_buffers) permits.
+		    packets as the configured window size (send_window) permits.
+
+		    Files are read with one read() call per block into send_buffer, in-memory data
+		    is sent directly from send_data.
 
 		    Will call CallInterface::transmissionComplete() if the file was transferred completely.
 
@@ -580,6 +650,28 @@ class Connection
 		*/
 		void send_block() throw (CapiError,CapiWrongState,CapiExternalError,CapiMsgError);
 
+		/** @brief check if send_window and send_max_queued allow to send another block
+
+		    Must be called with send_mutex locked.
+
+		    @return true if another block may be sent
+		*/
+		bool send_window_free();
+
+		/** @brief close the file or forget the buffer currently sent and the rest of the playlist
+
+		    Must be called with send_mutex locked.
+		*/
+		void close_send_source();
+
+		/** @brief close the file or forget the buffer currently sent and go on with the next item of the playlist
+
+		    Must be called with send_mutex locked.
+
+		    @return true if the next item was opened, false if the playlist is finished
+		*/
+		bool next_send_source();
+
 		/** @brief called to build the B Configuration info elements out of given service
 
 		    This is a convenience function to do the quite annoying enconding stuff for the
@@ -651,6 +743,9 @@ class Connection
 
 		_cdword plci;    ///< CAPI id for call
 		_cdword ncci;    ///< id for logical connection
+		unsigned controller; ///< number of the controller the call is made on
+
+		long long setup_start; ///< time the call was created (see Metrics::now()), 0 after the setup time was recorded
 
 		service_t service; ///< as described in Connection::service_t, set to the last known service (either got from ISDN or set explicitly)
 
@@ -672,9 +767,22 @@ class Connection
 
 		pthread_mutex_t send_mutex,  ///< to realize critical sections in transmission code
 				receive_mutex; ///< to realize critical sections in reception code
-
-		ofstream *file_for_reception; ///< NULL if no file is received, pointer to the file otherwise
-		ifstream *file_to_send;  ///< NULL if no file is sent, pointer to the file otherwise
+		pthread_cond_t send_cond; ///< signalled when all sent blocks were confirmed, used with send_mutex
+
+		FileWriter *file_for_reception; ///< NULL if no file is received, pointer to the writer of the file otherwise
+		FileWriter *encoded_reception; ///< NULL if no encoded file is written, pointer to the writer of the file otherwise
+		int file_to_send;  ///< -1 if no file is sent, file descriptor of the file otherwise
+		const char *send_data; ///< NULL if no in-memory data is sent, pointer to the data otherwise
+		unsigned send_data_length, ///< length of send_data
+			send_data_pos; ///< offset of the next block to send in send_data
+		vector<send_item_t> send_list; ///< playlist given to start_list_transmission()
+		unsigned send_list_pos; ///< index of the next item to send in send_list
+		unsigned send_window, ///< max. number of unconfirmed blocks for the current transmission, see Capi::setVoiceTransfer()
+			send_block_size, ///< size of the blocks sent in the current transmission
+			send_max_queued, ///< max. number of unconfirmed bytes for the current transmission, 0 for no limit
+			send_queued; ///< number of bytes sent but not confirmed yet
+		timeval abort_time; ///< time of the last abort_file_transmission(), tv_sec is 0 if there was none
+		unsigned abort_queued; ///< value of send_queued at abort_time
                                      
 		ostream &debug, ///< debug stream
 		        &error; ///< stream for error messages 
@@ -682,7 +790,8 @@ class Connection
 
 		/** @brief ring buffer for sending
 
-		    7 buffers a 2048 byte mark the maximal window size handled by CAPI
+		    7 buffers a 2048 byte mark the maximal window size handled by CAPI, the window and block size
+		    actually used are given by send_window and send_block_size
 
 		    is empty: buffer_used==0 / is full: buffers_used==7
 		    to forget item: buffers_used--; buffer_start++;
@@ -690,6 +799,8 @@ class Connection
 		*/
 		char send_buffer[7][2048];
 
+		unsigned short send_length[7]; ///< number of bytes sent in the blocks of the ring buffer
+
 		unsigned short buffer_start, ///< holds the index for the first buffer currently used
 			buffers_used; ///< holds the number of currently used buffers
 
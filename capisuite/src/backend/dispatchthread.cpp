@@ -0,0 +1,93 @@
+/*  @file dispatchthread.cpp
+    @brief Contains DispatchThread - Thread processing received CAPI messages for a part of the connections
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <iostream>
+#include "capi.h"
+#include "dispatchthread.h"
+
+void* dispatchthread_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no DispatchThread reference given in dispatchthread_exec_handler" << endl;
+		exit(1);
+	}
+	DispatchThread *instance=static_cast<DispatchThread*>(arg);
+	instance->run();
+	return NULL;
+}
+
+DispatchThread::DispatchThread(Capi *capi) throw (CapiMsgError)
+:messages(),terminate(false),capi(capi)
+{
+	pthread_mutex_init(&messages_mutex, NULL);
+	pthread_cond_init(&messages_cond, NULL);
+
+	int erg=pthread_create(&thread_handle, NULL, dispatchthread_exec_handler, this);
+	if (erg!=0) {
+		pthread_mutex_destroy(&messages_mutex);
+		pthread_cond_destroy(&messages_cond);
+		throw (CapiMsgError(erg,"Error while starting dispatch thread","DispatchThread::DispatchThread()"));
+	}
+}
+
+DispatchThread::~DispatchThread()
+{
+	pthread_mutex_lock(&messages_mutex);
+	terminate=true;
+	pthread_cond_signal(&messages_cond);
+	pthread_mutex_unlock(&messages_mutex);
+
+	pthread_join(thread_handle,NULL);
+
+	pthread_mutex_destroy(&messages_mutex);
+	pthread_cond_destroy(&messages_cond);
+}
+
+void
+DispatchThread::put(unsigned char *message)
+{
+	pthread_mutex_lock(&messages_mutex);
+	messages.push(message);
+	pthread_cond_signal(&messages_cond);
+	pthread_mutex_unlock(&messages_mutex);
+}
+
+void
+DispatchThread::run()
+{
+	while (1) {
+		pthread_mutex_lock(&messages_mutex);
+		while (messages.empty() && !terminate)
+			pthread_cond_wait(&messages_cond,&messages_mutex);
+		if (messages.empty()) { // terminate is set and all messages are processed
+			pthread_mutex_unlock(&messages_mutex);
+			return;
+		}
+		unsigned char *message=messages.front();
+		messages.pop();
+		pthread_mutex_unlock(&messages_mutex);
+
+		capi->processMessage(message);
+		delete[] message;
+	}
+}
+
+/* History
+
+$Log$
+
+*/
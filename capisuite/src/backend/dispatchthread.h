@@ -0,0 +1,88 @@
+/** @file dispatchthread.h
+    @brief Contains DispatchThread - Thread processing received CAPI messages for a part of the connections
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef DISPATCHTHREAD_H
+#define DISPATCHTHREAD_H
+
+#include <pthread.h>
+#include <queue>
+#include "capiexception.h"
+
+using namespace std;
+
+class Capi;
+
+/** @brief Thread exec handler for DispatchThread class
+
+    This is a handler which will call run() of the given DispatchThread for the use in pthread_create().
+*/
+void* dispatchthread_exec_handler(void* arg);
+
+/** @brief Thread processing received CAPI messages for a part of the connections
+
+    The message thread of Capi only reads the messages from CAPI and hands them over
+    to one of several DispatchThreads. All messages of one PLCI go to the same
+    DispatchThread, so they're processed in the order they were received while other
+    connections are handled in parallel. So a slow handler only delays the connections
+    sharing its thread.
+
+    The messages are copies of the raw CAPI messages allocated with new[], the
+    DispatchThread deletes them after processing them with Capi::processMessage().
+
+    @author agent
+*/
+class DispatchThread
+{
+	friend void* dispatchthread_exec_handler(void*);
+
+	public:
+		/** @brief Constructor. Start the thread.
+
+		    @param capi the Capi object which processes the messages
+		    @throw CapiMsgError Thrown if the thread can't be started
+		*/
+		DispatchThread(Capi *capi) throw (CapiMsgError);
+
+		/** @brief Destructor. Process all waiting messages and stop the thread.
+		*/
+		~DispatchThread();
+
+		/** @brief Queue a message for processing
+
+		    @param message copy of the raw CAPI message allocated with new[], will be deleted after processing
+		*/
+		void put(unsigned char *message);
+
+	private:
+		/** @brief Thread body, processes the queued messages until the object is destroyed
+		*/
+		void run();
+
+		queue<unsigned char*> messages; ///< messages waiting for processing
+		pthread_mutex_t messages_mutex; ///< protects messages and terminate
+		pthread_cond_t messages_cond; ///< signalled when a message was queued or terminate was set
+		bool terminate; ///< set by the destructor to stop the thread after processing the waiting messages
+		pthread_t thread_handle; ///< the thread
+		Capi *capi; ///< the Capi object which processes the messages
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
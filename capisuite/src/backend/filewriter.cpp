@@ -0,0 +1,260 @@
+/*  @file filewriter.cpp
+    @brief Contains FileWriter - Writes received data to a file in a separate thread
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sstream>
+#include <errno.h> // for errno
+#include <fcntl.h> // for open(), fcntl()
+#include <unistd.h> // for write(), pwrite(), close(), fdatasync(), ftruncate()
+#include <stdlib.h> // for posix_memalign(), free()
+#include <string.h> // for strerror(), memcpy()
+#include <sys/time.h> // for gettimeofday()
+#include "filewriter.h"
+#include "asynclog.h"
+
+#define conf_receive_block_size 32768 // data collected before the writer thread wakes up
+#define conf_direct_align 4096 // alignment of blocks written with O_DIRECT
+
+void* filewriter_exec_handler(void* arg)
+{
+	if (!arg) {
+                cerr << "FATAL ERROR: no FileWriter reference given in filewriter_exec_handler" << endl;
+		exit(1);
+	}
+	FileWriter *instance=static_cast<FileWriter*>(arg);
+	instance->run();
+	return NULL;
+}
+
+FileWriter::FileWriter(string filename, sync_policy_t sync_policy, ostream &debug, unsigned short debug_level, ostream &error, AudioEncoder *encoder) throw (CapiExternalError)
+:filename(filename),fd(-1),sync_policy(sync_policy),pending(),writing(),carry(),direct_buffer(NULL),encoder(encoder),encoded(),received(0),discard(0),
+closing(false),failed(false),debug(debug),error(error),debug_level(debug_level)
+{
+	int flags=O_WRONLY|O_CREAT|O_TRUNC;
+	if (encoder && sync_policy==SYNC_DIRECT)
+		sync_policy=this->sync_policy=SYNC_DATA; // the header is rewritten at the end, which O_DIRECT doesn't allow
+#ifdef O_DIRECT
+	if (sync_policy==SYNC_DIRECT) {
+		void *buffer;
+		if (posix_memalign(&buffer,conf_direct_align,conf_receive_block_size)==0) {
+			direct_buffer=static_cast<char*>(buffer);
+			fd=open(filename.c_str(),flags|O_DIRECT,0666);
+		}
+	}
+#endif
+	if (fd==-1) {
+		if (sync_policy==SYNC_DIRECT) {
+			if (debug_level>=2)
+				debug << prefix() << "O_DIRECT not possible for " << filename << ", using fdatasync() instead" << endl;
+			this->sync_policy=SYNC_DATA;
+			free(direct_buffer);
+			direct_buffer=NULL;
+		}
+		fd=open(filename.c_str(),flags,0666);
+	}
+	if (fd==-1) {
+		delete encoder;
+		throw CapiExternalError("unable to open file for reception ("+filename+")","FileWriter::FileWriter()");
+	}
+	if (encoder) { // placeholder, completed by finishFile()
+		string header=encoder->header(0);
+		writeAll(header.data(),header.size());
+	}
+
+	pthread_mutex_init(&pending_mutex, NULL);
+	pthread_cond_init(&pending_cond, NULL);
+
+	if (pthread_create(&thread_handle, NULL, filewriter_exec_handler, this)) {
+		pthread_mutex_destroy(&pending_mutex);
+		pthread_cond_destroy(&pending_cond);
+		close(fd);
+		free(direct_buffer);
+		delete encoder;
+		throw CapiExternalError("unable to start writer thread","FileWriter::FileWriter()");
+	}
+}
+
+FileWriter::~FileWriter()
+{
+	pthread_mutex_lock(&pending_mutex);
+	closing=true;
+	pthread_cond_signal(&pending_cond);
+	pthread_mutex_unlock(&pending_mutex);
+
+	pthread_join(thread_handle,NULL);
+
+	if (close(fd)==-1 && !failed)
+		error << prefix() << "ERROR: can't close " << filename << " (" << strerror(errno) << ")" << endl;
+	free(direct_buffer);
+	delete encoder;
+
+	pthread_mutex_destroy(&pending_mutex);
+	pthread_cond_destroy(&pending_cond);
+}
+
+void
+FileWriter::write(const unsigned char *data, unsigned length)
+{
+	pthread_mutex_lock(&pending_mutex);
+	size_t before=pending.size();
+	pending.append(reinterpret_cast<const char*>(data),length);
+	if (before<conf_receive_block_size && pending.size()>=conf_receive_block_size)
+		pthread_cond_signal(&pending_cond);
+	pthread_mutex_unlock(&pending_mutex);
+}
+
+void
+FileWriter::discardTail(unsigned long length)
+{
+	pthread_mutex_lock(&pending_mutex);
+	discard=length;
+	pthread_mutex_unlock(&pending_mutex);
+}
+
+void
+FileWriter::run()
+{
+	pthread_mutex_lock(&pending_mutex);
+	while (1) {
+		while (!closing && pending.size()<conf_receive_block_size) {
+			timeval now;
+			gettimeofday(&now,NULL);
+			timespec deadline;
+			deadline.tv_sec=now.tv_sec+1;
+			deadline.tv_nsec=now.tv_usec*1000;
+			if (pthread_cond_timedwait(&pending_cond,&pending_mutex,&deadline)==ETIMEDOUT && !pending.empty())
+				break; // write what we have at least once a second
+		}
+		bool last=closing;
+		writing.swap(pending);
+		pthread_mutex_unlock(&pending_mutex);
+
+		received+=writing.size();
+		if (encoder) {
+			encoder->encode(reinterpret_cast<const unsigned char*>(writing.data()),writing.size(),encoded);
+			if (last)
+				encoder->finish(encoded);
+			writeBlock(encoded,last);
+			encoded.erase();
+		} else
+			writeBlock(writing,last);
+		writing.erase();
+		if (last) {
+			finishFile();
+			return;
+		}
+
+		pthread_mutex_lock(&pending_mutex);
+	}
+}
+
+void
+FileWriter::writeBlock(string &data, bool last)
+{
+	if (failed)
+		return;
+
+	if (sync_policy!=SYNC_DIRECT) {
+		if (data.empty() || !writeAll(data.data(),data.size()))
+			return;
+		if (sync_policy==SYNC_DATA && fdatasync(fd)==-1) {
+			error << prefix() << "ERROR: can't sync " << filename << " (" << strerror(errno) << ")" << endl;
+			failed=true;
+		}
+		return;
+	}
+
+	// O_DIRECT needs aligned buffers, offsets and lengths, so keep the unaligned rest for the next time
+	carry.append(data);
+	size_t aligned=carry.size()/conf_direct_align*conf_direct_align;
+	for (size_t pos=0;pos<aligned;pos+=conf_receive_block_size) {
+		size_t length=aligned-pos<conf_receive_block_size ? aligned-pos : conf_receive_block_size;
+		memcpy(direct_buffer,carry.data()+pos,length);
+		if (!writeAll(direct_buffer,length))
+			return;
+	}
+	carry.erase(0,aligned);
+
+	if (last) {
+#ifdef O_DIRECT
+		fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) & ~O_DIRECT);
+#endif
+		if (!writeAll(carry.data(),carry.size()))
+			return;
+		if (fdatasync(fd)==-1) {
+			error << prefix() << "ERROR: can't sync " << filename << " (" << strerror(errno) << ")" << endl;
+			failed=true;
+		}
+	}
+}
+
+bool
+FileWriter::writeAll(const char *data, size_t length)
+{
+	while (length) {
+		ssize_t written=::write(fd,data,length);
+		if (written==-1) {
+			if (errno==EINTR)
+				continue;
+			error << prefix() << "ERROR: can't write to " << filename << " (" << strerror(errno) << "), discarding further data" << endl;
+			failed=true;
+			return false;
+		}
+		data+=written;
+		length-=written;
+	}
+	return true;
+}
+
+void
+FileWriter::finishFile()
+{
+	if (failed || (!encoder && !discard))
+		return;
+
+	unsigned long kept=received>discard ? received-discard : 0;
+	if (discard) {
+		off_t size=encoder ? encoder->headerSize()+encoder->dataSize(kept) : kept;
+		if (ftruncate(fd,size)==-1) {
+			error << prefix() << "ERROR: can't truncate " << filename << " (" << strerror(errno) << ")" << endl;
+			failed=true;
+			return;
+		}
+	}
+	if (encoder) {
+		string header=encoder->header(kept);
+		if (pwrite(fd,header.data(),header.size(),0)!=static_cast<ssize_t>(header.size())) {
+			error << prefix() << "ERROR: can't write header of " << filename << " (" << strerror(errno) << ")" << endl;
+			failed=true;
+			return;
+		}
+	}
+	if (sync_policy!=SYNC_NONE && fdatasync(fd)==-1) {
+		error << prefix() << "ERROR: can't sync " << filename << " (" << strerror(errno) << ")" << endl;
+		failed=true;
+	}
+}
+
+string
+FileWriter::prefix()
+{
+	return AsyncLog::prefix("FileWriter",this);
+}
+
+/* History
+
+$Log$
+
+*/
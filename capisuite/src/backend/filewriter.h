@@ -0,0 +1,178 @@
+/** @file filewriter.h
+    @brief Contains FileWriter - Writes received data to a file in a separate thread
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef FILEWRITER_H
+#define FILEWRITER_H
+
+#include <pthread.h>
+#include <string>
+#include "../../config.h"
+#ifdef HAVE_OSTREAM
+  #include <ostream>
+#else
+  #include <ostream.h>
+#endif
+#include "capiexception.h"
+#include "audioencoder.h"
+
+using namespace std;
+
+/** @brief Thread exec handler for FileWriter class
+
+    This is a handler which will call run() of the given FileWriter for the use in pthread_create().
+*/
+void* filewriter_exec_handler(void* arg);
+
+/** @brief Writes received data to a file in a separate thread
+
+    Connection::data_b3_ind() is called in the CAPI thread and must answer each
+    DATA_B3_IND quickly, otherwise the controller runs out of receive buffers. So
+    it only appends the data to a buffer in memory with write(), which never waits
+    for the disk.
+
+    A separate thread takes the buffered data and writes it to the file in large
+    blocks as soon as enough data has collected or after one second at the latest.
+    The buffers are swapped under the lock, so the thread never holds it while
+    writing.
+
+    The sync policy decides how the data goes to the disk:
+	- SYNC_NONE: normal buffered writes, the kernel decides when to write
+	- SYNC_DATA: fdatasync() after each block, so received data isn't lost if the system crashes
+	- SYNC_DIRECT: open the file with O_DIRECT to bypass the page cache, only aligned blocks are written
+	  this way and the rest is written when the file is closed
+
+    If an AudioEncoder is given, the writer thread converts the data with it
+    before writing, so the file is ready for use when the recording ends. The
+    file header is completed when the file is closed. As the header must be
+    rewritten, SYNC_DIRECT isn't used together with an encoder.
+
+    Silence at the end of a recording can be dropped with discardTail().
+
+    Write errors are reported once to the error stream, further data is discarded.
+
+    The destructor writes all remaining data and closes the file, so the file is
+    complete as soon as the object was deleted.
+
+    @author agent
+*/
+class FileWriter
+{
+	friend void* filewriter_exec_handler(void*);
+
+	public:
+		/** @brief how received data is synced to the disk
+		*/
+		enum sync_policy_t {
+			SYNC_NONE, ///< leave it to the kernel
+			SYNC_DATA, ///< call fdatasync() after each written block
+			SYNC_DIRECT ///< use O_DIRECT, falls back to SYNC_DATA if not supported
+		};
+
+		/** @brief Constructor. Open the file and start the writer thread.
+
+		    @param filename name of the file to write, it's created or truncated
+		    @param sync_policy how to sync the data to the disk
+		    @param debug stream for debugging info
+		    @param debug_level verbosity level for debug messages
+		    @param error stream for error messages
+		    @param encoder encoder to convert the data with, NULL to write it unchanged. It's deleted by the FileWriter.
+		    @throw CapiExternalError Thrown if the file can't be opened or the thread can't be started
+		*/
+		FileWriter(string filename, sync_policy_t sync_policy, ostream &debug, unsigned short debug_level, ostream &error, AudioEncoder *encoder=NULL) throw (CapiExternalError);
+
+		/** @brief Destructor. Write all remaining data, stop the thread and close the file.
+
+		    This waits until the data is on the disk, so don't call it while holding
+		    a lock which is needed to answer CAPI messages.
+		*/
+		~FileWriter();
+
+		/** @brief Append data to the file
+
+		    The data is only copied to the internal buffer, so this never waits for disk I/O.
+
+		    @param data pointer to the data
+		    @param length number of bytes to write
+		*/
+		void write(const unsigned char *data, unsigned length);
+
+		/** @brief Drop data at the end of the file when it's closed
+
+		    @param length number of bytes of the written data to drop, counted before encoding
+		*/
+		void discardTail(unsigned long length);
+
+	private:
+		/** @brief Thread body, writes the buffered data until the object is destroyed
+		*/
+		void run();
+
+		/** @brief Write a block of data to the file according to the sync policy
+
+		    @param data data to write, the O_DIRECT rest is kept in carry
+		    @param last true if this is the last block before closing the file
+		*/
+		void writeBlock(string &data, bool last);
+
+		/** @brief Write data completely, handling interrupted and partial writes
+
+		    @param data pointer to the data
+		    @param length number of bytes to write
+		    @return false if writing failed, the error is reported then
+		*/
+		bool writeAll(const char *data, size_t length);
+
+		/** @brief Drop the discarded data and complete the header after all data was written
+		*/
+		void finishFile();
+
+		/** @brief return a prefix containing this pointer and date for log messages
+
+		    @return constructed prefix as stringstream
+		*/
+		string prefix();
+
+		string filename; ///< name of the written file
+		int fd; ///< file descriptor of the written file
+		sync_policy_t sync_policy; ///< how to sync the data to the disk
+
+		string pending; ///< data received but not yet taken by the writer thread
+		string writing; ///< data currently written by the writer thread, swapped with pending to reuse both buffers
+		string carry; ///< unaligned rest of the data when using O_DIRECT, only used by the writer thread
+		char *direct_buffer; ///< aligned buffer for O_DIRECT writes, NULL for other policies
+		AudioEncoder *encoder; ///< converts the data before writing, NULL if it's written unchanged
+		string encoded; ///< data converted by encoder, only used by the writer thread
+		unsigned long received, ///< number of bytes taken by the writer thread
+			discard; ///< number of bytes to drop at the end, see discardTail()
+		bool closing, ///< set by the destructor to tell the thread to write the rest and finish
+			failed; ///< set after a write error, further data is discarded
+
+		pthread_t thread_handle; ///< the writer thread
+		pthread_mutex_t pending_mutex; ///< protects pending, closing and discard
+		pthread_cond_t pending_cond; ///< signalled when enough data is pending or closing is set
+
+		ostream &debug, ///< debug stream
+			&error; ///< error stream
+		unsigned short debug_level; ///< debug level
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,196 @@
+/*  @file metrics.cpp
+    @brief Contains Metrics - Process-wide counters, gauges and histograms describing the operation of CapiSuite
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sstream>
+#include <iomanip>
+#include <string.h>
+#include <sys/time.h>
+#include "metrics.h"
+
+unsigned long Metrics::counters[counter_count];
+long Metrics::send_buffers=0;
+long Metrics::queued_calls=0;
+long Metrics::active_calls[max_controllers];
+unsigned Metrics::highest_controller=0;
+Metrics::histogram_data_t Metrics::histograms[histogram_count];
+const long long Metrics::bucket_limits[bucket_count]={1000,5000,10000,50000,100000,500000,1000000,5000000,10000000,30000000,60000000,300000000};
+Metrics::error_slot_t Metrics::capi_errors[error_slots];
+unsigned long Metrics::capi_errors_lost=0;
+
+void
+Metrics::observe(histogram_t histogram, long long usecs)
+{
+	if (usecs<0) // clock was set back
+		usecs=0;
+	int i=0;
+	while (i<bucket_count && usecs>bucket_limits[i])
+		i++;
+	histogram_data_t &h=histograms[histogram];
+	__sync_fetch_and_add(&h.buckets[i],1);
+	__sync_fetch_and_add(&h.sum,static_cast<unsigned long long>(usecs));
+	__sync_fetch_and_add(&h.count,1);
+}
+
+void
+Metrics::callStarted(unsigned controller)
+{
+	if (controller>=max_controllers)
+		return;
+	__sync_fetch_and_add(&active_calls[controller],1);
+	unsigned highest=highest_controller;
+	while (controller>highest) {
+		unsigned old=__sync_val_compare_and_swap(&highest_controller,highest,controller);
+		if (old==highest)
+			break;
+		highest=old;
+	}
+}
+
+void
+Metrics::callFinished(unsigned controller)
+{
+	if (controller<max_controllers)
+		__sync_fetch_and_sub(&active_calls[controller],1);
+}
+
+void
+Metrics::capiError(unsigned info)
+{
+	unsigned key=info+1; // 0 marks a free slot
+	for (int i=0;i<error_slots;i++) {
+		error_slot_t &slot=capi_errors[(info+i)%error_slots];
+		unsigned current=slot.key;
+		if (!current)
+			current=__sync_val_compare_and_swap(&slot.key,0,key);
+		if (!current || current==key) {
+			__sync_fetch_and_add(&slot.count,1);
+			return;
+		}
+	}
+	__sync_fetch_and_add(&capi_errors_lost,1);
+}
+
+long long
+Metrics::now()
+{
+	timeval t;
+	gettimeofday(&t,NULL);
+	return static_cast<long long>(t.tv_sec)*1000000+t.tv_usec;
+}
+
+/** @brief Write a duration given in microseconds as seconds
+*/
+static void
+writeSeconds(ostream &out, unsigned long long usecs)
+{
+	out << usecs/1000000 << '.' << setw(6) << setfill('0') << usecs%1000000 << setfill(' ');
+}
+
+string
+Metrics::format()
+{
+	// the values are read without lock while they are changed, so they
+	// may be off by the few updates done while format() is running
+	stringstream out;
+
+	out << "# HELP capisuite_calls_total Calls handled since start.\n";
+	out << "# TYPE capisuite_calls_total counter\n";
+	out << "capisuite_calls_total{direction=\"incoming\"} " << counters[CALLS_INCOMING] << "\n";
+	out << "capisuite_calls_total{direction=\"outgoing\"} " << counters[CALLS_OUTGOING] << "\n";
+
+	out << "# HELP capisuite_active_calls Calls currently in progress.\n";
+	out << "# TYPE capisuite_active_calls gauge\n";
+	for (unsigned i=1;i<=highest_controller;i++)
+		out << "capisuite_active_calls{controller=\"" << i << "\"} " << active_calls[i] << "\n";
+
+	out << "# HELP capisuite_capi_messages_total CAPI messages exchanged since start.\n";
+	out << "# TYPE capisuite_capi_messages_total counter\n";
+	out << "capisuite_capi_messages_total{direction=\"received\"} " << counters[MESSAGES_RECEIVED] << "\n";
+	out << "capisuite_capi_messages_total{direction=\"sent\"} " << counters[MESSAGES_SENT] << "\n";
+
+	out << "# HELP capisuite_data_b3_bytes_total Payload bytes transferred in DATA_B3 messages.\n";
+	out << "# TYPE capisuite_data_b3_bytes_total counter\n";
+	out << "capisuite_data_b3_bytes_total{direction=\"received\"} " << counters[BYTES_RECEIVED] << "\n";
+	out << "capisuite_data_b3_bytes_total{direction=\"sent\"} " << counters[BYTES_SENT] << "\n";
+
+	out << "# HELP capisuite_data_b3_blocks_total DATA_B3 blocks transferred.\n";
+	out << "# TYPE capisuite_data_b3_blocks_total counter\n";
+	out << "capisuite_data_b3_blocks_total{direction=\"received\"} " << counters[BLOCKS_RECEIVED] << "\n";
+	out << "capisuite_data_b3_blocks_total{direction=\"sent\"} " << counters[BLOCKS_SENT] << "\n";
+
+	out << "# HELP capisuite_send_buffers_used DATA_B3 blocks sent and not confirmed yet.\n";
+	out << "# TYPE capisuite_send_buffers_used gauge\n";
+	out << "capisuite_send_buffers_used " << send_buffers << "\n";
+
+	out << "# HELP capisuite_incoming_queue_depth Incoming calls waiting for a free worker.\n";
+	out << "# TYPE capisuite_incoming_queue_depth gauge\n";
+	out << "capisuite_incoming_queue_depth " << queued_calls << "\n";
+
+	static const struct {
+		const char *name, *help, *label;
+		int series; // number of histograms, their labels are separated by \0
+		histogram_t histogram[2];
+	} families[]={
+		{"capisuite_call_setup_seconds","Time from the start of a call until the B3 connection is established.","direction=\"incoming\"\0direction=\"outgoing\"",2,{SETUP_INCOMING,SETUP_OUTGOING}},
+		{"capisuite_script_seconds","Run time of the Python scripts.","script=\"incoming\"\0script=\"idle\"",2,{SCRIPT_INCOMING,SCRIPT_IDLE}},
+		{"capisuite_interpreter_wait_seconds","Time the Python scripts waited for the interpreter.","script=\"incoming\"\0script=\"idle\"",2,{WAIT_INCOMING,WAIT_IDLE}},
+		{"capisuite_incoming_queue_wait_seconds","Time incoming calls waited for a free worker.","",1,{QUEUE_INCOMING}}
+	};
+	for (unsigned f=0;f<sizeof(families)/sizeof(families[0]);f++) {
+		out << "# HELP " << families[f].name << " " << families[f].help << "\n";
+		out << "# TYPE " << families[f].name << " histogram\n";
+		const char *label=families[f].label;
+		for (int n=0;n<families[f].series;n++) {
+			const histogram_data_t &h=histograms[families[f].histogram[n]];
+			unsigned long cumulative=0;
+			for (int i=0;i<=bucket_count;i++) {
+				cumulative+=h.buckets[i];
+				out << families[f].name << "_bucket{" << label << (*label ? "," : "") << "le=\"";
+				if (i<bucket_count)
+					writeSeconds(out,bucket_limits[i]);
+				else
+					out << "+Inf";
+				out << "\"} " << cumulative << "\n";
+			}
+			string labels=*label ? string("{")+label+"}" : string();
+			out << families[f].name << "_sum" << labels << " ";
+			writeSeconds(out,h.sum);
+			out << "\n";
+			out << families[f].name << "_count" << labels << " " << h.count << "\n";
+			label+=strlen(label)+1;
+		}
+	}
+
+	out << "# HELP capisuite_script_errors_total Python scripts which failed with an error.\n";
+	out << "# TYPE capisuite_script_errors_total counter\n";
+	out << "capisuite_script_errors_total " << counters[SCRIPT_ERRORS] << "\n";
+
+	out << "# HELP capisuite_capi_errors_total Errors reported by CAPI, by info code.\n";
+	out << "# TYPE capisuite_capi_errors_total counter\n";
+	for (int i=0;i<error_slots;i++)
+		if (capi_errors[i].key)
+			out << "capisuite_capi_errors_total{info=\"0x" << hex << setw(4) << setfill('0') << capi_errors[i].key-1 << dec << setfill(' ') << "\"} " << capi_errors[i].count << "\n";
+	if (capi_errors_lost)
+		out << "capisuite_capi_errors_total{info=\"other\"} " << capi_errors_lost << "\n";
+
+	return out.str();
+}
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,172 @@
+/** @file metrics.h
+    @brief Contains Metrics - Process-wide counters, gauges and histograms describing the operation of CapiSuite
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+
+using namespace std;
+
+/** @brief Process-wide counters, gauges and histograms describing the operation of CapiSuite
+
+    The values are updated by Capi, Connection and the Python scripts while
+    they work, so updating must be cheap and must never block. All values are
+    plain integers changed with the atomic builtins of gcc, no lock is taken.
+
+    The following values are collected:
+	- calls per direction and active calls per controller
+	- CAPI messages received and sent, errors reported by CAPI per info code (see CapiMsgError)
+	- DATA_B3 bytes and blocks received and sent, blocks waiting for their confirmation
+	- incoming calls waiting for a free worker
+	- histograms of the call setup time, the run time of the Python scripts, the time
+	  the scripts had to wait for the Python interpreter and the time incoming calls
+	  waited for a free worker
+
+    format() returns all values in the text format used by Prometheus. Rates
+    like calls per second are calculated from the counters by the reader.
+
+    All methods are static and thread-safe.
+
+    @author agent
+*/
+class Metrics
+{
+	public:
+		/** @brief counters, they only grow
+		*/
+		enum counter_t {
+			CALLS_INCOMING, ///< incoming calls
+			CALLS_OUTGOING, ///< outgoing calls
+			MESSAGES_RECEIVED, ///< CAPI messages received
+			MESSAGES_SENT, ///< CAPI messages sent
+			BYTES_RECEIVED, ///< DATA_B3 bytes received
+			BYTES_SENT, ///< DATA_B3 bytes sent
+			BLOCKS_RECEIVED, ///< DATA_B3 blocks received
+			BLOCKS_SENT, ///< DATA_B3 blocks sent
+			SCRIPT_ERRORS, ///< Python scripts which failed with an error
+			counter_count ///< number of counters, no counter
+		};
+
+		/** @brief histograms of durations
+		*/
+		enum histogram_t {
+			SETUP_INCOMING, ///< time from CONNECT_IND to CONNECT_B3_ACTIVE_IND of incoming calls
+			SETUP_OUTGOING, ///< time from creating an outgoing call to CONNECT_B3_ACTIVE_IND
+			SCRIPT_INCOMING, ///< run time of the incoming script
+			SCRIPT_IDLE, ///< run time of the idle script
+			WAIT_INCOMING, ///< time the incoming script waits for the Python interpreter
+			WAIT_IDLE, ///< time the idle script waits for the Python interpreter
+			QUEUE_INCOMING, ///< time an incoming call waits in the queue for a free worker
+			histogram_count ///< number of histograms, no histogram
+		};
+
+		/** @brief Increase a counter
+
+		    @param counter the counter
+		    @param value the amount to add
+		*/
+		static void count(counter_t counter, unsigned long value=1) { __sync_fetch_and_add(&counters[counter],value); }
+
+		/** @brief Record a duration in a histogram
+
+		    @param histogram the histogram
+		    @param usecs the duration in microseconds
+		*/
+		static void observe(histogram_t histogram, long long usecs);
+
+		/** @brief Change the number of DATA_B3 blocks sent but not confirmed yet
+
+		    @param delta the amount to add, negative to decrease
+		*/
+		static void changeSendBuffers(long delta) { __sync_fetch_and_add(&send_buffers,delta); }
+
+		/** @brief Change the number of incoming calls waiting for a free worker
+
+		    @param delta the amount to add, negative to decrease
+		*/
+		static void changeQueuedCalls(long delta) { __sync_fetch_and_add(&queued_calls,delta); }
+
+		/** @brief Count a call which was started on the given controller
+
+		    @param controller number of the controller
+		*/
+		static void callStarted(unsigned controller);
+
+		/** @brief Count a call which was finished on the given controller
+
+		    @param controller number of the controller given to callStarted()
+		*/
+		static void callFinished(unsigned controller);
+
+		/** @brief Count an error reported by CAPI
+
+		    @param info the error code (info value) given by CAPI
+		*/
+		static void capiError(unsigned info);
+
+		/** @brief Return the current time for measuring durations
+
+		    @return time in microseconds
+		*/
+		static long long now();
+
+		/** @brief Return all values in the text format of Prometheus
+
+		    @return the values, one per line
+		*/
+		static string format();
+
+	private:
+		enum {
+			max_controllers=128, ///< controllers counted in active_calls, CAPI numbers them from 1 to 127
+			error_slots=64, ///< number of different info codes counted in capi_errors
+			bucket_count=12 ///< number of limits in bucket_limits
+		};
+
+		/** @brief values of one histogram
+		*/
+		struct histogram_data_t {
+			unsigned long buckets[bucket_count+1]; ///< number of values per bucket, the last one counts values above all limits
+			unsigned long count; ///< number of values
+			unsigned long long sum; ///< sum of all values in microseconds
+		};
+
+		/** @brief counter for one CAPI info code
+		*/
+		struct error_slot_t {
+			unsigned key; ///< info code plus one, 0 if the slot is free
+			unsigned long count; ///< number of errors with this code
+		};
+
+		static unsigned long counters[counter_count]; ///< values of the counters
+		static long send_buffers; ///< number of DATA_B3 blocks sent but not confirmed yet
+		static long queued_calls; ///< number of incoming calls waiting for a free worker
+		static long active_calls[max_controllers]; ///< number of active calls per controller
+		static unsigned highest_controller; ///< highest controller number given to callStarted()
+		static histogram_data_t histograms[histogram_count]; ///< values of the histograms
+		static const long long bucket_limits[bucket_count]; ///< upper limits of the histogram buckets in microseconds
+		static error_slot_t capi_errors[error_slots]; ///< counters per info code, hashed by the code with linear probing
+		static unsigned long capi_errors_lost; ///< errors not counted as all slots of capi_errors are used
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,203 @@
+/*  @file promptcache.cpp
+    @brief Contains PromptCache - Process-wide cache for audio prompts held in memory
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "promptcache.h"
+
+map<string,PromptCache::Prompt*> PromptCache::prompts;
+set<string> PromptCache::directories;
+unsigned long PromptCache::used=0;
+unsigned long PromptCache::limit=8*1024*1024;
+pthread_mutex_t PromptCache::cache_mutex=PTHREAD_MUTEX_INITIALIZER;
+
+unsigned
+PromptCache::addDirectory(string dir) throw (CapiExternalError)
+{
+	if (dir.empty() || dir[dir.size()-1]!='/')
+		dir+='/';
+
+	DIR *d=opendir(dir.c_str());
+	if (!d)
+		throw CapiExternalError("can't open directory "+dir,"PromptCache::addDirectory()");
+
+	pthread_mutex_lock(&cache_mutex);
+	directories.insert(dir);
+	pthread_mutex_unlock(&cache_mutex);
+
+	unsigned count=0;
+	struct dirent *entry;
+	while ((entry=readdir(d))) {
+		string name(entry->d_name);
+		if (name.size()>3 && name.substr(name.size()-3)==".la") {
+			const Prompt *p=acquire(dir+name);
+			if (p) {
+				count++;
+				release(p);
+			}
+		}
+	}
+	closedir(d);
+	return count;
+}
+
+void
+PromptCache::setLimit(unsigned long bytes)
+{
+	pthread_mutex_lock(&cache_mutex);
+	limit=bytes;
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+unsigned long
+PromptCache::getSize()
+{
+	pthread_mutex_lock(&cache_mutex);
+	unsigned long s=used;
+	pthread_mutex_unlock(&cache_mutex);
+	return s;
+}
+
+const PromptCache::Prompt*
+PromptCache::acquire(string filename)
+{
+	string::size_type pos=filename.rfind('/');
+	if (pos==string::npos)
+		return NULL;
+
+	struct stat st;
+	if (stat(filename.c_str(),&st) || !S_ISREG(st.st_mode))
+		return NULL; // let the caller report the error
+
+	pthread_mutex_lock(&cache_mutex);
+	if (!directories.count(filename.substr(0,pos+1))) {
+		pthread_mutex_unlock(&cache_mutex);
+		return NULL;
+	}
+	map<string,Prompt*>::iterator it=prompts.find(filename);
+	if (it!=prompts.end()) {
+		Prompt *p=it->second;
+		if (p->device==st.st_dev && p->inode==st.st_ino && p->mtime==st.st_mtime && p->size==st.st_size) {
+			p->references++;
+			pthread_mutex_unlock(&cache_mutex);
+			return p;
+		}
+		remove(it); // file was changed
+	}
+	unsigned long available= used<limit ? limit-used : 0;
+	pthread_mutex_unlock(&cache_mutex);
+
+	// read the file without holding the lock, so other calls can go on
+	Prompt *p=load(filename,available);
+	if (!p)
+		return NULL;
+
+	pthread_mutex_lock(&cache_mutex);
+	it=prompts.find(filename);
+	if (it!=prompts.end()) { // another call has loaded it in the meantime
+		Prompt *q=it->second;
+		if (q->device==p->device && q->inode==p->inode && q->mtime==p->mtime && q->size==p->size) {
+			q->references++;
+			pthread_mutex_unlock(&cache_mutex);
+			delete p;
+			return q;
+		}
+		remove(it);
+	}
+	if (used+p->data.size()>limit) {
+		pthread_mutex_unlock(&cache_mutex);
+		delete p;
+		return NULL;
+	}
+	p->references=1;
+	p->cached=true;
+	prompts[filename]=p;
+	used+=p->data.size();
+	pthread_mutex_unlock(&cache_mutex);
+	return p;
+}
+
+void
+PromptCache::release(const Prompt *prompt)
+{
+	Prompt *p=const_cast<Prompt*>(prompt);
+	pthread_mutex_lock(&cache_mutex);
+	p->references--;
+	if (!p->references && !p->cached)
+		delete p;
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+PromptCache::Prompt*
+PromptCache::load(string filename, unsigned long max_size)
+{
+	int fd=open(filename.c_str(),O_RDONLY);
+	if (fd==-1)
+		return NULL;
+
+	// take the file attributes from the opened file, so they belong to the data we read
+	struct stat st;
+	if (fstat(fd,&st) || !S_ISREG(st.st_mode) || static_cast<unsigned long>(st.st_size)>max_size) {
+		close(fd);
+		return NULL;
+	}
+
+	Prompt *p=new Prompt;
+	p->device=st.st_dev;
+	p->inode=st.st_ino;
+	p->mtime=st.st_mtime;
+	p->size=st.st_size;
+	p->references=0;
+	p->cached=false;
+	p->data.resize(st.st_size);
+
+	off_t pos=0;
+	while (pos<st.st_size) {
+		ssize_t i=read(fd,&p->data[pos],st.st_size-pos);
+		if (i==-1 && errno==EINTR)
+			continue;
+		if (i<=0)
+			break;
+		pos+=i;
+	}
+	close(fd);
+
+	if (pos!=st.st_size) { // read error or file was truncated while reading
+		delete p;
+		return NULL;
+	}
+	return p;
+}
+
+void
+PromptCache::remove(map<string,Prompt*>::iterator it)
+{
+	Prompt *p=it->second;
+	used-=p->data.size();
+	p->cached=false;
+	prompts.erase(it);
+	if (!p->references)
+		delete p;
+}
+
+/* History
+
+$Log$
+
+*/
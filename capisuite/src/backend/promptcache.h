@@ -0,0 +1,154 @@
+/** @file promptcache.h
+    @brief Contains PromptCache - Process-wide cache for audio prompts held in memory
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef PROMPTCACHE_H
+#define PROMPTCACHE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <pthread.h>
+#include <sys/types.h>
+#include "capiexception.h"
+
+using namespace std;
+
+/** @brief Process-wide cache for audio prompts held in memory
+
+    The answering machine plays the same small files (beep, announcements, the
+    words spoken by cs_helpers.sayNumber()) in nearly every call. Instead of
+    opening and reading them for each call, AudioSend gets their contents from
+    this cache and sends them directly out of memory with
+    Connection::start_buffer_transmission().
+
+    The files are already stored in the bit-reversed A-Law format used on the
+    line, so the cached data is sent as it is and one copy is shared by all
+    concurrent calls.
+
+    Only files located directly in one of the directories given to addDirectory()
+    are cached, so recorded calls played back by the scripts don't fill up the
+    memory. addDirectory() also loads all ".la" files in the directory at once.
+
+    Each acquire() checks the file with stat(). If it was changed or replaced
+    since it was loaded, the new contents are read. Calls still playing the
+    old contents keep them until they call release(), the old copy is freed
+    when the last of them is finished.
+
+    All methods are static and thread-safe.
+
+    @author agent
+*/
+class PromptCache
+{
+	public:
+		/** @brief A cached prompt, valid from acquire() until release()
+		*/
+		class Prompt
+		{
+			friend class PromptCache;
+
+			public:
+				/** @brief Return the A-Law data of the prompt
+
+				    @return pointer to the data
+				*/
+				const char* getData() const { return data.data(); }
+
+				/** @brief Return the length of the prompt
+
+				    @return length of the data in bytes
+				*/
+				unsigned getLength() const { return data.size(); }
+
+			private:
+				string data; ///< contents of the file
+				dev_t device; ///< device of the file when it was loaded
+				ino_t inode; ///< inode of the file when it was loaded
+				time_t mtime; ///< modification time of the file when it was loaded
+				off_t size; ///< size of the file when it was loaded
+				unsigned references; ///< number of users which acquired the prompt and haven't released it yet
+				bool cached; ///< true as long as the prompt is contained in the cache
+		};
+
+		/** @brief Add a directory whose prompts should be cached and load all prompts in it
+
+		    @param dir name of the directory
+		    @return number of files loaded
+		    @throw CapiExternalError Thrown if the directory can't be read
+		*/
+		static unsigned addDirectory(string dir) throw (CapiExternalError);
+
+		/** @brief Set the maximum amount of memory used by the cache
+
+		    Prompts which would exceed the limit aren't cached and are read from disk as before.
+
+		    @param bytes limit in bytes
+		*/
+		static void setLimit(unsigned long bytes);
+
+		/** @brief Return the amount of memory currently used by the cache
+
+		    @return size of all cached prompts in bytes
+		*/
+		static unsigned long getSize();
+
+		/** @brief Get the contents of a file from the cache
+
+		    If the file isn't cached yet or was changed, it is read now. Each
+		    successful call must be followed by a call to release().
+
+		    @param filename name of the file
+		    @return the prompt, or NULL if the file can't or shouldn't be cached - read it from disk then
+		*/
+		static const Prompt* acquire(string filename);
+
+		/** @brief Give a prompt back which was got from acquire()
+
+		    @param prompt the prompt
+		*/
+		static void release(const Prompt *prompt);
+
+	private:
+		/** @brief Load a file into a new Prompt object
+
+		    @param filename name of the file
+		    @param max_size the file is not loaded if it is larger than this
+		    @return the prompt with no references, or NULL if the file can't be read or is too large
+		*/
+		static Prompt* load(string filename, unsigned long max_size);
+
+		/** @brief Remove a prompt from the cache and delete it if it isn't used any more
+
+		    Must be called with cache_mutex held.
+
+		    @param it position of the prompt in prompts
+		*/
+		static void remove(map<string,Prompt*>::iterator it);
+
+		static map<string,Prompt*> prompts; ///< the cached prompts, the key is the file name
+		static set<string> directories; ///< directories whose prompts are cached, with trailing slash
+		static unsigned long used; ///< size of all cached prompts in bytes
+		static unsigned long limit; ///< maximum for used
+		static pthread_mutex_t cache_mutex; ///< protects all static attributes and the reference counters
+};
+
+#endif
+
+/* History
+
+$Log$
+
+*/
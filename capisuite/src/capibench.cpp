@@ -0,0 +1,363 @@
+/** @file capibench.cpp
+    @brief Contains main() of capibench - load and latency benchmark using the CAPI simulator
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h> // for usleep()
+#include <sys/time.h> // for gettimeofday()
+#include <sys/resource.h> // for getrusage()
+#include "backend/capi.h"
+#include "backend/capisimulator.h"
+#include "backend/connection.h"
+#include "backend/applicationinterface.h"
+#include "modules/connectmodule.h"
+#include "modules/audiosend.h"
+#include "modules/disconnectmodule.h"
+
+/** @brief Handles the simulated calls like a simple answering machine
+
+    Each call is accepted as voice call in an own thread, a prompt held in memory
+    is played and the call is disconnected afterwards, unless the simulated caller
+    hung up before.
+
+    @author agent
+*/
+class BenchApplication: public ApplicationInterface
+{
+	public:
+		/** @brief Constructor.
+
+		    @param prompt A-Law data played to each caller
+		*/
+		BenchApplication(const string &prompt)
+		:prompt(prompt),active_calls(0),failed_calls(0)
+		{
+			pthread_mutex_init(&calls_mutex, NULL);
+			pthread_cond_init(&calls_cond, NULL);
+		}
+
+		/** @brief Destructor.
+		*/
+		~BenchApplication()
+		{
+			pthread_mutex_destroy(&calls_mutex);
+			pthread_cond_destroy(&calls_cond);
+		}
+
+		/** @brief Start a thread handling the call, see ApplicationInterface::callWaiting()
+		*/
+		void callWaiting(Connection *conn);
+
+		/** @brief Body of the call threads
+
+		    @param conn the call to handle, deleted at the end
+		*/
+		void handleCall(Connection *conn);
+
+		/** @brief Wait until all call threads have finished
+
+		    @return number of calls which failed with an error
+		*/
+		unsigned waitForCalls();
+
+	private:
+		/** @brief arguments for bench_call_handler()
+		*/
+		struct call_args_t {
+			BenchApplication *application; ///< the application
+			Connection *conn; ///< the call to handle
+		};
+
+		friend void* bench_call_handler(void*);
+
+		const string &prompt; ///< A-Law data played to each caller
+		unsigned active_calls, ///< number of running call threads
+			failed_calls; ///< number of calls which failed with an error
+		pthread_mutex_t calls_mutex; ///< protects active_calls and failed_calls
+		pthread_cond_t calls_cond; ///< signalled when a call thread finishes
+};
+
+void* bench_call_handler(void* arg)
+{
+	BenchApplication::call_args_t *args=static_cast<BenchApplication::call_args_t*>(arg);
+	args->application->handleCall(args->conn);
+	delete args;
+	return NULL;
+}
+
+void
+BenchApplication::callWaiting(Connection *conn)
+{
+	call_args_t *args=new call_args_t;
+	args->application=this;
+	args->conn=conn;
+
+	pthread_mutex_lock(&calls_mutex);
+	active_calls++;
+	pthread_mutex_unlock(&calls_mutex);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+	pthread_t thread_handle;
+	if (pthread_create(&thread_handle, &attr, bench_call_handler, args)) {
+		cerr << "ERROR: can't create thread for call" << endl;
+		delete args;
+		pthread_mutex_lock(&calls_mutex);
+		active_calls--;
+		failed_calls++;
+		pthread_mutex_unlock(&calls_mutex);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+void
+BenchApplication::handleCall(Connection *conn)
+{
+	bool failed=false;
+	try {
+		ConnectModule active(conn,Connection::VOICE,"","");
+		active.mainLoop();
+		AudioSend audio(conn,prompt.data(),prompt.size(),false);
+		audio.mainLoop();
+	}
+	catch (CapiWrongState) {} // the simulated caller hung up
+	catch (CapiError e) {
+		cerr << "ERROR: call failed, message was: " << e << endl;
+		failed=true;
+	}
+	try {
+		DisconnectModule active(conn);
+		active.mainLoop();
+	}
+	catch (CapiError e) {
+		cerr << "ERROR: disconnect failed, message was: " << e << endl;
+		failed=true;
+	}
+	delete conn;
+
+	pthread_mutex_lock(&calls_mutex);
+	active_calls--;
+	if (failed)
+		failed_calls++;
+	pthread_cond_signal(&calls_cond);
+	pthread_mutex_unlock(&calls_mutex);
+}
+
+unsigned
+BenchApplication::waitForCalls()
+{
+	pthread_mutex_lock(&calls_mutex);
+	while (active_calls)
+		pthread_cond_wait(&calls_cond,&calls_mutex);
+	unsigned failed=failed_calls;
+	pthread_mutex_unlock(&calls_mutex);
+	return failed;
+}
+
+/** @brief Print min, average, median, 99th percentile and max of the measured times
+
+    @param name name of the measurement
+    @param samples measured times in usecs
+*/
+void printSamples(const char *name, vector<long> samples)
+{
+	cout << name << ": ";
+	if (samples.empty()) {
+		cout << "no samples" << endl;
+		return;
+	}
+	sort(samples.begin(),samples.end());
+	long long sum=0;
+	for (unsigned i=0;i<samples.size();i++)
+		sum+=samples[i];
+	cout << samples.size() << " samples, min " << samples.front() << ", avg " << sum/samples.size()
+	  << ", median " << samples[samples.size()/2] << ", 99% " << samples[samples.size()*99/100]
+	  << ", max " << samples.back() << " usecs" << endl;
+}
+
+/** @brief Print the usage of capibench
+*/
+void help()
+{
+	cout << "capibench runs CapiSuite's CAPI and call handling code against a simulated" << endl;
+	cout << "CAPI and measures the dispatch cost, call setup latency and audio jitter." << endl << endl;
+	cout << "syntax: capibench [options]" << endl << endl;
+	cout << "-c n, --calls=n		number of incoming calls (default: 200)" << endl;
+	cout << "-n n, --concurrent=n		max. number of simultaneous calls (default: 60)" << endl;
+	cout << "-i ms, --interval=ms		interval between incoming calls (default: 10)" << endl;
+	cout << "-l ms, --duration=ms		caller hangs up after this time (default: 5000)" << endl;
+	cout << "-p ms, --prompt=ms		length of the prompt played to the caller (default: 3000)" << endl;
+	cout << "-b n, --block=n			size of received data blocks in bytes (default: 160)" << endl;
+	cout << "-j us, --jitter=us		max. random delay of received data blocks (default: 0)" << endl;
+	cout << "-t n, --threads=n		number of dispatch threads (default: 4)" << endl;
+	cout << "-s n, --seed=n			seed for random delays and data (default: 1)" << endl;
+	cout << "-v n, --verbose=n		debug level, messages are written to stderr (default: 0)" << endl;
+}
+
+/** @brief main function of capibench
+*/
+int main(int argc, char** argv)
+{
+	struct option long_options[] = {
+		{"help", no_argument, NULL, 'h'},
+		{"calls", required_argument, NULL, 'c'},
+		{"concurrent", required_argument, NULL, 'n'},
+		{"interval", required_argument, NULL, 'i'},
+		{"duration", required_argument, NULL, 'l'},
+		{"prompt", required_argument, NULL, 'p'},
+		{"block", required_argument, NULL, 'b'},
+		{"jitter", required_argument, NULL, 'j'},
+		{"threads", required_argument, NULL, 't'},
+		{"seed", required_argument, NULL, 's'},
+		{"verbose", required_argument, NULL, 'v'},
+		{0, 0, 0, 0}
+	};
+
+	CapiSimulator::parameters_t parameters;
+	parameters.controllers=1;
+	parameters.calls=200;
+	parameters.concurrent=60;
+	parameters.call_interval=10000;
+	parameters.call_duration=5000000;
+	parameters.dial_delay=100000;
+	parameters.block_size=160;
+	parameters.jitter=0;
+	parameters.seed=1;
+	parameters.cip=16; // telephony
+	unsigned prompt_length=3000, dispatch_threads=4, debug_level=0;
+
+	int result=0;
+	do {
+		result=getopt_long(argc,argv,"hc:n:i:l:p:b:j:t:s:v:",long_options,NULL);
+		switch (result) {
+			case -1: // end
+			break;
+
+			case 'c':
+				parameters.calls=atoi(optarg);
+			break;
+
+			case 'n':
+				parameters.concurrent=atoi(optarg);
+			break;
+
+			case 'i':
+				parameters.call_interval=atoi(optarg)*1000;
+			break;
+
+			case 'l':
+				parameters.call_duration=atoi(optarg)*1000;
+			break;
+
+			case 'p':
+				prompt_length=atoi(optarg);
+			break;
+
+			case 'b':
+				parameters.block_size=atoi(optarg);
+			break;
+
+			case 'j':
+				parameters.jitter=atoi(optarg);
+			break;
+
+			case 't':
+				dispatch_threads=atoi(optarg);
+			break;
+
+			case 's':
+				parameters.seed=atoi(optarg);
+			break;
+
+			case 'v':
+				debug_level=atoi(optarg);
+			break;
+
+			case 'h':
+			default:
+				help();
+				exit(1);
+			break;
+		}
+	} while (result!=-1);
+
+	// enough controllers with 30 B channels each (primary rate interface) for all simultaneous calls
+	parameters.channels=30;
+	parameters.controllers=(parameters.concurrent+29)/30;
+
+	string prompt;
+	for (unsigned i=0;i<prompt_length*8;i++) // A-Law has 8 bytes per msec
+		prompt+=static_cast<char>(0xD5^(i&0x0F));
+
+	BenchApplication application(prompt);
+	CapiSimulator *simulator=NULL;
+	Capi *capi=NULL;
+
+	timeval start,end;
+	rusage usage_start,usage_end;
+	gettimeofday(&start,NULL);
+	getrusage(RUSAGE_SELF,&usage_start);
+
+	try {
+		simulator=new CapiSimulator(parameters,cerr,debug_level,cerr);
+		capi=new Capi(cerr,debug_level,cerr,0,0,vector<string>(),0,7,2048,FileWriter::SYNC_NONE,dispatch_threads,simulator);
+		capi->registerApplicationInterface(&application);
+		capi->setListenTelephony(0);
+	}
+	catch (CapiError e) {
+		cerr << "ERROR: can't start simulation, message was: " << e << endl;
+		exit(1);
+	}
+
+	while (!simulator->finished())
+		usleep(100000);
+	unsigned failed=application.waitForCalls();
+
+	gettimeofday(&end,NULL);
+	getrusage(RUSAGE_SELF,&usage_end);
+
+	CapiSimulator::statistics_t statistics=simulator->getStatistics();
+	long wall=(end.tv_sec-start.tv_sec)*1000000+(end.tv_usec-start.tv_usec);
+	long cpu=(usage_end.ru_utime.tv_sec-usage_start.ru_utime.tv_sec+usage_end.ru_stime.tv_sec-usage_start.ru_stime.tv_sec)*1000000
+	  +(usage_end.ru_utime.tv_usec-usage_start.ru_utime.tv_usec+usage_end.ru_stime.tv_usec-usage_start.ru_stime.tv_usec);
+	unsigned long messages=statistics.messages_sent+statistics.messages_received;
+
+	cout << "calls: " << statistics.calls_offered << " offered, " << statistics.calls_connected << " connected, "
+	  << statistics.calls_rejected << " rejected, " << statistics.calls_finished << " finished, " << failed << " failed" << endl;
+	cout << "messages: " << statistics.messages_sent << " to application, " << statistics.messages_received << " from application" << endl;
+	cout << "time: " << wall << " usecs wall, " << cpu << " usecs cpu, "
+	  << (messages ? static_cast<double>(cpu)/messages : 0) << " usecs cpu per message" << endl;
+	cout << "data: " << statistics.bytes_received << " bytes sent by application, " << statistics.blocks_lost << " received blocks lost" << endl;
+	printSamples("accept latency",statistics.accept_latency);
+	printSamples("setup latency",statistics.setup_latency);
+	printSamples("data latency",statistics.data_latency);
+	printSamples("send latency",statistics.send_latency);
+	printSamples("send gaps",statistics.send_gaps);
+
+	delete capi;
+	delete simulator;
+	return failed ? 2 : 0;
+}
+
+/* History
+
+$Log$
+
+*/
@@ -0,0 +1,596 @@
+/** @file microbench.cpp
+    @brief Contains main() of capimicrobench - microbenchmarks for the hot paths of the backend
+
+    @author agent <agent@local>
+    $Revision: 1.1 $
+*/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <getopt.h>
+#include <stdlib.h> // for atol(), exit()
+#include <string.h> // for memset()
+#include <pthread.h>
+#include <unistd.h> // for usleep()
+#include <sys/time.h> // for gettimeofday()
+#include "backend/capi.h"
+#include "backend/capitransport.h"
+#include "backend/connection.h"
+#include "backend/applicationinterface.h"
+#include "backend/callinterface.h"
+#include "modules/audioreceive.h"
+
+/** @brief CAPI without any controller behind it
+
+    Messages sent by the application are counted and discarded. getMessage()
+    returns the message set by the benchmark, so Capi::readMessage() can be
+    called directly without involving another thread.
+
+    @author agent
+*/
+class NullTransport: public CapiTransport
+{
+	public:
+		NullTransport()
+		:message(NULL),messages_sent(0),released(false)
+		{}
+
+		unsigned isInstalled()
+		{
+			return 0;
+		}
+
+		unsigned getProfile(unsigned controller, unsigned char *buf)
+		{
+			memset(buf,0,64);
+			if (!controller) {
+				buf[0]=1; // one controller
+			} else if (controller==1) {
+				buf[2]=30; // B channels of a primary rate interface
+				buf[4]=0x08; // DTMF
+				buf[8]=0x02; // B1: 64 kbit/s bit-transparent
+				buf[12]=0x02; // B2: transparent
+				buf[16]=0x01; // B3: transparent
+			} else
+				return 0x2002; // illegal controller
+			return 0;
+		}
+
+		unsigned char* getManufacturer(unsigned controller, unsigned char *buf)
+		{
+			strcpy(reinterpret_cast<char*>(buf),"CapiSuite microbenchmark");
+			return buf;
+		}
+
+		unsigned char* getVersion(unsigned controller, unsigned char *buf)
+		{
+			_cdword version[4]={2,0,0,1};
+			memcpy(buf,version,sizeof(version));
+			return buf;
+		}
+
+		unsigned registerApplication(unsigned maxLogicalConnection, unsigned maxBDataBlocks, unsigned maxBDataLen, unsigned *applId)
+		{
+			*applId=1;
+			return 0;
+		}
+
+		unsigned release(unsigned applId)
+		{
+			released=true;
+			return 0;
+		}
+
+		unsigned putMessage(unsigned applId, unsigned char *message)
+		{
+			messages_sent++;
+			return 0;
+		}
+
+		unsigned getMessage(unsigned applId, unsigned char **message)
+		{
+			if (!this->message)
+				return 0x1104; // queue empty
+			*message=this->message;
+			return 0;
+		}
+
+		unsigned waitForMessage(unsigned applId)
+		{
+			// the message thread of Capi is cancelled before release(), usleep() is a cancellation point
+			while (!released)
+				usleep(100000);
+			return 0x1101; // illegal application number
+		}
+
+		unsigned char *message; ///< message returned by getMessage(), NULL if none
+		unsigned long messages_sent; ///< number of messages sent by the application
+
+	private:
+		volatile bool released; ///< true after release()
+};
+
+/** @brief Runs the microbenchmarks and prints their results
+
+    A Capi object using the NullTransport is created and one incoming voice
+    call is connected by feeding the according messages to Capi::readMessage().
+    Then each benchmark calls one hot path of the backend for the given number
+    of iterations. The call is disconnected afterwards.
+
+    The results are written as tab separated lines "name, iterations, nsecs per
+    operation, MB per second" to stdout, "-" is used if no data is processed.
+    Lines starting with "#" are comments.
+
+    @author agent
+*/
+class BackendBenchmark: public ApplicationInterface, public CallInterface
+{
+	public:
+		/** @brief Constructor.
+
+		    @param iterations number of iterations of each benchmark
+		    @param block_size size of the data blocks received with DATA_B3_IND
+		*/
+		BackendBenchmark(unsigned long iterations, unsigned block_size)
+		:capi(NULL),conn(NULL),iterations(iterations),block_size(block_size),sink(0)
+		{}
+
+		/** @brief Connect the call, run all benchmarks and disconnect
+
+		    @throw CapiError Thrown if the call can't be set up or a benchmark fails
+		*/
+		void run() throw (CapiError);
+
+		/** @brief Store the incoming call, see ApplicationInterface::callWaiting()
+		*/
+		void callWaiting(Connection *conn)
+		{
+			this->conn=conn;
+		}
+
+		void alerting() {}
+		void callConnected() {}
+		void callDisconnectedLogical() {}
+		void callDisconnectedPhysical() {}
+		void transmissionComplete() {} // restarting is done by benchSendBlock() as we're called with send_mutex held
+		void gotDTMF() {}
+		void dataIn(unsigned char* data, unsigned length) {}
+
+	private:
+		/** @brief Create Capi and connect the incoming call
+		*/
+		void setup() throw (CapiError);
+
+		/** @brief Disconnect the call and delete Capi
+		*/
+		void teardown() throw (CapiError);
+
+		/** @brief Measure Capi::describeParamInfo()
+		*/
+		void benchDescribeParamInfo();
+
+		/** @brief Measure Connection::getNumber() for calling and called party numbers
+		*/
+		void benchGetNumber();
+
+		/** @brief Measure Connection::convertToCP437()
+		*/
+		void benchConvertToCP437();
+
+		/** @brief Measure Capi::readMessage() for one message
+
+		    @param name name of the benchmark
+		    @param message the message in raw CAPI format
+		    @param bytes number of data bytes contained in the message, 0 if none
+		*/
+		void benchDispatch(const char *name, string message, unsigned bytes=0) throw (CapiError);
+
+		/** @brief Measure Connection::data_b3_ind() without dispatching
+
+		    @param name name of the benchmark
+		    @param message the DATA_B3_IND in raw CAPI format
+		*/
+		void benchDataB3Ind(const char *name, string message) throw (CapiError);
+
+		/** @brief Measure Connection::send_block() driven by DATA_B3_CONF from memory
+		*/
+		void benchSendBlock() throw (CapiError);
+
+		/** @brief Measure AudioReceive::dataIn() with silence and with noise
+
+		    This replaces the registered CallInterface temporarily.
+		*/
+		void benchAudioReceive() throw (CapiError);
+
+		/** @brief Assemble a message in raw CAPI format
+
+		    @param message the message
+		    @return the assembled message
+		*/
+		string assemble(_cmsg &message);
+
+		/** @brief Prepare a message as sent by CAPI
+
+		    @param message the message to fill
+		    @param command CAPI command
+		    @param subcommand CAPI subcommand
+		    @param address controller, PLCI or NCCI
+		    @return reference to message
+		*/
+		_cmsg& header(_cmsg &message, _cbyte command, _cbyte subcommand, _cdword address);
+
+		/** @brief Let Capi handle a message
+
+		    @param message the message in raw CAPI format
+		*/
+		void dispatch(string &message) throw (CapiError);
+
+		/** @brief Print the result of a benchmark
+
+		    @param name name of the benchmark
+		    @param usecs time needed for all iterations
+		    @param bytes number of data bytes processed per iteration, 0 if none
+		*/
+		void report(const char *name, long long usecs, unsigned bytes=0);
+
+		/** @brief return the current time in usecs
+		*/
+		static long long currentTime();
+
+		NullTransport transport; ///< the CAPI used
+		Capi *capi; ///< the Capi object under test
+		Connection *conn; ///< the connected call
+		unsigned long iterations; ///< number of iterations of each benchmark
+		unsigned block_size; ///< size of the received data blocks
+		string block; ///< data of the received data blocks
+		_cword messageNumber; ///< message number for the next indication
+		size_t sink; ///< results are accumulated here, so the compiler can't omit the calls
+};
+
+static const _cdword bench_plci=0x101; // controller 1, first PLCI
+static const _cdword bench_ncci=0x10101; // first NCCI of bench_plci
+
+long long
+BackendBenchmark::currentTime()
+{
+	timeval tv;
+	gettimeofday(&tv,NULL);
+	return static_cast<long long>(tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+_cmsg&
+BackendBenchmark::header(_cmsg &message, _cbyte command, _cbyte subcommand, _cdword address)
+{
+	memset(&message,0,sizeof(_cmsg));
+	capi_cmsg_header(&message,1,command,subcommand,messageNumber++,address);
+	return message;
+}
+
+string
+BackendBenchmark::assemble(_cmsg &message)
+{
+	unsigned char buffer[2048]; // only messages with a few short structs are used
+	capi_cmsg2message(&message,buffer);
+	return string(reinterpret_cast<char*>(buffer),CAPIMSG_LEN(buffer));
+}
+
+void
+BackendBenchmark::dispatch(string &message) throw (CapiError)
+{
+	transport.message=reinterpret_cast<unsigned char*>(&message[0]);
+	capi->readMessage();
+	transport.message=NULL;
+}
+
+void
+BackendBenchmark::report(const char *name, long long usecs, unsigned bytes)
+{
+	if (!usecs)
+		usecs=1;
+	cout << name << "\t" << iterations << "\t" << static_cast<double>(usecs)*1000/iterations << "\t";
+	if (bytes)
+		cout << static_cast<double>(bytes)*iterations/usecs; // bytes per usec are MB per sec
+	else
+		cout << "-";
+	cout << endl;
+}
+
+void
+BackendBenchmark::setup() throw (CapiError)
+{
+	messageNumber=0;
+	block.resize(block_size);
+	for (unsigned i=0;i<block_size;i++)
+		block[i]=static_cast<char>(0xAB); // A-Law silence as sent by ISDN (bit-reversed)
+
+	capi=new Capi(cerr,0,cerr,0,0,vector<string>(),0,7,2048,FileWriter::SYNC_NONE,0,&transport);
+	capi->registerApplicationInterface(this);
+
+	unsigned char called[]={4,0x81,'1','0','0'};
+	unsigned char calling[]={9,0x21,0x80,'5','5','5','1','2','3','4'};
+	_cmsg message;
+	header(message,CAPI_CONNECT,CAPI_IND,bench_plci);
+	message.CIPValue=16; // telephony
+	message.CalledPartyNumber=called;
+	message.CallingPartyNumber=calling;
+	string raw=assemble(message);
+	dispatch(raw);
+	if (!conn)
+		throw CapiError("incoming call wasn't signalled","BackendBenchmark::setup()");
+
+	conn->registerCallInterface(this);
+	conn->connectWaiting(Connection::VOICE);
+
+	raw=assemble(header(message,CAPI_CONNECT_ACTIVE,CAPI_IND,bench_plci));
+	dispatch(raw);
+	raw=assemble(header(message,CAPI_CONNECT_B3,CAPI_IND,bench_ncci));
+	dispatch(raw);
+	raw=assemble(header(message,CAPI_CONNECT_B3_ACTIVE,CAPI_IND,bench_ncci));
+	dispatch(raw);
+	if (conn->getState()!=Connection::UP)
+		throw CapiError("call couldn't be connected","BackendBenchmark::setup()");
+}
+
+void
+BackendBenchmark::teardown() throw (CapiError)
+{
+	_cmsg message;
+	string raw=assemble(header(message,CAPI_DISCONNECT_B3,CAPI_IND,bench_ncci));
+	dispatch(raw);
+	header(message,CAPI_DISCONNECT,CAPI_IND,bench_plci);
+	message.Reason=0x3490; // normal call clearing
+	raw=assemble(message);
+	dispatch(raw);
+
+	delete conn;
+	conn=NULL;
+	delete capi;
+	capi=NULL;
+}
+
+void
+BackendBenchmark::benchDescribeParamInfo()
+{
+	static const unsigned codes[]={0x0000,0x1101,0x2001,0x3008,0x3301,0x3490,0x34a9,0xffff};
+	long long start=currentTime();
+	for (unsigned long i=0;i<iterations;i++)
+		sink+=Capi::describeParamInfo(codes[i%(sizeof(codes)/sizeof(codes[0]))]).size();
+	report("describeParamInfo",currentTime()-start);
+}
+
+void
+BackendBenchmark::benchGetNumber()
+{
+	unsigned char calling[]={12,0x21,0x80,'0','3','0','1','2','3','4','5','6','7'};
+	unsigned char called[]={5,0x81,'1','2','3','4'};
+
+	long long start=currentTime();
+	for (unsigned long i=0;i<iterations;i++)
+		sink+=conn->getNumber(calling,true).size();
+	report("getNumber/calling",currentTime()-start);
+
+	start=currentTime();
+	for (unsigned long i=0;i<iterations;i++)
+		sink+=conn->getNumber(called,false).size();
+	report("getNumber/called",currentTime()-start);
+}
+
+void
+BackendBenchmark::benchConvertToCP437()
+{
+	const string headline="Fax von M\xfcller & S\xf6hne, Stra\xdf" "e 1, K\xf6ln";
+	long long start=currentTime();
+	for (unsigned long i=0;i<iterations;i++) {
+		string text(headline);
+		conn->convertToCP437(text);
+		sink+=text.size();
+	}
+	report("convertToCP437",currentTime()-start,headline.size());
+}
+
+void
+BackendBenchmark::benchDispatch(const char *name, string message, unsigned bytes) throw (CapiError)
+{
+	long long start=currentTime();
+	for (unsigned long i=0;i<iterations;i++) {
+		dispatch(message);
+		if ((i & 0x3ff)==0)
+			conn->clearDTMF(); // don't let the DTMF buffer grow
+	}
+	report(name,currentTime()-start,bytes);
+	conn->clearDTMF();
+}
+
+void
+BackendBenchmark::benchDataB3Ind(const char *name, string message) throw (CapiError)
+{
+	_cmsg disassembled;
+	capi_message2cmsg(&disassembled,reinterpret_cast<unsigned char*>(&message[0]));
+	long long start=currentTime();
+	for (unsigned long i=0;i<iterations;i++)
+		conn->data_b3_ind(disassembled);
+	report(name,currentTime()-start,block_size);
+}
+
+void
+BackendBenchmark::benchSendBlock() throw (CapiError)
+{
+	unsigned sent=capi->voice_transfer.block_size;
+	string data(64*sent,static_cast<char>(0xAB)); // whole blocks only, so each DATA_B3_CONF sends one full block
+	_cmsg message;
+	string raw=assemble(header(message,CAPI_DATA_B3,CAPI_CONF,bench_ncci));
+	long long start=currentTime();
+	for (unsigned long i=0;i<iterations;i++) {
+		if (!conn->send_data && !conn->buffers_used)
+			conn->start_buffer_transmission(data.data(),data.size());
+		raw[12]=conn->buffer_start & 0xFF; // DataHandle, must match the oldest block sent
+		raw[13]=conn->buffer_start >> 8;
+		dispatch(raw);
+	}
+	report("readMessage/DATA_B3_CONF+send_block",currentTime()-start,sent);
+
+	pthread_mutex_lock(&conn->send_mutex);
+	conn->close_send_source();
+	pthread_mutex_unlock(&conn->send_mutex);
+	while (conn->buffers_used) { // confirm the rest, so the call is in a clean state
+		raw[12]=conn->buffer_start & 0xFF;
+		raw[13]=conn->buffer_start >> 8;
+		dispatch(raw);
+	}
+}
+
+void
+BackendBenchmark::benchAudioReceive() throw (CapiError)
+{
+	string noise(block_size,0);
+	unsigned random=1;
+	for (unsigned i=0;i<block_size;i++) {
+		random=random*1103515245+12345;
+		noise[i]=static_cast<char>(random>>16);
+	}
+
+	{
+		AudioReceive receive(conn,"/dev/null",-1,5,false); // registers itself as CallInterface
+		unsigned char *data=reinterpret_cast<unsigned char*>(&block[0]);
+		long long start=currentTime();
+		for (unsigned long i=0;i<iterations;i++)
+			receive.dataIn(data,block_size);
+		report("AudioReceive::dataIn/silence",currentTime()-start,block_size);
+
+		data=reinterpret_cast<unsigned char*>(&noise[0]);
+		start=currentTime();
+		for (unsigned long i=0;i<iterations;i++)
+			receive.dataIn(data,block_size);
+		report("AudioReceive::dataIn/noise",currentTime()-start,block_size);
+	}
+	conn->registerCallInterface(this);
+}
+
+void
+BackendBenchmark::run() throw (CapiError)
+{
+	setup();
+
+	cout << "# capimicrobench: " << iterations << " iterations, " << block_size << " bytes per received block" << endl;
+	cout << "# benchmark\titerations\tns_per_op\tMB_per_s" << endl;
+
+	benchDescribeParamInfo();
+	benchGetNumber();
+	benchConvertToCP437();
+
+	_cmsg message;
+	header(message,CAPI_LISTEN,CAPI_CONF,1);
+	benchDispatch("readMessage/LISTEN_CONF",assemble(message));
+
+	unsigned char info_element[]={1,0x89};
+	header(message,CAPI_INFO,CAPI_IND,bench_plci);
+	message.InfoNumber=0x18; // channel identification, ignored by Capi
+	message.InfoElement=info_element;
+	benchDispatch("readMessage/INFO_IND",assemble(message));
+
+	unsigned char dtmf[]={1,'5'};
+	header(message,CAPI_FACILITY,CAPI_IND,bench_plci);
+	message.FacilitySelector=1; // DTMF
+	message.FacilityIndicationParameter=dtmf;
+	benchDispatch("readMessage/FACILITY_IND",assemble(message));
+
+	header(message,CAPI_DATA_B3,CAPI_IND,bench_ncci);
+	message.Data=&block[0];
+	message.DataLength=block_size;
+	string data_b3_ind=assemble(message);
+	benchDispatch("readMessage/DATA_B3_IND",data_b3_ind,block_size);
+	benchDataB3Ind("data_b3_ind",data_b3_ind);
+
+	conn->start_file_reception("/dev/null");
+	benchDispatch("readMessage/DATA_B3_IND+reception",data_b3_ind,block_size);
+	benchDataB3Ind("data_b3_ind+reception",data_b3_ind);
+	conn->stop_file_reception();
+
+	benchSendBlock();
+	benchAudioReceive();
+
+	cout << "# " << transport.messages_sent << " messages sent by the application" << endl;
+	if (!sink)
+		cout << "# no results?" << endl;
+
+	teardown();
+}
+
+/** @brief Print the usage of capimicrobench
+*/
+void help()
+{
+	cout << "capimicrobench measures the hot paths of CapiSuite's CAPI and call handling" << endl;
+	cout << "code without any ISDN hardware. Results are written as tab separated values." << endl << endl;
+	cout << "syntax: capimicrobench [options]" << endl << endl;
+	cout << "-n n, --iterations=n		number of iterations of each benchmark (default: 100000)" << endl;
+	cout << "-b n, --block=n			size of received data blocks in bytes (default: 160)" << endl;
+}
+
+/** @brief main function of capimicrobench
+*/
+int main(int argc, char** argv)
+{
+	struct option long_options[] = {
+		{"help", no_argument, NULL, 'h'},
+		{"iterations", required_argument, NULL, 'n'},
+		{"block", required_argument, NULL, 'b'},
+		{0, 0, 0, 0}
+	};
+
+	unsigned long iterations=100000;
+	unsigned block_size=160;
+
+	int result=0;
+	do {
+		result=getopt_long(argc,argv,"hn:b:",long_options,NULL);
+		switch (result) {
+			case -1: // end
+			break;
+
+			case 'n':
+				iterations=atol(optarg);
+			break;
+
+			case 'b':
+				block_size=atoi(optarg);
+			break;
+
+			case 'h':
+			default:
+				help();
+				exit(1);
+			break;
+		}
+	} while (result!=-1);
+
+	if (!iterations || !block_size || block_size>2048) {
+		help();
+		exit(1);
+	}
+
+	BackendBenchmark benchmark(iterations,block_size);
+	try {
+		benchmark.run();
+	}
+	catch (CapiError e) {
+		cerr << "ERROR: benchmark failed, message was: " << e << endl;
+		exit(1);
+	}
+	return 0;
+}
+
+/* History
+
+$Log$
+
+*/
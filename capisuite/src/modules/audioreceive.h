@@ -19,6 +19,7 @@
 
 #include <string>
 #include "callmodule.h"
+#include "../backend/audioencoder.h"
 
 class Connection;
 
@@ -36,6 +37,7 @@ using namespace std;
     The call must be in audio mode (by connecting with service VOICE), otherwise an exception will be caused.
 
     The created file will be saved in the format given by Capi, that is bit-reversed A-Law (or u-Law), 8 kHz mono.
+    Optionally, a WAV file is written at the same time (see AudioEncoder).
 
     @author Gernot Hillier
 */
@@ -51,9 +53,11 @@ class AudioReceive: public CallModule
 		    @param timeout timeout in seconds after which record is finished, 0=record forever (until call is finished)
 		    @param silence_timeout duration of silence in seconds after which record is finished, 0=no silence detection
 		    @param DTMF_exit true: abort if we receive DTMF during mainLoop() or if DTMF was received before
+		    @param encoded_file name of a file to save the audio stream to in WAV format additionally, empty for none
+		    @param format format of encoded_file
 		    @throw CapiExternalError Thrown if connection is not in speech mode
   		*/
-		AudioReceive(Connection *conn, string file, int timeout, int silence_timeout, bool DTMF_exit) throw (CapiExternalError);
+		AudioReceive(Connection *conn, string file, int timeout, int silence_timeout, bool DTMF_exit, string encoded_file="", AudioEncoder::format_t format=AudioEncoder::WAV_PCM) throw (CapiExternalError);
 
  		/** @brief Start file reception, wait for one of the timeouts or disconnection and stop the reception. 
 		
@@ -64,11 +68,12 @@ class AudioReceive: public CallModule
   		*/
 		void mainLoop() throw (CapiWrongState, CapiExternalError);
 
- 		/** @brief Test all received audio packets for silence and count silent packets
+ 		/** @brief Test the received audio for silence and count silent samples
 
-		    All bytes of a received packages (i.e. 2048 bytes) are partly A-Law decoded, added and
-		    compared to a threshhold. If silence is found, silence_count is increased, otherwise the
-		    counter is reset to 0.
+		    The received samples are divided into frames of 20 msec. For each frame the RMS of the
+		    A-Law decoded samples is compared to a threshold. A frame with a higher level resets
+		    silence_count to 0, silent frames are added to it. After voice, some silent frames
+		    are ignored (hangover), so short pauses don't count as silence.
 
 		    If the silence_timeout value is reached, the mainLoop is signalled to finish.
   		*/
@@ -80,10 +85,24 @@ class AudioReceive: public CallModule
   		*/
 		long duration();
 
+ 		/** @brief Return the level of the last complete frame of received audio
+
+		    Only available if silence detection is enabled.
+
+		    @return RMS of the last frame (20 msec) in 13 bit linear units, max. 4032
+  		*/
+		unsigned level();
+
 	private:
 		unsigned int silence_count; ///< counter how many consecutive samples (bytes) have been silent
+		unsigned int frame_energy, ///< sum of the squared samples of the current frame
+			frame_fill, ///< number of samples in the current frame
+			hangover, ///< number of silent frames which will still be ignored
+			last_energy; ///< sum of the squared samples of the last complete frame
 		unsigned int silence_timeout; ///< amount of silence samples after which record is finished
 		string file; ///< file name to save audio data to
+		string encoded_file; ///< file name to save encoded audio data to, empty for none
+		AudioEncoder::format_t format; ///< format of encoded_file
 		long start_time, ///< time in seconds since the epoch when the recording was started
 			end_time; ///< time in seconds since the epoch when the recording was finished
 };
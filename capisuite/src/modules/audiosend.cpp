@@ -15,10 +15,25 @@
  ***************************************************************************/
 
 #include "../backend/connection.h"
+#include "../backend/promptcache.h"
 #include "audiosend.h"
 
 AudioSend::AudioSend(Connection *conn, string file, bool DTMF_exit) throw (CapiExternalError)
-:CallModule(conn,-1,DTMF_exit),file(file)
+:CallModule(conn,-1,DTMF_exit),files(1,file),data(NULL),length(0)
+{
+	if (conn->getService()!=Connection::VOICE)
+	 	throw CapiExternalError("Connection not in speech mode","AudioSend::AudioSend()");
+}
+
+AudioSend::AudioSend(Connection *conn, const char *data, unsigned length, bool DTMF_exit) throw (CapiExternalError)
+:CallModule(conn,-1,DTMF_exit),files(),data(data),length(length)
+{
+	if (conn->getService()!=Connection::VOICE)
+	 	throw CapiExternalError("Connection not in speech mode","AudioSend::AudioSend()");
+}
+
+AudioSend::AudioSend(Connection *conn, const vector<string> &files, bool DTMF_exit) throw (CapiExternalError)
+:CallModule(conn,-1,DTMF_exit),files(files),data(NULL),length(0)
 {
 	if (conn->getService()!=Connection::VOICE)
 	 	throw CapiExternalError("Connection not in speech mode","AudioSend::AudioSend()");
@@ -29,16 +44,49 @@ AudioSend::mainLoop() throw (CapiError,CapiWrongState,CapiExternalError,CapiMsgE
 {
 	start_time=getTime();
 	if (!(DTMF_exit && (!conn->getDTMF().empty()) ) ) {
-		conn->start_file_transmission(file);
-		CallModule::mainLoop();
+		vector<const PromptCache::Prompt*> prompts;
+		vector<Connection::send_item_t> items(files.size());
+		for (unsigned i=0;i<files.size();i++) {
+			const PromptCache::Prompt *prompt=PromptCache::acquire(files[i]);
+			items[i].filename=files[i];
+			items[i].data= prompt ? prompt->getData() : NULL;
+			items[i].length= prompt ? prompt->getLength() : 0;
+			if (prompt)
+				prompts.push_back(prompt);
+		}
+		try {
+			if (data)
+				conn->start_buffer_transmission(data,length);
+			else
+				conn->start_list_transmission(items);
+			CallModule::mainLoop();
+		}
+		catch (...) {
+			if (!prompts.empty())
+				conn->stop_file_transmission(); // the prompts must not be released while CAPI still uses them
+			for (unsigned i=0;i<prompts.size();i++)
+				PromptCache::release(prompts[i]);
+			throw;
+		}
 		conn->stop_file_transmission();
+		for (unsigned i=0;i<prompts.size();i++)
+			PromptCache::release(prompts[i]);
 	}
 }
 
 void
 AudioSend::transmissionComplete()
 {
-	finish=true;
+	finishModule();
+}
+
+void
+AudioSend::gotDTMF()
+{
+	if (DTMF_exit) {
+		conn->abort_file_transmission();
+		finishModule();
+	}
 }
 
 long
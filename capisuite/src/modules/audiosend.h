@@ -18,6 +18,7 @@
 #define AUDIOSEND_H
 
 #include <string>
+#include <vector>
 #include "callmodule.h"
 
 class Connection;
@@ -33,6 +34,9 @@ using namespace std;
     isn't empty when it is created. That allows the user to abort subsequent audio receive and send commands with one
     DTMF signal w/o needing to check for received DTMF after each command.
 
+    Files located in one of the directories of the PromptCache are sent out of
+    the cache instead of being read from disk.
+
     The connction must be in audio mode (by connecting with service VOICE), otherwise an exception will be caused.
 
     @author Gernot Hillier
@@ -49,6 +53,27 @@ class AudioSend: public CallModule
   		*/
 		AudioSend(Connection *conn, string file, bool DTMF_exit) throw (CapiExternalError);
 
+ 		/** @brief Constructor. Test if we are in speech mode and create an object which sends data held in memory.
+
+                    @param conn reference to Connection object
+		    @param data A-Law data to send, must be valid until mainLoop() returns
+		    @param length length of data in bytes
+		    @param DTMF_exit set to true, if you want to finish when DTMF signal is received
+		    @throw CapiExternalError Thrown if speech mode isn't established before.
+  		*/
+		AudioSend(Connection *conn, const char *data, unsigned length, bool DTMF_exit) throw (CapiExternalError);
+
+ 		/** @brief Constructor. Test if we are in speech mode and create an object which sends several files without gaps.
+
+		    The files are sent one after another as if they were one file, see Connection::start_list_transmission().
+
+                    @param conn reference to Connection object
+		    @param files names of the files to send
+		    @param DTMF_exit set to true, if you want to finish when DTMF signal is received
+		    @throw CapiExternalError Thrown if speech mode isn't established before.
+  		*/
+		AudioSend(Connection *conn, const vector<string> &files, bool DTMF_exit) throw (CapiExternalError);
+
  		/** @brief Start file transmission, wait for the end of the file or the connection, stop file transmission
 
 		    @throw CapiWrongState Thrown when disconnection takes place.
@@ -63,6 +88,13 @@ class AudioSend: public CallModule
   		*/
 		void transmissionComplete();
 
+ 		/** @brief abort the transmission at once if DTMF_exit is set and finish main loop
+
+		    The transmission is aborted in the thread which received the DTMF signal, so
+		    only the audio already queued is played. See Connection::abort_file_transmission().
+  		*/
+		void gotDTMF();
+
  		/** @brief Return the time in seconds since start of mainLoop()
 
 		    @return time in seconds since start of mainLoop()
@@ -70,7 +102,9 @@ class AudioSend: public CallModule
 		long duration();
 
 	private:
-		string file; ///< name of the file to send
+		vector<string> files; ///< names of the files to send
+		const char *data; ///< data to send if no files are given, NULL otherwise
+		unsigned length; ///< length of data
 		long start_time; ///< time in seconds since the epoch when the module was started
 };
 
@@ -22,6 +22,8 @@
 CallModule::CallModule(Connection *connection, int timeout, bool DTMF_exit)
 :finish(false),abort(false),timeout(timeout),conn(connection),DTMF_exit(DTMF_exit)
 {
+	pthread_mutex_init(&module_mutex, NULL);
+	pthread_cond_init(&module_cond, NULL);
 	if (conn)
 		conn->registerCallInterface(this); // Connection needs to know who we are...
 }
@@ -30,39 +32,88 @@ CallModule::~CallModule()
 {
 	if (conn)
 		conn->registerCallInterface(NULL); // tell Connection that we've finished...
+
+	pthread_mutex_lock(&module_mutex); // assure the lock is free before destroying it
+	pthread_mutex_unlock(&module_mutex);
+	pthread_mutex_destroy(&module_mutex);
+	pthread_cond_destroy(&module_cond);
 }
 
 void
 CallModule::callDisconnectedPhysical()
 {
-	abort=true;
+	abortModule();
 }
 
 void
 CallModule::callDisconnectedLogical()
 {
-	abort=true;
+	abortModule();
 }
 
 void
 CallModule::mainLoop() throw (CapiWrongState,CapiMsgError,CapiExternalError,CapiError)
 {
-	if (! (DTMF_exit && (conn->getDTMF()!="") ) ) {
+	bool dtmf_waiting=DTMF_exit && (conn->getDTMF()!="");
+
+	pthread_mutex_lock(&module_mutex);
+	if (!dtmf_waiting) {
 		exit_time=getTime()+timeout;
-		timespec delay_time;
-		delay_time.tv_sec=0; delay_time.tv_nsec=100000000;  // 100 msec
-		while(!finish && !abort && ( (timeout==-1) || (getTime() <= exit_time) ) )
-			nanosleep(&delay_time,NULL);
+		while(!finish && !abort && ( (timeout==-1) || (getTime() <= exit_time) ) ) {
+			if (timeout==-1)
+				pthread_cond_wait(&module_cond,&module_mutex);
+			else {
+				timespec deadline; // getTime() has a resolution of one second
+				deadline.tv_sec=exit_time+1; deadline.tv_nsec=0;
+				pthread_cond_timedwait(&module_cond,&module_mutex,&deadline);
+			}
+		}
 	}
-	if (abort)
+	bool aborted=abort;
+	pthread_mutex_unlock(&module_mutex);
+
+	if (aborted)
 		throw CapiWrongState("call abort detected","CallModule::mainLoop()");
 }
 
 void
 CallModule::resetTimer(int new_timeout)
 {
+	pthread_mutex_lock(&module_mutex);
+	exit_time=getTime()+new_timeout;
+	timeout=new_timeout;
+	pthread_cond_broadcast(&module_cond); // mainLoop() has to recalculate its deadline
+	pthread_mutex_unlock(&module_mutex);
+}
+
+void
+CallModule::finishModule()
+{
+	pthread_mutex_lock(&module_mutex);
+	finish=true;
+	pthread_cond_broadcast(&module_cond);
+	pthread_mutex_unlock(&module_mutex);
+}
+
+void
+CallModule::abortModule()
+{
+	pthread_mutex_lock(&module_mutex);
+	abort=true;
+	pthread_cond_broadcast(&module_cond);
+	pthread_mutex_unlock(&module_mutex);
+}
+
+void
+CallModule::restartModule(int new_timeout)
+{
+	pthread_mutex_lock(&module_mutex);
+	finish=false;
+	abort=false;
 	exit_time=getTime()+new_timeout;
 	timeout=new_timeout;
+	pthread_cond_broadcast(&module_cond);
+	pthread_mutex_unlock(&module_mutex);
 }
 
 long 
@@ -99,7 +150,7 @@ void
 CallModule::gotDTMF()
 {                          
 	if (DTMF_exit)
-		finish=true;
+		finishModule();
 }
 
 /*  History
@@ -17,6 +17,7 @@
 #ifndef CALLMODULE_H
 #define CALLMODULE_H
 
+#include <pthread.h>
 #include "../backend/callinterface.h"
 #include "../backend/capiexception.h"
 
@@ -118,12 +119,29 @@ class CallModule: public CallInterface
   		*/
 		void resetTimer(int new_timeout);
 
+ 		/** @brief set finish and wake up mainLoop()
+		    Sub classes must use this instead of setting finish directly when the module should exit nicely.
+  		*/
+		void finishModule();
+
+ 		/** @brief set abort and wake up mainLoop()
+		    Use this if the connection is lost, mainLoop() will throw CapiWrongState then.
+  		*/
+		void abortModule();
+
+ 		/** @brief clear finish and abort and restart the timer with new timeout value
+		    Used to wait again, e.g. with a new Connection object.
+  		*/
+		void restartModule(int new_timeout);
+
 		bool DTMF_exit; ///< if set to true, we will finish when we receive a DTMF signal
-		bool finish;  ///< set this if the module should exit nicely for any reason
-		bool abort;   ///< set this for hard exit because connection is lost, causes CapiWrongState to be throwed in mainLoop
+		bool finish;  ///< true if the module should exit nicely for any reason, set it with finishModule()
+		bool abort;   ///< true for hard exit because connection is lost, causes CapiWrongState to be throwed in mainLoop, set it with abortModule()
 		Connection* conn; ///< reference to the according Connection object
 		long exit_time; ///< time when the timeout should occur
 		int timeout; ///< timeout period in seconds
+		pthread_mutex_t module_mutex; ///< protects finish, abort and exit_time against the CAPI thread
+		pthread_cond_t module_cond; ///< signalled whenever finish, abort or exit_time change
 };
 
 #endif
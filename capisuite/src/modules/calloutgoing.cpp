@@ -14,47 +14,81 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <algorithm>
+#include <sstream>
+#include "../backend/capi.h"
 #include "calloutgoing.h"
 
-CallOutgoing::CallOutgoing(Capi *capi, _cdword controller, string call_from, string call_to, Connection::service_t service, int timeout, string faxStationID, string faxHeadline, bool clir)
-:CallModule(NULL,-1,false),capi(capi),controller(controller)
-,call_from(call_from),call_to(call_to),service(service),
-faxStationID(faxStationID),faxHeadline(faxHeadline),clir(clir)
+CallOutgoing::CallOutgoing(Capi *capi, const vector<unsigned> &controllers, string call_from, string call_to, Connection::service_t service, int timeout, string faxStationID, string faxHeadline, bool clir)
+:CallModule(NULL,-1,false),service(service),call_from(call_from),call_to(call_to),
+faxStationID(faxStationID),faxHeadline(faxHeadline),capi(capi),controllers(controllers),clir(clir)
 ,saved_timeout(timeout)
 {}
 
 void
 CallOutgoing::mainLoop() throw (CapiExternalError, CapiMsgError)
 {
-	conn=new Connection(capi,controller,call_from,clir,call_to,service,faxStationID,faxHeadline);
-	conn->registerCallInterface(this);
-
-	try {
-		// first, we have no timeout, timeout is activated in alerting()!
-		CallModule::mainLoop();
+	vector<unsigned> left=controllers; // not tried yet
+	unsigned controller=capi->selectController(left);
+	if (!controller)
+		throw CapiExternalError("no valid controller given","CallOutgoing::mainLoop()");
+
+	while (1) {
+		left.erase(find(left.begin(),left.end(),controller));
+		conn=new Connection(capi,controller,call_from,clir,call_to,service,faxStationID,faxHeadline);
+		conn->registerCallInterface(this);
+
+		try {
+			// first, we have no timeout, timeout is activated in alerting()!
+			CallModule::mainLoop();
+		}
+		catch (CapiWrongState) {} // filter abort exception
+
+		if (finish) // connection up
+			result=0;
+		else if (abort) { // error during connection setup
+			result=conn->getCause();
+			if (!result)
+				result=2; // no reason available
+			else if (noChannel(result) && (controller=capi->selectController(left))) {
+				stringstream msg;
+				msg << "no channel available (cause 0x" << hex << result << "), trying controller " << dec << controller;
+				conn->debugMessage(msg.str(),1);
+				delete conn; // Capi::connect_conf() is done with it before it wakes us up
+				conn=NULL;
+				restartModule(-1);
+				continue;
+			}
+		} else { // timeout exceeded
+			result=1;
+			conn->disconnectCall(); 
+			timespec delay_time;
+			delay_time.tv_sec=0; delay_time.tv_nsec=100000000;  // 100 msec
+			while(conn->getState()!=Connection::DOWN)
+				nanosleep(&delay_time,NULL);
+		}
+		break;
 	}
-	catch (CapiWrongState) {} // filter abort exception
-        
-	if (finish) // connection up
-		result=0;
-	else if (abort) { // error during connection setup
-		result=conn->getCause();
-		if (!result)
-			result=2; // no reason available
-	} else { // timeout exceeded
-		result=1;
-		conn->disconnectCall(); 
-		timespec delay_time;
-		delay_time.tv_sec=0; delay_time.tv_nsec=100000000;  // 100 msec
-		while(conn->getState()!=Connection::DOWN)
-			nanosleep(&delay_time,NULL);
+}
+
+bool
+CallOutgoing::noChannel(int cause)
+{
+	switch (cause) {
+		case 0x2003: // CONNECT_CONF: no PLCI available
+		case 0x3301: // protocol error layer 1, e.g. the line is down
+		case 0x34A2: // no circuit / channel available
+		case 0x34AC: // requested circuit / channel not available
+			return true;
+		default:
+			return false;
 	}
 }
 
 void
 CallOutgoing::callConnected()
 {
-	finish=true;
+	finishModule();
 }
 
 void
@@ -17,6 +17,7 @@
 #ifndef CALLOUTGOINGMODULE_H
 #define CALLOUTGOINGMODULE_H
 
+#include <vector>
 #include "callmodule.h"
 #include "../backend/connection.h"
 
@@ -36,6 +37,11 @@ using namespace std;
 
     You can get the reason for exiting with getResult().
 
+    If several controllers are given, the call is made on the one with the most
+    free B channels (see Capi::selectController()). If the call fails because no
+    channel is available there (CAPI info 0x2003 or cause 0x3301, 0x34A2, 0x34AC),
+    the next one of the remaining controllers is tried.
+
     @author Gernot Hillier
 */
 class CallOutgoing: public CallModule
@@ -44,7 +50,7 @@ class CallOutgoing: public CallModule
 		/** @brief Constructor. Create object.
 
 		    @param capi reference to object of Capi to use
-		    @param controller controller number to use
+		    @param controllers controller numbers to use, must contain at least one valid controller
 		    @param call_from string containing the number to call
 		    @param call_to string containing the own number to use
 		    @param service service to call with as described in Connection::service_t
@@ -53,13 +59,13 @@ class CallOutgoing: public CallModule
 		    @param faxHeadline fax headline, only necessary when connecting in FAXG3 mode
 		    @param clir set to true to disable sending of own number
 		*/
-		CallOutgoing(Capi *capi, _cdword controller, string call_from, string call_to, Connection::service_t service, int timeout, string faxStationID, string faxHeadline, bool clir);
+		CallOutgoing(Capi *capi, const vector<unsigned> &controllers, string call_from, string call_to, Connection::service_t service, int timeout, string faxStationID, string faxHeadline, bool clir);
 
 		/** @brief Initiate connection, wait for it to succeed  
 		
 		    This call module does never throw CapiWrongState! see getResult() if you need to know if conneciton succeeded.
 
-		    @throw CapiExternalError Thrown by Connection::Connection(Capi*,_cdword,string,bool,string,service_t,string,string)
+		    @throw CapiExternalError Thrown by Connection::Connection(Capi*,_cdword,string,bool,string,service_t,string,string) or if no valid controller was given
 		    @throw CapiMsgError Thrown by Connection::Connection(Capi*,_cdword,string,bool,string,service_t,string,string)
 		*/
 		void mainLoop() throw (CapiExternalError, CapiMsgError);
@@ -90,13 +96,20 @@ class CallOutgoing: public CallModule
 		int getResult();
 
 	private:
+		/** @brief check if a call failed because no B channel was available on the controller
+
+		    @param cause result of the failed call
+		    @return true if another controller may succeed
+		*/
+		static bool noChannel(int cause);
+
 		Connection::service_t service;   ///< service with which we should connect
 		string call_from, ///< CallingPartyNumber
 		       call_to, ///< CalledPartyNumber
 		       faxStationID, ///< fax Station ID to use
 		       faxHeadline; ///< fax headlint to use
 		Capi *capi; ///< reference to object of Capi to use
-		_cdword controller; ///< controller to use
+		vector<unsigned> controllers; ///< controllers to use
 		bool clir; ///< enable CLIR? (don't show own number to called party)
 		int result; ///< result of the call establishment process (0=success, 1=timeout exceeded, 2=aborted w/o reason, 0x3301-0x34FF=CAPI errors)
 		int saved_timeout; ///< we'll save the given timeout for later as first phase (wait for alerting) doesn't need timeout
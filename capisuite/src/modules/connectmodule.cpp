@@ -30,7 +30,7 @@ ConnectModule::mainLoop() throw (CapiWrongState, CapiExternalError, CapiMsgError
 void
 ConnectModule::callConnected()
 {
-	finish=true;
+	finishModule();
 }
 
 /*  History
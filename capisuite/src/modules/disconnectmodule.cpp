@@ -41,7 +41,7 @@ void DisconnectModule::callDisconnectedLogical()
 
 void DisconnectModule::callDisconnectedPhysical()
 {
- 	finish=true;
+ 	finishModule();
 }
 
 /*  History
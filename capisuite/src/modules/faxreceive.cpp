@@ -37,7 +37,7 @@ FaxReceive::mainLoop() throw (CapiWrongState, CapiExternalError)
 void 
 FaxReceive::transmissionComplete()
 {
-	finish=true;
+	finishModule();
 }
 
 /*  History
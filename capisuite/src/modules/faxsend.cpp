@@ -37,7 +37,7 @@ FaxSend::mainLoop() throw (CapiError,CapiWrongState,CapiExternalError,CapiMsgErr
 void 
 FaxSend::transmissionComplete()
 {
-	finish=true;
+	finishModule();
 }
 
 /*  History
@@ -41,9 +41,9 @@ ReadDTMF::gotDTMF()
 {
 	digit_count=conn->getDTMF().size();
 	if (max_digits && (digit_count >= max_digits))
-		finish=true;        
+		finishModule();
 	else
-		exit_time=getTime()+timeout;
+		resetTimer(timeout);
 }
 
 /*  History
@@ -38,13 +38,13 @@ Switch2FaxG3::mainLoop() throw (CapiWrongState, CapiExternalError, CapiMsgError)
 void
 Switch2FaxG3::callDisconnectedLogical()
 {
-	finish=true;
+	finishModule();
 }
 
 void
 Switch2FaxG3::callConnected()
 {
-	finish=true;
+	finishModule();
 }
 
 /*  History